@@ -0,0 +1,50 @@
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include <cmbml/psm/loopback/context.hpp>
+
+using namespace cmbml;
+
+// Packets per second through the in-memory switch, sent and received on one thread, for a
+// range of payload sizes. No socket or timer is involved and the impairments are seeded,
+// so runs on a loaded CI machine stay comparable.
+// Usage: loopback_bench [packets per size] [loss probability]
+
+using Clock = std::chrono::steady_clock;
+
+int main(int argc, char ** argv) {
+  const int packets = argc > 1 ? atoi(argv[1]) : 200000;
+  const double loss = argc > 2 ? atof(argv[2]) : 0;
+  assert(packets > 0);
+
+  printf("%8s %14s %10s\n", "bytes", "packets/s", "received");
+  for (size_t bytes = 64; bytes <= 8192; bytes *= 4) {
+    loopback::Switch network(true);
+    loopback::LinkOptions link;
+    link.loss = loss;
+    network.set_default_link_options(link);
+    loopback::Context sender(network);
+    loopback::Context receiver(network);
+    Locator_t locator = {};
+    locator.kind = LOCATOR_KIND_UDPv4;
+    receiver.add_unicast_receiver(locator);
+    locator = receiver.receive_locators()[0];
+    const int doorbell = receiver.receive_sockets()[0];
+
+    Packet<> packet(bytes / sizeof(uint32_t), 0);
+    size_t received = 0;
+    const auto start = Clock::now();
+    for (int i = 0; i < packets; ++i) {
+      sender.unicast_send(locator, packet.data(), packet.size());
+      while (receiver.receive_from(doorbell, [&received](const Packet<> &) { ++received; },
+        bytes))
+      {
+      }
+    }
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    printf("%8zu %14.0f %10zu\n", bytes, packets / seconds, received);
+  }
+  return 0;
+}
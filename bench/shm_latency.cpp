@@ -0,0 +1,112 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include <cmbml/psm/shm/context.hpp>
+
+using namespace cmbml;
+
+// One-way latency between two processes on this host, over UDP and over shared memory:
+// half of the median round trip of a small packet bounced between them.
+// Usage: shm_latency_bench [round trips]
+
+using Clock = std::chrono::steady_clock;
+
+// The locator of the Context's last UDP receiver.
+Locator_t udp_receiver(shm::Context & context) {
+  Locator_t any = {};
+  context.add_unicast_receiver(any);
+  struct sockaddr_in address;
+  socklen_t length = sizeof(address);
+  int result = getsockname(context.udp::Context::receive_sockets().back(),
+    reinterpret_cast<struct sockaddr *>(&address), &length);
+  assert(result == 0);
+  Locator_t locator = {};
+  locator.kind = LOCATOR_KIND_UDPv4;
+  locator.port = ntohs(address.sin_port);
+  const uint32_t host = ntohl(address.sin_addr.s_addr);
+  for (int i = 0; i < 4; ++i) {
+    locator.address[i] = (host >> (24 - 8 * i)) & 0xff;
+  }
+  return locator;
+}
+
+Locator_t shm_receiver(shm::Context & context, uint16_t port) {
+  const Locator_t locator = context.shm_locator(port);
+  context.add_unicast_receiver(locator);
+  return locator;
+}
+
+Locator_t add_receiver(shm::Context & context, bool shared_memory, uint16_t port) {
+  return shared_memory ? shm_receiver(context, port) : udp_receiver(context);
+}
+
+double one_way_us(bool shared_memory, int round_trips) {
+  const uint16_t port = 20000 + (getpid() % 4000) * 8;
+  int ready[2];
+  int result = pipe(ready);
+  assert(result == 0);
+
+  shm::Context context;
+  const Locator_t own = add_receiver(context, shared_memory, port);
+  const pid_t child = fork();
+  assert(child >= 0);
+  if (child == 0) {
+    {
+      // Bounces every packet back.
+      shm::Context echo_context;
+      const Locator_t echo = add_receiver(echo_context, shared_memory, port + 1);
+      ssize_t written = write(ready[1], &echo, sizeof(echo));
+      (void)written;
+      int bounced = 0;
+      while (bounced < round_trips) {
+        echo_context.receive_packet([&](const Packet<> & packet) {
+          echo_context.unicast_send(own, packet.data(), 1);
+          ++bounced;
+        }, 64);
+      }
+    }
+    _exit(0);
+  }
+  Locator_t echo;
+  ssize_t bytes_read = read(ready[0], &echo, sizeof(echo));
+  assert(bytes_read == sizeof(echo));
+  close(ready[0]);
+  close(ready[1]);
+
+  List<double> round_trip_us;
+  round_trip_us.reserve(round_trips);
+  for (int i = 0; i < round_trips; ++i) {
+    const uint32_t packet[1] = {static_cast<uint32_t>(i)};
+    const auto start = Clock::now();
+    context.unicast_send(echo, packet, 1);
+    bool answered = false;
+    while (!answered) {
+      context.receive_packet([&answered](const Packet<> &) { answered = true; }, 64);
+    }
+    round_trip_us.push_back(
+      std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+  }
+  int status;
+  waitpid(child, &status, 0);
+  std::nth_element(round_trip_us.begin(), round_trip_us.begin() + round_trips / 2,
+    round_trip_us.end());
+  return round_trip_us[round_trips / 2] / 2;
+}
+
+int main(int argc, char ** argv) {
+  const int round_trips = argc > 1 ? atoi(argv[1]) : 20000;
+  assert(round_trips > 0);
+  printf("%8s %12s\n", "", "one-way us");
+  printf("%8s %12.2f\n", "udp", one_way_us(false, round_trips));
+  printf("%8s %12.2f\n", "shm", one_way_us(true, round_trips));
+  return 0;
+}
@@ -0,0 +1,118 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <cmbml/psm/udp/context.hpp>
+
+using namespace cmbml;
+
+// Cost per sendto of copying a payload into the kernel versus MSG_ZEROCOPY, including
+// reaping the completions, for a range of payload sizes.
+// Usage: zerocopy_bench [ipv4 address] [port] [sends per size]
+// Without an address, a sink socket on loopback is used. Loopback always copies (the
+// completions report it), so the crossover only shows towards a remote address.
+
+using Clock = std::chrono::steady_clock;
+
+Locator_t make_locator(const char * address, uint16_t port) {
+  Locator_t locator = {};
+  locator.kind = LOCATOR_KIND_UDPv4;
+  locator.port = port;
+  in_addr_t parsed = ntohl(inet_addr(address));
+  for (int i = 0; i < 4; ++i) {
+    locator.address[i] = (parsed >> (24 - 8 * i)) & 0xff;
+  }
+  return locator;
+}
+
+// A socket nobody reads, so that loopback sends have somewhere to go.
+int bind_sink(uint16_t & port) {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  assert(fd >= 0);
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int result = bind(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address));
+  assert(result == 0);
+  socklen_t length = sizeof(address);
+  getsockname(fd, reinterpret_cast<struct sockaddr *>(&address), &length);
+  port = ntohs(address.sin_port);
+  return fd;
+}
+
+void drain_completions(udp::Context & context) {
+  const List<int> sockets = context.send_sockets();
+  while (context.zerocopy_pending() != 0) {
+    struct pollfd poll_fds[2];
+    for (size_t i = 0; i < sockets.size(); ++i) {
+      poll_fds[i] = {sockets[i], 0, 0};
+    }
+    poll(poll_fds, sockets.size(), 10);
+    context.reap_zerocopy_completions();
+  }
+}
+
+double send_ns(udp::Context & context, const Locator_t & locator,
+  const udp::Context::SharedPacket & packet, int sends, bool zerocopy)
+{
+  const auto start = Clock::now();
+  for (int i = 0; i < sends; ++i) {
+    if (zerocopy) {
+      context.unicast_send(locator, packet);
+    } else {
+      context.unicast_send(locator, packet->data(), packet->size());
+    }
+  }
+  drain_completions(context);
+  const auto elapsed = Clock::now() - start;
+  return std::chrono::duration<double, std::nano>(elapsed).count() / sends;
+}
+
+int main(int argc, char ** argv) {
+  uint16_t port = argc > 2 ? atoi(argv[2]) : 0;
+  const int sends = argc > 3 ? atoi(argv[3]) : 20000;
+  int sink = -1;
+  if (argc <= 1) {
+    sink = bind_sink(port);
+  }
+  const Locator_t locator = make_locator(argc > 1 ? argv[1] : "127.0.0.1", port);
+
+  udp::Context context;
+  if (!context.enable_zerocopy(1)) {
+    printf("SO_ZEROCOPY is not supported by this kernel.\n");
+    return 1;
+  }
+
+  printf("%8s %12s %12s\n", "bytes", "copy ns", "zerocopy ns");
+  size_t crossover = 0;
+  for (size_t bytes = 1024; bytes <= 64 * 1024; bytes *= 2) {
+    const size_t words = std::min<size_t>(bytes, CMBML__MAX_FRAGMENT_SIZE) / sizeof(uint32_t);
+    auto packet = std::make_shared<const Packet<>>(words, 0xabcdabcd);
+    const double copy = send_ns(context, locator, packet, sends, false);
+    const double zerocopy = send_ns(context, locator, packet, sends, true);
+    printf("%8zu %12.1f %12.1f\n", words * sizeof(uint32_t), copy, zerocopy);
+    if (crossover == 0 && zerocopy < copy) {
+      crossover = words * sizeof(uint32_t);
+    }
+  }
+  if (crossover) {
+    printf("zero-copy is faster from %zu bytes\n", crossover);
+  } else {
+    printf("zero-copy was never faster\n");
+  }
+  printf("%zu of the zero-copy sends were copied by the kernel\n", context.zerocopy_copied());
+  if (sink != -1) {
+    close(sink);
+  }
+  return 0;
+}
@@ -52,13 +52,11 @@ namespace cmbml {
 
     auto configure() {
       using boost::msm::lite::event;
-      using boost::msm::lite::on_entry;
       using boost::msm::lite::state;
       using namespace cmbml::reader_events;
 
       state<class initial> initial_s;
       state<class waiting> waiting_s;
-      state<class may_ack> may_ack_s;
       state<class must_ack> must_ack_s;
       state<class initial2> initial2_s;
       state<class ready> ready_s;
@@ -68,19 +66,20 @@ namespace cmbml {
       return boost::msm::lite::make_transition_table(
         *initial_s  + event<reader_created<ReaderT>> / on_reader_created = waiting_s,
 
-        waiting_s   + event<heartbeat_received> [not_final_guard] = must_ack_s,
-        waiting_s   + event<heartbeat_received> [not_live_guard]  = may_ack_s,
-        waiting_s   + event<heartbeat_received>                   = waiting_s,
-        may_ack_s   + event<missing_changes_empty>                = waiting_s,
-        may_ack_s   + event<missing_changes_not_empty>            = must_ack_s,
-        must_ack_s  + on_entry / on_must_ack_entry,  // TODO
-        must_ack_s  + event<heartbeat_response_delay<Transport>> / on_heartbeat_response_delay = waiting_s,
+        // Each WriterProxy arms its own ACKNACK timer in on_heartbeat; this region only
+        // records whether any ACKNACK is owed.
+        waiting_s   + event<heartbeat_received<ReaderT>> [not_final_guard] = must_ack_s,
+        waiting_s   + event<heartbeat_received<ReaderT>> [may_ack_guard]   = must_ack_s,
+        waiting_s   + event<heartbeat_received<ReaderT>>                   = waiting_s,
+        must_ack_s  + event<heartbeat_response_delay<ReaderT, Transport>>  = waiting_s,
 
         *initial2_s + event<reader_created<ReaderT>>               = ready_s,
 
-        ready_s     + event<heartbeat_received>     / on_heartbeat = ready_s,
-        ready_s     + event<data_received<ReaderT>> / on_data      = ready_s,
-        ready_s     + event<gap_received>           / on_gap       = ready_s,
+        ready_s     + event<heartbeat_received<ReaderT>> / on_heartbeat = ready_s,
+        ready_s     + event<data_received<ReaderT>>      / on_data      = ready_s,
+        ready_s     + event<gap_received<ReaderT>>       / on_gap       = ready_s,
+        ready_s     + event<heartbeat_response_delay<ReaderT, Transport>>
+          / on_heartbeat_response_delay = ready_s,
 
         *any_s  + event<reader_deleted<ReaderT>> / on_reader_deleted = final_s
       );
@@ -10,6 +10,9 @@ namespace cmbml {
 
   auto on_reader_created = [](auto & e) {
     WriterProxy writer_proxy(e.remote_writer_guid, e.unicast_locators, e.multicast_locators);
+    writer_proxy.reorder_max_hold = e.reader.reorder_max_hold_duration.to_ns();
+    writer_proxy.heartbeat_response_delay = e.reader.heartbeat_response_delay.to_ns();
+    writer_proxy.heartbeat_suppression_duration = e.reader.heartbeat_suppression_duration.to_ns();
     e.reader.add_matched_writer(std::move(writer_proxy));
     // TODO WriterProxy is initialized with all past and future samples from the Writer
     // as discussed in 8.4.10.4.
@@ -20,54 +23,64 @@ namespace cmbml {
   };
 
   auto on_data_received_stateless = [](auto & e) {
-    CacheChange change(e.data);
-    e.reader.reader_cache.add_change(std::move(change));
+    e.reader.deliver(CacheChange(std::move(e.data)));
+  };
+
+  // Guards
+  auto not_final_guard = [](auto & e) {
+    return !e.heartbeat.final_flag;
   };
 
+  // Small subtlety based on literal interpretation of precedence in spec.
+  // may_ack resolves at once: the reader must ack if the writer has changes it's missing.
+  auto may_ack_guard = [](auto & e) {
+    return e.heartbeat.final_flag && !e.heartbeat.liveliness_flag &&
+      e.writer->has_missing_changes();
+  };
+
+  // Reliable readers hand changes to the HistoryCache in order, through the WriterProxy.
+  template<typename ReaderT>
+  auto deliver_to_cache(ReaderT & reader) {
+    return [&reader](CacheChange && change) {
+      reader.deliver(std::move(change));
+    };
+  }
+
   auto on_heartbeat = [](auto & e) {
     assert(e.writer);
     e.writer->update_missing_changes(e.heartbeat.last_sn);
-    e.writer->update_lost_changes(e.heartbeat.first_sn);
+    e.writer->deliver_lost_changes(e.heartbeat.first_sn, deliver_to_cache(e.reader));
+    e.writer->release_expired_changes(deliver_to_cache(e.reader));
+    if (not_final_guard(e) || may_ack_guard(e)) {
+      e.writer->schedule_acknack();
+    }
   };
 
   auto on_data = [](auto & e) {
-    CacheChange change(e.data);
-    e.reader.reader_cache.add_change(std::move(change));
     // TODO Check that this lookup is correct.
     GUID_t writer_guid = {e.receiver.source_guid_prefix, e.data.writer_id};
     WriterProxy * proxy = e.reader.matched_writer_lookup(writer_guid);
     // TODO: This could be a warning in production.
     assert(proxy);
-    proxy->set_received_change(change.sequence_number);
+    CacheChange change(std::move(e.data));
+    change.writer_guid = writer_guid;
+    proxy->deliver_change(std::move(change), deliver_to_cache(e.reader));
   };
 
   auto on_gap = [](auto & e) {
     assert(e.writer);
-    // Does the spec describe a range or a pair? Look at other impls
-    // I think it's safe to say it's a pair
-    for (const auto & seq_num : {e.gap.gap_start.value(), e.gap.gap_list.base.value() - 1}) {
-      e.writer->set_irrelevant_change(seq_num);
-    }
+    auto deliver = deliver_to_cache(e.reader);
+    // Irrelevant: every change from gap_start up to gap_list.base, and those in gap_list.
+    e.writer->deliver_irrelevant_changes(
+      e.gap.gap_start.value(), e.gap.gap_list.base.value(), deliver);
     for (const auto & seq_num : e.gap.gap_list.set) {
-      e.writer->set_irrelevant_change(seq_num.value());
+      e.writer->deliver_irrelevant_change(seq_num, deliver);
     }
+    e.writer->release_expired_changes(deliver);
   };
 
   auto on_heartbeat_response_delay = [](auto & e) {
-    SequenceNumberSet missing_seq_num_set({e.writer.max_available_changes() + 1});
-    assert(missing_seq_num_set.set.empty());
-    for (const auto & change : e.writer.missing_changes()) {
-      missing_seq_num_set.set.push_back(change.sequence_number);
-    }
-    // TODO Implement send and maybe a constructor for acknack
-    // TODO see spec page  127 for capacity handling behavior in sequence set
-    AckNack acknack;
-    acknack.reader_id = e.reader_id;
-    acknack.writer_id = e.writer.get_guid().entity_id;
-    acknack.reader_sn_state = std::move(missing_seq_num_set);
-    // Current setting final=1, which means we do not expect a response from the writer
-    acknack.final_flag = 1;
-    e.writer.send(std::move(acknack), e.transport_context);
+    e.reader.send_due_acknacks(e.transport_context);
   };
 
   auto on_data_received_stateful = [](auto & e) {
@@ -83,29 +96,9 @@ namespace cmbml {
       if (change.sequence_number > expected_seq_num) {
         writer_proxy->update_lost_changes(change.sequence_number);
       }
-      e.reader.reader_cache.add_change(std::move(change));
+      e.reader.deliver(std::move(change));
     }
     assert(writer_proxy->max_available_changes() >= seq);
   };
-
-  // Entry functions
-  // TODO: bind executor: pass to the state machine, pass timer values...
-  auto on_must_ack_entry = [](auto & e) {
-    auto on_timer = []() {
-      // event<heartbeat_response_delay> h;
-      // state_machine.process_event(h);
-    };
-    // executor.add_timed_task(heartbeat_response_delay, on_timer);
-  };
-
-  // Guards
-  auto not_final_guard = [](auto & e) {
-    return !e.heartbeat.final_flag;
-  };
-
-  // Small subtlety based on literal interpretation of precedence in spec
-  auto not_live_guard = [](auto & e) {
-    return e.heartbeat.final_flag && !e.heartbeat.liveliness_flag;
-  };
 }
 #endif  // CMBML__READER_STATE_MACHINE_ACTIONS__HPP_
@@ -33,22 +33,23 @@ namespace reader_events {
     WriterProxy * writer;
   };
 
+  template<typename ReaderT>
   struct heartbeat_received {
+    ReaderT & reader;
     WriterProxy * writer;
     Heartbeat & heartbeat;
   };
 
-  template<typename TransportContext>
+  // Fired when the ACKNACK timer of at least one WriterProxy has expired.
+  template<typename ReaderT, typename TransportContext = udp::Context>
   struct heartbeat_response_delay {
-    WriterProxy & writer;
-    EntityId_t & reader_id;
+    ReaderT & reader;
     TransportContext & transport_context;
   };
 
-  struct missing_changes_empty {};
-  struct missing_changes_not_empty {};
-
+  template<typename ReaderT>
   struct gap_received {
+    ReaderT & reader;
     WriterProxy * writer;
     Gap & gap;
   };
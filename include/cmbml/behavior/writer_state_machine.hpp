@@ -62,11 +62,10 @@ namespace cmbml {
         pushing_s    + event<unsent_changes_empty>                                = announcing_s,
         pushing_s    + event<can_send<WriterT>>           / on_can_send           = pushing_s,
         announcing_s + event<after_heartbeat<WriterT>>    / on_heartbeat          = announcing_s,
-        waiting_s    + event<acknack_received<WriterT>>   / on_acknack            = waiting_s,
+        *waiting_s   + event<acknack_received<WriterT>>   / on_acknack            = waiting_s,
         waiting_s    + event<requested_changes>                                   = must_repair_s,
         must_repair_s + event<acknack_received<WriterT>>  / on_acknack            = must_repair_s,
-        must_repair_s + event<after_nack_delay>                                   = repairing_s,
-        repairing_s + event<can_send<WriterT>>            / on_can_send_reliable  = repairing_s,
+        must_repair_s + event<after_nack_delay<WriterT>>  / on_nack_delay         = repairing_s,
         repairing_s + event<requested_changes_empty>                              = waiting_s,
 
         *any_s        + event<released_locator<WriterT>> / on_released_locator = final_s
@@ -106,7 +105,6 @@ namespace cmbml {
   {
     auto configure() {
       using boost::msm::lite::event;
-      using boost::msm::lite::on_entry;
       using boost::msm::lite::state;
       using namespace cmbml::stateful_writer;
 
@@ -129,12 +127,10 @@ namespace cmbml {
         announcing_s  + event<unacked_changes_empty>                              = idle_s,
         idle_s        + event<unacked_changes>                                    = announcing_s,
         announcing_s  + event<after_heartbeat<WriterT>>   / on_heartbeat = announcing_s,
-        waiting_s     + event<acknack_received<WriterT>>  / on_acknack            = waiting_s,
+        *waiting_s    + event<acknack_received<WriterT>>  / on_acknack            = waiting_s,
         waiting_s     + event<requested_changes>                                  = must_repair_s,
-        must_repair_s + on_entry / [](){},  // TODO start timer
         must_repair_s + event<acknack_received<WriterT>>  / on_acknack            = must_repair_s,
-        must_repair_s + event<after_nack_delay>                                   = repairing_s,
-        repairing_s   + event<can_send_stateful<>>        / on_can_send_repairing = repairing_s,
+        must_repair_s + event<after_nack_delay<WriterT>>  / on_nack_delay         = repairing_s,
         repairing_s   + event<requested_changes_empty>                            = waiting_s,
 
         *ready_s      + event<new_change<WriterT>>        / on_new_change     = ready_s,
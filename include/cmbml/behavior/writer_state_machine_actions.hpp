@@ -13,29 +13,12 @@ namespace stateless_writer {
   };
 
   // Small optimzation could be made: the best effort can_send state does not need a ref. to the Writer
+  // The other locators waiting for the same change share its serialized DATA.
   auto on_can_send = [](auto & e) {
-    CacheChange next_change = e.locator.pop_next_unsent_change();
-    Data data(std::move(next_change), e.locator.expects_inline_qos, e.writer_has_key);
-    // TODO: inline_qos; need to copy from related DDS writer
-    /*
-    if (data.expects_inline_qos) {
-    }
-    */
-    data.reader_id = entity_id_unknown;
-    e.locator.send(std::move(data), e.context);
-  };
-
-  auto on_can_send_reliable = [](auto & e) {
-    CacheChange change = e.locator.pop_next_unsent_change();
-    if (e.writer.writer_cache.contains_change(change.sequence_number)) {
-      Data data(std::move(change), e.locator.expects_inline_qos, e.writer_has_key);
-      // TODO: inline_qos; need to copy from related DDS writer
-      data.reader_id = entity_id_unknown;
-      e.locator.send(std::move(data), e.context);
-    } else {
-      Gap gap(entity_id_unknown, e.writer.guid.entity_id, change.sequence_number);
-      e.locator.send(std::move(gap), e.context);
-    }
+    auto send = [&e](ReaderLocator & reader_locator, const std::shared_ptr<Packet<>> & packet) {
+      reader_locator.send(*packet, e.context);
+    };
+    e.writer.send_unsent_change(e.locator.next_unsent_seq_num(), e.writer_has_key, send);
   };
 
   auto on_released_locator = [](auto & e) {
@@ -56,15 +39,29 @@ namespace stateless_writer {
 
 
   auto on_acknack = [](auto & e) {
-    auto locator_lambda = [&e](Locator_t & locator) {
-      ReaderLocator & reader_locator = e.writer.lookup_reader_locator(locator);
-      reader_locator.set_requested_changes(e.acknack.reader_sn_state.set);
-    };
-    for (auto & reply_locator : e.receiver.unicast_reply_locator_list) {
-      locator_lambda(reply_locator);
+    // The unicast reply locator identifies the reader; the multicast one is shared by a group.
+    for (const auto & reply_locator : e.receiver.unicast_reply_locator_list) {
+      if (e.writer.find_reader_locator(reply_locator)) {
+        e.writer.nack_aggregator.add_request(
+          reply_locator, e.acknack.reader_sn_state.set, e.writer.nack_response_delay);
+      }
     }
-    for (auto & reply_locator : e.receiver.multicast_reply_locator_list) {
-      locator_lambda(reply_locator);
+  };
+
+  auto on_nack_delay = [](auto & e) {
+    auto repairs = e.writer.nack_aggregator.collect_repairs(
+      e.writer.nack_suppression_duration, e.writer.repair_multicast_threshold);
+    for (const auto & repair : repairs) {
+      if (e.writer.writer_cache.contains_change(repair.sequence_number)) {
+        Data data(e.writer.writer_cache.copy_change(repair.sequence_number), false,
+          e.writer_has_key);
+        // TODO: inline_qos; need to copy from related DDS writer
+        data.reader_id = entity_id_unknown;
+        e.writer.send_repair(std::move(data), repair, e.context);
+      } else {
+        Gap gap(entity_id_unknown, e.writer.guid.entity_id, repair.sequence_number);
+        e.writer.send_repair(std::move(gap), repair, e.context);
+      }
     }
   };
 
@@ -87,7 +84,9 @@ namespace stateful_writer {
   auto on_can_send = [](auto & e) {
     ChangeForReader change = e.reader_proxy.pop_next_unsent_change();
     change.status = ChangeForReaderStatus::underway;
-    if (change.is_relevant) {
+    if (change.is_relevant && e.reader_proxy.local_reader) {
+      e.reader_proxy.deliver_local(std::move(change));
+    } else if (change.is_relevant) {
       Data data(std::move(change), e.reader_proxy.expects_inline_qos, e.writer_has_key);
       // TODO inline QoS
       data.reader_id = entity_id_unknown;
@@ -131,25 +130,29 @@ namespace stateful_writer {
     GUID_t reader_guid = {e.receiver.source_guid_prefix, e.acknack.reader_id};
     ReaderProxy & proxy = e.writer.lookup_matched_reader(reader_guid);
     proxy.set_acked_changes(e.acknack.reader_sn_state.base - 1);
-    proxy.set_requested_changes(e.acknack.reader_sn_state.set);
+    // Requests are repaired together once the response window closes (see on_nack_delay).
+    e.writer.nack_aggregator.add_request(
+      reader_guid, e.acknack.reader_sn_state.set, e.writer.nack_response_delay);
     // TODO assert postconditions
     // Postconditions:
     //   MIN { change.sequenceNumber IN the_reader_proxy.unacked_changes() } >=
     //   ACKNACK.readerSNState.base - 1
   };
 
-  auto on_can_send_repairing = [](auto & e) {
-    ChangeForReader change = e.reader_proxy.pop_next_requested_change();
-    change.status = ChangeForReaderStatus::underway;
-    if (change.is_relevant) {
-      Data data(std::move(change), e.reader_proxy.expects_inline_qos, e.writer_has_key);
-      data.reader_id = e.reader_proxy.remote_reader_guid.entity_id;  // ??? Is this implied by the spec?
-      // TODO inline QoS
-      e.reader_proxy.send(std::move(data), e.context);
-    } else {
-      Gap gap(e.reader_proxy.remote_reader_guid.entity_id, change.writer_guid.entity_id,
-          change.sequence_number);
-      e.reader_proxy.send(std::move(gap), e.context);
+  auto on_nack_delay = [](auto & e) {
+    auto repairs = e.writer.nack_aggregator.collect_repairs(
+      e.writer.nack_suppression_duration, e.writer.repair_multicast_threshold);
+    for (const auto & repair : repairs) {
+      if (e.writer.writer_cache.contains_change(repair.sequence_number)) {
+        Data data(e.writer.writer_cache.copy_change(repair.sequence_number), false,
+          e.writer_has_key);
+        // TODO inline QoS
+        data.reader_id = entity_id_unknown;
+        e.writer.send_repair(std::move(data), repair, e.context);
+      } else {
+        Gap gap(entity_id_unknown, e.writer.guid.entity_id, repair.sequence_number);
+        e.writer.send_repair(std::move(gap), repair, e.context);
+      }
     }
   };
 
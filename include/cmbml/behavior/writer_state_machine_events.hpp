@@ -46,7 +46,15 @@ namespace cmbml {
 
   struct requested_changes {};
   struct requested_changes_empty {};
-  struct after_nack_delay {};
+
+  // Fired when the NACK response window opened by the first ACKNACK has expired.
+  template<typename WriterT,
+    typename Transport = udp::Context>
+  struct after_nack_delay {
+    WriterT & writer;
+    Transport & context;
+    bool writer_has_key;
+  };
 
   template<typename StatefulWriterT>
   struct configured_reader {
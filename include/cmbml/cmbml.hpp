@@ -4,6 +4,8 @@
 #include <cmbml/dds/writer.hpp>
 #include <cmbml/dds/reader.hpp>
 
+#include <cmbml/utility/thread_pool_executor.hpp>
+
 #include <cmbml/structure/writer.hpp>
 #include <cmbml/structure/reader.hpp>
 
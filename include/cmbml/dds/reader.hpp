@@ -2,6 +2,10 @@
 #define CMBML__DDS__READER_HPP_
 
 #include <cmbml/behavior/reader_state_machine_events.hpp>
+#include <cmbml/cdr/deserialize_anything.hpp>
+#include <cmbml/dds/wait_set.hpp>
+#include <cmbml/structure/intra_process.hpp>
+#include <cmbml/utility/executor.hpp>
 
 namespace cmbml {
 namespace dds {
@@ -11,81 +15,190 @@ namespace dds {
   template<typename RTPSReader, typename Context = udp::Context, typename Executor = SyncExecutor>
   class DataReader {
   public:
+    ~DataReader() {
+      if (local_reader) {
+        IntraProcessRegistry::instance().remove_reader(rtps_reader.guid);
+      }
+    }
 
     void add_tasks(Executor & executor) {
-      Context thread_context;
+      this->executor = &executor;
       // TODO Initialize receiver locators
-      auto receiver_thread = [this, &thread_context]() {
-        // This is a blocking call
-        thread_context.receive_packet(
-            [&](const auto & packet) { deserialize_message(packet, thread_context); }
-        );
-      };
-      executor.add_task(receiver_thread);
-
+      context = &endpoint_context(executor, own_context);
+      executor.add_receiver(*context,
+        [this](const auto & packet) { deserialize_message(packet, *context); }
+      );
+      // DataWriters of this process that match the reader from now on hand it their changes
+      // directly, on their own threads.
+      if (!local_reader) {
+        local_reader = IntraProcessRegistry::instance().add_reader(
+          rtps_reader.guid, rtps_reader.unicast_locator_list,
+          [this](CacheChange && change) { on_local_change(std::move(change)); });
+      }
     }
 
     List<CacheChange> on_read() {
-      return rtps_reader.reader_cache.get_filtered_cache_changes(&DataReader::dds_filter);
+      auto lock = lock_reader();
+      status_condition.clear_status_changes(data_available_status);
+      auto filter = [this](const CacheChange & change) { return dds_filter(change); };
+      return rtps_reader.reader_cache.get_filtered_cache_changes(filter);
     }
     List<CacheChange> on_take() {
-      List<CacheChange> ret = rtps_reader.reader_cache.get_filtered_cache_changes(&DataReader::dds_filter);
+      auto lock = lock_reader();
+      status_condition.clear_status_changes(data_available_status);
+      auto filter = [this](const CacheChange & change) { return dds_filter(change); };
+      List<CacheChange> ret = rtps_reader.reader_cache.get_filtered_cache_changes(filter);
       rtps_reader.reader_cache.clear();
+      read_condition.set_has_data(false);
       return ret;
     }
 
+    // Calls listener(const CacheChange &) on the receive thread for each change the reader
+    // accepts. Unless keep_in_history, changes go only to the listener: on_read and the
+    // conditions below never see them, which saves copying each sample in and out of the cache.
+    template<typename ListenerT>
+    void set_listener(ListenerT && listener, bool keep_in_history = true) {
+      auto lock = lock_reader();
+      rtps_reader.on_data_available = std::forward<ListenerT>(listener);
+      rtps_reader.keep_in_history = keep_in_history;
+    }
+
+    // Attach these to a WaitSet to block until data arrives instead of polling on_read.
+    ReadCondition & get_readcondition() {
+      return read_condition;
+    }
+    StatusCondition & get_statuscondition() {
+      return status_condition;
+    }
+
+    // TODO Refine MessageReceiver logic
+    template<typename SrcT, typename NetworkContext = udp::Context>
+    void deserialize_message(const SrcT & src, NetworkContext & context) {
+      size_t index = 0;
+      Header header;
+      StatusCode deserialize_status = deserialize(header, src, index);
+      if (deserialize_status != StatusCode::ok || header.protocol != rtps_protocol_id) {
+        return;
+      }
+      MessageReceiver receiver(header.guid_prefix, Context::kind, context.address_as_array());
+      // index counts bits.
+      while (index < 32 * src.size() && deserialize_status == StatusCode::ok) {
+        deserialize_status = deserialize_submessage(src, index, receiver);
+      }
+    }
+
     template<typename SrcT>
-    void deserialize_submessage(
+    StatusCode deserialize_submessage(
       const SrcT & src, size_t & index, MessageReceiver & receiver)
     {
-      auto header_callback = [&src, &index, &receiver](SubmessageHeader & header) {
+      auto header_callback = [this, &src, &index, &receiver](SubmessageHeader & header) {
         switch (header.submessage_id) {
           case SubmessageKind::heartbeat_id:
-            deserialize<Heartbeat>(src, index, &DataReader::on_heartbeat, receiver);
-            break;
+            return deserialize<Heartbeat>(src, index,
+              [this, &receiver](auto && heartbeat) {
+                on_heartbeat(std::move(heartbeat), receiver);
+                return StatusCode::ok;
+              }
+            );
           case SubmessageKind::gap_id:
-            deserialize<Gap>(src, index, &DataReader::on_gap, receiver);
-            break;
+            return deserialize<Gap>(src, index,
+              [this, &receiver](auto && gap) {
+                on_gap(std::move(gap), receiver);
+                return StatusCode::ok;
+              }
+            );
           case SubmessageKind::info_dst_id:
-            deserialize<InfoDestination>(src, index, &DataReader::on_info_destination, receiver);
-            break;
-          case SubmessageKind::heartbeat_frag_id:
-            // Fragmentation isn't implemented yet
-            assert(false);
-            break;
+            return deserialize<InfoDestination>(src, index,
+              [this, &receiver](auto && info_dst) {
+                on_info_destination(std::move(info_dst), receiver);
+                return StatusCode::ok;
+              }
+            );
           case SubmessageKind::data_id:
-            deserialize<Data>(src, index, &DataReader::on_data, receiver);
-            break;
+            return deserialize<Data>(src, index,
+              [this, &receiver](auto && data) {
+                on_data(std::move(data), receiver);
+                return StatusCode::ok;
+              }
+            );
+          case SubmessageKind::heartbeat_frag_id:
           case SubmessageKind::data_frag_id:
             // Fragmentation isn't implemented yet
-            assert(false);
-            break;
+            return StatusCode::not_yet_implemented;
           default:
-            assert(false);
+            // In the real implementation an unknown SubmessageId is ignored
+            // Should scan until next submessage found
+            return StatusCode::not_yet_implemented;
         }
       };
-      deserialize<SubmessageHeader>(src, index, header_callback);
+      return deserialize<SubmessageHeader>(src, index, header_callback);
+    }
+
+    // The RTPS reader, to give it a GUID and locators and to match writers before add_tasks,
+    // until there is discovery.
+    RTPSReader & get_rtps_reader() {
+      return rtps_reader;
     }
 
   private:
+    // Local writers deliver to the reader on their own threads, so everything that touches
+    // rtps_reader holds the delivery lock once the reader is registered. It is recursive, so
+    // a listener may call on_read or on_take.
+    std::unique_lock<std::recursive_mutex> lock_reader() {
+      if (!local_reader) {
+        return std::unique_lock<std::recursive_mutex>();
+      }
+      return local_reader->lock_delivery();
+    }
 
     void on_heartbeat(Heartbeat && heartbeat, MessageReceiver & receiver) {
       // TODO double-check that heartbeat comes from the matched destination...
       // In the implementation we should just emit a warning, e.g. in case someone is 
       // sending bogus packets
-      GUID_t writer_guid = {receiver.dest_guid_prefix, heartbeat.writer_id};
+      GUID_t writer_guid = {receiver.source_guid_prefix, heartbeat.writer_id};
+      auto lock = lock_reader();
       WriterProxy * proxy = rtps_reader.matched_writer_lookup(writer_guid);
       assert(proxy);
-      cmbml::reader_events::heartbeat_received e{proxy, heartbeat};
+      const bool acknack_was_scheduled = proxy->acknack_scheduled();
+      const size_t cached = rtps_reader.reader_cache.size();
+      cmbml::reader_events::heartbeat_received<RTPSReader> e{rtps_reader, proxy, heartbeat};
       state_machine.process_event(e);
+      // first_sn may give up on a hole, releasing the changes held behind it.
+      notify_if_cached(cached);
+      if (!acknack_was_scheduled && proxy->acknack_scheduled()) {
+        arm_acknack_timer(proxy->acknack_deadline());
+      }
+    }
+
+    // One-shot timer for an ACKNACK scheduled by a HEARTBEAT. Each firing sends every ACKNACK
+    // that is due by then, so timers of other writers may find nothing left to send.
+    void arm_acknack_timer(const WriterProxy::Clock::time_point & deadline) {
+      if (!executor) {
+        return;
+      }
+      executor->add_timed_task(
+        deadline - WriterProxy::Clock::now(), true,
+        [this]() {
+          auto lock = lock_reader();
+          if (!rtps_reader.acknacks_due()) {
+            return;
+          }
+          cmbml::reader_events::heartbeat_response_delay<RTPSReader, Context> e{
+            rtps_reader, *context};
+          state_machine.process_event(e);
+        }
+      );
     }
 
     void on_gap(Gap && gap, MessageReceiver & receiver) {
-      GUID_t writer_guid = {receiver.dest_guid_prefix, gap.writer_id};
+      GUID_t writer_guid = {receiver.source_guid_prefix, gap.writer_id};
+      auto lock = lock_reader();
       WriterProxy * proxy = rtps_reader.matched_writer_lookup(writer_guid);
       assert(proxy);
-      cmbml::reader_events::gap_received e{proxy, gap};
+      const size_t cached = rtps_reader.reader_cache.size();
+      cmbml::reader_events::gap_received<RTPSReader> e{rtps_reader, proxy, gap};
       state_machine.process_event(e);
+      notify_if_cached(cached);
     }
 
     void on_info_destination(InfoDestination && info_dst, MessageReceiver & receiver) {
@@ -99,9 +212,22 @@ namespace dds {
     }
 
     void on_data(Data && data, MessageReceiver & receiver) {
-      // user_data_callback(data);
+      auto lock = lock_reader();
+      const size_t cached = rtps_reader.reader_cache.size();
       cmbml::reader_events::data_received<RTPSReader> e{rtps_reader, data, receiver};
       state_machine.process_event(e);
+      notify_if_cached(cached);
+    }
+
+    // Called by LocalReader::deliver, which holds the delivery lock.
+    void on_local_change(CacheChange && change) {
+      const size_t cached = rtps_reader.reader_cache.size();
+      rtps_reader.deliver_local(std::move(change));
+      notify_if_cached(cached);
+    }
+
+    void notify_if_cached(size_t cached) {
+      dds::notify_if_cached(rtps_reader.reader_cache, cached, read_condition, status_condition);
     }
 
 
@@ -112,7 +238,14 @@ namespace dds {
 
     // MessageReceiver receiver;
     RTPSReader rtps_reader;
+    // The executor's Context for executors that keep one per thread, otherwise own_context.
+    Context * context = nullptr;
+    std::unique_ptr<Context> own_context;
+    Executor * executor = nullptr;
     boost::msm::lite::sm<typename RTPSReader::StateMachineT> state_machine;
+    ReadCondition read_condition;
+    StatusCondition status_condition;
+    std::shared_ptr<LocalReader> local_reader;
   };
 }
 }
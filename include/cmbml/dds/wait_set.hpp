@@ -0,0 +1,142 @@
+#ifndef CMBML__DDS__WAIT_SET_HPP_
+#define CMBML__DDS__WAIT_SET_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+#include <cmbml/types.hpp>
+
+namespace cmbml {
+namespace dds {
+
+  using StatusMask = uint32_t;
+  // Values from the DDS specification.
+  const StatusMask sample_lost_status = 0x0001 << 7;
+  const StatusMask data_available_status = 0x0001 << 10;
+  const StatusMask subscription_matched_status = 0x0001 << 14;
+  const StatusMask all_statuses = 0xffffffff;
+
+  class WaitSet;
+
+  // Something an application thread can wait for. The trigger value is set by the thread
+  // that runs the endpoint and read by the thread in WaitSet::wait, so it is atomic; setting
+  // it to true wakes the WaitSets the condition is attached to.
+  class Condition {
+  public:
+    Condition() = default;
+    ~Condition();
+
+    Condition(const Condition &) = delete;
+    Condition & operator=(const Condition &) = delete;
+
+    bool get_trigger_value() const {
+      return trigger_value;
+    }
+
+  protected:
+    void set_trigger_value(bool value);
+
+  private:
+    friend class WaitSet;
+
+    std::atomic<bool> trigger_value{false};
+    std::mutex wait_sets_mutex;
+    List<WaitSet *> wait_sets;
+  };
+
+  // Triggered by the application, e.g. to wake a WaitSet for shutdown.
+  class GuardCondition : public Condition {
+  public:
+    using Condition::set_trigger_value;
+  };
+
+  // Triggered while the reader's HistoryCache holds changes the application hasn't taken.
+  class ReadCondition : public Condition {
+  public:
+    // Called by the DataReader when its cache changes.
+    void set_has_data(bool has_data) {
+      set_trigger_value(has_data);
+    }
+  };
+
+  // Triggered while one of the enabled statuses has changed since the application last
+  // read or took from the entity.
+  class StatusCondition : public Condition {
+  public:
+    void set_enabled_statuses(StatusMask mask);
+    StatusMask get_enabled_statuses() const {
+      return enabled_statuses;
+    }
+
+    StatusMask get_status_changes() const {
+      return status_changes;
+    }
+
+    // Called by the entity.
+    void add_status_changes(StatusMask statuses);
+    void clear_status_changes(StatusMask statuses);
+
+  private:
+    void update_trigger_value();
+
+    std::atomic<StatusMask> enabled_statuses{all_statuses};
+    std::atomic<StatusMask> status_changes{0};
+  };
+
+  // Called by a DataReader after an event that may store changes in its cache: a DATA, or a
+  // HEARTBEAT or GAP that releases the changes held behind a hole. cached is the size of the
+  // cache before the event.
+  template<typename CacheT>
+  void notify_if_cached(const CacheT & cache, size_t cached,
+    ReadCondition & read_condition, StatusCondition & status_condition)
+  {
+    if (cache.size() > cached) {
+      read_condition.set_has_data(true);
+      status_condition.add_status_changes(data_available_status);
+    }
+  }
+
+  // Blocks an application thread until one of its conditions triggers. The thread sleeps in
+  // poll on an eventfd that triggering conditions write to, so it wakes as soon as the
+  // executor thread stores data, with no polling of the readers. get_fd() lets a middleware
+  // add the WaitSet to its own event loop instead (Linux).
+  class WaitSet {
+  public:
+    WaitSet();
+    ~WaitSet();
+
+    WaitSet(const WaitSet &) = delete;
+    WaitSet & operator=(const WaitSet &) = delete;
+
+    // The condition must outlive the WaitSet or be detached first.
+    void attach_condition(Condition & condition);
+    void detach_condition(Condition & condition);
+
+    // Fills active_conditions with the triggered conditions. Returns false if none
+    // triggered before timeout.
+    bool wait(
+      List<Condition *> & active_conditions,
+      std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max());
+
+    // Readable while the WaitSet has been woken and not waited on since.
+    int get_fd() const {
+      return event_fd;
+    }
+
+  private:
+    friend class Condition;
+
+    void wake();
+    void collect_triggered(List<Condition *> & active_conditions);
+
+    int event_fd = -1;
+    std::mutex conditions_mutex;
+    List<Condition *> conditions;
+  };
+
+}  // namespace dds
+}  // namespace cmbml
+
+#endif  // CMBML__DDS__WAIT_SET_HPP_
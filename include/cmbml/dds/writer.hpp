@@ -1,18 +1,35 @@
 #ifndef CMBML__DDS__WRITER_HPP_
 #define CMBML__DDS__WRITER_HPP_
 
+#include <mutex>
+
 #include <cmbml/behavior/writer_state_machine.hpp>
 #include <cmbml/cdr/serialize_anything.hpp>
 #include <cmbml/cdr/deserialize_anything.hpp>
+#include <cmbml/structure/flow_controller.hpp>
 #include <cmbml/structure/writer.hpp>
 
 #include <cmbml/psm/udp/context.hpp>
 
 #include <cmbml/utility/executor.hpp>
+#include <cmbml/utility/async_sender.hpp>
+#include <cmbml/utility/send_batch.hpp>
+#include <cmbml/utility/shared_packet.hpp>
 
 namespace cmbml {
 namespace dds {
 
+  // When a written change is sent.
+  enum class PublishMode {
+    // When the executor next runs the writer's state machine.
+    executor,
+    // By write(), in the caller's thread: the lowest latency, but the caller blocks in sendto,
+    // holding the writer lock that the executor's handlers of the writer take too.
+    synchronous,
+    // write() serializes the change and queues it for an AsyncSender; it never blocks.
+    asynchronous
+  };
+
   // Combines serialize/deserialize, state machine, etc.
   template<typename RTPSWriter, typename Context = udp::Context, typename Executor = SyncExecutor>
   class DataWriter {
@@ -23,25 +40,21 @@ namespace dds {
     }
 
     void add_tasks(Executor & executor) {
-      // TODO We really only want to have one context per thread.
-      // Currently this is an overestimation.
       // TODO thread safety!
-      Context thread_context;
+      this->executor = &executor;
       // TODO Initialize receiver locators
-      auto receiver_thread = [this, &thread_context]() {
-        // This is a blocking call
-        thread_context.receive_packet(
-            [&](const auto & packet) { deserialize_message(packet, thread_context); }
-        );
-      };
-      executor.add_task(receiver_thread);
+      context = &endpoint_context(executor, own_context);
+      executor.add_receiver(*context,
+        [this](const auto & packet) { deserialize_message(packet, *context); }
+      );
 
       hana::eval_if(RTPSWriter::reliability_level == ReliabilityKind_t::reliable,
-        [this, &executor, &thread_context]() {
+        [this, &executor]() {
           executor.add_timed_task(
             rtps_writer.heartbeat_period.to_ns(), false,
-            [this, &thread_context]() {
-              cmbml::after_heartbeat<RTPSWriter, Context> e{rtps_writer, thread_context};
+            [this]() {
+              auto lock = lock_writer();
+              cmbml::after_heartbeat<RTPSWriter, Context> e{rtps_writer, *context};
               state_machine.process_event(e);
             }
           );
@@ -50,24 +63,58 @@ namespace dds {
       );
     }
 
+    // The RTPS writer, to give it a GUID and to match readers before add_tasks, until there
+    // is discovery.
+    RTPSWriter & get_rtps_writer() {
+      return rtps_writer;
+    }
+
+    void set_publish_mode(PublishMode mode) {
+      assert(mode != PublishMode::asynchronous || async_sender);
+      publish_mode = mode;
+    }
+
+    // Publish asynchronously through sender, usually one per participant.
+    void set_async_sender(AsyncSender<Context> & sender) {
+      async_sender = &sender;
+      publish_mode = PublishMode::asynchronous;
+    }
+
+    // Shape what write() publishes: DATA is queued on the controller and sent as its budget
+    // allows, the rest from a timer on the executor. Attach the controller to a
+    // ParticipantFlowController to share a budget with the participant's other writers.
+    void set_flow_controller(FlowController & controller) {
+      flow_controller = &controller;
+      flow_controller->set_transport(
+        [this](const Locator_t & locator, bool multicast, const Packet<> & packet) {
+          send_datagram(locator, multicast, packet);
+        }
+      );
+    }
+
     // TODO hooks for user callback, etc.
     void on_write(Data && data) {
       // TODO state machine events?
-      rtps_writer.add_change(ChangeKind_t::alive, data, instance_handle);
+      auto lock = lock_writer();
+      rtps_writer.add_change(ChangeKind_t::alive, std::move(data), InstanceHandle_t(instance_handle));
+      publish();
     }
 
     void on_dispose() {
       if (RTPSWriter::topic_kind == TopicKind_t::no_key) {
         return;
       }
-      rtps_writer.add_change(ChangeKind_t::not_alive_disposed, instance_handle);
+      auto lock = lock_writer();
+      rtps_writer.add_change(ChangeKind_t::not_alive_disposed, InstanceHandle_t(instance_handle));
     }
 
     void on_unregister() {
       if (RTPSWriter::topic_kind == TopicKind_t::no_key) {
         return;
       }
-      rtps_writer.add_change(ChangeKind_t::not_alive_unregistered, instance_handle);
+      auto lock = lock_writer();
+      rtps_writer.add_change(
+        ChangeKind_t::not_alive_unregistered, InstanceHandle_t(instance_handle));
     }
 
     // TODO Refine MessageReceiver logic
@@ -142,14 +189,121 @@ namespace dds {
       return ret;
     }
 
-  private:
-
+    // Called by deserialize_submessage for each ACKNACK, on the thread receiving it.
     StatusCode on_acknack(AckNack && acknack, MessageReceiver & receiver) {
+      auto lock = lock_writer();
+      const bool window_was_open = rtps_writer.nack_aggregator.has_pending();
       cmbml::acknack_received<RTPSWriter> e{rtps_writer, std::move(acknack), receiver};
       state_machine.process_event(std::move(e));
+      if (rtps_writer.nack_aggregator.has_pending()) {
+        state_machine.process_event(cmbml::requested_changes{});
+        if (!window_was_open) {
+          arm_nack_response_timer();
+        }
+      }
       return StatusCode::ok;
     }
 
+  private:
+    // An executor such as ThreadPoolExecutor may run the receive loop and the heartbeat and
+    // NACK response timers on different threads at once, and write() runs on the caller's, so
+    // each holds the writer lock while it touches rtps_writer and the state machine.
+    std::unique_lock<std::mutex> lock_writer() {
+      return std::unique_lock<std::mutex>(writer_mutex);
+    }
+
+    // Sends the new changes now, or hands them to the sender thread, unless the executor
+    // sends them. Called with the writer lock held.
+    void publish() {
+      if (publish_mode == PublishMode::executor) {
+        return;
+      }
+      if (publish_mode == PublishMode::synchronous && context && !flow_controller) {
+        // One sendmmsg for all of the destinations.
+        ScopedSendBatch<Context> batch(*context);
+        send_unsent_changes();
+        return;
+      }
+      send_unsent_changes();
+      if (flow_controller) {
+        flush_flow_controller();
+      }
+    }
+
+    void send_unsent_changes() {
+      rtps_writer.send_unsent_changes(RTPSWriter::topic_kind == TopicKind_t::with_key,
+        [this](const Locator_t & locator, bool multicast, const SharedPacket & packet) {
+          if (flow_controller) {
+            flow_controller->enqueue(locator, multicast, *packet);
+          } else if (publish_mode == PublishMode::asynchronous) {
+            async_sender->enqueue(locator, multicast, *packet);
+          } else {
+            // Every destination shares the serialized DATA, so a Context with zero-copy
+            // enabled sends it without a copy (udp::Context::enable_zerocopy).
+            assert(context);
+            context_send(*context, locator, multicast, packet);
+          }
+        }
+      );
+    }
+
+    void send_datagram(const Locator_t & locator, bool multicast, const Packet<> & packet) {
+      if (publish_mode == PublishMode::asynchronous) {
+        async_sender->enqueue(locator, multicast, packet);
+        return;
+      }
+      assert(context);
+      if (multicast) {
+        context->multicast_send(locator, packet.data(), packet.size());
+      } else {
+        context->unicast_send(locator, packet.data(), packet.size());
+      }
+    }
+
+    // Sends what the flow controller allows now and arms a timer for the rest. Called by
+    // write() as well as by the timer, so the timer is armed on the executor's thread.
+    void flush_flow_controller() {
+      flow_controller->flush();
+      if (!executor || flow_controller->next_flush_time() == FlowClock::time_point::max() ||
+        flow_timer_armed.exchange(true))
+      {
+        return;
+      }
+      post_to_executor(*executor, [this]() {
+        const auto now = FlowClock::now();
+        const auto next_flush = flow_controller->next_flush_time(now);
+        // If everything was sent meanwhile, the timer just clears flow_timer_armed.
+        executor->add_timed_task(
+          next_flush == FlowClock::time_point::max() ?
+          FlowClock::duration::zero() : std::max(next_flush, now) - now, true,
+          [this]() {
+            flow_timer_armed = false;
+            flush_flow_controller();
+          }
+        );
+      });
+    }
+
+    // One-shot timer for the end of the NACK response window opened by the first ACKNACK.
+    void arm_nack_response_timer() {
+      if (!executor) {
+        return;
+      }
+      executor->add_timed_task(
+        rtps_writer.nack_aggregator.deadline() - std::chrono::steady_clock::now(), true,
+        [this]() {
+          auto lock = lock_writer();
+          if (!rtps_writer.nack_aggregator.has_pending()) {
+            return;
+          }
+          cmbml::after_nack_delay<RTPSWriter, Context> e{
+            rtps_writer, *context, RTPSWriter::topic_kind == TopicKind_t::with_key};
+          state_machine.process_event(e);
+          state_machine.process_event(cmbml::requested_changes_empty{});
+        }
+      );
+    }
+
     StatusCode on_info_source(InfoSource && info_src, MessageReceiver & receiver) {
       receiver.source_guid_prefix = info_src.guid_prefix;
       receiver.source_version = info_src.protocol_version;
@@ -194,8 +348,17 @@ namespace dds {
     }
 
     RTPSWriter rtps_writer;
+    // The executor's Context for executors that keep one per thread, otherwise own_context.
+    Context * context = nullptr;
+    std::unique_ptr<Context> own_context;
+    Executor * executor = nullptr;
+    PublishMode publish_mode = PublishMode::executor;
+    AsyncSender<Context> * async_sender = nullptr;
+    FlowController * flow_controller = nullptr;
+    std::atomic<bool> flow_timer_armed{false};
     InstanceHandle_t instance_handle;
     boost::msm::lite::sm<typename RTPSWriter::StateMachineT> state_machine;
+    std::mutex writer_mutex;
   };
 
 }  // namespace dds
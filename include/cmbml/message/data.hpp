@@ -45,13 +45,14 @@ namespace cmbml {
       expects_inline_qos(inline_qos), has_data(!change.data.empty()),
       has_key(key), writer_id(change.writer_guid.entity_id), payload(change.data)
     {
-      // TODO: assign writer_sn_state?
+      // The base of writer_sn_state carries the writer sequence number.
+      writer_sn_state.base = change.sequence_number;
     }
     Data(const ChangeForReader && change, bool inline_qos, bool key) :
       expects_inline_qos(inline_qos), has_data(!change.data.empty()),
       has_key(key), writer_id(change.writer_guid.entity_id), payload(change.data)
     {
-      // TODO: writer_sn_state?
+      writer_sn_state.base = change.sequence_number;
     }
   };
 
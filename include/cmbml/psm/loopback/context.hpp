@@ -0,0 +1,245 @@
+#ifndef CMBML__PSM__LOOPBACK__CONTEXT_HPP_
+#define CMBML__PSM__LOOPBACK__CONTEXT_HPP_
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <tuple>
+
+#include <cmbml/cdr/common.hpp>
+#include <cmbml/psm/udp/context.hpp>
+#include <cmbml/utility/hash_index.hpp>
+
+namespace cmbml {
+namespace loopback {
+
+// How the switch treats the packets sent to one destination. Each packet, and each copy of
+// a multicast packet, is impaired on its own.
+struct LinkOptions {
+  std::chrono::nanoseconds latency = std::chrono::nanoseconds(0);
+  // Probabilities, from 0 to 1.
+  double loss = 0;
+  double duplication = 0;
+  double reordering = 0;
+  // A reordered packet is held back this much longer than latency, so the packets sent
+  // after it in that time overtake it.
+  std::chrono::nanoseconds reorder_delay = std::chrono::milliseconds(1);
+};
+
+struct SwitchStats {
+  uint64_t sent = 0;
+  uint64_t delivered = 0;
+  uint64_t lost = 0;
+  uint64_t duplicated = 0;
+  uint64_t reordered = 0;
+  // Sent to a locator nobody receives on, or received by a Context destroyed since.
+  uint64_t unroutable = 0;
+};
+
+class Context;
+
+// Routes packets between the Contexts of this process by locator, as if they were on one
+// host: a unicast locator reaches the Context receiving on its port, whatever its address,
+// and a multicast locator every Context that joined its group and port.
+// Impairments are drawn from a generator seeded by the caller, so a run can be repeated.
+// With a manual clock, time stands still until advance() is called, and packets are
+// delivered only once it passes their due time; that makes latency tests deterministic.
+// Otherwise a thread of the switch delivers delayed packets at their due time.
+class Switch {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit Switch(bool manual_clock = false, uint64_t seed = 1);
+  ~Switch();
+
+  Switch(const Switch &) = delete;
+  Switch & operator=(const Switch &) = delete;
+
+  // The switch of default-constructed Contexts.
+  static Switch & instance();
+
+  void set_default_link_options(const LinkOptions & options);
+  // For packets sent to destination, which is routed like the packets themselves.
+  void set_link_options(const Locator_t & destination, bool multicast,
+    const LinkOptions & options);
+
+  // With a manual clock, moves time forward and delivers what became due.
+  void advance(std::chrono::nanoseconds duration);
+
+  Clock::time_point now() const;
+
+  // Packets the switch holds, not yet delivered.
+  size_t in_flight() const;
+
+  SwitchStats stats() const;
+
+  // One receiver of a Context. The Context waits on its doorbell, a pipe that is readable
+  // while packets wait in the inbox.
+  struct Receiver {
+    Locator_t locator;
+    bool multicast;
+    int doorbell = -1;
+    int doorbell_writer = -1;
+    bool rung = false;
+    bool closed = false;
+    std::deque<std::shared_ptr<const Packet<>>> inbox;
+  };
+
+private:
+  friend class Context;
+
+  struct InFlight {
+    std::shared_ptr<Receiver> receiver;
+    std::shared_ptr<const Packet<>> packet;
+  };
+
+  // Ties are broken by the order packets were sent in.
+  using DueKey = std::tuple<Clock::time_point, uint64_t>;
+
+  static Locator_t routing_key(const Locator_t & locator, bool multicast);
+
+  std::shared_ptr<Receiver> add_receiver(const Locator_t & locator, bool multicast);
+  void remove_receiver(const std::shared_ptr<Receiver> & receiver);
+  uint16_t ephemeral_port();
+
+  void send(const Locator_t & locator, bool multicast,
+    const std::shared_ptr<const Packet<>> & packet);
+  // The next packet of a receiver, or null.
+  std::shared_ptr<const Packet<>> take(Receiver & receiver);
+
+  // now(), with the lock held.
+  Clock::time_point current_time() const;
+  const LinkOptions & link_options(const Locator_t & key) const;
+  bool draw(double probability);
+  void schedule(const std::shared_ptr<Receiver> & receiver,
+    const std::shared_ptr<const Packet<>> & packet, Clock::duration delay);
+  // Moves what is due by time into the inboxes. Called with the lock held.
+  void deliver_due(Clock::time_point time);
+  void deliver(Receiver & receiver, const std::shared_ptr<const Packet<>> & packet);
+  void run_delivery_thread();
+
+  mutable std::mutex mutex;
+  const bool manual_clock;
+  Clock::time_point manual_now;
+  std::mt19937_64 generator;
+  LinkOptions default_options;
+  LocatorIndex<LinkOptions> options_by_key;
+
+  LocatorIndex<size_t> groups_by_key;
+  // The receivers on each routing key.
+  List<List<std::shared_ptr<Receiver>>> groups;
+  uint16_t next_ephemeral_port = 49152;
+
+  std::map<DueKey, InFlight> in_flight_packets;
+  uint64_t send_order = 0;
+  SwitchStats counters;
+
+  std::thread delivery_thread;
+  std::condition_variable delivery_wakeup;
+  bool stopping = false;
+};
+
+// An in-memory transport with the interface of udp::Context, whose packets go through a
+// Switch instead of the network; see the Switch for how they are routed and impaired.
+class Context {
+public:
+  static const int32_t kind = LOCATOR_KIND_UDPv4;
+
+  using SharedPacket = std::shared_ptr<const Packet<>>;
+
+  Context();
+  explicit Context(Switch & network);
+  ~Context();
+
+  Context(const Context &) = delete;
+  Context & operator=(const Context &) = delete;
+
+  // A port of 0 takes an unused port; see receive_locators.
+  void add_unicast_receiver(const Locator_t & locator);
+  void add_multicast_receiver(const Locator_t & locator);
+
+  // The locators of the receivers, in the order they were added.
+  List<Locator_t> receive_locators() const;
+
+  // packet holds size 32-bit words.
+  void unicast_send(const Locator_t & locator, const uint32_t * packet, size_t size);
+  void multicast_send(const Locator_t & locator, const uint32_t * packet, size_t size);
+  // Without a copy: the receivers share the packet.
+  void unicast_send(const Locator_t & locator, const SharedPacket & packet);
+  void multicast_send(const Locator_t & locator, const SharedPacket & packet);
+
+  // Blocks until a packet is waiting, then passes every waiting packet to callback. Returns
+  // early after interrupt_receive.
+  template<typename CallbackT>
+  void receive_packet(CallbackT && callback, size_t packet_size = CMBML__MAX_FRAGMENT_SIZE)
+  {
+    bool received = false;
+    for (const auto & receiver : receivers) {
+      while (receive_from(receiver->doorbell, callback, packet_size)) {
+        received = true;
+      }
+    }
+    if (received) {
+      return;
+    }
+    for (int doorbell : wait_readable()) {
+      while (receive_from(doorbell, callback, packet_size)) {
+      }
+    }
+  }
+
+  // Makes the receive_packet call blocked in another thread return, or the next call if none
+  // is blocked.
+  void interrupt_receive();
+
+  // Passes the next packet of the receiver with this doorbell to callback, without
+  // blocking. Returns false if none was waiting.
+  template<typename CallbackT>
+  bool receive_from(
+    int doorbell, CallbackT && callback, size_t packet_size = CMBML__MAX_FRAGMENT_SIZE)
+  {
+    const Packet<> * packet = next_packet(doorbell, packet_size);
+    if (!packet) {
+      return false;
+    }
+    callback(*packet);
+    return true;
+  }
+
+  // The doorbells, for event loops that wait on them.
+  List<int> receive_sockets() const;
+
+  size_t receive_shard_count() const {
+    return 1;
+  }
+
+  List<int> receive_sockets(size_t /* shard */) const {
+    return receive_sockets();
+  }
+
+  // 127.0.0.1
+  IPAddress address_as_array() const;
+
+  Switch & network;
+
+private:
+  void add_receiver(const Locator_t & locator, bool multicast);
+  const Packet<> * next_packet(int doorbell, size_t packet_size);
+  List<int> wait_readable();
+
+  List<std::shared_ptr<Switch::Receiver>> receivers;
+  int interrupt_pipe[2];
+  // The buffer passed to callbacks, and the bytes it holds.
+  Packet<> buffer;
+  size_t used = 0;
+};
+
+}  // namespace loopback
+}  // namespace cmbml
+
+#endif  // CMBML__PSM__LOOPBACK__CONTEXT_HPP_
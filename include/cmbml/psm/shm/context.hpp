@@ -0,0 +1,208 @@
+#ifndef CMBML__PSM__SHM__CONTEXT_HPP_
+#define CMBML__PSM__SHM__CONTEXT_HPP_
+
+#include <deque>
+#include <map>
+#include <utility>
+
+#include <cmbml/psm/udp/context.hpp>
+
+namespace cmbml {
+namespace shm {
+
+// A vendor-specific locator kind. The address is the host's boot id, so participants on
+// other hosts can tell the locator isn't theirs to use; the port names the ring.
+#define LOCATOR_KIND_SHM 16
+
+struct ShmOptions {
+  // Descriptors per receive ring; a power of two. A send to a full ring is dropped.
+  size_t ring_capacity = 1024;
+  // Payload blocks in this Context's pool. A send finding every block in use is dropped.
+  size_t pool_blocks = 256;
+  size_t block_bytes = CMBML__MAX_FRAGMENT_SIZE;
+};
+
+// udp::Context with a shared-memory transport for participants on the same host (Linux).
+// Locators of kind LOCATOR_KIND_SHM go over shared memory and all others over UDP, so a
+// participant advertises shm_locator(port) next to its UDP locators, and a sender keeps
+// the ones reachable_locators() returns.
+// Each shm receiver owns a ring of descriptors in a named segment, which any process on
+// the host may push to. A sender writes a payload once into a block of its own pool
+// segment and pushes a descriptor of it; the receiver copies the block into the Packet it
+// passes to the callback and releases it. A SharedPacket sent to several receivers takes
+// one block.
+// The doorbell of a ring is a named pipe, which is one of receive_sockets(), so event loops
+// can wait on it. Senders only write to it when the receiver has found the ring empty, so
+// under load no syscall is made on either side.
+// A receiver that closes its ring releases the blocks still pushed to it. A sender keeps
+// track of what it pushed to each ring until it is taken, and takes back the blocks pushed
+// to a ring whose receiver died, once its pool runs out.
+class Context : public udp::Context {
+public:
+  explicit Context(const ShmOptions & options = ShmOptions());
+  ~Context();
+
+  Context(const Context &) = delete;
+  Context & operator=(const Context &) = delete;
+
+  // The locator to advertise for the shm receiver on port.
+  Locator_t shm_locator(uint16_t port) const;
+
+  // Whether locator is an shm locator of this host.
+  bool is_local(const Locator_t & locator) const;
+
+  // The locators of a remote endpoint to send to: its shm locators if it is on this host,
+  // otherwise the others.
+  List<Locator_t> reachable_locators(const List<Locator_t> & advertised) const;
+
+  // An shm locator opens the ring for its port, which must not be 0.
+  void add_unicast_receiver(const Locator_t & locator);
+  void add_multicast_receiver(const Locator_t & locator);
+
+  // Sends to an shm locator of another host are dropped and counted as send errors.
+  void unicast_send(const Locator_t & locator, const uint32_t * packet, size_t size);
+  void multicast_send(const Locator_t & locator, const uint32_t * packet, size_t size);
+  void unicast_send(udp::Destination & destination, const uint32_t * packet, size_t size);
+  void multicast_send(udp::Destination & destination, const uint32_t * packet, size_t size);
+  void unicast_send(const Locator_t & locator, const SharedPacket & packet);
+  void multicast_send(const Locator_t & locator, const SharedPacket & packet);
+
+  template<typename CallbackT>
+  void receive_packet(CallbackT && callback, size_t packet_size = CMBML__MAX_FRAGMENT_SIZE)
+  {
+    // Read what's already in the rings first; finding them empty arms their doorbells.
+    bool received = false;
+    for (auto & fd_ring : receive_rings) {
+      while (receive_from(fd_ring.first, callback, packet_size)) {
+        received = true;
+      }
+    }
+    if (received) {
+      return;
+    }
+    for (int recv_socket : wait_readable()) {
+      while (receive_from(recv_socket, callback, packet_size)) {
+      }
+    }
+  }
+
+  // Takes the next packet of an shm ring, given its doorbell, or of a UDP socket.
+  template<typename CallbackT>
+  bool receive_from(
+    int recv_socket, CallbackT && callback, size_t packet_size = CMBML__MAX_FRAGMENT_SIZE)
+  {
+    auto ring = receive_rings.find(recv_socket);
+    if (ring == receive_rings.end()) {
+      return udp::Context::receive_from(recv_socket, callback, packet_size);
+    }
+    const Packet<> * packet = next_packet(ring->second, packet_size);
+    if (!packet) {
+      return false;
+    }
+    callback(*packet);
+    return true;
+  }
+
+  // The UDP sockets and the doorbells of the shm rings.
+  List<int> receive_sockets() const;
+
+  // Blocks of this Context's pool that receivers haven't released yet.
+  size_t blocks_in_use() const;
+
+  // The layout of the shared segments, defined with the code that maps them.
+  struct RingHeader;
+  struct RingSlot;
+  struct PoolHeader;
+
+  // What a descriptor points at: a block of a sender's pool.
+  struct Descriptor {
+    uint32_t pid;
+    uint32_t pool;
+    uint32_t block;
+    uint32_t bytes;
+  };
+
+private:
+  struct Mapping {
+    void * memory = nullptr;
+    size_t size = 0;
+  };
+
+  struct ReceiveRing {
+    uint16_t port;
+    int doorbell;
+    Mapping mapping;
+    // Only this Context takes from the ring, so the head is kept here.
+    uint64_t head = 0;
+    // The buffer passed to callbacks, and the bytes it holds.
+    Packet<> buffer;
+    size_t used = 0;
+  };
+
+  struct SendRing {
+    Mapping mapping;
+    int doorbell = -1;
+    // The positions pushed to and their blocks, until the receiver takes them.
+    std::deque<std::pair<uint64_t, uint32_t>> pushed;
+  };
+
+  // A block written for a SharedPacket; the Context holds a reference to it, so the packet
+  // can be sent to more receivers without writing it again.
+  struct SharedBlock {
+    SharedPacket packet;
+    uint32_t block;
+  };
+
+  bool shm_kind(const Locator_t & locator) const {
+    return locator.kind == LOCATOR_KIND_SHM;
+  }
+
+  bool open_receive_ring(uint16_t port);
+  SendRing * send_ring(uint16_t port);
+  // Takes back the blocks pushed to ring that its receiver hasn't taken, and unmaps it.
+  void close_send_ring(std::map<uint16_t, SendRing>::iterator ring);
+  // Closes the rings whose receiver closed them or died; false if there were none.
+  bool close_abandoned_send_rings();
+  bool create_pool();
+
+  // Takes a free block and writes bytes into it; returns its index, or -1.
+  int64_t write_block(const void * data, size_t bytes);
+  void release_block(uint32_t block);
+  // Pushes a descriptor of block to the receiver at destination.
+  bool push(udp::Destination & destination, uint32_t block, size_t bytes);
+  void shm_send(udp::Destination & destination, const uint32_t * packet, size_t size);
+  void shm_send_shared(udp::Destination & destination, const SharedPacket & packet);
+
+  const Packet<> * next_packet(ReceiveRing & ring, size_t packet_size);
+  // Closes ring, and releases the blocks of the descriptors left in it.
+  void close_receive_ring(ReceiveRing & ring);
+  // The pool a descriptor points into, mapped if needed; null if it's gone or the
+  // descriptor is out of its bounds.
+  PoolHeader * sender_pool(const Descriptor & descriptor);
+  // Reads the block a descriptor points at into ring.buffer; false if its pool is gone.
+  bool read_block(ReceiveRing & ring, const Descriptor & descriptor, size_t packet_size);
+  List<int> wait_readable();
+
+  ShmOptions options;
+  IPAddress host_id;
+  uint32_t pid;
+
+  // Receive rings by doorbell.
+  std::map<int, ReceiveRing> receive_rings;
+  std::map<uint16_t, SendRing> send_rings;
+
+  uint32_t pool_index = 0;
+  Mapping pool;
+  PoolHeader * pool_header = nullptr;
+  // Where the search for a free block starts.
+  size_t next_block = 0;
+  SharedBlock shared_block;
+
+  // Pools of other Contexts, by pid and index.
+  std::map<uint64_t, Mapping> mapped_pools;
+};
+
+}
+}
+
+#endif  // CMBML__PSM__SHM__CONTEXT_HPP_
@@ -3,12 +3,19 @@
 
 #include <cmbml/cdr/common.hpp>
 #include <cmbml/psm/udp/constants.hpp>
+#include <cmbml/psm/udp/destination_cache.hpp>
 #include <cmbml/psm/udp/ports.hpp>
 #include <cmbml/message/submessage.hpp>
 
+#include <string.h>
+#include <sys/select.h>
+#include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
+#include <deque>
 #include <map>
+#include <memory>
 
 namespace cmbml {
 namespace udp {
@@ -16,6 +23,17 @@ namespace udp {
 // UDP Max fragment size
 #define CMBML__MAX_FRAGMENT_SIZE 65507
 
+// One message of a batched receive or send. recvmmsg and sendmmsg are Linux-only; elsewhere
+// the Context goes through a batch with a recvmsg or sendmsg per message.
+#ifdef __linux__
+using MessageHeader = struct mmsghdr;
+#else
+struct MessageHeader {
+  struct msghdr msg_hdr;
+  unsigned int msg_len;
+};
+#endif
+
 struct InfoReplyIp4 {
   BOOST_HANA_DEFINE_STRUCT(InfoReplyIp4,
     (MulticastFlag, multicast_flag),
@@ -91,66 +109,307 @@ public:
     {0x0, 0x2, 0x0, static_cast<uint8_t>(BuiltinEntity::reader_with_key)};
 
   Context();
+  ~Context();
+
+  Context(const Context &) = delete;
+  Context & operator=(const Context &) = delete;
 
   // Settings
   // This is pretty big...
   // using default_resend_data_period = Duration_t<30, 0>;
 
+  // Opens shards sockets per port for the receivers added afterwards, with SO_REUSEPORT,
+  // so that as many threads can receive on the port; see
+  // PinnedExecutor::add_sharded_receiver. The kernel spreads unicast datagrams over them
+  // by source address and port, or, with steer_by_guid_prefix, by the GUID prefix in the
+  // RTPS header, so that a remote participant's datagrams always reach the same socket.
+  // Multicast datagrams are copied to every socket, so multicast shards always keep only
+  // the GUID prefixes of their own shard. Linux only: elsewhere the kernel doesn't spread
+  // datagrams over the sockets, and a port keeps a single shard.
+  void set_receive_shards(size_t shards, bool steer_by_guid_prefix = false);
+
+  size_t receive_shard_count() const {
+    return receive_shards;
+  }
+
+  // A port of 0 binds an ephemeral port.
   void add_unicast_receiver(const Locator_t & locator);
   void add_multicast_receiver(const Locator_t & locator);
 
+  // packet holds size 32-bit words.
   void unicast_send(const Locator_t & locator, const uint32_t * packet, size_t size);
 
   void multicast_send(const Locator_t & locator, const uint32_t * packet, size_t size);
 
+  // The destination a locator resolves to, with its send statistics. It lives as long as
+  // the Context, so proxies keep it and send to it without resolving the locator again.
+  Destination & resolve(const Locator_t & locator) {
+    return destination_cache.resolve(locator);
+  }
+
+  void unicast_send(Destination & destination, const uint32_t * packet, size_t size);
+
+  void multicast_send(Destination & destination, const uint32_t * packet, size_t size);
+
+  // Every destination sent to so far.
+  const DestinationCache & destinations() const {
+    return destination_cache;
+  }
+
+  // A payload whose owner may be the Context for a while; see enable_zerocopy.
+  using SharedPacket = std::shared_ptr<const Packet<>>;
+
+  // Like unicast_send, but with zero-copy enabled a large enough packet is sent with
+  // MSG_ZEROCOPY: the kernel reads it from the caller's pages, and the Context keeps a
+  // reference until the completion is reaped. Inside a SendBatch, the datagrams queued so
+  // far are flushed first. DataWriter sends its DATA this way.
+  void unicast_send(const Locator_t & locator, const SharedPacket & packet);
+
+  void multicast_send(const Locator_t & locator, const SharedPacket & packet);
+
+  // Opts in to MSG_ZEROCOPY for shared packets of at least threshold_bytes. Pinning pages
+  // and reaping the completion cost more than copying a small packet. Returns false, and
+  // leaves zero-copy off, if the kernel lacks SO_ZEROCOPY (Linux 4.14, and never elsewhere).
+  bool enable_zerocopy(size_t threshold_bytes);
+
+  bool zerocopy_enabled() const {
+    return zerocopy_threshold != 0;
+  }
+
+  // Releases the packets of completed zero-copy sends and returns how many. Completions
+  // are queued on the error queue of the send sockets, which wakes poll and epoll for them;
+  // see EpollExecutor::add_zerocopy_reaper. Also called by a send once
+  // max_zerocopy_pending packets are waiting.
+  size_t reap_zerocopy_completions();
+
+  size_t zerocopy_pending() const;
+
+  // Zero-copy sends the kernel copied after all, e.g. to a loopback destination.
+  size_t zerocopy_copied() const {
+    return zerocopy_copied_sends;
+  }
+
+  List<int> send_sockets() const;
+
+  size_t max_zerocopy_pending = 1024;
+
+  // Sends packet as a train of datagrams of segment_size words each (the last may be shorter),
+  // e.g. the DATA_FRAG submessages of one sample. With UDP generic segmentation offload the
+  // kernel or the NIC splits one large send into the datagrams; otherwise each is sent on
+  // its own.
+  void unicast_send_segments(
+    const Locator_t & locator, const uint32_t * packet, size_t size, size_t segment_size);
+
+  void multicast_send_segments(
+    const Locator_t & locator, const uint32_t * packet, size_t size, size_t segment_size);
+
+  // Asks the kernel to coalesce the datagrams arriving on a socket (UDP_GRO). receive_from
+  // splits them up again, so callbacks still see one datagram per packet. Done for the
+  // receivers added to this Context when supported. Returns false if it isn't.
+  bool enable_gro(int recv_socket);
+
+  // While a SendBatch is alive, unicast_send and multicast_send copy the datagram into a
+  // queue instead of calling sendto. The queue goes to the kernel with one sendmmsg per
+  // socket when the outermost SendBatch ends, or once send_batch_size datagrams are queued,
+  // so a fan-out to many destinations, or many submessages, costs a single syscall.
+  class SendBatch {
+  public:
+    explicit SendBatch(Context & batch_context) : context(batch_context) {
+      ++context.send_batch_depth;
+    }
+    ~SendBatch() {
+      if (--context.send_batch_depth == 0) {
+        context.flush_sends();
+      }
+    }
+
+    SendBatch(const SendBatch &) = delete;
+    SendBatch & operator=(const SendBatch &) = delete;
+
+  private:
+    Context & context;
+  };
+
+  // Sends the queued datagrams now. Returns how many the kernel accepted.
+  size_t flush_sends();
+
+  // Blocks until at least one receive socket is readable, then reads what's waiting on
+  // each readable socket. Returns early after interrupt_receive.
   template<typename CallbackT>
   void receive_packet(CallbackT && callback, size_t packet_size = CMBML__MAX_FRAGMENT_SIZE)
   {
-    fd_set socket_set;
-    FD_ZERO(&socket_set);
-    int max_socket = 0;
-    for (const auto & port_socket_pair : port_socket_map) {
-      FD_SET(port_socket_pair.second, &socket_set);
-      if (port_socket_pair.second > max_socket) {
-        max_socket = port_socket_pair.second;
+    // select overwrites its argument, so copy the set built as the receivers were added.
+    fd_set socket_set = receive_socket_set;
+    int num_fds = select(max_receive_socket + 1, &socket_set, NULL, NULL, NULL);
+    if (num_fds <= 0) {
+      return;
+    }
+    if (interrupt_pipe[0] != -1 && FD_ISSET(interrupt_pipe[0], &socket_set)) {
+      clear_interrupt();
+    }
+    for (const auto & port_sockets_pair : port_socket_map) {
+      for (int recv_socket : port_sockets_pair.second) {
+        if (FD_ISSET(recv_socket, &socket_set)) {
+          // Drain the batch, so no packet waits in it for the socket to be readable again.
+          while (receive_from(recv_socket, callback, packet_size)) {
+          }
+        }
       }
     }
+  }
+
+  // Makes the receive_packet call blocked in another thread return, or the next call if none
+  // is blocked. Safe to call from any thread, e.g. by an executor that is shutting down.
+  void interrupt_receive();
+
+  // Passes one packet from a receive socket to callback, without blocking.
+  // Returns false if none was waiting. Packets are read receive_batch_size at a time with
+  // recvmmsg and handed out from the batch, so a busy socket costs one syscall per batch.
+  template<typename CallbackT>
+  bool receive_from(
+    int recv_socket, CallbackT && callback, size_t packet_size = CMBML__MAX_FRAGMENT_SIZE)
+  {
+    ReceiveBatch & batch = receive_batches[recv_socket];
+    if (batch.next == batch.count && fill_receive_batch(recv_socket, batch, packet_size) == 0) {
+      return false;
+    }
+    callback(*batch.ready[batch.next++]);
+    return true;
+  }
 
-    int num_fds = select(max_socket + 1, &socket_set, NULL, NULL, NULL);
-    for (const auto & port_socket_pair : port_socket_map) {
-      Packet<> packet(packet_size);
-      int recv_socket = port_socket_pair.second;
-      if (!FD_ISSET(recv_socket, &socket_set)) {
-        continue;
-      }
+  // Consecutive packets of a ReceiveBatch.
+  struct PacketBatch {
+    const Packet<> & operator[](size_t i) const {
+      return *packets[i];
+    }
+    size_t size() const {
+      return count;
+    }
+
+    const Packet<> * const * packets;
+    size_t count;
+  };
 
-      // TODO checking src is important error checking/security
-      // struct sockaddr_in src_address;
-      // 
-      ssize_t bytes_received = recvfrom(
-        recv_socket, packet.data(), packet.size() * sizeof(Packet<>::value_type), 0, NULL, NULL);
-      callback(packet);
+  // Like receive_from, but passes every packet of the batch to callback(const PacketBatch &)
+  // at once.
+  template<typename CallbackT>
+  bool receive_batch_from(
+    int recv_socket, CallbackT && callback, size_t packet_size = CMBML__MAX_FRAGMENT_SIZE)
+  {
+    ReceiveBatch & batch = receive_batches[recv_socket];
+    if (batch.next == batch.count && fill_receive_batch(recv_socket, batch, packet_size) == 0) {
+      return false;
     }
+    const PacketBatch packets = {&batch.ready[batch.next], batch.count - batch.next};
+    batch.next = batch.count;
+    callback(packets);
+    return true;
   }
 
-  IPAddress address_as_array() const;
+  // For event loops that wait on the sockets themselves.
+  List<int> receive_sockets() const;
+  // The receive sockets of one shard. Different shards may be read on different threads.
+  List<int> receive_sockets(size_t shard) const;
 
-private:
+  IPAddress address_as_array() const;
 
-  static void socket_send(
-    int socket, const Locator_t & locator, const uint32_t * packet, size_t size);
+  // Packets per recvmmsg, and datagrams per sendmmsg. Each receive socket keeps
+  // receive_batch_size buffers of the packet size.
+  size_t receive_batch_size = 16;
+  size_t send_batch_size = 64;
 
-  // Blocks until a packet is received.
-  // Intention is to wrap this in a future or async task in the executor.
+  // Whether segmented sends use UDP_SEGMENT; detected by the constructor, and cleared if the
+  // kernel refuses a segmented send. May be cleared to always send datagrams one by one.
+  bool gso_enabled = false;
 
-  uint32_t local_address;  // what's the best type?
+protected:
+  // Reads what interrupt_receive wrote, so the next receive_packet blocks again.
+  void clear_interrupt();
 
   int unicast_send_socket = -1;
   int multicast_send_socket = -1;
+  // interrupt_receive writes to the second end; receive_packet waits on the first as well.
+  int interrupt_pipe[2] = {-1, -1};
+
+private:
+  // Room for one UDP_GRO or UDP_SEGMENT control message.
+  struct ControlBuffer {
+    alignas(struct cmsghdr) uint8_t bytes[CMSG_SPACE(sizeof(int))];
+  };
+
+  // The packets of the last recvmmsg on one socket; buffers are reused by the next one.
+  struct ReceiveBatch {
+    List<Packet<>> buffers;
+    // Bytes kept in each buffer, so the rest of a reused buffer can be cleared.
+    List<size_t> used;
+    List<MessageHeader> headers;
+    List<struct iovec> vectors;
+    List<ControlBuffer> controls;
+    // Copies of the segments after the first of coalesced (GRO) buffers.
+    List<Packet<>> segments;
+    // The packets in the order received.
+    List<const Packet<> *> ready;
+    size_t count = 0;
+    size_t next = 0;
+  };
+
+  // MSG_ZEROCOPY sends are numbered per socket, in the order the kernel accepted them.
+  struct ZerocopySend {
+    uint32_t id;
+    SharedPacket packet;
+  };
 
-  std::map<uint16_t, int> port_socket_map;
+  struct ZerocopySocket {
+    uint32_t next_id = 0;
+    std::deque<ZerocopySend> pending;
+  };
+
+  struct QueuedSend {
+    int socket;
+    Destination * destination;
+    List<uint8_t> data;
+    // Bytes per datagram for a segmented send, or 0.
+    uint16_t segment_bytes;
+  };
+
+  // Returns the number of packets read.
+  size_t fill_receive_batch(int recv_socket, ReceiveBatch & batch, size_t packet_size);
+
+  // Opens and binds a socket per shard; joins the group if membership is given.
+  void add_receive_sockets(struct sockaddr_in bind_address, const struct ip_mreq * membership);
+
+  void socket_send(int socket, Destination & destination, const uint32_t * packet, size_t size);
+  void socket_send_shared(int socket, Destination & destination, const SharedPacket & packet);
+  void socket_send_segments(int socket, Destination & destination, const uint32_t * packet,
+    size_t size, size_t segment_size);
+  void send_now(int socket, Destination & destination, const void * data,
+    size_t bytes, uint16_t segment_bytes = 0);
+
+  uint32_t local_address;  // what's the best type?
 
-  // TODO: store and use allocator for Packets
+  // Per port, one socket per shard.
+  std::map<uint16_t, List<int>> port_socket_map;
+  size_t receive_shards = 1;
+  bool steer_receive_shards = false;
+  List<List<int>> shard_sockets;
+  fd_set receive_socket_set;
+  int max_receive_socket = -1;
+
+  std::map<int, ReceiveBatch> receive_batches;
+
+  DestinationCache destination_cache;
+
+  size_t send_batch_depth = 0;
+  // Entries past queued_sends are kept for their buffers.
+  List<QueuedSend> send_queue;
+  size_t queued_sends = 0;
+  List<MessageHeader> send_headers;
+  List<struct iovec> send_vectors;
+  List<ControlBuffer> send_controls;
+
+  size_t zerocopy_threshold = 0;
+  std::map<int, ZerocopySocket> zerocopy_sockets;
+  size_t zerocopy_copied_sends = 0;
 };
 
 }
@@ -0,0 +1,70 @@
+#ifndef CMBML__PSM__UDP__DESTINATION_CACHE_HPP_
+#define CMBML__PSM__UDP__DESTINATION_CACHE_HPP_
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <cstdint>
+#include <deque>
+
+#include <cmbml/types.hpp>
+#include <cmbml/utility/hash_index.hpp>
+
+namespace cmbml {
+namespace udp {
+
+// A locator resolved to the socket address sendto takes, with what has been sent to it.
+struct Destination {
+  Locator_t locator;
+  struct sockaddr_storage address;
+  socklen_t address_length;
+
+  uint64_t datagrams_sent = 0;
+  uint64_t bytes_sent = 0;
+  // Datagrams the kernel refused, e.g. an IPv6 destination on an IPv4 socket.
+  uint64_t send_errors = 0;
+
+  const struct sockaddr * sockaddr() const {
+    return reinterpret_cast<const struct sockaddr *>(&address);
+  }
+
+  void record_sent(size_t datagrams, size_t bytes) {
+    datagrams_sent += datagrams;
+    bytes_sent += bytes;
+  }
+};
+
+// Destinations by locator. A Destination stays where it is for the lifetime of the cache,
+// so a pointer to it is a handle: sending through one skips the lookup and the conversion.
+// LOCATOR_KIND_UDPv6 locators resolve to a sockaddr_in6; any other kind to a sockaddr_in
+// from the first four octets.
+class DestinationCache {
+public:
+  using const_iterator = std::deque<Destination>::const_iterator;
+
+  Destination & resolve(const Locator_t & locator);
+
+  // nullptr if the locator hasn't been resolved.
+  const Destination * find(const Locator_t & locator) const;
+
+  size_t size() const {
+    return destinations.size();
+  }
+
+  const_iterator begin() const {
+    return destinations.begin();
+  }
+
+  const_iterator end() const {
+    return destinations.end();
+  }
+
+private:
+  LocatorIndex<Destination *> index;
+  std::deque<Destination> destinations;
+};
+
+}
+}
+
+#endif  // CMBML__PSM__UDP__DESTINATION_CACHE_HPP_
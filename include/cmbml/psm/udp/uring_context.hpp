@@ -0,0 +1,200 @@
+#ifndef CMBML__PSM__UDP__URING_CONTEXT_HPP_
+#define CMBML__PSM__UDP__URING_CONTEXT_HPP_
+
+#include <linux/io_uring.h>
+
+#include <deque>
+
+#include <cmbml/psm/udp/context.hpp>
+
+namespace cmbml {
+namespace udp {
+
+struct UringOptions {
+  // Submission queue entries.
+  unsigned entries = 256;
+  // Receive buffers shared by all receive sockets; a power of two.
+  unsigned buffer_count = 64;
+  size_t buffer_bytes = CMBML__MAX_FRAGMENT_SIZE;
+  // A kernel thread polls the submission queue, so sends need no syscall while it's awake.
+  // It spins on a CPU for sqpoll_idle_ms after the last submission.
+  bool sqpoll = false;
+  unsigned sqpoll_idle_ms = 100;
+};
+
+// udp::Context on io_uring (Linux 6.0), for DataWriter and DataReader to take as their
+// Context. Each receive socket has one multishot receive that fills buffers taken from a
+// provided buffer ring, so packets arrive without a syscall each. Sends are SENDMSG
+// submissions: outside a SendBatch each one is submitted at once (with no syscall under
+// SQPOLL), inside one they are all submitted when it ends.
+// Completions signal an eventfd, the only entry of receive_sockets(), so event loops wait on
+// it and call receive_from until it returns false.
+// If the kernel can't do all of this, uring_enabled() is false and every call goes to
+// udp::Context.
+class UringContext : public Context {
+public:
+  explicit UringContext(const UringOptions & options = UringOptions());
+  ~UringContext();
+
+  UringContext(const UringContext &) = delete;
+  UringContext & operator=(const UringContext &) = delete;
+
+  bool uring_enabled() const {
+    return ring_fd != -1;
+  }
+
+  void add_unicast_receiver(const Locator_t & locator);
+  void add_multicast_receiver(const Locator_t & locator);
+
+  void unicast_send(const Locator_t & locator, const uint32_t * packet, size_t size);
+  void multicast_send(const Locator_t & locator, const uint32_t * packet, size_t size);
+  void unicast_send(Destination & destination, const uint32_t * packet, size_t size);
+  void multicast_send(Destination & destination, const uint32_t * packet, size_t size);
+
+  class SendBatch {
+  public:
+    explicit SendBatch(UringContext & batch_context) : context(batch_context) {
+      ++context.uring_batch_depth;
+    }
+    ~SendBatch() {
+      if (--context.uring_batch_depth == 0) {
+        context.flush_sends();
+      }
+    }
+
+    SendBatch(const SendBatch &) = delete;
+    SendBatch & operator=(const SendBatch &) = delete;
+
+  private:
+    UringContext & context;
+  };
+
+  // Submits the queued sends with one io_uring_enter. Returns how many were submitted.
+  size_t flush_sends();
+
+  // Packets are at most UringOptions::buffer_bytes long; packet_size only matters in the
+  // fallback.
+  template<typename CallbackT>
+  void receive_packet(CallbackT && callback, size_t packet_size = CMBML__MAX_FRAGMENT_SIZE)
+  {
+    if (!uring_enabled()) {
+      Context::receive_packet(callback, packet_size);
+      return;
+    }
+    wait_for_completion();
+    while (receive_from(event_fd, callback, packet_size)) {
+    }
+  }
+
+  // Passes the next received packet, from any receive socket, to callback.
+  template<typename CallbackT>
+  bool receive_from(
+    int recv_socket, CallbackT && callback, size_t packet_size = CMBML__MAX_FRAGMENT_SIZE)
+  {
+    if (!uring_enabled()) {
+      return Context::receive_from(recv_socket, callback, packet_size);
+    }
+    const Packet<> * packet = next_packet();
+    if (!packet) {
+      return false;
+    }
+    callback(*packet);
+    return true;
+  }
+
+  List<int> receive_sockets() const;
+
+private:
+  // What a completion is for, in the top byte of its user_data.
+  enum class Operation : uint8_t {
+    receive = 1,
+    send,
+    cancel,
+    interrupt
+  };
+
+  // A SENDMSG in flight, with everything the kernel reads.
+  // The destination's statistics are updated when the send completes.
+  struct SendSlot {
+    Destination * destination;
+    struct iovec vector;
+    struct msghdr message;
+    List<uint8_t> data;
+  };
+
+  struct ReceivedPacket {
+    uint16_t buffer_id;
+    size_t bytes;
+  };
+
+  bool setup_ring(const UringOptions & options);
+  bool setup_buffer_ring(const UringOptions & options);
+  bool probe_multishot_receive();
+  void teardown();
+
+  struct io_uring_sqe * get_sqe();
+  // Makes the new submissions visible and enters the kernel if it has to. Waits for a
+  // completion if wait is set.
+  int submit(bool wait = false);
+  void arm_receive(int recv_socket);
+  void arm_new_receivers();
+  // Polls the interrupt pipe, so that interrupt_receive ends wait_for_completion.
+  void arm_interrupt();
+  void uring_send(int socket, Destination & destination, const uint32_t * packet, size_t size);
+
+  // Handles the completions posted so far. Returns false if there were none.
+  bool reap_completions();
+  void wait_for_completion();
+  const Packet<> * next_packet();
+  void recycle_buffer(uint16_t buffer_id);
+
+  int ring_fd = -1;
+  int event_fd = -1;
+  bool sqpoll = false;
+
+  // Submission and completion rings, shared with the kernel.
+  void * sq_ring = nullptr;
+  size_t sq_ring_size = 0;
+  void * cq_ring = nullptr;
+  size_t cq_ring_size = 0;
+  struct io_uring_sqe * sqes = nullptr;
+  size_t sqes_size = 0;
+  unsigned * sq_head = nullptr;
+  unsigned * sq_tail = nullptr;
+  unsigned * sq_flags = nullptr;
+  unsigned * sq_array = nullptr;
+  unsigned sq_mask = 0;
+  unsigned sq_entries = 0;
+  unsigned * cq_head = nullptr;
+  unsigned * cq_tail = nullptr;
+  unsigned cq_mask = 0;
+  struct io_uring_cqe * cqes = nullptr;
+  // Our tail, ahead of *sq_tail by the entries not submitted yet.
+  unsigned sqe_tail = 0;
+
+  // Provided buffer ring: the receive buffers the kernel picks from.
+  struct io_uring_buf_ring * buffer_ring = nullptr;
+  size_t buffer_ring_size = 0;
+  unsigned buffer_mask = 0;
+  List<Packet<>> buffers;
+  // Bytes received into each buffer, so the rest of a reused buffer can be cleared.
+  List<size_t> buffer_used;
+  // The buffer whose packet the last receive_from passed out; given back to the kernel on
+  // the next call.
+  int lent_buffer = -1;
+
+  List<int> armed_sockets;
+  std::deque<ReceivedPacket> received;
+  bool interrupt_armed = false;
+  bool interrupted = false;
+
+  // A deque, as the kernel holds pointers into the slots.
+  std::deque<SendSlot> send_slots;
+  List<size_t> free_send_slots;
+  size_t uring_batch_depth = 0;
+};
+
+}
+}
+
+#endif  // CMBML__PSM__UDP__URING_CONTEXT_HPP_
@@ -0,0 +1,57 @@
+#ifndef CMBML__CHANGE_WINDOW__HPP_
+#define CMBML__CHANGE_WINDOW__HPP_
+
+#include <array>
+
+#include <cmbml/structure/history.hpp>
+#include <cmbml/types.hpp>
+
+namespace cmbml {
+
+  // Reception state of the changes of one remote writer (the ChangeFromWriter statuses of
+  // 8.4.10.4), without payloads.
+  // Every change below base is received or lost. The ChangeFromWriterStatus of the next
+  // `capacity` changes is stored in 2 bits each, in a circular bitmap starting at head:
+  //   00 unknown, 01 missing, 10 received, 11 lost
+  // so "available" (received or lost) is the high bit and queries run a word at a time.
+  class ChangeWindow {
+  public:
+    // Same span as the bitmap of a SequenceNumberSet.
+    static const size_t capacity = 256;
+
+    // Highest sequence number N such that every change <= N is received or lost.
+    uint64_t max_available() const {
+      return base - 1;
+    }
+
+    // Changes below the window are reported as received.
+    ChangeFromWriterStatus status(uint64_t seq) const;
+
+    void set_received(uint64_t seq);
+    // Unknown or missing changes below first_available become lost.
+    void update_lost(uint64_t first_available);
+    // Unknown changes up to and including last_available become missing.
+    void update_missing(uint64_t last_available);
+    List<SequenceNumber_t> missing() const;
+    bool has_missing() const;
+
+  private:
+    size_t ring_position(uint64_t seq) const {
+      return (head + (seq - base)) % capacity;
+    }
+
+    template<typename CallbackT>
+    void for_each_word(uint64_t first, uint64_t last, CallbackT && callback);
+
+    // Advance base past the available changes at the front of the window.
+    void slide();
+
+    uint64_t base = 1;
+    size_t head = 0;
+    uint64_t last_announced = 0;
+    std::array<uint64_t, capacity / 32> words = {{0}};
+  };
+
+}  // namespace cmbml
+
+#endif  // CMBML__CHANGE_WINDOW__HPP_
@@ -0,0 +1,60 @@
+#ifndef CMBML__FANOUT_PLAN__HPP_
+#define CMBML__FANOUT_PLAN__HPP_
+
+#include <algorithm>
+
+#include <cmbml/cdr/common.hpp>
+#include <cmbml/types.hpp>
+#include <cmbml/utility/destination_handles.hpp>
+#include <cmbml/utility/send_batch.hpp>
+
+namespace cmbml {
+
+  // The deduplicated destinations of a writer's matched readers.
+  // Readers in the same participant share unicast locators and many readers share a multicast
+  // group, so a message serialized once is sent to each unique destination exactly once.
+  struct FanoutPlan {
+    void add_unicast_locator(const Locator_t & locator) {
+      add_unique(unicast_locators, locator);
+    }
+
+    void add_multicast_locator(const Locator_t & locator) {
+      add_unique(multicast_locators, locator);
+    }
+
+    void clear() {
+      unicast_locators.clear();
+      multicast_locators.clear();
+      unicast_destinations.reset();
+      multicast_destinations.reset();
+    }
+
+    template<typename TransportContext>
+    void send(const Packet<> & packet, TransportContext & context) {
+      ScopedSendBatch<TransportContext> batch(context);
+      unicast_destinations.unicast_send(
+        context, unicast_locators, packet.data(), packet.size());
+      multicast_destinations.multicast_send(
+        context, multicast_locators, packet.data(), packet.size());
+    }
+
+    List<Locator_t> unicast_locators;
+    List<Locator_t> multicast_locators;
+
+  private:
+    void add_unique(List<Locator_t> & locators, const Locator_t & locator) {
+      if (std::find(locators.begin(), locators.end(), locator) == locators.end()) {
+        locators.push_back(locator);
+        // Resolved again by the next send.
+        unicast_destinations.reset();
+        multicast_destinations.reset();
+      }
+    }
+
+    DestinationHandles unicast_destinations;
+    DestinationHandles multicast_destinations;
+  };
+
+}  // namespace cmbml
+
+#endif  // CMBML__FANOUT_PLAN__HPP_
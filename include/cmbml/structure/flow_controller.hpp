@@ -0,0 +1,147 @@
+#ifndef CMBML__FLOW_CONTROLLER__HPP_
+#define CMBML__FLOW_CONTROLLER__HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+#include <cmbml/cdr/common.hpp>
+#include <cmbml/types.hpp>
+
+namespace cmbml {
+
+  using FlowClock = std::chrono::steady_clock;
+
+  // Refills at bytes_per_second up to burst_bytes. A datagram larger than the burst is let
+  // through once the bucket is full, leaving it in debt.
+  struct TokenBucket {
+    // A rate of 0 means unlimited.
+    explicit TokenBucket(
+      uint64_t bytes_per_second = 0, size_t burst_bytes = 64 * 1024,
+      FlowClock::time_point now = FlowClock::now());
+
+    bool unlimited() const {
+      return rate == 0;
+    }
+
+    bool can_consume(size_t bytes, FlowClock::time_point now);
+    void consume(size_t bytes);
+    // When can_consume(bytes) will hold, assuming nothing else is consumed.
+    FlowClock::time_point available_at(size_t bytes, FlowClock::time_point now);
+
+  private:
+    void refill(FlowClock::time_point now);
+
+    uint64_t rate;
+    double capacity;
+    double tokens;
+    FlowClock::time_point last_refill;
+  };
+
+  // Caps the bytes per second and the datagrams per period that may leave; 0 means no cap.
+  struct FlowLimits {
+    uint64_t bytes_per_second = 0;
+    size_t burst_bytes = 64 * 1024;
+    size_t max_datagrams_per_period = 0;
+    std::chrono::nanoseconds period = std::chrono::milliseconds(1);
+  };
+
+  class ParticipantFlowController;
+
+  // Sits between a writer and its transport: datagrams are queued with enqueue() and sent,
+  // in order, by flush() as the writer's limits and the participant's shared budget allow.
+  // The rest waits for a later flush(), at next_flush_time(), instead of overrunning the
+  // receivers' socket buffers.
+  // A writer enqueues and flushes on the thread that writes, and flushes again from a timer,
+  // so the controller locks; the writers of a participant share its lock.
+  class FlowController {
+  public:
+    using Transport = std::function<void(const Locator_t &, bool, const Packet<> &)>;
+
+    explicit FlowController(const FlowLimits & limits = FlowLimits(),
+      FlowClock::time_point now = FlowClock::now());
+    ~FlowController();
+
+    FlowController(const FlowController &) = delete;
+    FlowController & operator=(const FlowController &) = delete;
+
+    // Called with each datagram that is let through.
+    void set_transport(Transport && send) {
+      transport = std::move(send);
+    }
+
+    void enqueue(const Locator_t & locator, bool multicast, const Packet<> & packet);
+
+    // Sends the datagrams the budget allows; with a participant, all of the participant's
+    // writers take turns. Returns how many datagrams were sent.
+    size_t flush(FlowClock::time_point now = FlowClock::now());
+
+    // When a queued datagram may go, or time_point::max() if none is queued.
+    FlowClock::time_point next_flush_time(FlowClock::time_point now = FlowClock::now());
+
+    size_t queued() {
+      std::lock_guard<std::mutex> lock(flow_mutex());
+      return queue.size();
+    }
+
+  private:
+    friend class ParticipantFlowController;
+
+    std::mutex & flow_mutex();
+
+    struct QueuedDatagram {
+      Locator_t locator;
+      bool multicast;
+      Packet<> packet;
+    };
+
+    bool admits(size_t bytes, FlowClock::time_point now);
+    void account(size_t bytes);
+    // Sends the front datagram if this writer's limits allow it.
+    bool send_front(FlowClock::time_point now);
+    FlowClock::time_point own_flush_time(FlowClock::time_point now);
+
+    TokenBucket bucket;
+    size_t max_datagrams_per_period;
+    std::chrono::nanoseconds period;
+    FlowClock::time_point period_start;
+    size_t datagrams_in_period = 0;
+
+    std::deque<QueuedDatagram> queue;
+    Transport transport;
+    ParticipantFlowController * participant = nullptr;
+    std::mutex own_mutex;
+  };
+
+  // A budget shared by the writers of a participant. flush() serves the writers round-robin,
+  // one datagram each per turn, so one writer's burst can't starve the others.
+  class ParticipantFlowController {
+  public:
+    explicit ParticipantFlowController(const FlowLimits & limits = FlowLimits(),
+      FlowClock::time_point now = FlowClock::now());
+    ~ParticipantFlowController();
+
+    ParticipantFlowController(const ParticipantFlowController &) = delete;
+    ParticipantFlowController & operator=(const ParticipantFlowController &) = delete;
+
+    void attach(FlowController & writer);
+    void detach(FlowController & writer);
+
+    size_t flush(FlowClock::time_point now = FlowClock::now());
+    FlowClock::time_point next_flush_time(FlowClock::time_point now = FlowClock::now());
+
+  private:
+    friend class FlowController;
+
+    std::mutex mutex;
+    FlowController shared;
+    List<FlowController *> writers;
+    // Where the next round starts.
+    size_t next_writer = 0;
+  };
+
+}  // namespace cmbml
+
+#endif  // CMBML__FLOW_CONTROLLER__HPP_
@@ -14,9 +14,14 @@ namespace cmbml {
 
   struct Data;
   struct CacheChange {
+    CacheChange() = default;
     explicit CacheChange(const Data & data);
+    // Takes the payload instead of copying it.
+    explicit CacheChange(Data && data);
     CacheChange(const CacheChange &) = default;
     CacheChange(CacheChange &&) = default;
+    CacheChange & operator=(const CacheChange &) = default;
+    CacheChange & operator=(CacheChange &&) = default;
     CacheChange(ChangeKind_t k, Data && data, InstanceHandle_t && handle, const GUID_t & writer_guid);
     CacheChange(ChangeKind_t k, InstanceHandle_t && handle, const GUID_t & writer_guid);
     ChangeKind_t kind;
@@ -50,7 +55,7 @@ namespace cmbml {
 
     template<typename CallbackT,
       typename std::enable_if<
-        std::is_same<typename std::result_of<CallbackT>::type, bool>::value>::type * = nullptr>
+        std::is_same<typename std::result_of<CallbackT(const CacheChange &)>::type, bool>::value>::type * = nullptr>
     List<CacheChange> get_filtered_cache_changes(CallbackT & callback) const {
       List<CacheChange> ret;
       for (const auto & pair : changes) {
@@ -66,10 +71,15 @@ namespace cmbml {
     bool contains_change(uint64_t seq_num) const;
     const SequenceNumber_t & get_min_sequence_number() const;
     const SequenceNumber_t & get_max_sequence_number() const;
+
+    size_t size() const {
+      return changes.size();
+    }
   private:
     std::map<uint64_t, CacheChange> changes;
     SequenceNumber_t min_seq = {INT32_MAX, INT32_MAX};
-    SequenceNumber_t max_seq = {INT32_MIN, 0};
+    // Sequence numbers start at 1; value() of a negative high word would outrank them all.
+    SequenceNumber_t max_seq = {0, 0};
   };
 
   // TODO Again, I think inheritance is too expensive here and composition should be used instead!
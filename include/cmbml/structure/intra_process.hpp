@@ -0,0 +1,71 @@
+#ifndef CMBML__INTRA_PROCESS__HPP_
+#define CMBML__INTRA_PROCESS__HPP_
+
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include <cmbml/structure/history.hpp>
+#include <cmbml/types.hpp>
+
+namespace cmbml {
+
+  // A reader of this process that writers hand their changes to directly, without
+  // serializing them or going through a transport.
+  class LocalReader {
+  public:
+    using DeliverT = std::function<void(CacheChange &&)>;
+
+    LocalReader(const GUID_t & reader_guid, const List<Locator_t> & unicast_locators,
+      DeliverT && deliver_change);
+
+    // Hands change to the reader, unless it has been removed from the registry; change is
+    // left untouched then. Calls into one reader are serialized.
+    bool deliver(CacheChange && change);
+
+    // Held by the reader whenever it touches its state from another thread than the local
+    // writers': to handle messages from the network, on its timers and in read and take.
+    std::unique_lock<std::recursive_mutex> lock_delivery() {
+      return std::unique_lock<std::recursive_mutex>(mutex);
+    }
+
+    const GUID_t guid;
+    const List<Locator_t> unicast_locator_list;
+
+  private:
+    friend class IntraProcessRegistry;
+    void detach();
+
+    std::recursive_mutex mutex;
+    DeliverT deliver_change;
+  };
+
+  // The readers of this process that writers may deliver to directly. Writers look up their
+  // matched readers here when they are added (StatefulWriter by GUID, StatelessWriter by
+  // locator), so a reader must be added before it is matched; readers matched earlier are
+  // sent to over the network.
+  class IntraProcessRegistry {
+  public:
+    static IntraProcessRegistry & instance();
+
+    std::shared_ptr<LocalReader> add_reader(const GUID_t & guid,
+      const List<Locator_t> & unicast_locators, LocalReader::DeliverT deliver);
+
+    // Writers that matched the reader drop the changes they still hand to it.
+    void remove_reader(const GUID_t & guid);
+
+    std::shared_ptr<LocalReader> find_reader(const GUID_t & guid) const;
+
+    // The readers listening on a unicast locator. Every reader on the locator has to be
+    // added for a StatelessWriter to skip sending to it.
+    List<std::shared_ptr<LocalReader>> find_readers(const Locator_t & locator) const;
+
+  private:
+    mutable std::mutex mutex;
+    // Matching is rare, so a linear search will do.
+    List<std::shared_ptr<LocalReader>> readers;
+  };
+
+}  // namespace cmbml
+
+#endif  // CMBML__INTRA_PROCESS__HPP_
@@ -0,0 +1,153 @@
+#ifndef CMBML__NACK_AGGREGATOR__HPP_
+#define CMBML__NACK_AGGREGATOR__HPP_
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <utility>
+
+#include <cmbml/types.hpp>
+
+namespace cmbml {
+
+  // A change to repair once the NACK response window closes.
+  template<typename RequesterT>
+  struct RepairRequest {
+    SequenceNumber_t sequence_number;
+    // Every reader that asked for this change during the window.
+    List<RequesterT> requesters;
+    bool use_multicast = false;
+  };
+
+  // Collects the ACKNACKs arriving within nack_response_delay of the first one, so that a
+  // change requested by many readers is repaired once instead of once per reader.
+  // RequesterT identifies the remote reader: GUID_t for the StatefulWriter, the unicast
+  // reply Locator_t for the StatelessWriter.
+  template<typename RequesterT>
+  class NackAggregator {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    // Returns true if this request opened a new response window.
+    bool add_request(
+        const RequesterT & requester, const List<SequenceNumber_t> & requested_seq_nums,
+        const Duration_t & response_delay, Clock::time_point now = Clock::now())
+    {
+      if (requested_seq_nums.empty()) {
+        return false;
+      }
+      bool opened = false;
+      if (!window_open) {
+        window_open = true;
+        window_deadline = now + response_delay.to_ns();
+        opened = true;
+      }
+      for (const auto & seq : requested_seq_nums) {
+        List<RequesterT> & requesters = pending[seq.value()];
+        if (std::find(requesters.begin(), requesters.end(), requester) == requesters.end()) {
+          requesters.push_back(requester);
+        }
+      }
+      return opened;
+    }
+
+    bool has_pending() const {
+      return window_open;
+    }
+
+    bool response_due(Clock::time_point now = Clock::now()) const {
+      return window_open && now >= window_deadline;
+    }
+
+    const Clock::time_point & deadline() const {
+      return window_deadline;
+    }
+
+    // Close the window and return the union of the requested changes in sequence order.
+    // A reader's request is dropped if the change was repaired within suppression_duration
+    // by multicast, or by unicast to that reader; a change left without requesters is
+    // dropped.
+    List<RepairRequest<RequesterT>> collect_repairs(
+        const Duration_t & suppression_duration, size_t multicast_threshold,
+        Clock::time_point now = Clock::now())
+    {
+      forget_repairs_before(now - suppression_duration.to_ns());
+
+      List<RepairRequest<RequesterT>> ret;
+      ret.reserve(pending.size());
+      for (auto & pair : pending) {
+        RepairedChange & repaired = last_repaired[pair.first];
+        List<RequesterT> & requesters = pair.second;
+        requesters.erase(std::remove_if(requesters.begin(), requesters.end(),
+          [&repaired](const RequesterT & requester) { return repaired.covers(requester); }),
+          requesters.end());
+        if (requesters.empty()) {
+          continue;
+        }
+        RepairRequest<RequesterT> repair;
+        repair.sequence_number = SequenceNumber_t::from_value(pair.first);
+        repair.use_multicast = requesters.size() > multicast_threshold;
+        if (repair.use_multicast) {
+          repaired.multicast = true;
+          repaired.multicast_time = now;
+        } else {
+          for (const auto & requester : requesters) {
+            repaired.unicast.emplace_back(requester, now);
+          }
+        }
+        repair.requesters = std::move(requesters);
+        ret.push_back(std::move(repair));
+      }
+      pending.clear();
+      window_open = false;
+      return ret;
+    }
+
+  private:
+    // The repairs of one change that are still within the suppression window.
+    struct RepairedChange {
+      bool covers(const RequesterT & requester) const {
+        return multicast || std::any_of(unicast.begin(), unicast.end(),
+          [&requester](const std::pair<RequesterT, Clock::time_point> & repaired) {
+            return repaired.first == requester;
+          });
+      }
+
+      bool empty() const {
+        return !multicast && unicast.empty();
+      }
+
+      // A multicast repair reached every reader.
+      bool multicast = false;
+      Clock::time_point multicast_time;
+      List<std::pair<RequesterT, Clock::time_point>> unicast;
+    };
+
+    void forget_repairs_before(Clock::time_point oldest) {
+      for (auto it = last_repaired.begin(); it != last_repaired.end(); ) {
+        RepairedChange & repaired = it->second;
+        if (repaired.multicast && repaired.multicast_time <= oldest) {
+          repaired.multicast = false;
+        }
+        repaired.unicast.erase(std::remove_if(repaired.unicast.begin(), repaired.unicast.end(),
+          [oldest](const std::pair<RequesterT, Clock::time_point> & entry) {
+            return entry.second <= oldest;
+          }), repaired.unicast.end());
+        if (repaired.empty()) {
+          it = last_repaired.erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+
+    // sequence number -> readers requesting it
+    std::map<uint64_t, List<RequesterT>> pending;
+    std::map<uint64_t, RepairedChange> last_repaired;
+    Clock::time_point window_deadline;
+    bool window_open = false;
+  };
+
+}  // namespace cmbml
+
+#endif  // CMBML__NACK_AGGREGATOR__HPP_
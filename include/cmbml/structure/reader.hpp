@@ -1,13 +1,19 @@
 #ifndef CMBML__READER__HPP_
 #define CMBML__READER__HPP_
 
+#include <cmbml/structure/change_window.hpp>
 #include <cmbml/structure/history.hpp>
+#include <cmbml/structure/reorder_buffer.hpp>
 #include <cmbml/message/data.hpp>
 #include <cmbml/psm/udp/context.hpp>
 #include <cmbml/cdr/serialize_anything.hpp>
+#include <cmbml/utility/destination_handles.hpp>
+#include <cmbml/utility/hash_index.hpp>
 
+#include <algorithm>
 #include <cassert>
-#include <map>
+#include <chrono>
+#include <functional>
 
 namespace cmbml {
   // Forward declarations of state machine types
@@ -28,41 +34,117 @@ namespace cmbml {
       unicast_locator_list(unicast_locators),
       multicast_locator_list(multicast_locators) {}
 
-    const SequenceNumber_t & max_available_changes();
+    SequenceNumber_t max_available_changes() const;
     void set_irrelevant_change(const SequenceNumber_t & seq_num);
-    void set_irrelevant_change(const int64_t seq_num);
+    void set_irrelevant_change(const uint64_t seq_num);
     void update_lost_changes(const SequenceNumber_t & first_available_seq_num);
     void update_missing_changes(const SequenceNumber_t & last_available_seq_num);
     void set_received_change(const SequenceNumber_t & seq_num);
-    const List<ChangeFromWriter> & missing_changes();
-    const GUID_t & get_guid();
+    List<SequenceNumber_t> missing_changes() const;
+    bool has_missing_changes() const;
+    const GUID_t & get_guid() const;
+
+    // ACKNACK scheduling (8.4.12.2): the first HEARTBEAT that requires a response arms a
+    // one-shot timer of heartbeat_response_delay. HEARTBEATs that arrive while the timer is
+    // armed, or within heartbeat_suppression_duration of the last ACKNACK, add nothing.
+    using Clock = std::chrono::steady_clock;
+    // Returns true if this call armed the timer.
+    bool schedule_acknack(Clock::time_point now = Clock::now());
+    bool acknack_due(Clock::time_point now = Clock::now()) const;
+    bool acknack_scheduled() const {
+      return acknack_armed;
+    }
+    const Clock::time_point & acknack_deadline() const {
+      return acknack_due_time;
+    }
+    // Build the ACKNACK for the current state of the proxy and disarm the timer.
+    AckNack make_acknack(const EntityId_t & reader_id, Clock::time_point now = Clock::now());
+
+    std::chrono::nanoseconds heartbeat_response_delay = std::chrono::milliseconds(500);
+    std::chrono::nanoseconds heartbeat_suppression_duration = std::chrono::nanoseconds(0);
+
+    // In-order delivery for reliable readers: each call passes every change that is now in
+    // sequence order to deliver(CacheChange &&), holding back those that arrived early.
+    template<typename DeliverT>
+    void deliver_change(CacheChange && change, DeliverT && deliver) {
+      set_received_change(change.sequence_number);
+      reorder_buffer.add_change(std::move(change), ReorderBuffer::Clock::now(), deliver);
+      release_expired_changes(deliver);
+    }
+
+    template<typename DeliverT>
+    void deliver_irrelevant_change(const SequenceNumber_t & seq_num, DeliverT && deliver) {
+      set_irrelevant_change(seq_num);
+      reorder_buffer.skip_change(seq_num.value(), deliver);
+    }
+
+    // Every change in [first, end) is irrelevant (a GAP range, 8.3.7.4.5). Once the changes
+    // before the rest of the range are available, it is closed at once like lost changes,
+    // so a range of any length takes at most a window's worth of steps.
+    template<typename DeliverT>
+    void deliver_irrelevant_changes(uint64_t first, uint64_t end, DeliverT && deliver) {
+      uint64_t seq = first;
+      for (; seq < end && seq > changes_from_writer.max_available() + 1; ++seq) {
+        deliver_irrelevant_change(SequenceNumber_t::from_value(seq), deliver);
+      }
+      if (seq < end) {
+        deliver_lost_changes(SequenceNumber_t::from_value(end), deliver);
+      }
+    }
+
+    template<typename DeliverT>
+    void deliver_lost_changes(const SequenceNumber_t & first_available_seq_num, DeliverT && deliver)
+    {
+      update_lost_changes(first_available_seq_num);
+      reorder_buffer.skip_below(first_available_seq_num.value(), deliver);
+    }
+
+    // Stop waiting for holes in front of changes held longer than reorder_max_hold.
+    template<typename DeliverT>
+    void release_expired_changes(DeliverT && deliver) {
+      reorder_buffer.release_expired(ReorderBuffer::Clock::now(), reorder_max_hold, deliver);
+    }
+
+    std::chrono::nanoseconds reorder_max_hold = std::chrono::milliseconds(100);
 
     // who provides the Context?
+    // acknack comes from make_acknack, which already counted it.
     template<typename TransportContext = cmbml::udp::Context>
     void send(AckNack && acknack, TransportContext & context) {
       // TODO Need to wrap with a SubmessageHeader and Message...
-      acknack.count = ++acknack_count;
       size_t packet_size = get_packet_size(acknack);
       Packet<> packet(packet_size);
 
       // AckNack is variable length so we need to "dynamically" allocate the packet
       serialize(acknack, packet);
-      // needs to know which destination to send to (pass a Locator?)
-      // XXX This is dubious.
-      for (const auto & locator : unicast_locator_list) {
-        context.unicast_send(locator, packet.data(), packet.size());
-      }
-      for (const auto & locator : multicast_locator_list) {
-        context.multicast_send(locator, packet.data(), packet.size());
+      send(packet, context);
+    }
+
+    // Replies go to the writer's unicast locators, or to its multicast locators if it has
+    // none.
+    template<typename TransportContext = cmbml::udp::Context>
+    void send(const Packet<> & packet, TransportContext & context) {
+      if (!unicast_locator_list.empty()) {
+        unicast_destinations.unicast_send(
+          context, unicast_locator_list, packet.data(), packet.size());
+        return;
       }
+      multicast_destinations.multicast_send(
+        context, multicast_locator_list, packet.data(), packet.size());
     }
 
   private:
     GUID_t remote_writer_guid;
     List<Locator_t> unicast_locator_list;
     List<Locator_t> multicast_locator_list;
-    std::map<uint64_t, ChangeFromWriter> changes_from_writer;
+    DestinationHandles unicast_destinations;
+    DestinationHandles multicast_destinations;
+    ChangeWindow changes_from_writer;
+    ReorderBuffer reorder_buffer;
     uint32_t acknack_count = 0;
+    bool acknack_armed = false;
+    Clock::time_point acknack_due_time;
+    Clock::time_point last_acknack_time;
   };
 
 
@@ -80,7 +162,26 @@ namespace cmbml {
     Reader() {
     }
 
+    // Every change the reader accepts goes through here, in order for reliable readers.
+    void deliver(CacheChange && change) {
+      if (on_data_available) {
+        on_data_available(change);
+      }
+      if (keep_in_history) {
+        reader_cache.add_change(std::move(change));
+      }
+    }
+
+    // A change handed over by a writer of this process (see IntraProcessRegistry).
+    void deliver_local(CacheChange && change) {
+      deliver(std::move(change));
+    }
+
     HistoryCache reader_cache;
+    // Optional listener, called on the receive thread with each change before it is added to
+    // reader_cache. Without keep_in_history the change is handed to the listener only.
+    std::function<void(const CacheChange &)> on_data_available;
+    bool keep_in_history = true;
     static const bool stateful = Stateful;
     static const bool expects_inline_qos = expectsInlineQos;
 
@@ -88,6 +189,8 @@ namespace cmbml {
     using StateMachineT = BestEffortStatelessReaderMsm<Reader>;
     Duration_t heartbeat_response_delay = {0, 500*1000*1000};
     Duration_t heartbeat_suppression_duration = {0, 0};
+    // How long a reliable reader holds a change back waiting for an earlier missing one.
+    Duration_t reorder_max_hold_duration = {0, 100*1000*1000};
   };
 
   template<bool expectsInlineQos, typename EndpointParams>
@@ -96,28 +199,112 @@ namespace cmbml {
     }
 
     void add_matched_writer(WriterProxy && writer_proxy) {
-      matched_writers.insert(std::make_pair(writer_proxy.get_guid(), std::move(writer_proxy)));
+      size_t * position = matched_writer_index.find(writer_proxy.get_guid());
+      if (position) {
+        matched_writers[*position] = std::move(writer_proxy);
+        return;
+      }
+      matched_writer_index.insert(writer_proxy.get_guid(), matched_writers.size());
+      matched_writers.push_back(std::move(writer_proxy));
     }
     // Why not remove by GUID?
     void remove_matched_writer(WriterProxy * writer_proxy) {
       assert(writer_proxy);
-      matched_writers.erase(writer_proxy->get_guid());
+      const GUID_t writer_guid = writer_proxy->get_guid();
+      size_t * position = matched_writer_index.find(writer_guid);
+      if (!position) {
+        return;
+      }
+      // Swap with the last entry and pop, keeping the index in sync.
+      const size_t removed = *position;
+      matched_writer_index.erase(writer_guid);
+      if (removed != matched_writers.size() - 1) {
+        matched_writers[removed] = std::move(matched_writers.back());
+        matched_writer_index.insert(matched_writers[removed].get_guid(), removed);
+      }
+      matched_writers.pop_back();
     }
 
     WriterProxy * matched_writer_lookup(const GUID_t & writer_guid) {
-      if (!matched_writers.count(writer_guid)) {
+      size_t * position = matched_writer_index.find(writer_guid);
+      if (!position) {
         return nullptr;
       }
-      return &matched_writers.at(writer_guid);
+      return &matched_writers[*position];
     }
 
-    HistoryCache reader_cache;
+    // A change handed over by a writer of this process (see IntraProcessRegistry), in the
+    // same order as a DATA from that writer: reliable readers deliver through its WriterProxy.
+    void deliver_local(CacheChange && change) {
+      WriterProxy * proxy = matched_writer_lookup(change.writer_guid);
+      if (!proxy) {
+        return;
+      }
+      if (StatelessReader::reliability_level == ReliabilityKind_t::reliable) {
+        proxy->deliver_change(std::move(change),
+          [this](CacheChange && in_order) { this->deliver(std::move(in_order)); });
+        return;
+      }
+      const SequenceNumber_t expected_seq_num = proxy->max_available_changes() + 1;
+      if (change.sequence_number >= expected_seq_num) {
+        proxy->set_received_change(change.sequence_number);
+        if (change.sequence_number > expected_seq_num) {
+          proxy->update_lost_changes(change.sequence_number);
+        }
+        this->deliver(std::move(change));
+      }
+    }
+
+    bool acknacks_due(WriterProxy::Clock::time_point now = WriterProxy::Clock::now()) const {
+      return std::any_of(matched_writers.begin(), matched_writers.end(),
+        [now](const WriterProxy & writer) { return writer.acknack_due(now); });
+    }
+
+    // Send the ACKNACKs whose timers expired. The ACKNACKs for all the writers of one remote
+    // participant go out in one datagram, to that participant's locators.
+    template<typename TransportContext = cmbml::udp::Context>
+    void send_due_acknacks(
+      TransportContext & context, WriterProxy::Clock::time_point now = WriterProxy::Clock::now())
+    {
+      List<WriterProxy *> due;
+      for (auto & writer : matched_writers) {
+        if (writer.acknack_due(now)) {
+          due.push_back(&writer);
+        }
+      }
+      std::sort(due.begin(), due.end(), [](const WriterProxy * a, const WriterProxy * b) {
+        return a->get_guid().prefix < b->get_guid().prefix;
+      });
+
+      auto group_begin = due.begin();
+      while (group_begin != due.end()) {
+        const GuidPrefix_t & prefix = (*group_begin)->get_guid().prefix;
+        auto group_end = std::find_if(group_begin, due.end(), [&prefix](const WriterProxy * w) {
+          return w->get_guid().prefix != prefix;
+        });
+
+        List<AckNack> acknacks;
+        size_t packet_size = 0;
+        for (auto it = group_begin; it != group_end; ++it) {
+          acknacks.push_back((*it)->make_acknack(this->guid.entity_id, now));
+          packet_size += get_packet_size(acknacks.back());
+        }
+        Packet<> packet(packet_size);
+        size_t index = 0;
+        for (const auto & acknack : acknacks) {
+          serialize(acknack, packet, index);
+        }
+        (*group_begin)->send(packet, context);
+        group_begin = group_end;
+      }
+    }
 
     using StateMachineT = typename std::conditional<
       StatelessReader::reliability_level == ReliabilityKind_t::best_effort,
       BestEffortStatefulReaderMsm<StatelessReader>, ReliableStatefulReaderMsm<StatelessReader>>::type;
   private:
-    std::map<GUID_t, WriterProxy, GUIDCompare> matched_writers;
+    List<WriterProxy> matched_writers;
+    GuidIndex<size_t> matched_writer_index;
   };
 
   template<bool expectsInlineQos, typename... Params>
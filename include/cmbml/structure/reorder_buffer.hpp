@@ -0,0 +1,183 @@
+#ifndef CMBML__REORDER_BUFFER__HPP_
+#define CMBML__REORDER_BUFFER__HPP_
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+
+#include <cmbml/structure/change_window.hpp>
+#include <cmbml/structure/history.hpp>
+
+namespace cmbml {
+
+  // Holds the changes of one remote writer that arrive ahead of a hole, so a reliable reader
+  // hands them to its HistoryCache in sequence order. A hole is closed by the missing DATA,
+  // by a GAP, by the writer no longer having the change, or by giving up on it once the
+  // change behind it has been held for longer than the maximum hold time.
+  // Every change is stored and released at most once, so delivery is O(1) amortized.
+  // Changes are passed on through a deliver(CacheChange &&) callback.
+  class ReorderBuffer {
+  public:
+    using Clock = std::chrono::steady_clock;
+    static const size_t capacity = ChangeWindow::capacity;
+
+    // Next sequence number to be delivered.
+    uint64_t next_expected() const {
+      return next;
+    }
+
+    // Number of changes held back.
+    size_t size() const {
+      return held_count;
+    }
+
+    // Returns false if the change was already delivered, held or skipped.
+    template<typename DeliverT>
+    bool add_change(CacheChange && change, Clock::time_point now, DeliverT && deliver) {
+      const uint64_t seq = change.sequence_number.value();
+      if (seq < next) {
+        return false;
+      }
+      if (seq >= next + capacity) {
+        // Out of room: give up on the oldest holes, as the WriterProxy window does.
+        skip_below(seq - capacity + 1, deliver);
+      }
+      if (seq == next) {
+        // In order: nothing to hold.
+        deliver(std::move(change));
+        ++next;
+        drain(deliver);
+        return true;
+      }
+      Slot & slot = slot_for(seq);
+      if (slot.state != SlotState::empty) {
+        return false;
+      }
+      slot.state = SlotState::held;
+      slot.change = std::move(change);
+      slot.arrival = now;
+      ++held_count;
+      return true;
+    }
+
+    // The change will never be delivered (GAP or irrelevant).
+    template<typename DeliverT>
+    void skip_change(uint64_t seq, DeliverT && deliver) {
+      if (seq < next || seq >= next + capacity) {
+        return;
+      }
+      if (seq == next) {
+        ++next;
+        drain(deliver);
+        return;
+      }
+      Slot & slot = slot_for(seq);
+      if (slot.state == SlotState::empty) {
+        slot.state = SlotState::skipped;
+      }
+    }
+
+    // Changes below seq will never be delivered (lost); held changes below it are released.
+    template<typename DeliverT>
+    void skip_below(uint64_t seq, DeliverT && deliver) {
+      while (next < seq) {
+        if (held_count == 0) {
+          clear_slots(next, std::min<uint64_t>(seq, next + capacity));
+          next = seq;
+          break;
+        }
+        release_next(deliver);
+      }
+      drain(deliver);
+    }
+
+    // Give up on the holes in front of changes held for at least max_hold.
+    template<typename DeliverT>
+    void release_expired(
+      Clock::time_point now, const std::chrono::nanoseconds & max_hold, DeliverT && deliver)
+    {
+      // Walk forward from next. Each hole is skipped if the change held right behind it has
+      // waited too long; the first hole whose change is still fresh stops the walk.
+      const uint64_t end = next + capacity;
+      uint64_t hole_start = end;
+      size_t held_seen = 0;
+      for (uint64_t seq = next; seq < end && held_seen < held_count; ++seq) {
+        Slot & slot = slots[seq % capacity];
+        if (slot.state == SlotState::empty) {
+          if (hole_start == end) {
+            hole_start = seq;
+          }
+          continue;
+        }
+        if (slot.state == SlotState::held) {
+          ++held_seen;
+          if (hole_start != end) {
+            if (now - slot.arrival < max_hold) {
+              break;
+            }
+            for (uint64_t i = hole_start; i < seq; ++i) {
+              slots[i % capacity].state = SlotState::skipped;
+            }
+          }
+        }
+        hole_start = end;
+      }
+      drain(deliver);
+    }
+
+  private:
+    enum class SlotState {
+      empty, held, skipped
+    };
+
+    struct Slot {
+      SlotState state = SlotState::empty;
+      CacheChange change;
+      Clock::time_point arrival;
+    };
+
+    Slot & slot_for(uint64_t seq) {
+      if (slots.empty()) {
+        slots.resize(capacity);
+      }
+      assert(seq >= next && seq < next + capacity);
+      return slots[seq % capacity];
+    }
+
+    void clear_slots(uint64_t first, uint64_t last) {
+      if (slots.empty()) {
+        return;
+      }
+      for (uint64_t i = first; i < last; ++i) {
+        slots[i % capacity].state = SlotState::empty;
+      }
+    }
+
+    template<typename DeliverT>
+    void release_next(DeliverT && deliver) {
+      Slot & slot = slots[next % capacity];
+      if (slot.state == SlotState::held) {
+        --held_count;
+        deliver(std::move(slot.change));
+      }
+      slot.state = SlotState::empty;
+      ++next;
+    }
+
+    // Release the run of held or skipped changes starting at next.
+    template<typename DeliverT>
+    void drain(DeliverT && deliver) {
+      while (!slots.empty() && slots[next % capacity].state != SlotState::empty) {
+        release_next(deliver);
+      }
+    }
+
+    // Ring of capacity slots indexed by sequence number, allocated on first use.
+    List<Slot> slots;
+    uint64_t next = 1;
+    size_t held_count = 0;
+  };
+
+}  // namespace cmbml
+
+#endif  // CMBML__REORDER_BUFFER__HPP_
@@ -4,11 +4,18 @@
 #include <cassert>
 #include <algorithm>
 #include <deque>
+#include <memory>
 
 #include <cmbml/cdr/serialize_anything.hpp>
 #include <cmbml/message/data.hpp>
 #include <cmbml/psm/udp/context.hpp>
+#include <cmbml/structure/fanout_plan.hpp>
 #include <cmbml/structure/history.hpp>
+#include <cmbml/structure/intra_process.hpp>
+#include <cmbml/structure/nack_aggregator.hpp>
+#include <cmbml/utility/destination_handles.hpp>
+#include <cmbml/utility/hash_index.hpp>
+#include <cmbml/utility/shared_packet.hpp>
 
 namespace cmbml {
   // Forward declarations of state machine types.
@@ -31,6 +38,12 @@ namespace cmbml {
     // I believe it is most convenient if next_unsent_change has pop semantics:
     // (removes the change from the unsent_changes list and moves it out of the function.)
     CacheChange pop_next_unsent_change();
+    // Marks the next unsent change sent without copying it out of the cache.
+    void skip_next_unsent_change();
+    bool has_unsent_changes() const;
+    uint64_t next_unsent_seq_num() const {
+      return highest_seq_num_sent.value() + 1;
+    }
 
     void set_requested_changes(const List<SequenceNumber_t> & request_seq_numbers);
 
@@ -67,17 +80,27 @@ namespace cmbml {
     template<typename TransportContext = udp::Context>
     void send(Packet<> & packet, TransportContext & context) {
       // TODO Implement glomming-on of packets during send and wrapping in Message.
-      context.unicast_send(locator, packet.data(), packet.size());
+      destination.unicast_send(context, locator, packet.data(), packet.size());
     }
 
     bool locator_compare(const Locator_t & loc);
     void reset_unsent_changes();
 
+    // Hands change to each reader of this process behind the locator instead of sending it.
+    void deliver_local(CacheChange && change);
+
+    const Locator_t & get_locator() const {
+      return locator;
+    }
+
     // TODO see below note in ReaderProxy about compile-time behavior here
     bool expects_inline_qos;
+    // Set when the writer adds the locator, if readers of this process listen on it.
+    List<std::shared_ptr<LocalReader>> local_readers;
 
   private:
     Locator_t locator;
+    DestinationHandles destination;
   };
 
 
@@ -99,6 +122,12 @@ namespace cmbml {
 
     ChangeForReader pop_next_requested_change();
     ChangeForReader pop_next_unsent_change();
+    bool has_unsent_changes() const {
+      return cache_accessor.has_unsent_changes();
+    }
+    uint64_t next_unsent_seq_num() const {
+      return cache_accessor.next_unsent_seq_num();
+    }
     void set_requested_changes(List<SequenceNumber_t> & request_seq_numbers);
     void add_change_for_reader(ChangeForReader && change);
 
@@ -109,22 +138,39 @@ namespace cmbml {
       Packet<> packet(packet_size);
       serialize(msg, packet);
 
-      for (const auto & locator : unicast_locator_list) {
-        context.unicast_send(locator, packet.data(), packet.size());
-      }
-      for (const auto & locator : multicast_locator_list) {
-        context.multicast_send(locator, packet.data(), packet.size());
-      }
+      unicast_send(packet, context);
+      multicast_send(packet, context);
+    }
+
+    // Through the Destinations the locator lists resolved to on the first send.
+    template<typename TransportContext = udp::Context>
+    void unicast_send(const Packet<> & packet, TransportContext & context) {
+      unicast_destinations.unicast_send(
+        context, unicast_locator_list, packet.data(), packet.size());
+    }
+
+    template<typename TransportContext = udp::Context>
+    void multicast_send(const Packet<> & packet, TransportContext & context) {
+      multicast_destinations.multicast_send(
+        context, multicast_locator_list, packet.data(), packet.size());
     }
 
 
     void set_acked_changes(const SequenceNumber_t & seq_num);
 
+    // Hands change to the reader of this process instead of sending it; nothing can be lost
+    // on the way, so it counts as acknowledged.
+    void deliver_local(CacheChange && change);
+
     bool expects_inline_qos;
+    // Set when the writer matches the reader, if it lives in this process.
+    std::shared_ptr<LocalReader> local_reader;
   private:
     SequenceNumber_t highest_acked_seq_num;
     ReaderCacheAccessor cache_accessor;
     HistoryCache * writer_cache;
+    DestinationHandles unicast_destinations;
+    DestinationHandles multicast_destinations;
     // List<ChangeForReader> changes_for_reader;
 
     // List<ChangeForReader> unsent_changes_list;
@@ -139,34 +185,39 @@ namespace cmbml {
 
   template<bool pushMode, typename EndpointParams>
   struct Writer : Endpoint<EndpointParams>{
+    // Sequence numbers start at 1 and increase with each change (8.4.7.1).
     CacheChange new_change(ChangeKind_t k, Data && data, InstanceHandle_t && handle) {
-      auto ret = CacheChange(k, data, handle, this->guid);
-      ret.sequence_number = writer_cache.get_max_sequence_number() + 1;
+      auto ret = CacheChange(k, std::move(data), std::move(handle), this->guid);
+      last_change_seq_num = last_change_seq_num + 1;
+      ret.sequence_number = last_change_seq_num;
       return ret;
     }
 
     CacheChange new_change(ChangeKind_t k, InstanceHandle_t && handle) {
-      auto ret = CacheChange(k, handle, this->guid);
-      ret.sequence_number = writer_cache.get_max_sequence_number() + 1;
+      auto ret = CacheChange(k, std::move(handle), this->guid);
+      last_change_seq_num = last_change_seq_num + 1;
+      ret.sequence_number = last_change_seq_num;
       return ret;
     }
 
     void add_change(ChangeKind_t k, Data && data, InstanceHandle_t && handle) {
-      writer_cache.add_change(std::move(new_change(k, data, handle)));
+      writer_cache.add_change(new_change(k, std::move(data), std::move(handle)));
     }
 
     void add_change(ChangeKind_t k, InstanceHandle_t && handle) {
-      writer_cache.add_change(std::move(new_change(k, handle)));
+      writer_cache.add_change(new_change(k, std::move(handle)));
     }
 
     HistoryCache writer_cache;
     Duration_t heartbeat_period = {3, 0};
     Duration_t nack_response_delay = {0, 500*1000*1000};
     Duration_t nack_suppression_duration = {0, 0};
+    // A repair requested by more readers than this is multicast instead of unicast.
+    size_t repair_multicast_threshold = 1;
     static const bool push_mode = pushMode;
     Count_t heartbeat_count = 0;
   protected:
-    SequenceNumber_t last_change_seq_num;
+    SequenceNumber_t last_change_seq_num = {0, 0};
   };
 
   // Forward declare state machine struct
@@ -178,25 +229,43 @@ namespace cmbml {
     }
 
     void add_reader_locator(ReaderLocator && locator) {
-      reader_locators.push_back(locator);
+      locator.local_readers =
+        IntraProcessRegistry::instance().find_readers(locator.get_locator());
+      reader_locator_index.insert(locator.get_locator(), reader_locators.size());
+      reader_locators.push_back(std::move(locator));
+      fanout_plan_stale = true;
     }
 
     // TODO Better identifier?
     void remove_reader_locator(ReaderLocator * locator) {
       assert(locator);
-      std::remove_if(reader_locators.begin(), reader_locators.end(),
-        [locator](auto x) {
-          return &x == locator;
-        });
+      size_t * position = reader_locator_index.find(locator->get_locator());
+      if (!position) {
+        return;
+      }
+      // Swap with the last entry and pop, keeping the index in sync.
+      const size_t removed = *position;
+      reader_locator_index.erase(locator->get_locator());
+      if (removed != reader_locators.size() - 1) {
+        reader_locators[removed] = std::move(reader_locators.back());
+        reader_locator_index.insert(reader_locators[removed].get_locator(), removed);
+      }
+      reader_locators.pop_back();
+      fanout_plan_stale = true;
     }
 
-    ReaderLocator & lookup_reader_locator(Locator_t & locator) {
-      for (auto & reader_locator : reader_locators) {
-        if (reader_locator.locator_compare(locator)) {
-          return reader_locator;
-        }
+    ReaderLocator & lookup_reader_locator(const Locator_t & locator) {
+      ReaderLocator * reader_locator = find_reader_locator(locator);
+      assert(reader_locator);
+      return *reader_locator;
+    }
+
+    ReaderLocator * find_reader_locator(const Locator_t & locator) {
+      const size_t * position = reader_locator_index.find(locator);
+      if (!position) {
+        return nullptr;
       }
-      assert(false);
+      return &reader_locators[*position];
     }
 
     void reset_unsent_changes() {
@@ -205,70 +274,292 @@ namespace cmbml {
       }
     }
 
+    // Serialize once and send to each distinct reader locator once.
     template<typename T, typename TransportContext = udp::Context>
     void send(T && msg, TransportContext & context) {
       size_t packet_size = get_packet_size(msg);
       Packet<> packet(packet_size);
       serialize(msg, packet);
       // TODO Implement glomming-on of packets during send and wrapping in Message.
+      get_fanout_plan().send(packet, context);
+    }
+
+    // Push every change that a reader locator hasn't been sent yet, outside the state
+    // machine: calls send(locator, multicast, packet) with one serialized DATA at a time,
+    // as a SharedPacket if send takes one (see send_shared_packet).
+    // Changes go out in order, each serialized once and sent to every locator waiting for it.
+    template<typename SendT>
+    void send_unsent_changes(bool writer_has_key, SendT && send) {
+      auto send_to_locator = [&send](ReaderLocator & reader_locator,
+        const std::shared_ptr<Packet<>> & packet)
+      {
+        send_shared_packet(send, reader_locator.get_locator(), false, packet);
+      };
+      while (true) {
+        uint64_t seq = UINT64_MAX;
+        for (const auto & reader_locator : reader_locators) {
+          if (reader_locator.has_unsent_changes()) {
+            seq = std::min(seq, reader_locator.next_unsent_seq_num());
+          }
+        }
+        if (seq == UINT64_MAX) {
+          return;
+        }
+        send_unsent_change(seq, writer_has_key, send_to_locator);
+      }
+    }
+
+    // Send change seq to each reader locator whose next unsent change it is, by calling
+    // send(reader_locator, packet). The DATA is serialized once for the locators expecting
+    // inline QoS and once for the others.
+    template<typename SendT>
+    void send_unsent_change(uint64_t seq, bool writer_has_key, SendT & send) {
+      std::shared_ptr<Packet<>> packets[2];
       for (auto & reader_locator : reader_locators) {
-        //context.unicast_send(reader_locator.locator, packet.data(), packet.size());
-        reader_locator.send(packet, context);
+        if (!reader_locator.has_unsent_changes() || reader_locator.next_unsent_seq_num() != seq) {
+          continue;
+        }
+        if (!reader_locator.local_readers.empty()) {
+          reader_locator.deliver_local(reader_locator.pop_next_unsent_change());
+          continue;
+        }
+        std::shared_ptr<Packet<>> & packet = packets[reader_locator.expects_inline_qos ? 1 : 0];
+        if (packet) {
+          reader_locator.skip_next_unsent_change();
+        } else {
+          Data data(reader_locator.pop_next_unsent_change(),
+            reader_locator.expects_inline_qos, writer_has_key);
+          // TODO: inline_qos; need to copy from related DDS writer
+          data.reader_id = entity_id_unknown;
+          packet = std::make_shared<Packet<>>(get_packet_size(data));
+          serialize(data, *packet);
+        }
+        send(reader_locator, packet);
       }
     }
 
+    // Rebuilt lazily after the reader locators change.
+    FanoutPlan & get_fanout_plan() {
+      if (fanout_plan_stale) {
+        fanout_plan.clear();
+        for (const auto & reader_locator : reader_locators) {
+          if (!reader_locator.local_readers.empty()) {
+            continue;
+          }
+          // ReaderLocator::send always uses the unicast socket.
+          fanout_plan.add_unicast_locator(reader_locator.get_locator());
+        }
+        fanout_plan_stale = false;
+      }
+      return fanout_plan;
+    }
+
+    // The stateless writer keeps no per-reader state, so a multicast repair goes to every
+    // ReaderLocator, through the fanout plan, and a unicast repair only to the locators that
+    // asked for it, through their own Destinations.
+    template<typename T, typename TransportContext = udp::Context>
+    void send_repair(T && msg, const RepairRequest<Locator_t> & repair, TransportContext & context)
+    {
+      if (repair.use_multicast) {
+        send(msg, context);
+        return;
+      }
+      size_t packet_size = get_packet_size(msg);
+      Packet<> packet(packet_size);
+      serialize(msg, packet);
+      ScopedSendBatch<TransportContext> batch(context);
+      for (const auto & locator : repair.requesters) {
+        ReaderLocator * reader_locator = find_reader_locator(locator);
+        if (reader_locator) {
+          reader_locator->send(packet, context);
+        }
+      }
+    }
+
+    NackAggregator<Locator_t> nack_aggregator;
+
     static const bool stateful = false;
     using StateMachineT = typename std::conditional<
       StatelessWriter::reliability_level == ReliabilityKind_t::best_effort,
       BestEffortStatelessWriterMsm<StatelessWriter>, ReliableStatelessWriterMsm<StatelessWriter>>::type;
   private:
     List<ReaderLocator> reader_locators;
+    LocatorIndex<size_t> reader_locator_index;
+    FanoutPlan fanout_plan;
+    bool fanout_plan_stale = true;
   };
 
   template<bool pushMode, typename EndpointParams>
   struct StatefulWriter : Writer<pushMode, EndpointParams> {
     void add_matched_reader(ReaderProxy && reader_proxy) {
-      matched_readers.push_back(reader_proxy);
+      reader_proxy.local_reader =
+        IntraProcessRegistry::instance().find_reader(reader_proxy.remote_reader_guid);
+      matched_reader_index.insert(reader_proxy.remote_reader_guid, matched_readers.size());
+      matched_readers.push_back(std::move(reader_proxy));
+      fanout_plan_stale = true;
     }
 
     void remove_matched_reader(ReaderProxy * reader_proxy) {
       assert(reader_proxy);
-      std::remove_if(matched_readers.begin(), matched_readers.end(),
-        [reader_proxy](auto & reader) {
-          return reader.remote_reader_guid == reader_proxy->remote_reader_guid;
-        }
-      );
+      const GUID_t reader_guid = reader_proxy->remote_reader_guid;
+      size_t * position = matched_reader_index.find(reader_guid);
+      if (!position) {
+        return;
+      }
+      // Swap with the last entry and pop, keeping the index in sync.
+      const size_t removed = *position;
+      matched_reader_index.erase(reader_guid);
+      if (removed != matched_readers.size() - 1) {
+        matched_readers[removed] = std::move(matched_readers.back());
+        matched_reader_index.insert(matched_readers[removed].remote_reader_guid, removed);
+      }
+      matched_readers.pop_back();
+      fanout_plan_stale = true;
     }
 
     ReaderProxy & lookup_matched_reader(const GUID_t & reader_guid) {
-      for (auto & reader : matched_readers) {
-        if (reader.remote_reader_guid == reader_guid) {
-          return reader;
-        }
+      ReaderProxy * reader = find_matched_reader(reader_guid);
+      assert(reader);
+      return *reader;
+    }
+
+    ReaderProxy * find_matched_reader(const GUID_t & reader_guid) {
+      const size_t * position = matched_reader_index.find(reader_guid);
+      if (!position) {
+        return nullptr;
       }
-      assert(false);
+      return &matched_readers[*position];
     }
 
     // TODO
     bool is_acked_by_all(CacheChange & change);
 
+    // Serialize once and send to each distinct destination of the matched readers once.
     // TODO This should wrap a submessage in a Message packet
     template<typename T, typename TransportContext = udp::Context>
     void send(T && msg, TransportContext & context) {
       size_t packet_size = get_packet_size(msg);
       Packet<> packet(packet_size);
       serialize(msg, packet);
+      get_fanout_plan().send(packet, context);
+    }
 
-      for (auto reader : matched_readers) {
-        for (const auto & locator : reader.unicast_locator_list) {
-          context.unicast_send(locator, packet.data(), packet.size());
+    // Push every change that a matched reader hasn't been sent yet, outside the state
+    // machine: calls send(locator, multicast, packet) with one serialized DATA at a time,
+    // as a SharedPacket if send takes one (see send_shared_packet).
+    // Changes go out in order, each serialized once and sent once to each destination of
+    // the readers waiting for it, so readers sharing a locator or group share the datagram.
+    template<typename SendT>
+    void send_unsent_changes(bool writer_has_key, SendT && send) {
+      while (true) {
+        uint64_t seq = UINT64_MAX;
+        for (const auto & reader : matched_readers) {
+          if (reader.has_unsent_changes()) {
+            seq = std::min(seq, reader.next_unsent_seq_num());
+          }
         }
-        for (const auto & locator : reader.multicast_locator_list) {
-          context.multicast_send(locator, packet.data(), packet.size());
+        if (seq == UINT64_MAX) {
+          return;
+        }
+        // By whether the readers expect inline QoS.
+        std::shared_ptr<Packet<>> packets[2];
+        List<Locator_t> unicast_sent[2];
+        List<Locator_t> multicast_sent[2];
+        for (auto & reader : matched_readers) {
+          if (!reader.has_unsent_changes() || reader.next_unsent_seq_num() != seq) {
+            continue;
+          }
+          ChangeForReader change = reader.pop_next_unsent_change();
+          if (!change.is_relevant) {
+            continue;
+          }
+          if (reader.local_reader) {
+            reader.deliver_local(std::move(change));
+            continue;
+          }
+          const size_t variant = reader.expects_inline_qos ? 1 : 0;
+          std::shared_ptr<Packet<>> & packet = packets[variant];
+          if (!packet) {
+            Data data(std::move(change), reader.expects_inline_qos, writer_has_key);
+            data.reader_id = entity_id_unknown;
+            packet = std::make_shared<Packet<>>(get_packet_size(data));
+            serialize(data, *packet);
+          }
+          send_once(reader.unicast_locator_list, false, packet, unicast_sent[variant], send);
+          send_once(reader.multicast_locator_list, true, packet, multicast_sent[variant], send);
         }
       }
     }
 
+    // Rebuilt lazily after the matched readers change.
+    FanoutPlan & get_fanout_plan() {
+      if (fanout_plan_stale) {
+        fanout_plan.clear();
+        for (const auto & reader : matched_readers) {
+          // Readers of this process get no HEARTBEATs: they have every change handed to them.
+          if (reader.local_reader) {
+            continue;
+          }
+          for (const auto & locator : reader.unicast_locator_list) {
+            fanout_plan.add_unicast_locator(locator);
+          }
+          for (const auto & locator : reader.multicast_locator_list) {
+            fanout_plan.add_multicast_locator(locator);
+          }
+        }
+        fanout_plan_stale = false;
+      }
+      return fanout_plan;
+    }
+
+    // Repair one change for the readers that requested it. A multicast repair goes once to
+    // each multicast group of the requesting readers; readers without a multicast locator,
+    // and every reader of a unicast repair, are sent to over unicast.
+    template<typename T, typename TransportContext = udp::Context>
+    void send_repair(T && msg, const RepairRequest<GUID_t> & repair, TransportContext & context)
+    {
+      size_t packet_size = get_packet_size(msg);
+      Packet<> packet(packet_size);
+      serialize(msg, packet);
+
+      ScopedSendBatch<TransportContext> batch(context);
+      List<Locator_t> multicast_sent;
+      for (const auto & reader_guid : repair.requesters) {
+        ReaderProxy * reader = find_matched_reader(reader_guid);
+        if (!reader) {
+          // Unmatched since it sent the ACKNACK.
+          continue;
+        }
+        if (!repair.use_multicast || reader->multicast_locator_list.empty()) {
+          reader->unicast_send(packet, context);
+          continue;
+        }
+        // The readers of a group usually share their multicast locators: the first goes
+        // through its Destinations, and the others find every locator sent already. Only
+        // readers whose groups partly overlap another's are sent to locator by locator.
+        const List<Locator_t> & groups = reader->multicast_locator_list;
+        const size_t already_sent = std::count_if(groups.begin(), groups.end(),
+          [&multicast_sent](const Locator_t & locator) {
+            return std::find(multicast_sent.begin(), multicast_sent.end(), locator) !=
+              multicast_sent.end();
+          });
+        if (already_sent == 0) {
+          reader->multicast_send(packet, context);
+          multicast_sent.insert(multicast_sent.end(), groups.begin(), groups.end());
+        } else if (already_sent < groups.size()) {
+          for (const auto & locator : groups) {
+            if (std::find(multicast_sent.begin(), multicast_sent.end(), locator) ==
+                multicast_sent.end())
+            {
+              context.multicast_send(locator, packet.data(), packet.size());
+              multicast_sent.push_back(locator);
+            }
+          }
+        }
+      }
+    }
+
+    NackAggregator<GUID_t> nack_aggregator;
 
     // TODO is this default reasonable? (not in the spec)
     Duration_t resend_data_period = {3, 0};
@@ -277,7 +568,22 @@ namespace cmbml {
       StatefulWriter::reliability_level == ReliabilityKind_t::best_effort,
       BestEffortStatefulWriterMsm<StatefulWriter>, ReliableStatefulWriterMsm<StatefulWriter>>::type;
   private:
+    template<typename SendT>
+    static void send_once(const List<Locator_t> & locators, bool multicast,
+      const SharedPacket & packet, List<Locator_t> & sent, SendT & send)
+    {
+      for (const auto & locator : locators) {
+        if (std::find(sent.begin(), sent.end(), locator) == sent.end()) {
+          send_shared_packet(send, locator, multicast, packet);
+          sent.push_back(locator);
+        }
+      }
+    }
+
     List<ReaderProxy> matched_readers;
+    GuidIndex<size_t> matched_reader_index;
+    FanoutPlan fanout_plan;
+    bool fanout_plan_stale = true;
   };
 
   // ACTUALLY we could template the Writer on the Reader Type
@@ -83,6 +83,10 @@ namespace cmbml {
       return high*multiplicand + low;
     }
 
+    constexpr static SequenceNumber_t from_value(uint64_t v) {
+      return SequenceNumber_t({static_cast<int32_t>(v >> 32), static_cast<uint32_t>(v)});
+    }
+
     constexpr static bool less_than(const SequenceNumber_t & a, const SequenceNumber_t & b) {
       return a.value() < b.value();
     }
@@ -150,22 +154,14 @@ namespace cmbml {
     }
   };
 
-  // TODO: collisions with endpoints outside of participant
+  // Lexicographic order on (prefix, entity_id).
+  // Prefer GuidIndex (utility/hash_index.hpp) for per-message lookups.
   struct GUIDCompare {
-    constexpr bool operator()(const GUID_t & a, const GUID_t & b) const {
-      bool less = true;
-      for (size_t i = 0; i < 4; ++i) {
-        if (a.entity_id[i] > b.entity_id[i]) {
-          return false;
-        }
+    bool operator()(const GUID_t & a, const GUID_t & b) const {
+      if (a.prefix != b.prefix) {
+        return a.prefix < b.prefix;
       }
-      for (size_t i = 0; i < 12; ++i) {
-        if (a.prefix[i] > b.prefix[i]) {
-          return false;
-        }
-      }
-
-      return true;
+      return a.entity_id < b.entity_id;
     }
   };
 
@@ -180,6 +176,10 @@ namespace cmbml {
     (int32_t, kind),
     (uint32_t, port),
     (IPAddress, address));
+
+    bool operator==(const Locator_t & b) const {
+      return kind == b.kind && port == b.port && address == b.address;
+    }
   };
 
   struct ProtocolVersion_t {
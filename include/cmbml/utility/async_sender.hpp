@@ -0,0 +1,215 @@
+#ifndef CMBML__UTILITY__ASYNC_SENDER_HPP_
+#define CMBML__UTILITY__ASYNC_SENDER_HPP_
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <limits>
+#include <thread>
+
+#include <cmbml/cdr/common.hpp>
+#include <cmbml/psm/udp/context.hpp>
+#include <cmbml/types.hpp>
+#include <cmbml/utility/mpsc_queue.hpp>
+#include <cmbml/utility/send_batch.hpp>
+
+namespace cmbml {
+
+// Sender thread for asynchronous publication, shared by the DataWriters of a participant
+// (Linux). enqueue() only pushes onto a lock-free queue, so a writing thread never blocks
+// on sendto. The sender thread drains the queue and appends the messages for one
+// destination into one datagram, which goes out when the next message wouldn't fit in
+// max_datagram_size, or flush_period after its first message was queued. With a zero
+// flush_period, the datagrams go out each time the queue has been drained, so only the
+// messages that queued up while the thread was busy are batched.
+// The thread sends through its own Context.
+template<typename ContextT = udp::Context>
+class AsyncSender {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit AsyncSender(
+    size_t max_datagram_bytes = CMBML__MAX_FRAGMENT_SIZE,
+    std::chrono::nanoseconds flush_period = std::chrono::nanoseconds(0))
+  : max_datagram_size(max_datagram_bytes), flush_delay(flush_period)
+  {
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    assert(event_fd >= 0);
+    thread = std::thread([this]() { run(); });
+  }
+
+  // Sends what was queued before returning.
+  ~AsyncSender() {
+    running = false;
+    wake();
+    thread.join();
+    close(event_fd);
+  }
+
+  AsyncSender(const AsyncSender &) = delete;
+  AsyncSender & operator=(const AsyncSender &) = delete;
+
+  // Safe to call from any thread; never blocks.
+  void enqueue(const Locator_t & locator, bool multicast, const Packet<> & packet) {
+    queue.push(Message{locator, multicast, packet});
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.exchange(false)) {
+      wake();
+    }
+  }
+
+  // Sender thread only, e.g. to configure it from a message callback.
+  ContextT & context() {
+    return send_context;
+  }
+
+  size_t datagrams_sent() const {
+    return datagrams;
+  }
+
+  size_t messages_sent() const {
+    return messages;
+  }
+
+private:
+  struct Message {
+    Locator_t locator;
+    bool multicast;
+    Packet<> packet;
+  };
+
+  struct Batch {
+    Locator_t locator;
+    bool multicast;
+    Packet<> datagram;
+    Clock::time_point first_queued;
+    size_t message_count;
+  };
+
+  void wake() {
+    const uint64_t one = 1;
+    ssize_t written = write(event_fd, &one, sizeof(one));
+    (void)written;
+  }
+
+  void run() {
+    while (true) {
+      const bool stopping = !running;
+      Message message;
+      while (queue.pop(message)) {
+        add_to_batch(std::move(message));
+      }
+      flush_batches(stopping ? Clock::time_point::max() : Clock::now());
+      if (stopping) {
+        // Everything queued before the destructor ran has been sent.
+        return;
+      }
+
+      sleeping = true;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (queue.empty() && running) {
+        struct pollfd poll_fd = {event_fd, POLLIN, 0};
+        poll(&poll_fd, 1, poll_timeout());
+      }
+      sleeping = false;
+      uint64_t count;
+      ssize_t bytes_read = read(event_fd, &count, sizeof(count));
+      (void)bytes_read;
+    }
+  }
+
+  static size_t bytes(const Packet<> & packet) {
+    return packet.size() * sizeof(Packet<>::value_type);
+  }
+
+  void add_to_batch(Message && message) {
+    auto batch = std::find_if(batches.begin(), batches.end(), [&message](const Batch & b) {
+      return b.multicast == message.multicast && b.locator == message.locator;
+    });
+    if (batch != batches.end() &&
+      bytes(batch->datagram) + bytes(message.packet) > max_datagram_size)
+    {
+      send(*batch);
+      batches.erase(batch);
+      batch = batches.end();
+    }
+    if (batch == batches.end()) {
+      batches.push_back(
+        Batch{message.locator, message.multicast, std::move(message.packet), Clock::now(), 1});
+      return;
+    }
+    batch->datagram.insert(
+      batch->datagram.end(), message.packet.begin(), message.packet.end());
+    ++batch->message_count;
+  }
+
+  // Sends the batches that have waited flush_period by now.
+  void flush_batches(Clock::time_point now) {
+    auto due = [this, now](const Batch & batch) {
+      return now == Clock::time_point::max() || batch.first_queued + flush_delay <= now;
+    };
+    {
+      ScopedSendBatch<ContextT> send_batch(send_context);
+      for (auto & batch : batches) {
+        if (due(batch)) {
+          send(batch);
+        }
+      }
+    }
+    batches.erase(std::remove_if(batches.begin(), batches.end(), due), batches.end());
+  }
+
+  void send(const Batch & batch) {
+    if (batch.multicast) {
+      send_context.multicast_send(batch.locator, batch.datagram.data(), batch.datagram.size());
+    } else {
+      send_context.unicast_send(batch.locator, batch.datagram.data(), batch.datagram.size());
+    }
+    ++datagrams;
+    messages += batch.message_count;
+  }
+
+  // Milliseconds until the oldest batch is due, rounded up; -1 if there are none.
+  int poll_timeout() const {
+    if (batches.empty()) {
+      return -1;
+    }
+    Clock::time_point first_due = Clock::time_point::max();
+    for (const auto & batch : batches) {
+      first_due = std::min(first_due, batch.first_queued + flush_delay);
+    }
+    const auto now = Clock::now();
+    if (first_due <= now) {
+      return 0;
+    }
+    const auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+      first_due - now + std::chrono::milliseconds(1) - std::chrono::nanoseconds(1));
+    return static_cast<int>(
+      std::min<std::chrono::milliseconds::rep>(wait.count(), std::numeric_limits<int>::max()));
+  }
+
+  const size_t max_datagram_size;
+  const std::chrono::nanoseconds flush_delay;
+
+  MpscQueue<Message> queue;
+  std::atomic<bool> running{true};
+  std::atomic<bool> sleeping{false};
+  int event_fd = -1;
+
+  // Sender thread only.
+  ContextT send_context;
+  List<Batch> batches;
+  std::atomic<size_t> datagrams{0};
+  std::atomic<size_t> messages{0};
+
+  std::thread thread;
+};
+
+}  // namespace cmbml
+
+#endif  // CMBML__UTILITY__ASYNC_SENDER_HPP_
@@ -0,0 +1,307 @@
+#ifndef CMBML__UTILITY__COROUTINE_HPP_
+#define CMBML__UTILITY__COROUTINE_HPP_
+
+#if !defined(__cpp_impl_coroutine)
+#error "cmbml/utility/coroutine.hpp requires C++20 coroutines; build with CMBML_ENABLE_COROUTINES"
+#endif
+
+#include <cassert>
+#include <chrono>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+#include <cmbml/types.hpp>
+#include <cmbml/utility/epoll_executor.hpp>
+
+// Optional C++20 layer: protocol loops written as straight-line coroutines on one thread,
+// instead of state machine callbacks, e.g. a writer push loop:
+//   Task push_loop(CoroutineScheduler & scheduler, AsyncEvent & changes, ...) {
+//     while (true) {
+//       co_await changes.wait_until([&]() {
+//         return cache.get_max_sequence_number() > locator.highest_seq_num_sent;
+//       });
+//       ... send the unsent changes ...
+//     }
+//   }
+// and a reader ACK loop:
+//   while (true) {
+//     co_await scheduler.readable(socket);  // a HEARTBEAT arrived
+//     co_await scheduler.sleep_for(heartbeat_response_delay);
+//     ... send the ACKNACK ...
+//   }
+
+namespace cmbml {
+
+class CoroutineScheduler;
+
+// A coroutine started with CoroutineScheduler::spawn. It frees itself when it returns; the
+// scheduler frees the ones still suspended when it is destroyed.
+class Task {
+public:
+  struct promise_type {
+    Task get_return_object() {
+      return Task{std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    // Runs only once spawned.
+    std::suspend_always initial_suspend() noexcept {
+      return {};
+    }
+    std::suspend_never final_suspend() noexcept {
+      return {};
+    }
+    void return_void() {}
+    void unhandled_exception() {
+      std::terminate();
+    }
+    ~promise_type();
+
+    CoroutineScheduler * scheduler = nullptr;
+  };
+
+  Task(Task && other) : handle(std::exchange(other.handle, nullptr)) {}
+  Task(const Task &) = delete;
+  Task & operator=(const Task &) = delete;
+
+  ~Task() {
+    // Never spawned.
+    if (handle) {
+      handle.destroy();
+    }
+  }
+
+private:
+  friend class CoroutineScheduler;
+
+  explicit Task(std::coroutine_handle<promise_type> h) : handle(h) {}
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+// Resumes coroutines on the thread that calls run(). Sockets and timers are watched by an
+// EpollExecutor; a coroutine made ready is resumed from a local queue, so switching between
+// coroutines costs no syscall and no lock. Not thread safe apart from shutdown().
+class CoroutineScheduler {
+public:
+  CoroutineScheduler() = default;
+
+  ~CoroutineScheduler() {
+    // Destroying a frame erases it from live.
+    while (!live.empty()) {
+      (*live.begin()).destroy();
+    }
+  }
+
+  CoroutineScheduler(const CoroutineScheduler &) = delete;
+  CoroutineScheduler & operator=(const CoroutineScheduler &) = delete;
+
+  // The task starts on the next turn of run().
+  void spawn(Task task) {
+    auto handle = std::exchange(task.handle, nullptr);
+    handle.promise().scheduler = this;
+    live.insert(handle);
+    schedule(handle);
+  }
+
+  void schedule(std::coroutine_handle<> handle) {
+    ready.push_back(handle);
+  }
+
+  struct ReadableAwaitable {
+    bool await_ready() const {
+      return false;
+    }
+    void await_suspend(std::coroutine_handle<> handle) {
+      scheduler.watch(fd, handle);
+    }
+    void await_resume() const {}
+
+    CoroutineScheduler & scheduler;
+    int fd;
+  };
+
+  // Suspends until fd is readable; the coroutine then reads it. One waiter per fd at a time.
+  ReadableAwaitable readable(int fd) {
+    return ReadableAwaitable{*this, fd};
+  }
+
+  struct SleepAwaitable {
+    bool await_ready() const {
+      return timeout <= std::chrono::nanoseconds(0);
+    }
+    void await_suspend(std::coroutine_handle<> handle) {
+      CoroutineScheduler * owner = &scheduler;
+      scheduler.loop.add_timed_task(timeout, true, [owner, handle]() {
+        owner->schedule(handle);
+      });
+    }
+    void await_resume() const {}
+
+    CoroutineScheduler & scheduler;
+    std::chrono::nanoseconds timeout;
+  };
+
+  // Suspends until the timer expires.
+  SleepAwaitable sleep_for(const std::chrono::nanoseconds & timeout) {
+    return SleepAwaitable{*this, timeout};
+  }
+
+  struct YieldAwaitable {
+    bool await_ready() const {
+      return false;
+    }
+    void await_suspend(std::coroutine_handle<> handle) {
+      scheduler.schedule(handle);
+    }
+    void await_resume() const {}
+
+    CoroutineScheduler & scheduler;
+  };
+
+  // Suspends to let the other ready coroutines run.
+  YieldAwaitable yield() {
+    return YieldAwaitable{*this};
+  }
+
+  void run() {
+    while (loop.is_running()) {
+      while (!ready.empty()) {
+        auto handle = ready.front();
+        ready.pop_front();
+        handle.resume();
+      }
+      // Only sleep when nothing is ready.
+      if (!loop.spin_once(ready.empty())) {
+        return;
+      }
+    }
+  }
+
+  // Safe to call from any thread.
+  void shutdown() {
+    loop.shutdown();
+  }
+
+  // Runs plain callbacks on the same thread.
+  EpollExecutor & executor() {
+    return loop;
+  }
+
+  size_t live_count() const {
+    return live.size();
+  }
+
+private:
+  friend struct Task::promise_type;
+
+  struct FdWatch {
+    size_t id = 0;
+    bool registered = false;
+    std::coroutine_handle<> waiter = nullptr;
+  };
+
+  // Each fd is added once, oneshot, and rearmed for each wait.
+  void watch(int fd, std::coroutine_handle<> handle) {
+    FdWatch & fd_watch = fd_watches[fd];
+    assert(!fd_watch.waiter);
+    fd_watch.waiter = handle;
+    if (fd_watch.registered) {
+      loop.rearm_fd(fd, fd_watch.id);
+      return;
+    }
+    fd_watch.registered = true;
+    fd_watch.id = loop.add_fd(fd, [this, fd]() {
+      FdWatch & ready_watch = fd_watches[fd];
+      auto waiter = std::exchange(ready_watch.waiter, nullptr);
+      if (waiter) {
+        schedule(waiter);
+      }
+    }, true);
+    assert(fd_watch.id != EpollExecutor::invalid_fd_id);
+  }
+
+  EpollExecutor loop;
+  std::deque<std::coroutine_handle<>> ready;
+  std::unordered_map<int, FdWatch> fd_watches;
+  struct HandleHash {
+    size_t operator()(const std::coroutine_handle<> & handle) const {
+      return std::hash<void *>()(handle.address());
+    }
+  };
+  std::unordered_set<std::coroutine_handle<>, HandleHash> live;
+};
+
+inline Task::promise_type::~promise_type() {
+  if (scheduler) {
+    scheduler->live.erase(std::coroutine_handle<promise_type>::from_promise(*this));
+  }
+}
+
+// Wakes the coroutines waiting on a condition, e.g. "the history has unsent changes": the
+// code that adds a change calls notify(), and the push loop waits with wait_until.
+class AsyncEvent {
+public:
+  explicit AsyncEvent(CoroutineScheduler & owner) : scheduler(owner) {}
+
+  AsyncEvent(const AsyncEvent &) = delete;
+  AsyncEvent & operator=(const AsyncEvent &) = delete;
+
+  struct WaitAwaitable {
+    bool await_ready() const {
+      return predicate && predicate();
+    }
+    void await_suspend(std::coroutine_handle<> handle) {
+      event.waiters.push_back(Waiter{handle, std::move(predicate)});
+    }
+    void await_resume() const {}
+
+    AsyncEvent & event;
+    std::function<bool()> predicate;
+  };
+
+  // Suspends until the next notify().
+  WaitAwaitable wait() {
+    return WaitAwaitable{*this, nullptr};
+  }
+
+  // Returns at once if predicate() holds; otherwise suspends until a notify() after which
+  // it holds.
+  template<typename PredicateT>
+  WaitAwaitable wait_until(PredicateT && predicate) {
+    return WaitAwaitable{*this, std::forward<PredicateT>(predicate)};
+  }
+
+  // Waiters whose condition holds run on the next turn of the scheduler.
+  void notify() {
+    size_t kept = 0;
+    for (auto & waiter : waiters) {
+      if (!waiter.predicate || waiter.predicate()) {
+        scheduler.schedule(waiter.handle);
+      } else {
+        waiters[kept++] = std::move(waiter);
+      }
+    }
+    waiters.resize(kept);
+  }
+
+  size_t waiter_count() const {
+    return waiters.size();
+  }
+
+private:
+  struct Waiter {
+    std::coroutine_handle<> handle;
+    std::function<bool()> predicate;
+  };
+
+  CoroutineScheduler & scheduler;
+  List<Waiter> waiters;
+};
+
+}  // namespace cmbml
+
+#endif  // CMBML__UTILITY__COROUTINE_HPP_
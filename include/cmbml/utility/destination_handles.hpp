@@ -0,0 +1,100 @@
+#ifndef CMBML__UTILITY__DESTINATION_HANDLES_HPP_
+#define CMBML__UTILITY__DESTINATION_HANDLES_HPP_
+
+#include <type_traits>
+#include <utility>
+
+#include <cmbml/cdr/common.hpp>
+#include <cmbml/psm/udp/destination_cache.hpp>
+#include <cmbml/types.hpp>
+#include <cmbml/utility/send_batch.hpp>
+
+namespace cmbml {
+
+namespace detail {
+template<typename ContextT, typename = void>
+struct resolves_destinations : std::false_type {};
+
+template<typename ContextT>
+struct resolves_destinations<ContextT, void_t<decltype(
+    std::declval<ContextT &>().resolve(std::declval<const Locator_t &>()))>>
+  : std::true_type {};
+}  // namespace detail
+
+// The Destinations a transport context resolved a list of locators to, kept next to the
+// list by its owner. The locators are resolved by the first send through a context, and
+// later sends go straight to the handles. Contexts without resolve() are given the
+// locators. The list must not change after the first send, unless reset() is called, and
+// the context must outlive the handles.
+class DestinationHandles {
+public:
+  template<typename ContextT>
+  void unicast_send(ContextT & context, const List<Locator_t> & locators,
+    const uint32_t * packet, size_t size)
+  {
+    send(context, locators.data(), locators.size(), false, packet, size,
+      detail::resolves_destinations<ContextT>());
+  }
+
+  template<typename ContextT>
+  void multicast_send(ContextT & context, const List<Locator_t> & locators,
+    const uint32_t * packet, size_t size)
+  {
+    send(context, locators.data(), locators.size(), true, packet, size,
+      detail::resolves_destinations<ContextT>());
+  }
+
+  // For an owner with a single locator.
+  template<typename ContextT>
+  void unicast_send(ContextT & context, const Locator_t & locator,
+    const uint32_t * packet, size_t size)
+  {
+    send(context, &locator, 1, false, packet, size, detail::resolves_destinations<ContextT>());
+  }
+
+  void reset() {
+    owner = nullptr;
+    handles.clear();
+  }
+
+private:
+  template<typename ContextT>
+  void send(ContextT & context, const Locator_t * locators, size_t count, bool multicast,
+    const uint32_t * packet, size_t size, std::true_type)
+  {
+    if (owner != &context || handles.size() != count) {
+      handles.clear();
+      for (size_t i = 0; i < count; ++i) {
+        handles.push_back(&context.resolve(locators[i]));
+      }
+      owner = &context;
+    }
+    for (udp::Destination * destination : handles) {
+      if (multicast) {
+        context.multicast_send(*destination, packet, size);
+      } else {
+        context.unicast_send(*destination, packet, size);
+      }
+    }
+  }
+
+  template<typename ContextT>
+  void send(ContextT & context, const Locator_t * locators, size_t count, bool multicast,
+    const uint32_t * packet, size_t size, std::false_type)
+  {
+    for (size_t i = 0; i < count; ++i) {
+      if (multicast) {
+        context.multicast_send(locators[i], packet, size);
+      } else {
+        context.unicast_send(locators[i], packet, size);
+      }
+    }
+  }
+
+  const void * owner = nullptr;
+  List<udp::Destination *> handles;
+};
+
+}  // namespace cmbml
+
+#endif  // CMBML__UTILITY__DESTINATION_HANDLES_HPP_
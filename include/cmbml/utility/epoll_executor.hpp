@@ -0,0 +1,145 @@
+#ifndef CMBML__UTILITY__EPOLL_EXECUTOR_HPP_
+#define CMBML__UTILITY__EPOLL_EXECUTOR_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+
+#include <cmbml/types.hpp>
+#include <cmbml/utility/timer_wheel.hpp>
+
+namespace cmbml {
+
+// Single-threaded event loop on epoll (Linux).
+// Receive sockets are registered once with add_receiver and read when they become readable.
+// Timers live on a TimerWheel and bound the epoll_wait timeout. post() hands work to the loop
+// from other threads through an eventfd. Apart from epoll_wait, the loop makes syscalls only
+// to read ready sockets and to drain the eventfd when something was posted.
+// Everything except post() and shutdown() must be called from the loop thread or before spin().
+class EpollExecutor {
+public:
+  EpollExecutor();
+  ~EpollExecutor();
+
+  EpollExecutor(const EpollExecutor &) = delete;
+  EpollExecutor & operator=(const EpollExecutor &) = delete;
+
+  // Calls callback(packet) for every packet received by the Context's receive sockets.
+  // False if a socket couldn't be added, e.g. because it was added already.
+  template<typename ContextT, typename CallbackT>
+  bool add_receiver(ContextT & context, CallbackT && callback) {
+    bool added = true;
+    for (int recv_socket : context.receive_sockets()) {
+      added = add_receive_socket(context, recv_socket, callback) && added;
+    }
+    return added;
+  }
+
+  // Just one of the Context's receive sockets, e.g. one shard's.
+  template<typename ContextT, typename CallbackT>
+  bool add_receive_socket(ContextT & context, int recv_socket, CallbackT && callback) {
+    return add_fd(recv_socket, [&context, recv_socket, callback]() {
+      while (context.receive_from(recv_socket, callback)) {
+      }
+    }) != invalid_fd_id;
+  }
+
+  // Releases the Context's zero-copy packets as their completions arrive (EPOLLERR on the
+  // send sockets).
+  template<typename ContextT>
+  void add_zerocopy_reaper(ContextT & context) {
+    for (int send_socket : context.send_sockets()) {
+      add_fd(send_socket, [&context]() {
+        context.reap_zerocopy_completions();
+      });
+    }
+  }
+
+  static const size_t invalid_fd_id = std::numeric_limits<size_t>::max();
+
+  // Calls on_readable whenever fd is readable (level-triggered). A oneshot fd is disabled
+  // after each call until rearm_fd. Returns the id that rearm_fd needs, or invalid_fd_id
+  // with errno set if epoll refused the fd; an fd can only be added once.
+  size_t add_fd(int fd, std::function<void()> on_readable, bool oneshot = false);
+  void remove_fd(int fd);
+  // Safe to call from any thread.
+  void rearm_fd(int fd, size_t id);
+
+  // Tasks run once per loop iteration; while there are any the loop polls instead of
+  // sleeping, so prefer add_receiver and timers.
+  template<typename CallbackT, typename ...Args>
+  void add_task(CallbackT && callback, Args &&... args) {
+    task_list.push_back(
+      [callback, args...]() mutable {
+        callback(args...);
+      }
+    );
+  }
+
+  template<typename CallbackT, typename ...Args>
+  TimerHandle add_timed_task(
+      const std::chrono::nanoseconds & timeout, bool oneshot, CallbackT && callback, Args &&... args)
+  {
+    return timers.arm(
+      timeout,
+      [callback, args...]() mutable {
+        callback(args...);
+      },
+      oneshot ? std::chrono::nanoseconds(0) : timeout
+    );
+  }
+
+  bool cancel_timed_task(const TimerHandle & handle) {
+    return timers.cancel(handle);
+  }
+
+  // Runs callback on the loop thread. Safe to call from any thread.
+  void post(std::function<void()> callback);
+
+  void spin();
+
+  // One iteration of spin(): waits for an event or the next timer if block is true, then
+  // dispatches ready fds, expires timers and runs tasks, so that whatever those callbacks
+  // leave to do can be done before the next wait. Returns false on an epoll error.
+  bool spin_once(bool block = true);
+
+  bool is_running() const {
+    return running;
+  }
+
+  // Makes spin() return, or return at once if it hasn't been called yet. Safe to call from
+  // any thread.
+  void shutdown();
+
+private:
+  // Milliseconds until the next timer, for epoll_wait.
+  int wait_timeout() const;
+  void wake();
+  void run_posted();
+
+  struct FdHandler {
+    int fd;
+    bool active;
+    std::function<void()> on_readable;
+  };
+
+  int epoll_fd = -1;
+  int event_fd = -1;
+  // Indexed by the epoll_event data; entries of removed fds stay, inactive. A deque so that
+  // handlers can add fds while they run.
+  std::deque<FdHandler> fd_handlers;
+
+  TimerWheel timers;
+  List<std::function<void()>> task_list;
+
+  std::mutex posted_mutex;
+  List<std::function<void()>> posted;
+  std::atomic<bool> running{true};
+};
+
+}  // namespace cmbml
+
+#endif  // CMBML__UTILITY__EPOLL_EXECUTOR_HPP_
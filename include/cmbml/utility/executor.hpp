@@ -1,22 +1,19 @@
 #ifndef CMBML__UTILITY__EXECUTOR_HPP_
 #define CMBML__UTILITY__EXECUTOR_HPP_
 
+#include <atomic>
 #include <chrono>
 #include <functional>
-#include <future>
+#include <memory>
+#include <thread>
 
 #include <cmbml/types.hpp>
+#include <cmbml/utility/timer_wheel.hpp>
 
 namespace cmbml {
 
-struct TimedTask {
-  std::function<void()> callback;
-  std::chrono::nanoseconds period;
-  std::chrono::steady_clock::time_point last_called_time;
-  bool oneshot = false;
-};
-
-// Single-threaded synchronous round-robin executor using std::thread library (POSIX)
+// Single-threaded synchronous round-robin executor.
+// Tasks run inline on the thread that calls spin(), so a task that blocks delays the others.
 class SyncExecutor {
 
 public:
@@ -25,63 +22,128 @@ public:
   void add_task(CallbackT && callback, Args &&... args) {
     // Wrap it in a bound lambda that takes no arguments
     task_list.push_back(
-      [callback, &args...]() {
+      [callback, args...]() mutable {
         callback(args...);
       }
     );
   }
 
+  // Calls callback(packet) for every packet received by the Context, from a task that blocks
+  // in Context::receive_packet.
+  template<typename ContextT, typename CallbackT>
+  void add_receiver(ContextT & context, CallbackT && callback) {
+    add_task([&context, callback]() {
+      context.receive_packet(callback);
+    });
+  }
+
+  // Runs callback after timeout, and then every timeout unless oneshot.
   template<typename CallbackT, typename ...Args>
-  void add_timed_task(
+  TimerHandle add_timed_task(
       const std::chrono::nanoseconds & timeout, bool oneshot, CallbackT && callback, Args &&... args)
   {
-    timed_tasks.push_back(
-      TimedTask{
-        [callback, &args...]() {
-          callback(args...);
-        },
-        timeout,
-        std::chrono::steady_clock::now(),
-        oneshot
-      }
+    return timers.arm(
+      timeout,
+      [callback, args...]() mutable {
+        callback(args...);
+      },
+      oneshot ? std::chrono::nanoseconds(0) : timeout
     );
-    // Keep track of the shortest timeout period.
-    min_timeout = std::min(min_timeout, timeout);
   }
 
-  void spin() {
-    // May want to reset the "start time" of all timed tasks here.
-    while (true) {
-      for (auto & task : timed_tasks) {
-        // Check if it's time to execute.
-        if (std::chrono::steady_clock::now() - task.last_called_time  >= task.period) {
-          task.callback();
-          task.last_called_time = std::chrono::steady_clock::now();
-        }
-      }
+  bool cancel_timed_task(const TimerHandle & handle) {
+    return timers.cancel(handle);
+  }
 
-      auto timeslice = min_timeout / task_list.size();
+  void spin() {
+    running = true;
+    while (running) {
+      timers.expire();
 
-      // TODO: I think we could get some savings if we don't make a new future every time
-      // In fact this might be logically incorrect
       for (auto & task : task_list) {
-        auto task_future = std::async(std::launch::async, task);
-        auto future_status = task_future.wait_for(timeslice);
-        if (future_status == std::future_status::ready) {
-          task_future.get();
+        task();
+      }
+
+      // Nothing to poll: sleep until the next timer is due.
+      if (task_list.empty()) {
+        if (timers.empty()) {
+          break;
         }
+        std::this_thread::sleep_until(timers.next_wakeup());
       }
     }
   }
 
+  // Makes spin() return after the current iteration. Safe to call from a task.
+  void shutdown() {
+    running = false;
+  }
+
 private:
-  List<TimedTask> timed_tasks;
+  TimerWheel timers;
   List<std::function<void()>> task_list;
-  // TODO Infer a good timeout value from the minimum wakeup period of tasks
-  //
-  std::chrono::nanoseconds min_timeout;
+  std::atomic<bool> running{false};
 };
 
+// The transport Context an endpoint's tasks should use: executors that keep one Context per
+// thread provide it through context(); otherwise the endpoint creates its own.
+template<typename ExecutorT, typename ContextT>
+auto endpoint_context_impl(ExecutorT & executor, std::unique_ptr<ContextT> &, int)
+-> decltype(static_cast<ContextT &>(executor.context()))
+{
+  return executor.context();
+}
+
+template<typename ExecutorT, typename ContextT>
+ContextT & endpoint_context_impl(ExecutorT &, std::unique_ptr<ContextT> & own_context, long) {
+  if (!own_context) {
+    own_context.reset(new ContextT());
+  }
+  return *own_context;
+}
+
+template<typename ExecutorT, typename ContextT>
+ContextT & endpoint_context(ExecutorT & executor, std::unique_ptr<ContextT> & own_context) {
+  return endpoint_context_impl(executor, own_context, 0);
+}
+
+// Runs callback on the executor's thread, for work such as arming a timer that must not
+// race with the executor: executors with post() run it there, e.g. EpollExecutor. The
+// others run it here; their timers can be armed from any thread, or they have only one.
+template<typename ExecutorT, typename CallbackT>
+auto post_to_executor_impl(ExecutorT & executor, CallbackT && callback, int)
+-> decltype(executor.post(std::function<void()>()), void())
+{
+  executor.post(std::forward<CallbackT>(callback));
+}
+
+template<typename ExecutorT, typename CallbackT>
+void post_to_executor_impl(ExecutorT &, CallbackT && callback, long) {
+  callback();
+}
+
+template<typename ExecutorT, typename CallbackT>
+void post_to_executor(ExecutorT & executor, CallbackT && callback) {
+  post_to_executor_impl(executor, std::forward<CallbackT>(callback), 0);
+}
+
+// Makes a receive_packet call blocked on context return, for Contexts that support it.
+template<typename ContextT>
+auto interrupt_receive_impl(ContextT & context, int)
+-> decltype(context.interrupt_receive(), void())
+{
+  context.interrupt_receive();
+}
+
+template<typename ContextT>
+void interrupt_receive_impl(ContextT &, long) {
+}
+
+template<typename ContextT>
+void interrupt_receive(ContextT & context) {
+  interrupt_receive_impl(context, 0);
+}
+
 // Random:
 // We'll need to implement a "waitset" for rmw
 // please address multithreading and protecting shared memory
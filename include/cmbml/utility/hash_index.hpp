@@ -0,0 +1,183 @@
+#ifndef CMBML__UTILITY__HASH_INDEX_HPP_
+#define CMBML__UTILITY__HASH_INDEX_HPP_
+
+#include <cstring>
+#include <utility>
+
+#include <cmbml/types.hpp>
+
+namespace cmbml {
+
+  // Finalizer from splitmix64: spreads the entropy of a word across all bits.
+  inline uint64_t mix_hash_word(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+  }
+
+  // Views the 16 bytes of a GUID as two 64-bit words.
+  struct GuidKeyTraits {
+    static void to_words(const GUID_t & guid, uint64_t & w0, uint64_t & w1) {
+      static_assert(sizeof(guid.prefix) + sizeof(guid.entity_id) == 16, "GUID_t must be 16 bytes");
+      uint32_t entity;
+      std::memcpy(&w0, guid.prefix.data(), 8);
+      std::memcpy(&w1, guid.prefix.data() + 8, 4);
+      std::memcpy(&entity, guid.entity_id.data(), 4);
+      w1 = (w1 & 0xffffffffULL) | (static_cast<uint64_t>(entity) << 32);
+    }
+
+    static uint64_t hash(const GUID_t & guid) {
+      uint64_t w0, w1;
+      to_words(guid, w0, w1);
+      return mix_hash_word(w0 ^ mix_hash_word(w1));
+    }
+
+    static bool equal(const GUID_t & a, const GUID_t & b) {
+      uint64_t a0, a1, b0, b1;
+      to_words(a, a0, a1);
+      to_words(b, b0, b1);
+      return a0 == b0 && a1 == b1;
+    }
+  };
+
+  struct LocatorKeyTraits {
+    static uint64_t hash(const Locator_t & locator) {
+      uint64_t w0, w1;
+      std::memcpy(&w0, locator.address.data(), 8);
+      std::memcpy(&w1, locator.address.data() + 8, 8);
+      const uint64_t kind_port =
+        (static_cast<uint64_t>(static_cast<uint32_t>(locator.kind)) << 32) | locator.port;
+      return mix_hash_word(w0 ^ mix_hash_word(w1 ^ mix_hash_word(kind_port)));
+    }
+
+    static bool equal(const Locator_t & a, const Locator_t & b) {
+      return a == b;
+    }
+  };
+
+  // Open-addressing hash table (linear probing, backward-shift deletion) mapping a key to a
+  // small value, typically the position of an endpoint in its owner's List.
+  // Capacity is a power of two and the load factor is kept at or below one half.
+  template<typename KeyT, typename ValueT, typename KeyTraits>
+  class HashIndex {
+  public:
+    ValueT * find(const KeyT & key) {
+      if (count == 0) {
+        return nullptr;
+      }
+      for (size_t i = home(key); slots[i].occupied; i = next(i)) {
+        if (KeyTraits::equal(slots[i].key, key)) {
+          return &slots[i].value;
+        }
+      }
+      return nullptr;
+    }
+
+    const ValueT * find(const KeyT & key) const {
+      return const_cast<HashIndex *>(this)->find(key);
+    }
+
+    // Inserts or overwrites. Returns true if the key was not present.
+    bool insert(const KeyT & key, const ValueT & value) {
+      if (2 * (count + 1) > slots.size()) {
+        rehash(slots.empty() ? 16 : 2 * slots.size());
+      }
+      size_t i = home(key);
+      for (; slots[i].occupied; i = next(i)) {
+        if (KeyTraits::equal(slots[i].key, key)) {
+          slots[i].value = value;
+          return false;
+        }
+      }
+      slots[i].key = key;
+      slots[i].value = value;
+      slots[i].occupied = true;
+      ++count;
+      return true;
+    }
+
+    bool erase(const KeyT & key) {
+      if (count == 0) {
+        return false;
+      }
+      size_t i = home(key);
+      for (; slots[i].occupied; i = next(i)) {
+        if (KeyTraits::equal(slots[i].key, key)) {
+          break;
+        }
+      }
+      if (!slots[i].occupied) {
+        return false;
+      }
+      // Shift back the following entries of the probe run so no tombstone is needed.
+      size_t hole = i;
+      for (size_t j = next(i); slots[j].occupied; j = next(j)) {
+        size_t h = home(slots[j].key);
+        // Move j into the hole unless its home lies cyclically in (hole, j].
+        if (((j - h) & mask()) >= ((j - hole) & mask())) {
+          slots[hole] = std::move(slots[j]);
+          hole = j;
+        }
+      }
+      slots[hole].occupied = false;
+      --count;
+      return true;
+    }
+
+    void clear() {
+      for (auto & slot : slots) {
+        slot.occupied = false;
+      }
+      count = 0;
+    }
+
+    size_t size() const {
+      return count;
+    }
+
+  private:
+    struct Slot {
+      KeyT key;
+      ValueT value;
+      bool occupied = false;
+    };
+
+    size_t mask() const {
+      return slots.size() - 1;
+    }
+
+    size_t home(const KeyT & key) const {
+      return KeyTraits::hash(key) & mask();
+    }
+
+    size_t next(size_t i) const {
+      return (i + 1) & mask();
+    }
+
+    void rehash(size_t capacity) {
+      List<Slot> old_slots(capacity);
+      old_slots.swap(slots);
+      count = 0;
+      for (auto & slot : old_slots) {
+        if (slot.occupied) {
+          insert(slot.key, slot.value);
+        }
+      }
+    }
+
+    List<Slot> slots;
+    size_t count = 0;
+  };
+
+  template<typename ValueT>
+  using GuidIndex = HashIndex<GUID_t, ValueT, GuidKeyTraits>;
+
+  template<typename ValueT>
+  using LocatorIndex = HashIndex<Locator_t, ValueT, LocatorKeyTraits>;
+
+}  // namespace cmbml
+
+#endif  // CMBML__UTILITY__HASH_INDEX_HPP_
@@ -0,0 +1,100 @@
+#ifndef CMBML__UTILITY__MPSC_QUEUE_HPP_
+#define CMBML__UTILITY__MPSC_QUEUE_HPP_
+
+#include <atomic>
+#include <utility>
+
+namespace cmbml {
+
+// Unbounded multi-producer single-consumer queue (Vyukov's intrusive MPSC design, with
+// nodes allocated per push). push() is one atomic exchange and never waits for other
+// producers or for the consumer; pop() is called by one thread only.
+template<typename T>
+class MpscQueue {
+public:
+  MpscQueue() : head(&stub), tail(&stub) {}
+
+  ~MpscQueue() {
+    T value;
+    while (pop(value)) {
+    }
+  }
+
+  MpscQueue(const MpscQueue &) = delete;
+  MpscQueue & operator=(const MpscQueue &) = delete;
+
+  // Safe to call from any thread.
+  void push(T && value) {
+    push_node(new Node(std::move(value)));
+  }
+
+  void push(const T & value) {
+    push_node(new Node(value));
+  }
+
+  // Consumer only. Returns false if the queue is empty, or if the only entry is still being
+  // linked by its producer; that entry is returned by a later call.
+  bool pop(T & value) {
+    Node * first = tail;
+    Node * next = first->next.load(std::memory_order_acquire);
+    if (first == &stub) {
+      if (!next) {
+        return false;
+      }
+      // Skip the stub.
+      tail = next;
+      first = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+    if (next) {
+      tail = next;
+      value = std::move(first->value);
+      delete first;
+      return true;
+    }
+    if (first != head.load(std::memory_order_acquire)) {
+      // A producer has swapped head but not linked its node yet.
+      return false;
+    }
+    // first is the last node: put the stub behind it so that it can be unlinked.
+    push_node(&stub);
+    next = first->next.load(std::memory_order_acquire);
+    if (next) {
+      tail = next;
+      value = std::move(first->value);
+      delete first;
+      return true;
+    }
+    return false;
+  }
+
+  // Consumer only; may miss an entry that is being pushed.
+  bool empty() const {
+    return tail == &stub && !stub.next.load(std::memory_order_acquire);
+  }
+
+private:
+  struct Node {
+    Node() = default;
+    explicit Node(T && v) : value(std::move(v)) {}
+    explicit Node(const T & v) : value(v) {}
+
+    std::atomic<Node *> next{nullptr};
+    T value;
+  };
+
+  void push_node(Node * node) {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    Node * previous = head.exchange(node, std::memory_order_acq_rel);
+    previous->next.store(node, std::memory_order_release);
+  }
+
+  Node stub;
+  std::atomic<Node *> head;
+  // Consumer only.
+  Node * tail;
+};
+
+}  // namespace cmbml
+
+#endif  // CMBML__UTILITY__MPSC_QUEUE_HPP_
@@ -0,0 +1,259 @@
+#ifndef CMBML__UTILITY__PINNED_EXECUTOR_HPP_
+#define CMBML__UTILITY__PINNED_EXECUTOR_HPP_
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <cmbml/psm/udp/context.hpp>
+#include <cmbml/types.hpp>
+#include <cmbml/utility/epoll_executor.hpp>
+
+namespace cmbml {
+
+// One event loop thread per configured CPU, pinned to it. Each worker owns a transport
+// Context, with its sockets and receive buffer, used only on that thread; an endpoint is
+// assigned to one worker for its lifetime and uses the worker's Context, e.g.
+//   dds::DataWriter<RTPSWriter, udp::Context, PinnedExecutor<>::Worker> writer;
+//   writer.add_tasks(executor.assign());
+// The endpoints of a worker share its sockets: each socket is read once and every packet
+// is passed to each endpoint's receive callback.
+template<typename ContextT = udp::Context>
+class PinnedExecutor {
+public:
+  class Worker {
+  public:
+    explicit Worker(int cpu_id) : cpu(cpu_id) {}
+
+    Worker(const Worker &) = delete;
+    Worker & operator=(const Worker &) = delete;
+
+    ContextT & context() {
+      return transport_context;
+    }
+
+    template<typename CallbackT, typename ...Args>
+    void add_task(CallbackT && callback, Args &&... args) {
+      std::function<void()> task = [callback, args...]() mutable {
+        callback(args...);
+      };
+      run_on_loop([this, task]() {
+        loop.add_task(task);
+      });
+    }
+
+    // Receive callbacks take the packet as const Packet<> &.
+    using ReceiveCallback = std::function<void(const Packet<> &)>;
+
+    template<typename CallbackT>
+    void add_receiver(ContextT & receive_context, CallbackT && callback) {
+      ReceiveCallback receive = callback;
+      for (int recv_socket : receive_context.receive_sockets()) {
+        add_receive_socket(receive_context, recv_socket, receive);
+      }
+    }
+
+    template<typename CallbackT>
+    void add_receive_socket(ContextT & receive_context, int recv_socket, CallbackT && callback) {
+      ReceiveCallback receive = callback;
+      run_on_loop([this, &receive_context, recv_socket, receive]() {
+        auto found = socket_callbacks.find(recv_socket);
+        if (found != socket_callbacks.end()) {
+          found->second->push_back(receive);
+          return;
+        }
+        // A deque, so a callback may add another without moving the one running.
+        auto callbacks = std::make_shared<std::deque<ReceiveCallback>>(1, receive);
+        socket_callbacks.emplace(recv_socket, callbacks);
+        const size_t id = loop.add_fd(recv_socket, [&receive_context, recv_socket, callbacks]() {
+          auto dispatch = [&callbacks](const Packet<> & packet) {
+            for (size_t i = 0; i < callbacks->size(); ++i) {
+              (*callbacks)[i](packet);
+            }
+          };
+          while (receive_context.receive_from(recv_socket, dispatch)) {
+          }
+        });
+        assert(id != EpollExecutor::invalid_fd_id);
+        (void)id;
+      });
+    }
+
+    using TimedTaskHandle = std::shared_ptr<TimerHandle>;
+
+    template<typename CallbackT, typename ...Args>
+    TimedTaskHandle add_timed_task(
+        const std::chrono::nanoseconds & timeout, bool oneshot, CallbackT && callback,
+        Args &&... args)
+    {
+      std::function<void()> task = [callback, args...]() mutable {
+        callback(args...);
+      };
+      auto handle = std::make_shared<TimerHandle>();
+      run_on_loop([this, timeout, oneshot, task, handle]() {
+        *handle = loop.add_timed_task(timeout, oneshot, task);
+      });
+      return handle;
+    }
+
+    void cancel_timed_task(const TimedTaskHandle & handle) {
+      run_on_loop([this, handle]() {
+        loop.cancel_timed_task(*handle);
+      });
+    }
+
+    int get_cpu() const {
+      return cpu;
+    }
+
+    // False if the CPU couldn't be set, e.g. it isn't in the process's affinity mask.
+    bool is_pinned() const {
+      return pinned;
+    }
+
+    size_t endpoint_count() const {
+      return endpoints;
+    }
+
+  private:
+    friend class PinnedExecutor;
+
+    // Before the loop starts, and on the loop thread, run directly; otherwise hand it over.
+    template<typename CallbackT>
+    void run_on_loop(CallbackT && callback) {
+      if (!started || std::this_thread::get_id() == loop_thread_id) {
+        callback();
+      } else {
+        loop.post(callback);
+      }
+    }
+
+    void start() {
+      started = true;
+      thread = std::thread([this]() {
+        loop_thread_id = std::this_thread::get_id();
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(cpu, &cpu_set);
+        pinned = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0;
+        loop.spin();
+      });
+    }
+
+    const int cpu;
+    std::atomic<bool> pinned{false};
+    std::atomic<bool> started{false};
+    std::atomic<std::thread::id> loop_thread_id;
+    size_t endpoints = 0;
+    // The receive callbacks of each socket the loop reads, used on the loop thread only.
+    std::map<int, std::shared_ptr<std::deque<ReceiveCallback>>> socket_callbacks;
+    ContextT transport_context;
+    EpollExecutor loop;
+    std::thread thread;
+  };
+
+  // One worker per entry of cpus; a CPU may be listed more than once.
+  explicit PinnedExecutor(const List<int> & cpus) {
+    for (int cpu : cpus) {
+      workers.emplace_back(cpu);
+    }
+  }
+
+  ~PinnedExecutor() {
+    shutdown();
+    join_workers();
+  }
+
+  PinnedExecutor(const PinnedExecutor &) = delete;
+  PinnedExecutor & operator=(const PinnedExecutor &) = delete;
+
+  // The worker with the fewest endpoints. Call before spin().
+  Worker & assign() {
+    assert(!workers.empty());
+    Worker * least_loaded = &workers.front();
+    for (auto & worker : workers) {
+      if (worker.endpoints < least_loaded->endpoints) {
+        least_loaded = &worker;
+      }
+    }
+    ++least_loaded->endpoints;
+    return *least_loaded;
+  }
+
+  Worker & get_worker(size_t index) {
+    return workers[index];
+  }
+
+  size_t size() const {
+    return workers.size();
+  }
+
+  // Reads shard i of the Context's receive sockets (see Context::set_receive_shards) on
+  // worker i modulo the number of workers, so receiving scales with the workers while the
+  // datagrams of one shard are handled in order. Each worker calls its own copy of callback.
+  template<typename CallbackT>
+  void add_sharded_receiver(ContextT & receive_context, CallbackT && callback) {
+    for (size_t shard = 0; shard < receive_context.receive_shard_count(); ++shard) {
+      Worker & worker = workers[shard % workers.size()];
+      for (int recv_socket : receive_context.receive_sockets(shard)) {
+        worker.add_receive_socket(receive_context, recv_socket, callback);
+      }
+    }
+  }
+
+  // Starts the workers and blocks until shutdown().
+  void spin() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (stopping) {
+        return;
+      }
+      for (auto & worker : workers) {
+        worker.start();
+      }
+    }
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      stop_condition.wait(lock, [this]() { return stopping; });
+    }
+    join_workers();
+  }
+
+  // Safe to call from any thread, including a worker.
+  void shutdown() {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    for (auto & worker : workers) {
+      worker.loop.shutdown();
+    }
+    stop_condition.notify_all();
+  }
+
+private:
+  void join_workers() {
+    for (auto & worker : workers) {
+      if (worker.thread.joinable()) {
+        worker.thread.join();
+      }
+    }
+  }
+
+  // A deque so that workers, which endpoints refer to, never move.
+  std::deque<Worker> workers;
+  std::mutex mutex;
+  std::condition_variable stop_condition;
+  bool stopping = false;
+};
+
+}  // namespace cmbml
+
+#endif  // CMBML__UTILITY__PINNED_EXECUTOR_HPP_
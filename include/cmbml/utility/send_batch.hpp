@@ -0,0 +1,27 @@
+#ifndef CMBML__UTILITY__SEND_BATCH_HPP_
+#define CMBML__UTILITY__SEND_BATCH_HPP_
+
+namespace cmbml {
+
+namespace detail {
+template<typename...>
+using void_t = void;
+}  // namespace detail
+
+// Batches the sends made through a transport context for its lifetime, if the context
+// supports it (ContextT::SendBatch, e.g. udp::Context); otherwise does nothing.
+template<typename ContextT, typename = void>
+struct ScopedSendBatch {
+  explicit ScopedSendBatch(ContextT &) {}
+};
+
+template<typename ContextT>
+struct ScopedSendBatch<ContextT, detail::void_t<typename ContextT::SendBatch>>
+  : ContextT::SendBatch
+{
+  explicit ScopedSendBatch(ContextT & context) : ContextT::SendBatch(context) {}
+};
+
+}  // namespace cmbml
+
+#endif  // CMBML__UTILITY__SEND_BATCH_HPP_
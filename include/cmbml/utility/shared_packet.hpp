@@ -0,0 +1,74 @@
+#ifndef CMBML__UTILITY__SHARED_PACKET_HPP_
+#define CMBML__UTILITY__SHARED_PACKET_HPP_
+
+#include <memory>
+
+#include <cmbml/cdr/common.hpp>
+#include <cmbml/types.hpp>
+
+namespace cmbml {
+
+// A serialized message that several sends share. A transport that keeps the packet past
+// the send, e.g. for MSG_ZEROCOPY or to hand it to other processes, holds a reference
+// instead of copying it.
+using SharedPacket = std::shared_ptr<const Packet<>>;
+
+namespace detail {
+template<typename SendT>
+auto send_shared_packet_impl(SendT & send, const Locator_t & locator, bool multicast,
+  const SharedPacket & packet, int) -> decltype(send(locator, multicast, packet), void())
+{
+  send(locator, multicast, packet);
+}
+
+template<typename SendT>
+void send_shared_packet_impl(SendT & send, const Locator_t & locator, bool multicast,
+  const SharedPacket & packet, long)
+{
+  send(locator, multicast, *packet);
+}
+
+template<typename ContextT>
+auto context_send_impl(ContextT & context, const Locator_t & locator, bool multicast,
+  const SharedPacket & packet, int) -> decltype(context.unicast_send(locator, packet), void())
+{
+  if (multicast) {
+    context.multicast_send(locator, packet);
+  } else {
+    context.unicast_send(locator, packet);
+  }
+}
+
+template<typename ContextT>
+void context_send_impl(ContextT & context, const Locator_t & locator, bool multicast,
+  const SharedPacket & packet, long)
+{
+  if (multicast) {
+    context.multicast_send(locator, packet->data(), packet->size());
+  } else {
+    context.unicast_send(locator, packet->data(), packet->size());
+  }
+}
+}  // namespace detail
+
+// Calls send(locator, multicast, packet) with the SharedPacket if send takes one, and with
+// the Packet otherwise.
+template<typename SendT>
+void send_shared_packet(SendT & send, const Locator_t & locator, bool multicast,
+  const SharedPacket & packet)
+{
+  detail::send_shared_packet_impl(send, locator, multicast, packet, 0);
+}
+
+// Sends packet through the context's SharedPacket overloads if it has them (udp, shm and
+// loopback Contexts), and as words otherwise.
+template<typename ContextT>
+void context_send(ContextT & context, const Locator_t & locator, bool multicast,
+  const SharedPacket & packet)
+{
+  detail::context_send_impl(context, locator, multicast, packet, 0);
+}
+
+}  // namespace cmbml
+
+#endif  // CMBML__UTILITY__SHARED_PACKET_HPP_
@@ -0,0 +1,201 @@
+#ifndef CMBML__UTILITY__THREAD_POOL_EXECUTOR_HPP_
+#define CMBML__UTILITY__THREAD_POOL_EXECUTOR_HPP_
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <cmbml/types.hpp>
+#include <cmbml/utility/executor.hpp>
+#include <cmbml/utility/timer_wheel.hpp>
+
+namespace cmbml {
+
+// Executor with a fixed pool of worker threads sharing one task queue.
+// The thread calling spin() sleeps until the next timer on the TimerWheel is due and queues
+// its task; a periodic task that is still queued or running when its timer fires again skips
+// that period. There are no polling tasks, which would keep a worker spinning.
+// Each receiver holds a worker that blocks in Context::receive_packet, so the pool needs more
+// threads than receivers. shutdown() interrupts the receive_packet calls of Contexts that
+// have interrupt_receive (udp, shm and loopback Contexts); others are waited for.
+class ThreadPoolExecutor {
+public:
+  explicit ThreadPoolExecutor(size_t num_threads = default_thread_count()) :
+    thread_count(std::max<size_t>(num_threads, 1)) {}
+
+  ThreadPoolExecutor(const ThreadPoolExecutor &) = delete;
+  ThreadPoolExecutor & operator=(const ThreadPoolExecutor &) = delete;
+
+  // spin() must have returned before the executor is destroyed.
+  ~ThreadPoolExecutor() {
+    shutdown();
+    join_workers();
+  }
+
+  // Calls callback(packet) for every packet received by the Context, from a worker that
+  // blocks in Context::receive_packet. The receive loop never runs on two workers at once.
+  template<typename ContextT, typename CallbackT>
+  void add_receiver(ContextT & context, CallbackT && callback) {
+    auto receive = std::make_shared<std::function<void()>>([&context, callback]() {
+      context.receive_packet(callback);
+    });
+    std::lock_guard<std::mutex> lock(mutex);
+    receive_loops.push_back(receive);
+    receive_interrupts.push_back([&context]() { interrupt_receive(context); });
+    if (spinning) {
+      enqueue_receive(receive);
+    }
+  }
+
+  template<typename CallbackT, typename ...Args>
+  TimerHandle add_timed_task(
+      const std::chrono::nanoseconds & timeout, bool oneshot, CallbackT && callback, Args &&... args)
+  {
+    auto task = std::make_shared<PoolTimedTask>();
+    task->callback = [callback, args...]() mutable {
+      callback(args...);
+    };
+    std::lock_guard<std::mutex> lock(mutex);
+    TimerHandle handle = timers.arm(
+      timeout,
+      [this, task]() { enqueue_timed_task(task); },
+      oneshot ? std::chrono::nanoseconds(0) : timeout
+    );
+    timer_condition.notify_one();
+    return handle;
+  }
+
+  bool cancel_timed_task(const TimerHandle & handle) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return timers.cancel(handle);
+  }
+
+  // Starts the workers and dispatches timed tasks until shutdown() is called.
+  void spin() {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (stopping) {
+      return;
+    }
+    spinning = true;
+    for (size_t i = workers.size(); i < thread_count; ++i) {
+      workers.emplace_back([this]() { worker_loop(); });
+    }
+    for (const auto & receive : receive_loops) {
+      enqueue_receive(receive);
+    }
+
+    while (!stopping) {
+      timers.expire();
+      const auto next_wakeup = timers.next_wakeup();
+      if (next_wakeup == std::chrono::steady_clock::time_point::max()) {
+        timer_condition.wait(lock);
+      } else {
+        timer_condition.wait_until(lock, next_wakeup);
+      }
+    }
+    spinning = false;
+    lock.unlock();
+    join_workers();
+  }
+
+  // Stops the executor: queued work is dropped and spin() returns once the running tasks
+  // finish. Safe to call from any thread, including from a task. Only the first call
+  // interrupts the receivers: by a later one, such as the destructor's, their Contexts may be
+  // gone.
+  void shutdown() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (stopping) {
+      return;
+    }
+    stopping = true;
+    work_queue.clear();
+    for (const auto & interrupt : receive_interrupts) {
+      interrupt();
+    }
+    work_condition.notify_all();
+    timer_condition.notify_all();
+  }
+
+  static size_t default_thread_count() {
+    return std::max(std::thread::hardware_concurrency(), 2u);
+  }
+
+private:
+  struct PoolTimedTask {
+    std::function<void()> callback;
+    // Queued or running.
+    bool in_flight = false;
+  };
+
+  // The following assume mutex is held.
+  // receive_packet returns after a batch of packets, so the loop is queued again behind the
+  // work the packets caused instead of keeping its worker.
+  void enqueue_receive(const std::shared_ptr<std::function<void()>> & receive) {
+    work_queue.push_back([this, receive]() {
+      (*receive)();
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!stopping) {
+        enqueue_receive(receive);
+      }
+    });
+    work_condition.notify_one();
+  }
+
+  void enqueue_timed_task(const std::shared_ptr<PoolTimedTask> & task) {
+    if (task->in_flight) {
+      return;
+    }
+    task->in_flight = true;
+    work_queue.push_back([this, task]() {
+      task->callback();
+      std::lock_guard<std::mutex> lock(mutex);
+      task->in_flight = false;
+    });
+    work_condition.notify_one();
+  }
+
+  void worker_loop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      work_condition.wait(lock, [this]() { return stopping || !work_queue.empty(); });
+      if (stopping) {
+        return;
+      }
+      auto work = std::move(work_queue.front());
+      work_queue.pop_front();
+      lock.unlock();
+      work();
+      lock.lock();
+    }
+  }
+
+  void join_workers() {
+    for (auto & worker : workers) {
+      if (worker.joinable()) {
+        worker.join();
+      }
+    }
+  }
+
+  const size_t thread_count;
+  List<std::thread> workers;
+
+  std::mutex mutex;
+  std::condition_variable work_condition;
+  std::condition_variable timer_condition;
+  std::deque<std::function<void()>> work_queue;
+  List<std::shared_ptr<std::function<void()>>> receive_loops;
+  List<std::function<void()>> receive_interrupts;
+  TimerWheel timers;
+  bool spinning = false;
+  bool stopping = false;
+};
+
+}  // namespace cmbml
+
+#endif  // CMBML__UTILITY__THREAD_POOL_EXECUTOR_HPP_
@@ -0,0 +1,106 @@
+#ifndef CMBML__UTILITY__TIMER_WHEEL_HPP_
+#define CMBML__UTILITY__TIMER_WHEEL_HPP_
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+
+#include <cmbml/types.hpp>
+
+namespace cmbml {
+
+  // Refers to a timer armed on a TimerWheel. Handles to timers that fired (one-shot) or were
+  // cancelled go stale and are rejected.
+  struct TimerHandle {
+    static const uint32_t invalid_index = std::numeric_limits<uint32_t>::max();
+    uint32_t index = invalid_index;
+    uint32_t generation = 0;
+
+    bool valid() const {
+      return index != invalid_index;
+    }
+  };
+
+  // Hierarchical timing wheel (Varghese & Lauck) for one-shot and periodic timers.
+  // Time is counted in ticks of `resolution`. Level l has 64 slots of 64^l ticks each; a timer
+  // goes in the level that spans its remaining time and moves down a level ("cascades") when
+  // time reaches its slot. Timers further out than the top level wait in it and are
+  // reinserted when it cascades.
+  // Arm and cancel are O(1). An occupancy bitmap per level finds the next slot with timers
+  // without visiting empty ones.
+  class TimerWheel {
+  public:
+    using Clock = std::chrono::steady_clock;
+    static const size_t slot_bits = 6;
+    static const size_t slots_per_level = 1 << slot_bits;
+    static const size_t levels = 4;
+
+    explicit TimerWheel(
+      std::chrono::nanoseconds resolution = std::chrono::milliseconds(1),
+      Clock::time_point start = Clock::now());
+
+    // Calls callback once delay has passed, then every period if period is nonzero.
+    TimerHandle arm(
+      std::chrono::nanoseconds delay, std::function<void()> callback,
+      std::chrono::nanoseconds period = std::chrono::nanoseconds(0),
+      Clock::time_point now = Clock::now());
+    // Returns false if the handle is stale. Safe to call from a timer callback.
+    bool cancel(const TimerHandle & handle);
+    bool is_armed(const TimerHandle & handle) const;
+
+    // Runs the callbacks of every timer due at or before now; returns how many fired.
+    // Callbacks may arm and cancel timers.
+    size_t expire(Clock::time_point now = Clock::now());
+
+    // When the earliest timer is due, or Clock::time_point::max() if none is armed.
+    Clock::time_point next_wakeup() const;
+
+    size_t size() const {
+      return armed_count;
+    }
+
+    bool empty() const {
+      return armed_count == 0;
+    }
+
+  private:
+    enum class TimerState : uint8_t { free, armed, running, cancelled };
+
+    struct Timer {
+      std::function<void()> callback;
+      uint64_t expires = 0;
+      uint64_t period = 0;
+      uint32_t prev = TimerHandle::invalid_index;
+      uint32_t next = TimerHandle::invalid_index;
+      uint32_t generation = 0;
+      uint8_t level = 0;
+      uint8_t slot = 0;
+      TimerState state = TimerState::free;
+    };
+
+    uint64_t ticks_until(Clock::time_point time_point, bool round_up) const;
+    // Earliest tick after current_tick at which a slot must be cascaded or run.
+    uint64_t next_event_tick() const;
+
+    void insert(uint32_t index);
+    void unlink(uint32_t index);
+    void release(uint32_t index);
+    void cascade(size_t level, size_t slot);
+    size_t run_slot(size_t slot);
+
+    std::chrono::nanoseconds resolution;
+    Clock::time_point start;
+    uint64_t current_tick = 0;
+    size_t armed_count = 0;
+
+    List<Timer> timers;
+    List<uint32_t> free_timers;
+    std::array<std::array<uint32_t, slots_per_level>, levels> slot_heads;
+    std::array<uint64_t, levels> occupied = {{0}};
+  };
+
+}  // namespace cmbml
+
+#endif  // CMBML__UTILITY__TIMER_WHEEL_HPP_
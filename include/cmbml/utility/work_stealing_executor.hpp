@@ -0,0 +1,150 @@
+#ifndef CMBML__UTILITY__WORK_STEALING_EXECUTOR_HPP_
+#define CMBML__UTILITY__WORK_STEALING_EXECUTOR_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <cmbml/types.hpp>
+#include <cmbml/utility/epoll_executor.hpp>
+
+namespace cmbml {
+
+// Multi-threaded executor for processes hosting many endpoints.
+// Work is submitted through Strands, one per endpoint: a Strand runs its work in order and
+// never on two threads at once, so an endpoint's state machine needs no locking. A Strand
+// with pending work sits in one worker's deque; workers take from the back of their own
+// deque and, when it is empty, steal from the front of the others'.
+// Sockets and timers are watched by one reactor thread (an EpollExecutor), which only posts
+// work to the Strands. There are no polling tasks: all of a Strand's work comes from its
+// sockets, its timers and post().
+class WorkStealingExecutor {
+public:
+  // Implements the Executor interface of dds::DataWriter and dds::DataReader, e.g.
+  //   dds::DataWriter<RTPSWriter, udp::Context, WorkStealingExecutor::Strand> writer;
+  //   writer.add_tasks(executor.make_strand());
+  class Strand {
+  public:
+    explicit Strand(WorkStealingExecutor & owner) : executor(owner) {}
+
+    Strand(const Strand &) = delete;
+    Strand & operator=(const Strand &) = delete;
+
+    // Runs callback on the strand. Safe to call from any thread.
+    void post(std::function<void()> callback);
+
+    // Packets are read on the strand; the socket is rearmed with the reactor once it has
+    // been drained, so a busy socket doesn't queue the strand more than once.
+    template<typename ContextT, typename CallbackT>
+    void add_receiver(ContextT & context, CallbackT && callback) {
+      for (int recv_socket : context.receive_sockets()) {
+        auto id = std::make_shared<size_t>(0);
+        auto read_socket = [this, &context, recv_socket, callback, id]() {
+          while (context.receive_from(recv_socket, callback)) {
+          }
+          executor.reactor.rearm_fd(recv_socket, *id);
+        };
+        executor.reactor.post([this, recv_socket, read_socket, id]() {
+          *id = executor.reactor.add_fd(recv_socket, [this, read_socket]() {
+            post(read_socket);
+          }, true);
+        });
+      }
+    }
+
+    using TimedTaskHandle = std::shared_ptr<TimerHandle>;
+
+    template<typename CallbackT, typename ...Args>
+    TimedTaskHandle add_timed_task(
+        const std::chrono::nanoseconds & timeout, bool oneshot, CallbackT && callback,
+        Args &&... args)
+    {
+      std::function<void()> task = [callback, args...]() mutable {
+        callback(args...);
+      };
+      auto handle = std::make_shared<TimerHandle>();
+      executor.reactor.post([this, timeout, oneshot, task, handle]() {
+        *handle = executor.reactor.add_timed_task(timeout, oneshot, [this, task]() {
+          post(task);
+        });
+      });
+      return handle;
+    }
+
+    void cancel_timed_task(const TimedTaskHandle & handle) {
+      executor.reactor.post([this, handle]() {
+        executor.reactor.cancel_timed_task(*handle);
+      });
+    }
+
+  private:
+    friend class WorkStealingExecutor;
+
+    // Called by a worker: runs up to run_budget callbacks, then yields the worker.
+    void run();
+
+    static const size_t run_budget = 64;
+
+    WorkStealingExecutor & executor;
+    std::mutex mutex;
+    std::deque<std::function<void()>> queue;
+    // Queued on a worker or running.
+    bool scheduled = false;
+  };
+
+  explicit WorkStealingExecutor(size_t num_workers = default_worker_count());
+  ~WorkStealingExecutor();
+
+  WorkStealingExecutor(const WorkStealingExecutor &) = delete;
+  WorkStealingExecutor & operator=(const WorkStealingExecutor &) = delete;
+
+  // Strands live as long as the executor.
+  Strand & make_strand();
+
+  // Starts the workers and runs the reactor on this thread until shutdown().
+  void spin();
+
+  // Stops the workers and the reactor; pending work is dropped. Safe to call from any thread.
+  void shutdown();
+
+  static size_t default_worker_count() {
+    return std::max(std::thread::hardware_concurrency(), 1u);
+  }
+
+private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Strand *> strands;
+    std::thread thread;
+  };
+
+  // A strand that yields goes to the front of the deque: last for its worker, first to steal.
+  void schedule(Strand * strand, bool yield = false);
+  Strand * pop(size_t worker_index);
+  Strand * steal(size_t thief_index);
+  void worker_loop(size_t worker_index);
+
+  EpollExecutor reactor;
+  std::deque<Worker> workers;
+
+  std::mutex strands_mutex;
+  std::deque<std::unique_ptr<Strand>> strands;
+
+  // Strands waiting in worker deques, and workers waiting for them.
+  std::atomic<size_t> queued_strands{0};
+  std::atomic<size_t> idle_workers{0};
+  std::atomic<size_t> next_worker{0};
+  std::mutex idle_mutex;
+  std::condition_variable idle_condition;
+  std::atomic<bool> stopping{false};
+};
+
+}  // namespace cmbml
+
+#endif  // CMBML__UTILITY__WORK_STEALING_EXECUTOR_HPP_
@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <cassert>
+#include <cmbml/structure/change_window.hpp>
+
+using namespace cmbml;
+
+// Selects the low bit of every 2-bit entry in a word.
+static const uint64_t low_bits = 0x5555555555555555ULL;
+static const size_t entries_per_word = 32;
+
+static const uint64_t status_unknown = 0x0;
+static const uint64_t status_missing = 0x1;
+static const uint64_t status_received = 0x2;
+static const uint64_t status_lost = 0x3;
+
+// Mask of the low bits of n entries starting at entry offset off within a word.
+static uint64_t entry_mask(size_t off, size_t n) {
+  uint64_t mask = n == entries_per_word ? low_bits : ((1ULL << (2 * n)) - 1) & low_bits;
+  return mask << (2 * off);
+}
+
+// Calls callback(word, mask) for every word overlapping the ring positions of the
+// sequence numbers in [first, last), where mask selects the low bit of each entry covered.
+template<typename CallbackT>
+void ChangeWindow::for_each_word(uint64_t first, uint64_t last, CallbackT && callback) {
+  first = std::max(first, base);
+  last = std::min(last, base + capacity);
+  if (first >= last) {
+    return;
+  }
+  size_t pos = ring_position(first);
+  uint64_t remaining = last - first;
+  while (remaining) {
+    const size_t off = pos % entries_per_word;
+    const size_t n = std::min<uint64_t>(remaining, entries_per_word - off);
+    callback(words[pos / entries_per_word], entry_mask(off, n));
+    remaining -= n;
+    pos = (pos + n) % capacity;
+  }
+}
+
+void ChangeWindow::slide() {
+  const uint64_t old_base = base;
+  while (true) {
+    const size_t off = head % entries_per_word;
+    uint64_t & word = words[head / entries_per_word];
+    const uint64_t not_available = ~(word >> 1) & entry_mask(off, entries_per_word - off);
+    const size_t n = not_available ?
+      static_cast<size_t>(__builtin_ctzll(not_available)) / 2 - off : entries_per_word - off;
+    if (n == 0) {
+      break;
+    }
+    // The entries are recycled for the sequence numbers entering at the end of the window.
+    const uint64_t mask = entry_mask(off, n);
+    word &= ~(mask | (mask << 1));
+    head = (head + n) % capacity;
+    base += n;
+  }
+  // Recycled entries for changes the writer already announced are missing, not unknown.
+  if (base != old_base && last_announced >= old_base + capacity) {
+    for_each_word(old_base + capacity, last_announced + 1, [](uint64_t & word, uint64_t mask) {
+      word |= mask;
+    });
+  }
+}
+
+ChangeFromWriterStatus ChangeWindow::status(uint64_t seq) const {
+  if (seq < base) {
+    return ChangeFromWriterStatus::received;
+  }
+  if (seq >= base + capacity) {
+    return seq <= last_announced ?
+      ChangeFromWriterStatus::missing : ChangeFromWriterStatus::unknown;
+  }
+  const size_t pos = ring_position(seq);
+  switch ((words[pos / entries_per_word] >> (2 * (pos % entries_per_word))) & 0x3) {
+    case status_missing:
+      return ChangeFromWriterStatus::missing;
+    case status_received:
+      return ChangeFromWriterStatus::received;
+    case status_lost:
+      return ChangeFromWriterStatus::lost;
+    default:
+      return ChangeFromWriterStatus::unknown;
+  }
+}
+
+void ChangeWindow::set_received(uint64_t seq) {
+  if (seq < base) {
+    return;
+  }
+  if (seq >= base + capacity) {
+    // The window cannot track older changes past this one; give up on them.
+    update_lost(seq - capacity + 1);
+  }
+  const size_t pos = ring_position(seq);
+  const size_t shift = 2 * (pos % entries_per_word);
+  uint64_t & word = words[pos / entries_per_word];
+  word = (word & ~(status_lost << shift)) | (status_received << shift);
+  slide();
+}
+
+void ChangeWindow::update_lost(uint64_t first_available) {
+  if (first_available <= base) {
+    return;
+  }
+  if (first_available >= base + capacity) {
+    // Everything in the window is now received or lost.
+    words.fill(0);
+    head = 0;
+    base = first_available;
+    if (last_announced >= base) {
+      update_missing(last_announced);
+    }
+    slide();
+    return;
+  }
+  // Entries without the "available" bit become lost; received entries keep their status.
+  for_each_word(base, first_available, [](uint64_t & word, uint64_t mask) {
+    const uint64_t lost = ~(word >> 1) & mask;
+    word |= lost | (lost << 1);
+  });
+  slide();
+}
+
+void ChangeWindow::update_missing(uint64_t last_available) {
+  last_announced = std::max(last_announced, last_available);
+  // Only unknown entries (both bits clear) become missing.
+  for_each_word(base, last_available + 1, [](uint64_t & word, uint64_t mask) {
+    word |= ~word & ~(word >> 1) & mask;
+  });
+}
+
+List<SequenceNumber_t> ChangeWindow::missing() const {
+  List<SequenceNumber_t> ret;
+  const size_t num_words = words.size();
+  const size_t head_word = head / entries_per_word;
+  const size_t head_off = head % entries_per_word;
+  // Walk the ring from head so the result is in ascending order. The head word is visited
+  // twice: first for the entries at or after head, last for the ones that wrapped around.
+  for (size_t i = 0; i <= num_words; ++i) {
+    const size_t word_index = (head_word + i) % num_words;
+    const uint64_t word = words[word_index];
+    uint64_t mask = low_bits;
+    if (i == 0) {
+      mask = entry_mask(head_off, entries_per_word - head_off);
+    } else if (i == num_words) {
+      mask = head_off ? entry_mask(0, head_off) : 0;
+    }
+    uint64_t missing_bits = word & ~(word >> 1) & mask;
+    while (missing_bits) {
+      const size_t entry = static_cast<size_t>(__builtin_ctzll(missing_bits)) / 2;
+      const size_t pos = word_index * entries_per_word + entry;
+      ret.push_back(SequenceNumber_t::from_value(base + (pos + capacity - head) % capacity));
+      missing_bits &= missing_bits - 1;
+    }
+  }
+  return ret;
+}
+
+bool ChangeWindow::has_missing() const {
+  if (last_announced >= base + capacity) {
+    return true;
+  }
+  return std::any_of(words.begin(), words.end(), [](uint64_t word) {
+    return (word & ~(word >> 1) & low_bits) != 0;
+  });
+}
@@ -0,0 +1,154 @@
+#include <cmbml/utility/epoll_executor.hpp>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <limits>
+
+using namespace cmbml;
+
+// epoll_event data of the eventfd; handlers are indexed from 0.
+static const uint64_t event_fd_tag = std::numeric_limits<uint64_t>::max();
+
+EpollExecutor::EpollExecutor() {
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  assert(epoll_fd >= 0);
+  event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  assert(event_fd >= 0);
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.u64 = event_fd_tag;
+  int result = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event_fd, &event);
+  assert(result == 0);
+  (void)result;
+}
+
+EpollExecutor::~EpollExecutor() {
+  if (event_fd >= 0) {
+    close(event_fd);
+  }
+  if (epoll_fd >= 0) {
+    close(epoll_fd);
+  }
+}
+
+size_t EpollExecutor::add_fd(int fd, std::function<void()> on_readable, bool oneshot) {
+  struct epoll_event event = {};
+  event.events = oneshot ? EPOLLIN | EPOLLONESHOT : EPOLLIN;
+  event.data.u64 = fd_handlers.size();
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+    return invalid_fd_id;
+  }
+  fd_handlers.push_back(FdHandler{fd, true, std::move(on_readable)});
+  return event.data.u64;
+}
+
+void EpollExecutor::rearm_fd(int fd, size_t id) {
+  assert(id != invalid_fd_id);
+  struct epoll_event event = {};
+  event.events = EPOLLIN | EPOLLONESHOT;
+  event.data.u64 = id;
+  epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+}
+
+void EpollExecutor::remove_fd(int fd) {
+  for (auto & handler : fd_handlers) {
+    if (handler.fd == fd && handler.active) {
+      epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+      // The handler may be the one running, so don't destroy it.
+      handler.active = false;
+    }
+  }
+}
+
+void EpollExecutor::post(std::function<void()> callback) {
+  {
+    std::lock_guard<std::mutex> lock(posted_mutex);
+    posted.push_back(std::move(callback));
+  }
+  wake();
+}
+
+void EpollExecutor::shutdown() {
+  running = false;
+  wake();
+}
+
+void EpollExecutor::wake() {
+  const uint64_t one = 1;
+  ssize_t written = write(event_fd, &one, sizeof(one));
+  (void)written;
+}
+
+void EpollExecutor::run_posted() {
+  uint64_t count;
+  ssize_t bytes_read = read(event_fd, &count, sizeof(count));
+  (void)bytes_read;
+  List<std::function<void()>> callbacks;
+  {
+    std::lock_guard<std::mutex> lock(posted_mutex);
+    callbacks.swap(posted);
+  }
+  for (auto & callback : callbacks) {
+    callback();
+  }
+}
+
+int EpollExecutor::wait_timeout() const {
+  if (!task_list.empty()) {
+    return 0;
+  }
+  const auto next_wakeup = timers.next_wakeup();
+  if (next_wakeup == TimerWheel::Clock::time_point::max()) {
+    return -1;
+  }
+  const auto now = TimerWheel::Clock::now();
+  if (next_wakeup <= now) {
+    return 0;
+  }
+  // Round up so the loop doesn't wake just before the timer is due.
+  const auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+    next_wakeup - now + std::chrono::milliseconds(1) - std::chrono::nanoseconds(1));
+  return static_cast<int>(
+    std::min<std::chrono::milliseconds::rep>(wait.count(), std::numeric_limits<int>::max()));
+}
+
+void EpollExecutor::spin() {
+  while (running) {
+    if (!spin_once()) {
+      return;
+    }
+  }
+}
+
+bool EpollExecutor::spin_once(bool block) {
+  std::array<struct epoll_event, 64> events;
+  const int timeout = block ? wait_timeout() : 0;
+  const int num_events = epoll_wait(epoll_fd, events.data(), events.size(), timeout);
+  if (num_events < 0) {
+    // A signal interrupted the wait: spin again. Anything else (EBADF, EFAULT, EINVAL) means
+    // the epoll instance is unusable, so the loop stops.
+    assert(errno == EINTR);
+    return errno == EINTR;
+  }
+  for (int i = 0; i < num_events; ++i) {
+    const uint64_t tag = events[i].data.u64;
+    if (tag == event_fd_tag) {
+      run_posted();
+    } else if (tag < fd_handlers.size() && fd_handlers[tag].active) {
+      fd_handlers[tag].on_readable();
+    }
+  }
+
+  timers.expire();
+  for (auto & task : task_list) {
+    task();
+  }
+  return true;
+}
@@ -0,0 +1,211 @@
+#include <cmbml/structure/flow_controller.hpp>
+
+#include <algorithm>
+#include <cassert>
+
+using namespace cmbml;
+
+static size_t datagram_bytes(const Packet<> & packet) {
+  return packet.size() * sizeof(Packet<>::value_type);
+}
+
+TokenBucket::TokenBucket(uint64_t bytes_per_second, size_t burst_bytes, FlowClock::time_point now)
+: rate(bytes_per_second), capacity(static_cast<double>(burst_bytes)), tokens(capacity),
+  last_refill(now)
+{
+}
+
+void TokenBucket::refill(FlowClock::time_point now) {
+  if (now <= last_refill) {
+    return;
+  }
+  const double elapsed = std::chrono::duration<double>(now - last_refill).count();
+  tokens = std::min(capacity, tokens + elapsed * rate);
+  last_refill = now;
+}
+
+bool TokenBucket::can_consume(size_t bytes, FlowClock::time_point now) {
+  if (unlimited()) {
+    return true;
+  }
+  refill(now);
+  return tokens >= std::min(static_cast<double>(bytes), capacity);
+}
+
+void TokenBucket::consume(size_t bytes) {
+  if (!unlimited()) {
+    tokens -= bytes;
+  }
+}
+
+FlowClock::time_point TokenBucket::available_at(size_t bytes, FlowClock::time_point now) {
+  if (can_consume(bytes, now)) {
+    return now;
+  }
+  const double missing = std::min(static_cast<double>(bytes), capacity) - tokens;
+  return now + std::chrono::duration_cast<FlowClock::duration>(
+    std::chrono::duration<double>(missing / rate));
+}
+
+FlowController::FlowController(const FlowLimits & limits, FlowClock::time_point now)
+: bucket(limits.bytes_per_second, limits.burst_bytes, now),
+  max_datagrams_per_period(limits.max_datagrams_per_period), period(limits.period),
+  period_start(now)
+{
+}
+
+FlowController::~FlowController() {
+  if (participant) {
+    participant->detach(*this);
+  }
+}
+
+std::mutex & FlowController::flow_mutex() {
+  return participant ? participant->mutex : own_mutex;
+}
+
+void FlowController::enqueue(const Locator_t & locator, bool multicast, const Packet<> & packet) {
+  std::lock_guard<std::mutex> lock(flow_mutex());
+  queue.push_back(QueuedDatagram{locator, multicast, packet});
+}
+
+bool FlowController::admits(size_t bytes, FlowClock::time_point now) {
+  if (max_datagrams_per_period != 0) {
+    if (now >= period_start + period) {
+      period_start = now;
+      datagrams_in_period = 0;
+    }
+    if (datagrams_in_period >= max_datagrams_per_period) {
+      return false;
+    }
+  }
+  return bucket.can_consume(bytes, now);
+}
+
+void FlowController::account(size_t bytes) {
+  bucket.consume(bytes);
+  ++datagrams_in_period;
+}
+
+bool FlowController::send_front(FlowClock::time_point now) {
+  if (queue.empty()) {
+    return false;
+  }
+  const size_t bytes = datagram_bytes(queue.front().packet);
+  if (!admits(bytes, now)) {
+    return false;
+  }
+  if (participant && !participant->shared.admits(bytes, now)) {
+    return false;
+  }
+  account(bytes);
+  if (participant) {
+    participant->shared.account(bytes);
+  }
+  const QueuedDatagram datagram = std::move(queue.front());
+  queue.pop_front();
+  assert(transport);
+  transport(datagram.locator, datagram.multicast, datagram.packet);
+  return true;
+}
+
+size_t FlowController::flush(FlowClock::time_point now) {
+  if (participant) {
+    return participant->flush(now);
+  }
+  std::lock_guard<std::mutex> lock(own_mutex);
+  size_t sent = 0;
+  while (send_front(now)) {
+    ++sent;
+  }
+  return sent;
+}
+
+FlowClock::time_point FlowController::own_flush_time(FlowClock::time_point now) {
+  if (queue.empty()) {
+    return FlowClock::time_point::max();
+  }
+  FlowClock::time_point ready = bucket.available_at(datagram_bytes(queue.front().packet), now);
+  if (max_datagrams_per_period != 0 && datagrams_in_period >= max_datagrams_per_period) {
+    ready = std::max(ready, period_start + period);
+  }
+  return ready;
+}
+
+FlowClock::time_point FlowController::next_flush_time(FlowClock::time_point now) {
+  if (participant) {
+    return participant->next_flush_time(now);
+  }
+  std::lock_guard<std::mutex> lock(own_mutex);
+  return own_flush_time(now);
+}
+
+ParticipantFlowController::ParticipantFlowController(
+  const FlowLimits & limits, FlowClock::time_point now)
+: shared(limits, now)
+{
+}
+
+ParticipantFlowController::~ParticipantFlowController() {
+  for (FlowController * writer : writers) {
+    writer->participant = nullptr;
+  }
+}
+
+void ParticipantFlowController::attach(FlowController & writer) {
+  std::lock_guard<std::mutex> lock(mutex);
+  assert(!writer.participant);
+  writer.participant = this;
+  writers.push_back(&writer);
+}
+
+void ParticipantFlowController::detach(FlowController & writer) {
+  std::lock_guard<std::mutex> lock(mutex);
+  writers.erase(std::remove(writers.begin(), writers.end(), &writer), writers.end());
+  writer.participant = nullptr;
+  next_writer = 0;
+}
+
+size_t ParticipantFlowController::flush(FlowClock::time_point now) {
+  std::lock_guard<std::mutex> lock(mutex);
+  size_t sent = 0;
+  bool progress = true;
+  while (progress && !writers.empty()) {
+    progress = false;
+    // One datagram per writer per round, starting where the last flush stopped.
+    for (size_t i = 0; i < writers.size(); ++i) {
+      const size_t index = (next_writer + i) % writers.size();
+      if (writers[index]->send_front(now)) {
+        ++sent;
+        progress = true;
+      } else if (!writers[index]->queue.empty() &&
+        !shared.admits(datagram_bytes(writers[index]->queue.front().packet), now))
+      {
+        // Out of shared budget: this writer goes first next time.
+        next_writer = index;
+        return sent;
+      }
+    }
+  }
+  return sent;
+}
+
+FlowClock::time_point ParticipantFlowController::next_flush_time(FlowClock::time_point now) {
+  std::lock_guard<std::mutex> lock(mutex);
+  FlowClock::time_point first = FlowClock::time_point::max();
+  for (FlowController * writer : writers) {
+    if (writer->queue.empty()) {
+      continue;
+    }
+    const size_t bytes = datagram_bytes(writer->queue.front().packet);
+    FlowClock::time_point ready = std::max(
+      writer->own_flush_time(now), shared.bucket.available_at(bytes, now));
+    if (shared.max_datagrams_per_period != 0 &&
+      shared.datagrams_in_period >= shared.max_datagrams_per_period)
+    {
+      ready = std::max(ready, shared.period_start + shared.period);
+    }
+    first = std::min(first, ready);
+  }
+  return first;
+}
@@ -1,6 +1,7 @@
 #include <algorithm>
 #include <cassert>
 #include <cmbml/structure/history.hpp>
+#include <cmbml/message/data.hpp>
 
 using namespace cmbml;
 
@@ -39,13 +40,28 @@ void HistoryCache::clear() {
   changes.clear();
 }
 
+// The GUID prefix of the writer is not part of the DATA submessage and is left unknown.
+CacheChange::CacheChange(const Data & d) :
+  kind(ChangeKind_t::alive), sequence_number(d.writer_sn_state.base), data(d.payload)
+{
+  writer_guid.prefix = guid_prefix_unknown;
+  writer_guid.entity_id = d.writer_id;
+}
+
+CacheChange::CacheChange(Data && d) :
+  kind(ChangeKind_t::alive), sequence_number(d.writer_sn_state.base), data(std::move(d.payload))
+{
+  writer_guid.prefix = guid_prefix_unknown;
+  writer_guid.entity_id = d.writer_id;
+}
+
 CacheChange::CacheChange(ChangeKind_t k, InstanceHandle_t && h, const GUID_t & g) :
   kind(k), instance_handle(h), writer_guid(g)
 {
 }
 
-CacheChange::CacheChange(ChangeKind_t k, Data && data, InstanceHandle_t && h, const GUID_t & g) :
-  kind(k), instance_handle(h), writer_guid(g)
+CacheChange::CacheChange(ChangeKind_t k, Data && d, InstanceHandle_t && h, const GUID_t & g) :
+  kind(k), instance_handle(h), writer_guid(g), data(std::move(d.payload))
 {
 }
 
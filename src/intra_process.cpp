@@ -0,0 +1,83 @@
+#include <algorithm>
+#include <cassert>
+
+#include <cmbml/structure/intra_process.hpp>
+
+using namespace cmbml;
+
+LocalReader::LocalReader(const GUID_t & reader_guid, const List<Locator_t> & unicast_locators,
+  DeliverT && deliver) :
+  guid(reader_guid), unicast_locator_list(unicast_locators), deliver_change(std::move(deliver))
+{
+}
+
+bool LocalReader::deliver(CacheChange && change) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  if (!deliver_change) {
+    return false;
+  }
+  deliver_change(std::move(change));
+  return true;
+}
+
+void LocalReader::detach() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  deliver_change = nullptr;
+}
+
+IntraProcessRegistry & IntraProcessRegistry::instance() {
+  static IntraProcessRegistry registry;
+  return registry;
+}
+
+std::shared_ptr<LocalReader> IntraProcessRegistry::add_reader(const GUID_t & guid,
+  const List<Locator_t> & unicast_locators, LocalReader::DeliverT deliver)
+{
+  assert(deliver);
+  auto reader = std::make_shared<LocalReader>(guid, unicast_locators, std::move(deliver));
+  std::lock_guard<std::mutex> lock(mutex);
+  assert(std::none_of(readers.begin(), readers.end(),
+    [&guid](const std::shared_ptr<LocalReader> & r) { return r->guid == guid; }));
+  readers.push_back(reader);
+  return reader;
+}
+
+void IntraProcessRegistry::remove_reader(const GUID_t & guid) {
+  std::shared_ptr<LocalReader> removed;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = std::find_if(readers.begin(), readers.end(),
+      [&guid](const std::shared_ptr<LocalReader> & r) { return r->guid == guid; });
+    if (it == readers.end()) {
+      return;
+    }
+    removed = std::move(*it);
+    readers.erase(it);
+  }
+  // Waits for a delivery in progress to finish.
+  removed->detach();
+}
+
+std::shared_ptr<LocalReader> IntraProcessRegistry::find_reader(const GUID_t & guid) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  for (const auto & reader : readers) {
+    if (reader->guid == guid) {
+      return reader;
+    }
+  }
+  return nullptr;
+}
+
+List<std::shared_ptr<LocalReader>> IntraProcessRegistry::find_readers(
+  const Locator_t & locator) const
+{
+  List<std::shared_ptr<LocalReader>> found;
+  std::lock_guard<std::mutex> lock(mutex);
+  for (const auto & reader : readers) {
+    const auto & locators = reader->unicast_locator_list;
+    if (std::find(locators.begin(), locators.end(), locator) != locators.end()) {
+      found.push_back(reader);
+    }
+  }
+  return found;
+}
@@ -0,0 +1,397 @@
+#include <cmbml/psm/loopback/context.hpp>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+using namespace cmbml;
+
+loopback::Switch::Switch(bool manual, uint64_t seed) :
+  manual_clock(manual), manual_now(Clock::time_point()), generator(seed)
+{
+}
+
+loopback::Switch::~Switch() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  delivery_wakeup.notify_all();
+  if (delivery_thread.joinable()) {
+    delivery_thread.join();
+  }
+}
+
+loopback::Switch & loopback::Switch::instance() {
+  static Switch network;
+  return network;
+}
+
+void loopback::Switch::set_default_link_options(const LinkOptions & options) {
+  std::lock_guard<std::mutex> lock(mutex);
+  default_options = options;
+}
+
+void loopback::Switch::set_link_options(
+  const Locator_t & destination, bool multicast, const LinkOptions & options)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  options_by_key.insert(routing_key(destination, multicast), options);
+}
+
+void loopback::Switch::advance(std::chrono::nanoseconds duration) {
+  assert(manual_clock);
+  std::lock_guard<std::mutex> lock(mutex);
+  manual_now += std::chrono::duration_cast<Clock::duration>(duration);
+  deliver_due(manual_now);
+}
+
+loopback::Switch::Clock::time_point loopback::Switch::now() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return current_time();
+}
+
+size_t loopback::Switch::in_flight() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return in_flight_packets.size();
+}
+
+loopback::SwitchStats loopback::Switch::stats() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return counters;
+}
+
+// Unicast routes by port alone, as every address of the host reaches the socket bound to
+// it; multicast by group and port.
+Locator_t loopback::Switch::routing_key(const Locator_t & locator, bool multicast) {
+  if (multicast) {
+    return locator;
+  }
+  Locator_t key = {};
+  key.kind = locator.kind;
+  key.port = locator.port;
+  return key;
+}
+
+std::shared_ptr<loopback::Switch::Receiver> loopback::Switch::add_receiver(
+  const Locator_t & locator, bool multicast)
+{
+  auto receiver = std::make_shared<Receiver>();
+  receiver->locator = locator;
+  receiver->multicast = multicast;
+  int fds[2];
+  int result = pipe(fds);
+  assert(result == 0);
+  (void)result;
+  for (int fd : fds) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  }
+  receiver->doorbell = fds[0];
+  receiver->doorbell_writer = fds[1];
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!multicast && receiver->locator.port == 0) {
+    receiver->locator.port = ephemeral_port();
+  }
+  const Locator_t key = routing_key(receiver->locator, multicast);
+  size_t * group = groups_by_key.find(key);
+  if (!group) {
+    groups_by_key.insert(key, groups.size());
+    groups.emplace_back();
+    group = groups_by_key.find(key);
+  }
+  // Like a socket bound to a port in use.
+  assert(multicast || groups[*group].empty());
+  groups[*group].push_back(receiver);
+  return receiver;
+}
+
+void loopback::Switch::remove_receiver(const std::shared_ptr<Receiver> & receiver) {
+  std::lock_guard<std::mutex> lock(mutex);
+  const size_t * group = groups_by_key.find(routing_key(receiver->locator, receiver->multicast));
+  assert(group);
+  auto & members = groups[*group];
+  members.erase(std::find(members.begin(), members.end(), receiver));
+  // Packets in flight to it keep the receiver, and are dropped on arrival.
+  receiver->closed = true;
+  receiver->inbox.clear();
+  close(receiver->doorbell);
+  close(receiver->doorbell_writer);
+  receiver->doorbell = -1;
+  receiver->doorbell_writer = -1;
+}
+
+uint16_t loopback::Switch::ephemeral_port() {
+  while (true) {
+    const uint16_t port = next_ephemeral_port;
+    next_ephemeral_port = next_ephemeral_port == 65535 ? 49152 : next_ephemeral_port + 1;
+    Locator_t key = {};
+    key.kind = LOCATOR_KIND_UDPv4;
+    key.port = port;
+    const size_t * group = groups_by_key.find(key);
+    if (!group || groups[*group].empty()) {
+      return port;
+    }
+  }
+}
+
+void loopback::Switch::send(
+  const Locator_t & locator, bool multicast, const std::shared_ptr<const Packet<>> & packet)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  ++counters.sent;
+  const Clock::time_point time = current_time();
+  // Whatever became due goes first, so a packet without latency doesn't overtake it.
+  deliver_due(time);
+  const Locator_t key = routing_key(locator, multicast);
+  const size_t * group = groups_by_key.find(key);
+  if (!group || groups[*group].empty()) {
+    ++counters.unroutable;
+    return;
+  }
+  const LinkOptions & options = link_options(key);
+  bool scheduled = false;
+  for (const auto & receiver : groups[*group]) {
+    if (draw(options.loss)) {
+      ++counters.lost;
+      continue;
+    }
+    size_t copies = 1;
+    if (draw(options.duplication)) {
+      ++counters.duplicated;
+      ++copies;
+    }
+    for (size_t i = 0; i < copies; ++i) {
+      Clock::duration delay = options.latency;
+      if (draw(options.reordering)) {
+        ++counters.reordered;
+        delay += options.reorder_delay;
+      }
+      if (delay == Clock::duration::zero()) {
+        deliver(*receiver, packet);
+      } else {
+        schedule(receiver, packet, delay);
+        scheduled = true;
+      }
+    }
+  }
+  if (scheduled && !manual_clock) {
+    if (!delivery_thread.joinable()) {
+      delivery_thread = std::thread([this]() { run_delivery_thread(); });
+    }
+    lock.unlock();
+    delivery_wakeup.notify_one();
+  }
+}
+
+std::shared_ptr<const Packet<>> loopback::Switch::take(Receiver & receiver) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (receiver.inbox.empty()) {
+    if (receiver.rung) {
+      uint8_t rings[64];
+      while (read(receiver.doorbell, rings, sizeof(rings)) > 0) {
+      }
+      receiver.rung = false;
+    }
+    return nullptr;
+  }
+  std::shared_ptr<const Packet<>> packet = std::move(receiver.inbox.front());
+  receiver.inbox.pop_front();
+  return packet;
+}
+
+loopback::Switch::Clock::time_point loopback::Switch::current_time() const {
+  return manual_clock ? manual_now : Clock::now();
+}
+
+const loopback::LinkOptions & loopback::Switch::link_options(const Locator_t & key) const {
+  const LinkOptions * options = options_by_key.find(key);
+  return options ? *options : default_options;
+}
+
+bool loopback::Switch::draw(double probability) {
+  if (probability <= 0) {
+    return false;
+  }
+  return std::uniform_real_distribution<double>(0, 1)(generator) < probability;
+}
+
+void loopback::Switch::schedule(const std::shared_ptr<Receiver> & receiver,
+  const std::shared_ptr<const Packet<>> & packet, Clock::duration delay)
+{
+  in_flight_packets.emplace(DueKey(current_time() + delay, send_order++),
+    InFlight{receiver, packet});
+}
+
+void loopback::Switch::deliver_due(Clock::time_point time) {
+  while (!in_flight_packets.empty() && std::get<0>(in_flight_packets.begin()->first) <= time) {
+    const InFlight & due = in_flight_packets.begin()->second;
+    deliver(*due.receiver, due.packet);
+    in_flight_packets.erase(in_flight_packets.begin());
+  }
+}
+
+void loopback::Switch::deliver(
+  Receiver & receiver, const std::shared_ptr<const Packet<>> & packet)
+{
+  if (receiver.closed) {
+    ++counters.unroutable;
+    return;
+  }
+  receiver.inbox.push_back(packet);
+  ++counters.delivered;
+  if (!receiver.rung) {
+    const uint8_t ring_once = 1;
+    ssize_t written = write(receiver.doorbell_writer, &ring_once, sizeof(ring_once));
+    (void)written;
+    receiver.rung = true;
+  }
+}
+
+void loopback::Switch::run_delivery_thread() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (!stopping) {
+    if (in_flight_packets.empty()) {
+      delivery_wakeup.wait(lock);
+    } else {
+      delivery_wakeup.wait_until(lock, std::get<0>(in_flight_packets.begin()->first));
+    }
+    deliver_due(Clock::now());
+  }
+}
+
+loopback::Context::Context() : Context(Switch::instance()) {
+}
+
+loopback::Context::Context(Switch & network_switch) : network(network_switch) {
+  int result = pipe(interrupt_pipe);
+  assert(result == 0);
+  (void)result;
+  for (int fd : interrupt_pipe) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  }
+}
+
+loopback::Context::~Context() {
+  for (const auto & receiver : receivers) {
+    network.remove_receiver(receiver);
+  }
+  close(interrupt_pipe[0]);
+  close(interrupt_pipe[1]);
+}
+
+void loopback::Context::interrupt_receive() {
+  const uint8_t interrupt = 1;
+  ssize_t written = write(interrupt_pipe[1], &interrupt, sizeof(interrupt));
+  (void)written;
+}
+
+void loopback::Context::add_unicast_receiver(const Locator_t & locator) {
+  add_receiver(locator, false);
+}
+
+void loopback::Context::add_multicast_receiver(const Locator_t & locator) {
+  add_receiver(locator, true);
+}
+
+void loopback::Context::add_receiver(const Locator_t & locator, bool multicast) {
+  receivers.push_back(network.add_receiver(locator, multicast));
+}
+
+List<Locator_t> loopback::Context::receive_locators() const {
+  List<Locator_t> locators;
+  for (const auto & receiver : receivers) {
+    locators.push_back(receiver->locator);
+  }
+  return locators;
+}
+
+void loopback::Context::unicast_send(
+  const Locator_t & locator, const uint32_t * packet, size_t size)
+{
+  network.send(locator, false, std::make_shared<const Packet<>>(packet, packet + size));
+}
+
+void loopback::Context::multicast_send(
+  const Locator_t & locator, const uint32_t * packet, size_t size)
+{
+  network.send(locator, true, std::make_shared<const Packet<>>(packet, packet + size));
+}
+
+void loopback::Context::unicast_send(const Locator_t & locator, const SharedPacket & packet) {
+  network.send(locator, false, packet);
+}
+
+void loopback::Context::multicast_send(const Locator_t & locator, const SharedPacket & packet) {
+  network.send(locator, true, packet);
+}
+
+List<int> loopback::Context::receive_sockets() const {
+  List<int> doorbells;
+  for (const auto & receiver : receivers) {
+    doorbells.push_back(receiver->doorbell);
+  }
+  return doorbells;
+}
+
+IPAddress loopback::Context::address_as_array() const {
+  IPAddress address;
+  address.fill(0);
+  address[0] = 127;
+  address[3] = 1;
+  return address;
+}
+
+const Packet<> * loopback::Context::next_packet(int doorbell, size_t packet_size) {
+  auto receiver = std::find_if(receivers.begin(), receivers.end(),
+    [doorbell](const std::shared_ptr<Switch::Receiver> & r) { return r->doorbell == doorbell; });
+  if (receiver == receivers.end()) {
+    return nullptr;
+  }
+  std::shared_ptr<const Packet<>> packet = network.take(**receiver);
+  if (!packet) {
+    return nullptr;
+  }
+  const size_t words = (packet_size + sizeof(Packet<>::value_type) - 1) /
+    sizeof(Packet<>::value_type);
+  if (buffer.size() != words) {
+    buffer.assign(words, 0);
+    used = 0;
+  }
+  const size_t copied = std::min(packet->size(), words);
+  std::copy(packet->begin(), packet->begin() + copied, buffer.begin());
+  // Clear what's left of a longer packet, as the UDP receive path does.
+  if (copied < used) {
+    std::fill(buffer.begin() + copied, buffer.begin() + used, 0);
+  }
+  used = copied;
+  return &buffer;
+}
+
+List<int> loopback::Context::wait_readable() {
+  List<struct pollfd> poll_fds;
+  for (const auto & receiver : receivers) {
+    poll_fds.push_back(pollfd{receiver->doorbell, POLLIN, 0});
+  }
+  poll_fds.push_back(pollfd{interrupt_pipe[0], POLLIN, 0});
+  List<int> readable;
+  if (poll(poll_fds.data(), poll_fds.size(), -1) <= 0) {
+    return readable;
+  }
+  if (poll_fds.back().revents & POLLIN) {
+    uint8_t interrupts[64];
+    while (read(interrupt_pipe[0], interrupts, sizeof(interrupts)) > 0) {
+    }
+  }
+  poll_fds.pop_back();
+  for (const auto & poll_fd : poll_fds) {
+    if (poll_fd.revents & POLLIN) {
+      readable.push_back(poll_fd.fd);
+    }
+  }
+  return readable;
+}
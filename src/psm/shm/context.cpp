@@ -0,0 +1,737 @@
+#include <cmbml/psm/shm/context.hpp>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <iterator>
+#include <new>
+#include <string>
+
+using namespace cmbml;
+
+static const uint32_t ring_magic = 0x434d5252;
+static const uint32_t pool_magic = 0x434d5250;
+static const size_t cache_line = 64;
+
+// Senders claim slots by advancing tail; a slot's sequence says whose turn it is
+// (bounded MPMC queue after Vyukov, with a single consumer).
+struct shm::Context::RingHeader {
+  std::atomic<uint32_t> magic;
+  uint32_t capacity;
+  uint32_t owner_pid;
+  // Set when the receiver goes away, so senders drop their mapping. Descriptors left in the
+  // ring are released by whoever takes them from their slot first: the receiver as it
+  // closes the ring, or their sender.
+  std::atomic<uint32_t> closed;
+  alignas(cache_line) std::atomic<uint64_t> tail;
+  // Set by the receiver when it found the ring empty; the sender that clears it rings.
+  alignas(cache_line) std::atomic<uint32_t> waiting;
+};
+
+struct shm::Context::RingSlot {
+  std::atomic<uint64_t> sequence;
+  Descriptor descriptor;
+};
+
+// Followed by a reference count per block, then by the blocks.
+struct shm::Context::PoolHeader {
+  uint32_t magic;
+  uint32_t block_count;
+  uint64_t block_bytes;
+};
+
+static size_t round_up(size_t bytes) {
+  return (bytes + cache_line - 1) & ~(cache_line - 1);
+}
+
+static size_t ring_bytes(size_t capacity) {
+  return sizeof(shm::Context::RingHeader) + capacity * sizeof(shm::Context::RingSlot);
+}
+
+static shm::Context::RingSlot * ring_slots(shm::Context::RingHeader * header) {
+  return reinterpret_cast<shm::Context::RingSlot *>(header + 1);
+}
+
+static size_t references_offset() {
+  return round_up(sizeof(shm::Context::PoolHeader));
+}
+
+static size_t blocks_offset(size_t block_count) {
+  return round_up(references_offset() + block_count * sizeof(std::atomic<uint32_t>));
+}
+
+static size_t pool_bytes(size_t block_count, size_t block_bytes) {
+  return blocks_offset(block_count) + block_count * block_bytes;
+}
+
+static std::atomic<uint32_t> * pool_references(shm::Context::PoolHeader * header) {
+  return reinterpret_cast<std::atomic<uint32_t> *>(
+    reinterpret_cast<uint8_t *>(header) + references_offset());
+}
+
+static uint8_t * pool_block(shm::Context::PoolHeader * header, uint32_t block) {
+  return reinterpret_cast<uint8_t *>(header) + blocks_offset(header->block_count) +
+    block * header->block_bytes;
+}
+
+static std::string ring_name(uint16_t port) {
+  return "/cmbml_shm_" + std::to_string(port);
+}
+
+// shm_open segments live in /dev/shm, so the doorbell goes next to its ring.
+static std::string doorbell_path(uint16_t port) {
+  return "/dev/shm/cmbml_shm_" + std::to_string(port) + ".bell";
+}
+
+static std::string pool_name(uint32_t pid, uint32_t pool) {
+  return "/cmbml_pool_" + std::to_string(pid) + "_" + std::to_string(pool);
+}
+
+// Maps an existing segment; returns nullptr if it's missing or smaller than min_size.
+static void * map_segment(const std::string & name, size_t min_size, size_t & size) {
+  int fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat status;
+  if (fstat(fd, &status) < 0 || static_cast<size_t>(status.st_size) < min_size) {
+    close(fd);
+    return nullptr;
+  }
+  size = status.st_size;
+  void * memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  return memory == MAP_FAILED ? nullptr : memory;
+}
+
+// Creates a segment of size bytes; fails if the name is taken.
+static void * create_segment(const std::string & name, size_t size) {
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    return nullptr;
+  }
+  if (ftruncate(fd, size) < 0) {
+    close(fd);
+    shm_unlink(name.c_str());
+    return nullptr;
+  }
+  void * memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) {
+    shm_unlink(name.c_str());
+    return nullptr;
+  }
+  return memory;
+}
+
+static bool process_alive(uint32_t pid) {
+  return pid != 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+// The ring left on port by a receiver that didn't close it, if its process is gone.
+static bool stale_ring(uint16_t port) {
+  size_t size;
+  void * memory = map_segment(ring_name(port), 0, size);
+  if (!memory) {
+    return false;
+  }
+  bool stale = true;
+  if (size >= sizeof(shm::Context::RingHeader)) {
+    const shm::Context::RingHeader * header =
+      static_cast<const shm::Context::RingHeader *>(memory);
+    stale = header->closed.load() || !process_alive(header->owner_pid);
+  }
+  munmap(memory, size);
+  return stale;
+}
+
+// Unlinks the pools of processes that died without closing their Contexts.
+static void remove_stale_pools() {
+  DIR * directory = opendir("/dev/shm");
+  if (!directory) {
+    return;
+  }
+  while (struct dirent * entry = readdir(directory)) {
+    unsigned owner;
+    unsigned pool;
+    if (sscanf(entry->d_name, "cmbml_pool_%u_%u", &owner, &pool) == 2 &&
+      !process_alive(owner))
+    {
+      shm_unlink(pool_name(owner, pool).c_str());
+    }
+  }
+  closedir(directory);
+}
+
+static IPAddress read_host_id() {
+  IPAddress id;
+  id.fill(0);
+  FILE * file = fopen("/proc/sys/kernel/random/boot_id", "r");
+  if (!file) {
+    const long host = gethostid();
+    memcpy(id.data(), &host, std::min(sizeof(host), id.size()));
+    return id;
+  }
+  char text[64];
+  size_t nibble = 0;
+  if (fgets(text, sizeof(text), file)) {
+    for (size_t i = 0; text[i] && nibble < 2 * id.size(); ++i) {
+      const char c = text[i];
+      int value;
+      if (c >= '0' && c <= '9') {
+        value = c - '0';
+      } else if (c >= 'a' && c <= 'f') {
+        value = c - 'a' + 10;
+      } else {
+        continue;
+      }
+      id[nibble / 2] |= value << (nibble % 2 ? 0 : 4);
+      ++nibble;
+    }
+  }
+  fclose(file);
+  return id;
+}
+
+static std::atomic<uint32_t> next_pool_index{0};
+
+shm::Context::Context(const ShmOptions & shm_options)
+: options(shm_options), host_id(read_host_id()), pid(getpid())
+{
+  assert(options.ring_capacity > 0 &&
+    (options.ring_capacity & (options.ring_capacity - 1)) == 0);
+  assert(options.pool_blocks > 0);
+  options.block_bytes = round_up(options.block_bytes);
+}
+
+shm::Context::~Context() {
+  for (auto & fd_ring : receive_rings) {
+    close_receive_ring(fd_ring.second);
+  }
+  for (auto & port_ring : send_rings) {
+    munmap(port_ring.second.mapping.memory, port_ring.second.mapping.size);
+    close(port_ring.second.doorbell);
+  }
+  if (pool_header) {
+    // Receivers that have mapped the pool keep it, so blocks in flight to them can still be
+    // read; those sent to a receiver that hasn't are lost.
+    munmap(pool.memory, pool.size);
+    shm_unlink(pool_name(pid, pool_index).c_str());
+  }
+  for (auto & mapped_pool : mapped_pools) {
+    munmap(mapped_pool.second.memory, mapped_pool.second.size);
+  }
+}
+
+Locator_t shm::Context::shm_locator(uint16_t port) const {
+  Locator_t locator = {};
+  locator.kind = LOCATOR_KIND_SHM;
+  locator.port = port;
+  locator.address = host_id;
+  return locator;
+}
+
+bool shm::Context::is_local(const Locator_t & locator) const {
+  return shm_kind(locator) && locator.address == host_id;
+}
+
+List<Locator_t> shm::Context::reachable_locators(const List<Locator_t> & advertised) const {
+  List<Locator_t> local;
+  List<Locator_t> others;
+  for (const auto & locator : advertised) {
+    if (is_local(locator)) {
+      local.push_back(locator);
+    } else if (!shm_kind(locator)) {
+      others.push_back(locator);
+    }
+  }
+  return local.empty() ? others : local;
+}
+
+void shm::Context::add_unicast_receiver(const Locator_t & locator) {
+  if (!shm_kind(locator)) {
+    udp::Context::add_unicast_receiver(locator);
+    return;
+  }
+  assert(locator.port != 0);
+  open_receive_ring(locator.port);
+}
+
+// A ring has one receiver, so an shm multicast locator is a ring like any other.
+void shm::Context::add_multicast_receiver(const Locator_t & locator) {
+  if (!shm_kind(locator)) {
+    udp::Context::add_multicast_receiver(locator);
+    return;
+  }
+  assert(locator.port != 0);
+  open_receive_ring(locator.port);
+}
+
+bool shm::Context::open_receive_ring(uint16_t port) {
+  const std::string name = ring_name(port);
+  const size_t size = ring_bytes(options.ring_capacity);
+  void * memory = create_segment(name, size);
+  if (!memory && errno == EEXIST && stale_ring(port)) {
+    shm_unlink(name.c_str());
+    memory = create_segment(name, size);
+  }
+  if (!memory) {
+    return false;
+  }
+
+  const std::string bell = doorbell_path(port);
+  unlink(bell.c_str());
+  int doorbell = -1;
+  if (mkfifo(bell.c_str(), 0600) == 0) {
+    // Opened for writing too, so it never reads as closed when no sender has it open.
+    doorbell = open(bell.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  }
+  if (doorbell < 0) {
+    munmap(memory, size);
+    shm_unlink(name.c_str());
+    unlink(bell.c_str());
+    return false;
+  }
+
+  RingHeader * header = new (memory) RingHeader();
+  header->capacity = options.ring_capacity;
+  header->owner_pid = pid;
+  RingSlot * slots = ring_slots(header);
+  for (size_t i = 0; i < options.ring_capacity; ++i) {
+    new (&slots[i]) RingSlot();
+    slots[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  // Senders don't use the ring before they see the magic.
+  header->magic.store(ring_magic, std::memory_order_release);
+
+  ReceiveRing & ring = receive_rings[doorbell];
+  ring.port = port;
+  ring.doorbell = doorbell;
+  ring.mapping.memory = memory;
+  ring.mapping.size = size;
+  return true;
+}
+
+shm::Context::SendRing * shm::Context::send_ring(uint16_t port) {
+  auto found = send_rings.find(port);
+  if (found != send_rings.end()) {
+    SendRing & ring = found->second;
+    if (!static_cast<RingHeader *>(ring.mapping.memory)->closed.load(std::memory_order_relaxed)) {
+      return &ring;
+    }
+    // The receiver went away; another may have opened the port since.
+    close_send_ring(found);
+  }
+
+  size_t size;
+  void * memory = map_segment(ring_name(port), sizeof(RingHeader), size);
+  if (!memory) {
+    return nullptr;
+  }
+  RingHeader * header = static_cast<RingHeader *>(memory);
+  int doorbell = -1;
+  if (header->magic.load(std::memory_order_acquire) == ring_magic && !header->closed.load() &&
+    size >= ring_bytes(header->capacity))
+  {
+    doorbell = open(doorbell_path(port).c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+  }
+  if (doorbell < 0) {
+    munmap(memory, size);
+    return nullptr;
+  }
+  SendRing & ring = send_rings[port];
+  ring.mapping.memory = memory;
+  ring.mapping.size = size;
+  ring.doorbell = doorbell;
+  return &ring;
+}
+
+void shm::Context::close_send_ring(std::map<uint16_t, SendRing>::iterator found) {
+  SendRing & ring = found->second;
+  RingHeader * header = static_cast<RingHeader *>(ring.mapping.memory);
+  RingSlot * slots = ring_slots(header);
+  const uint64_t mask = header->capacity - 1;
+  for (const auto & pushed : ring.pushed) {
+    uint64_t published = pushed.first + 1;
+    if (slots[pushed.first & mask].sequence.compare_exchange_strong(
+        published, pushed.first + header->capacity, std::memory_order_acq_rel))
+    {
+      release_block(pushed.second);
+    }
+  }
+  munmap(ring.mapping.memory, ring.mapping.size);
+  close(ring.doorbell);
+  send_rings.erase(found);
+}
+
+bool shm::Context::close_abandoned_send_rings() {
+  bool closed_any = false;
+  for (auto found = send_rings.begin(); found != send_rings.end(); ) {
+    const RingHeader * header = static_cast<const RingHeader *>(found->second.mapping.memory);
+    auto next = std::next(found);
+    if (header->closed.load() || !process_alive(header->owner_pid)) {
+      close_send_ring(found);
+      closed_any = true;
+    }
+    found = next;
+  }
+  return closed_any;
+}
+
+bool shm::Context::create_pool() {
+  remove_stale_pools();
+  pool_index = next_pool_index++;
+  const std::string name = pool_name(pid, pool_index);
+  const size_t size = pool_bytes(options.pool_blocks, options.block_bytes);
+  void * memory = create_segment(name, size);
+  if (!memory && errno == EEXIST) {
+    // Left by an earlier process with the same pid.
+    shm_unlink(name.c_str());
+    memory = create_segment(name, size);
+  }
+  if (!memory) {
+    return false;
+  }
+  pool.memory = memory;
+  pool.size = size;
+  pool_header = new (memory) PoolHeader();
+  pool_header->magic = pool_magic;
+  pool_header->block_count = options.pool_blocks;
+  pool_header->block_bytes = options.block_bytes;
+  std::atomic<uint32_t> * references = pool_references(pool_header);
+  for (size_t i = 0; i < options.pool_blocks; ++i) {
+    new (&references[i]) std::atomic<uint32_t>(0);
+  }
+  return true;
+}
+
+int64_t shm::Context::write_block(const void * data, size_t bytes) {
+  if (bytes > options.block_bytes || (!pool_header && !create_pool())) {
+    return -1;
+  }
+  std::atomic<uint32_t> * references = pool_references(pool_header);
+  do {
+    for (size_t i = 0; i < options.pool_blocks; ++i) {
+      const uint32_t block = (next_block + i) % options.pool_blocks;
+      // Acquire: the receiver that released the block is done reading it.
+      if (references[block].load(std::memory_order_acquire) == 0) {
+        memcpy(pool_block(pool_header, block), data, bytes);
+        // This Context's reference, held until every descriptor is pushed.
+        references[block].store(1, std::memory_order_relaxed);
+        next_block = block + 1;
+        return block;
+      }
+    }
+    // Every block is in use; some may be held by rings nobody will take them from.
+  } while (close_abandoned_send_rings());
+  return -1;
+}
+
+void shm::Context::release_block(uint32_t block) {
+  pool_references(pool_header)[block].fetch_sub(1, std::memory_order_release);
+}
+
+bool shm::Context::push(udp::Destination & destination, uint32_t block, size_t bytes) {
+  SendRing * ring = send_ring(destination.locator.port);
+  if (!ring) {
+    return false;
+  }
+  RingHeader * header = static_cast<RingHeader *>(ring->mapping.memory);
+  RingSlot * slots = ring_slots(header);
+  const uint64_t mask = header->capacity - 1;
+  // The receiver takes descriptors in order, so what it has taken is at the front.
+  while (!ring->pushed.empty()) {
+    const uint64_t pushed = ring->pushed.front().first;
+    if (slots[pushed & mask].sequence.load(std::memory_order_relaxed) == pushed + 1) {
+      break;
+    }
+    ring->pushed.pop_front();
+  }
+  uint64_t position = header->tail.load(std::memory_order_relaxed);
+  RingSlot * slot;
+  while (true) {
+    slot = &slots[position & mask];
+    const uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+    const int64_t difference = static_cast<int64_t>(sequence - position);
+    if (difference == 0) {
+      if (header->tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (difference < 0) {
+      // Full: the receiver is a whole ring behind.
+      return false;
+    } else {
+      position = header->tail.load(std::memory_order_relaxed);
+    }
+  }
+  pool_references(pool_header)[block].fetch_add(1, std::memory_order_relaxed);
+  slot->descriptor = Descriptor{pid, pool_index, block, static_cast<uint32_t>(bytes)};
+  slot->sequence.store(position + 1, std::memory_order_release);
+  ring->pushed.emplace_back(position, block);
+
+  // Pairs with the fence in next_packet: either the receiver sees the descriptor, or this
+  // sees it waiting.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (header->waiting.load(std::memory_order_relaxed) && header->waiting.exchange(0)) {
+    const uint8_t ring_once = 1;
+    ssize_t written = write(ring->doorbell, &ring_once, sizeof(ring_once));
+    (void)written;
+  }
+  return true;
+}
+
+void shm::Context::shm_send(
+  udp::Destination & destination, const uint32_t * packet, size_t size)
+{
+  const size_t bytes = size * sizeof(uint32_t);
+  const int64_t block = is_local(destination.locator) ? write_block(packet, bytes) : -1;
+  if (block < 0) {
+    ++destination.send_errors;
+    return;
+  }
+  if (push(destination, block, bytes)) {
+    destination.record_sent(1, bytes);
+  } else {
+    ++destination.send_errors;
+  }
+  release_block(block);
+}
+
+void shm::Context::shm_send_shared(udp::Destination & destination, const SharedPacket & packet) {
+  if (!is_local(destination.locator)) {
+    ++destination.send_errors;
+    return;
+  }
+  const size_t bytes = packet->size() * sizeof(Packet<>::value_type);
+  if (shared_block.packet != packet) {
+    if (shared_block.packet) {
+      release_block(shared_block.block);
+      shared_block.packet.reset();
+    }
+    const int64_t block = write_block(packet->data(), bytes);
+    if (block < 0) {
+      ++destination.send_errors;
+      return;
+    }
+    shared_block = SharedBlock{packet, static_cast<uint32_t>(block)};
+  }
+  if (push(destination, shared_block.block, bytes)) {
+    destination.record_sent(1, bytes);
+  } else {
+    ++destination.send_errors;
+  }
+}
+
+void shm::Context::unicast_send(const Locator_t & locator, const uint32_t * packet, size_t size) {
+  unicast_send(resolve(locator), packet, size);
+}
+
+void shm::Context::multicast_send(const Locator_t & locator, const uint32_t * packet, size_t size)
+{
+  multicast_send(resolve(locator), packet, size);
+}
+
+void shm::Context::unicast_send(
+  udp::Destination & destination, const uint32_t * packet, size_t size)
+{
+  if (shm_kind(destination.locator)) {
+    shm_send(destination, packet, size);
+    return;
+  }
+  udp::Context::unicast_send(destination, packet, size);
+}
+
+void shm::Context::multicast_send(
+  udp::Destination & destination, const uint32_t * packet, size_t size)
+{
+  if (shm_kind(destination.locator)) {
+    shm_send(destination, packet, size);
+    return;
+  }
+  udp::Context::multicast_send(destination, packet, size);
+}
+
+void shm::Context::unicast_send(const Locator_t & locator, const SharedPacket & packet) {
+  if (shm_kind(locator)) {
+    shm_send_shared(resolve(locator), packet);
+    return;
+  }
+  udp::Context::unicast_send(locator, packet);
+}
+
+void shm::Context::multicast_send(const Locator_t & locator, const SharedPacket & packet) {
+  if (shm_kind(locator)) {
+    shm_send_shared(resolve(locator), packet);
+    return;
+  }
+  udp::Context::multicast_send(locator, packet);
+}
+
+const Packet<> * shm::Context::next_packet(ReceiveRing & ring, size_t packet_size) {
+  RingHeader * header = static_cast<RingHeader *>(ring.mapping.memory);
+  RingSlot * slots = ring_slots(header);
+  const uint64_t mask = header->capacity - 1;
+  bool armed = false;
+  while (true) {
+    RingSlot & slot = slots[ring.head & mask];
+    if (slot.sequence.load(std::memory_order_acquire) == ring.head + 1) {
+      if (header->waiting.load(std::memory_order_relaxed)) {
+        header->waiting.store(0, std::memory_order_relaxed);
+      }
+      const Descriptor descriptor = slot.descriptor;
+      slot.sequence.store(ring.head + header->capacity, std::memory_order_release);
+      ++ring.head;
+      if (read_block(ring, descriptor, packet_size)) {
+        return &ring.buffer;
+      }
+      continue;
+    }
+    if (armed) {
+      return nullptr;
+    }
+    // Empty: drain the doorbell, ask senders to ring it and look once more, so that a
+    // descriptor pushed before they could see the request isn't left waiting.
+    uint8_t rings[64];
+    while (read(ring.doorbell, rings, sizeof(rings)) > 0) {
+    }
+    header->waiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    armed = true;
+  }
+}
+
+void shm::Context::close_receive_ring(ReceiveRing & ring) {
+  RingHeader * header = static_cast<RingHeader *>(ring.mapping.memory);
+  header->closed.store(1);
+  RingSlot * slots = ring_slots(header);
+  const uint64_t mask = header->capacity - 1;
+  const uint64_t tail = header->tail.load();
+  for (uint64_t position = ring.head; position < tail; ++position) {
+    RingSlot & slot = slots[position & mask];
+    uint64_t published = position + 1;
+    if (slot.sequence.load(std::memory_order_acquire) != published) {
+      continue;
+    }
+    const Descriptor descriptor = slot.descriptor;
+    if (slot.sequence.compare_exchange_strong(
+        published, position + header->capacity, std::memory_order_acq_rel))
+    {
+      if (PoolHeader * pool_of_sender = sender_pool(descriptor)) {
+        pool_references(pool_of_sender)[descriptor.block].fetch_sub(
+          1, std::memory_order_release);
+      }
+    }
+  }
+  munmap(ring.mapping.memory, ring.mapping.size);
+  shm_unlink(ring_name(ring.port).c_str());
+  close(ring.doorbell);
+  unlink(doorbell_path(ring.port).c_str());
+}
+
+shm::Context::PoolHeader * shm::Context::sender_pool(const Descriptor & descriptor) {
+  PoolHeader * header = nullptr;
+  if (descriptor.pid == pid && descriptor.pool == pool_index && pool_header) {
+    header = pool_header;
+  } else {
+    const uint64_t key = (static_cast<uint64_t>(descriptor.pid) << 32) | descriptor.pool;
+    auto found = mapped_pools.find(key);
+    if (found == mapped_pools.end()) {
+      Mapping mapping;
+      mapping.memory = map_segment(
+        pool_name(descriptor.pid, descriptor.pool), sizeof(PoolHeader), mapping.size);
+      if (!mapping.memory) {
+        // The sender is gone, and its blocks with it.
+        return nullptr;
+      }
+      found = mapped_pools.emplace(key, mapping).first;
+    }
+    header = static_cast<PoolHeader *>(found->second.memory);
+  }
+  if (header->magic != pool_magic || descriptor.block >= header->block_count ||
+    descriptor.bytes > header->block_bytes)
+  {
+    return nullptr;
+  }
+  return header;
+}
+
+bool shm::Context::read_block(
+  ReceiveRing & ring, const Descriptor & descriptor, size_t packet_size)
+{
+  PoolHeader * header = sender_pool(descriptor);
+  if (!header) {
+    return false;
+  }
+
+  const size_t words = (packet_size + sizeof(Packet<>::value_type) - 1) /
+    sizeof(Packet<>::value_type);
+  if (ring.buffer.size() != words) {
+    ring.buffer.assign(words, 0);
+    ring.used = 0;
+  }
+  const size_t bytes = std::min<size_t>(descriptor.bytes, words * sizeof(Packet<>::value_type));
+  uint8_t * buffer = reinterpret_cast<uint8_t *>(ring.buffer.data());
+  memcpy(buffer, pool_block(header, descriptor.block), bytes);
+  pool_references(header)[descriptor.block].fetch_sub(1, std::memory_order_release);
+  // Clear what's left of a longer packet, as the UDP receive path does.
+  if (bytes < ring.used) {
+    memset(buffer + bytes, 0, ring.used - bytes);
+  }
+  ring.used = bytes;
+  return true;
+}
+
+List<int> shm::Context::receive_sockets() const {
+  List<int> sockets = udp::Context::receive_sockets();
+  for (const auto & fd_ring : receive_rings) {
+    sockets.push_back(fd_ring.first);
+  }
+  return sockets;
+}
+
+List<int> shm::Context::wait_readable() {
+  const List<int> sockets = receive_sockets();
+  List<struct pollfd> poll_fds;
+  for (int recv_socket : sockets) {
+    poll_fds.push_back(pollfd{recv_socket, POLLIN, 0});
+  }
+  poll_fds.push_back(pollfd{interrupt_pipe[0], POLLIN, 0});
+  List<int> readable;
+  if (poll(poll_fds.data(), poll_fds.size(), -1) <= 0) {
+    return readable;
+  }
+  if (poll_fds.back().revents & POLLIN) {
+    clear_interrupt();
+  }
+  poll_fds.pop_back();
+  for (const auto & poll_fd : poll_fds) {
+    if (poll_fd.revents & POLLIN) {
+      readable.push_back(poll_fd.fd);
+    }
+  }
+  return readable;
+}
+
+size_t shm::Context::blocks_in_use() const {
+  if (!pool_header) {
+    return 0;
+  }
+  size_t in_use = 0;
+  const std::atomic<uint32_t> * references = pool_references(pool_header);
+  for (size_t i = 0; i < options.pool_blocks; ++i) {
+    if (references[i].load(std::memory_order_relaxed) != 0) {
+      ++in_use;
+    }
+  }
+  return in_use;
+}
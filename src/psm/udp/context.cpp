@@ -1,19 +1,71 @@
 #include <cmbml/psm/udp/context.hpp>
 
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <ifaddrs.h>
 #include <netdb.h>
+#include <netinet/udp.h>
 #include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <string>
 
 #include <sys/select.h>
 
+#ifdef __linux__
+#include <linux/errqueue.h>
+#include <linux/filter.h>
+#endif
+
 using namespace cmbml;
 
 #ifndef NI_MAXHOST
 #define NI_MAXHOST 1025  // ???
 #endif
 
+// Older libc headers lack the UDP offload options (Linux 4.18 and 5.0).
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+// And the zero-copy ones (Linux 4.14).
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+// The most datagrams the kernel takes in one segmented send (UDP_MAX_SEGMENTS).
+static const size_t max_gso_segments = 64;
+
 udp::Context::Context() {
+  FD_ZERO(&receive_socket_set);
+  if (pipe(interrupt_pipe) == 0) {
+    for (int fd : interrupt_pipe) {
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+    FD_SET(interrupt_pipe[0], &receive_socket_set);
+    max_receive_socket = interrupt_pipe[0];
+  } else {
+    interrupt_pipe[0] = interrupt_pipe[1] = -1;
+  }
+  shard_sockets.resize(receive_shards);
   // alternatively we could do delayed initialization
   // might prefer this since syscalls could fail
   // Unicast socket
@@ -22,6 +74,12 @@ udp::Context::Context() {
     // Fatal error
     return;
   }
+#ifdef __linux__
+  int segment_bytes = 0;
+  socklen_t option_length = sizeof(segment_bytes);
+  gso_enabled = getsockopt(
+    unicast_send_socket, SOL_UDP, UDP_SEGMENT, &segment_bytes, &option_length) == 0;
+#endif
 
   // Initialize a multicast socket
   multicast_send_socket = socket(AF_INET, SOCK_DGRAM, 0);
@@ -83,84 +141,680 @@ udp::Context::Context() {
   }
 }
 
+udp::Context::~Context() {
+  for (int fd : interrupt_pipe) {
+    if (fd != -1) {
+      close(fd);
+    }
+  }
+}
+
+void udp::Context::interrupt_receive() {
+  const uint8_t interrupt = 1;
+  // A full pipe already interrupts the next wait.
+  ssize_t written = write(interrupt_pipe[1], &interrupt, sizeof(interrupt));
+  (void)written;
+}
+
+void udp::Context::clear_interrupt() {
+  uint8_t interrupts[64];
+  while (read(interrupt_pipe[0], interrupts, sizeof(interrupts)) > 0) {
+  }
+}
+
+void udp::Context::set_receive_shards(size_t shards, bool steer_by_guid_prefix) {
+  assert(shards > 0);
+#ifndef __linux__
+  shards = 1;
+#endif
+  receive_shards = shards;
+  steer_receive_shards = steer_by_guid_prefix;
+  if (shard_sockets.size() < shards) {
+    shard_sockets.resize(shards);
+  }
+}
 
 void udp::Context::add_unicast_receiver(const Locator_t & locator) {
   // TODO Convert locator_t to LocatorUDPv4_t here and below?
-  // Create and bind the receive sockets
-  int recv_socket = socket(AF_INET, SOCK_DGRAM, 0);
-  if (recv_socket < 0) {
-    return;
-  }
   struct sockaddr_in receive_bind_address;
   memset(&receive_bind_address, 0, sizeof(sockaddr_in));
   receive_bind_address.sin_family = AF_INET;
   receive_bind_address.sin_addr.s_addr = local_address;
   receive_bind_address.sin_port = htons(locator.port);
-  int result = bind(recv_socket, reinterpret_cast<struct sockaddr *>(&receive_bind_address),
-      sizeof(receive_bind_address));
-  if (result < 0) {
-    shutdown(recv_socket, 0);
-    return;
-  }
-  port_socket_map[locator.port] = recv_socket;
+  add_receive_sockets(receive_bind_address, nullptr);
 }
 
 // Expect locator to contain the port to listen on and the address representing the 
 // multicast group
 void udp::Context::add_multicast_receiver(const Locator_t & locator) {
   const udp::LocatorUDPv4_t locator_v4(locator);
-  // Create and bind the receive sockets
-  int recv_socket = socket(AF_INET, SOCK_DGRAM, 0);
-  if (recv_socket < 0) {
-    return;
-  }
   struct sockaddr_in receive_bind_address;
   memset(&receive_bind_address, 0, sizeof(sockaddr_in));
   receive_bind_address.sin_family = AF_INET;
   receive_bind_address.sin_addr.s_addr = htonl(INADDR_ANY);
   receive_bind_address.sin_port = htons(locator_v4.port);
-  int result = bind(recv_socket, reinterpret_cast<struct sockaddr *>(&receive_bind_address),
-      sizeof(receive_bind_address));
-  if (result < 0) {
-    shutdown(recv_socket, 0);
-    return;
-  }
   // Set socket options to multicast
   struct ip_mreq membership_requirements;
-  membership_requirements.imr_multiaddr.s_addr = locator_v4.address;
+  membership_requirements.imr_multiaddr.s_addr = htonl(static_cast<uint32_t>(locator_v4.address));
   membership_requirements.imr_interface.s_addr = local_address;
-  result = setsockopt(
-    recv_socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership_requirements, sizeof(ip_mreq));
-  if (result < 0) {
+  add_receive_sockets(receive_bind_address, &membership_requirements);
+}
+
+#ifdef __linux__
+// Classic BPF over the GUID prefix, bytes 8 to 20 of the RTPS header, which starts
+// header_offset bytes into the packet: the XOR of its three words, modulo shards.
+// With keep_shard < 0 the program returns that shard index (a SO_REUSEPORT steering
+// program). Otherwise it keeps the packet only if it belongs to keep_shard (a socket
+// filter). Datagrams too short for an RTPS header go to shard 0.
+static List<struct sock_filter> guid_prefix_filter(
+  size_t shards, uint32_t header_offset, int keep_shard)
+{
+  const uint32_t keep = 0xffffffff;
+  const uint32_t short_result = keep_shard < 0 ? 0 : (keep_shard == 0 ? keep : 0);
+  List<struct sock_filter> program = {
+    BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+    BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, header_offset + 20, 1, 0),
+    BPF_STMT(BPF_RET | BPF_K, short_result),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, header_offset + 8),
+    BPF_STMT(BPF_MISC | BPF_TAX, 0),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, header_offset + 12),
+    BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+    BPF_STMT(BPF_MISC | BPF_TAX, 0),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, header_offset + 16),
+    BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+    BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, static_cast<uint32_t>(shards)),
+  };
+  if (keep_shard < 0) {
+    program.push_back(BPF_STMT(BPF_RET | BPF_A, 0));
+  } else {
+    program.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, static_cast<uint32_t>(keep_shard), 0, 1));
+    program.push_back(BPF_STMT(BPF_RET | BPF_K, keep));
+    program.push_back(BPF_STMT(BPF_RET | BPF_K, 0));
+  }
+  return program;
+}
+
+static bool attach_filter(int socket, int option, List<struct sock_filter> && program) {
+  struct sock_fprog filter = {static_cast<unsigned short>(program.size()), program.data()};
+  return setsockopt(socket, SOL_SOCKET, option, &filter, sizeof(filter)) == 0;
+}
+#endif
+
+void udp::Context::add_receive_sockets(
+  struct sockaddr_in bind_address, const struct ip_mreq * membership)
+{
+#ifdef __linux__
+  const bool sharded = receive_shards > 1;
+#endif
+  List<int> sockets;
+  bool failed = false;
+  for (size_t shard = 0; shard < receive_shards; ++shard) {
+    int recv_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (recv_socket < 0) {
+      failed = true;
+      break;
+    }
+    sockets.push_back(recv_socket);
+#ifdef __linux__
+    int enable = 1;
+    if (sharded &&
+      setsockopt(recv_socket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0)
+    {
+      failed = true;
+      break;
+    }
+    // Every socket of a multicast group gets a copy of each datagram, so each shard drops
+    // the GUID prefixes of the others. Attached before bind, so no datagram is let through.
+    if (sharded && membership && !attach_filter(recv_socket, SO_ATTACH_FILTER,
+      guid_prefix_filter(receive_shards, sizeof(struct udphdr), shard)))
+    {
+      failed = true;
+      break;
+    }
+#endif
+    int result = bind(recv_socket, reinterpret_cast<struct sockaddr *>(&bind_address),
+        sizeof(bind_address));
+    if (result < 0) {
+      failed = true;
+      break;
+    }
+    if (bind_address.sin_port == 0) {
+      // An ephemeral port: the other shards share it.
+      socklen_t length = sizeof(bind_address);
+      getsockname(recv_socket, reinterpret_cast<struct sockaddr *>(&bind_address), &length);
+    }
+#ifdef __linux__
+    // The group's program is attached through its first socket, before the others join.
+    if (shard == 0 && sharded && !membership && steer_receive_shards &&
+      !attach_filter(recv_socket, SO_ATTACH_REUSEPORT_CBPF,
+      guid_prefix_filter(receive_shards, 0, -1)))
+    {
+      failed = true;
+      break;
+    }
+#endif
+    if (membership && setsockopt(
+        recv_socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, membership, sizeof(ip_mreq)) < 0)
+    {
+      failed = true;
+      break;
+    }
+  }
+  if (failed) {
+    for (int recv_socket : sockets) {
+      close(recv_socket);
+    }
     return;
   }
 
-  port_socket_map[locator_v4.port] = recv_socket;
+  List<int> & port_sockets = port_socket_map[ntohs(bind_address.sin_port)];
+  for (size_t shard = 0; shard < sockets.size(); ++shard) {
+    const int recv_socket = sockets[shard];
+    enable_gro(recv_socket);
+    // Created now, so that shards on different threads only look the batches up.
+    receive_batches[recv_socket];
+    port_sockets.push_back(recv_socket);
+    shard_sockets[shard].push_back(recv_socket);
+    FD_SET(recv_socket, &receive_socket_set);
+    max_receive_socket = std::max(max_receive_socket, recv_socket);
+  }
 }
 
 void udp::Context::unicast_send(const Locator_t & locator, const uint32_t * packet, size_t size) {
-  socket_send(unicast_send_socket, locator, packet, size);
+  socket_send(unicast_send_socket, resolve(locator), packet, size);
 }
 
 void udp::Context::multicast_send(const Locator_t & locator, const uint32_t * packet, size_t size) {
-  socket_send(multicast_send_socket, locator, packet, size);
+  socket_send(multicast_send_socket, resolve(locator), packet, size);
+}
+
+void udp::Context::unicast_send(Destination & destination, const uint32_t * packet, size_t size) {
+  socket_send(unicast_send_socket, destination, packet, size);
+}
+
+void udp::Context::multicast_send(Destination & destination, const uint32_t * packet, size_t size)
+{
+  socket_send(multicast_send_socket, destination, packet, size);
+}
+
+void udp::Context::unicast_send(const Locator_t & locator, const SharedPacket & packet) {
+  socket_send_shared(unicast_send_socket, resolve(locator), packet);
+}
+
+void udp::Context::multicast_send(const Locator_t & locator, const SharedPacket & packet) {
+  socket_send_shared(multicast_send_socket, resolve(locator), packet);
+}
+
+bool udp::Context::enable_zerocopy(size_t threshold_bytes) {
+  assert(threshold_bytes > 0);
+#ifndef __linux__
+  return false;
+#endif
+  int enable = 1;
+  for (int send_socket : send_sockets()) {
+    if (setsockopt(send_socket, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) < 0) {
+      return false;
+    }
+  }
+  zerocopy_threshold = threshold_bytes;
+  return true;
+}
+
+// Sends one datagram with sendto and counts it.
+static bool send_datagram(int sender_socket, udp::Destination & destination, const void * data,
+  size_t bytes, int flags = 0)
+{
+  if (sendto(sender_socket, data, bytes, flags, destination.sockaddr(),
+    destination.address_length) < 0)
+  {
+    ++destination.send_errors;
+    return false;
+  }
+  destination.record_sent(1, bytes);
+  return true;
+}
+
+void udp::Context::socket_send_shared(
+  int sender_socket, Destination & destination, const SharedPacket & packet)
+{
+  if (sender_socket == -1) {
+    return;
+  }
+  const size_t bytes = packet->size() * sizeof(Packet<>::value_type);
+  if (!zerocopy_enabled() || bytes < zerocopy_threshold) {
+    socket_send(sender_socket, destination, packet->data(), packet->size());
+    return;
+  }
+  // Queued datagrams go first, so the batch keeps its order.
+  if (queued_sends != 0) {
+    flush_sends();
+  }
+  ZerocopySocket & zerocopy = zerocopy_sockets[sender_socket];
+  if (zerocopy.pending.size() >= max_zerocopy_pending) {
+    reap_zerocopy_completions();
+  }
+  if (sendto(sender_socket, packet->data(), bytes, MSG_ZEROCOPY, destination.sockaddr(),
+    destination.address_length) < 0)
+  {
+    if (errno == ENOBUFS) {
+      // Out of option memory for the completions: copy this one.
+      send_datagram(sender_socket, destination, packet->data(), bytes);
+    } else {
+      ++destination.send_errors;
+    }
+    return;
+  }
+  destination.record_sent(1, bytes);
+  zerocopy.pending.push_back(ZerocopySend{zerocopy.next_id++, packet});
+}
+
+size_t udp::Context::reap_zerocopy_completions() {
+  size_t released = 0;
+#ifdef __linux__
+  for (auto & socket_state : zerocopy_sockets) {
+    ZerocopySocket & zerocopy = socket_state.second;
+    while (!zerocopy.pending.empty()) {
+      ControlBuffer control[4];
+      struct msghdr message;
+      memset(&message, 0, sizeof(message));
+      message.msg_control = control;
+      message.msg_controllen = sizeof(control);
+      if (recvmsg(socket_state.first, &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+        break;
+      }
+      for (struct cmsghdr * header = CMSG_FIRSTHDR(&message); header;
+        header = CMSG_NXTHDR(&message, header))
+      {
+        if (header->cmsg_level != SOL_IP || header->cmsg_type != IP_RECVERR) {
+          continue;
+        }
+        struct sock_extended_err error;
+        memcpy(&error, CMSG_DATA(header), sizeof(error));
+        if (error.ee_errno != 0 || error.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+          continue;
+        }
+        // The sends from ee_info to ee_data, inclusive, are done; the ids wrap around.
+        const uint32_t first = error.ee_info;
+        const uint32_t range = error.ee_data - first;
+        const size_t before = zerocopy.pending.size();
+        zerocopy.pending.erase(std::remove_if(zerocopy.pending.begin(), zerocopy.pending.end(),
+          [first, range](const ZerocopySend & send) {
+            return send.id - first <= range;
+          }), zerocopy.pending.end());
+        const size_t completed = before - zerocopy.pending.size();
+        released += completed;
+        if (error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+          zerocopy_copied_sends += completed;
+        }
+      }
+    }
+  }
+#endif
+  return released;
+}
+
+size_t udp::Context::zerocopy_pending() const {
+  size_t pending = 0;
+  for (const auto & socket_state : zerocopy_sockets) {
+    pending += socket_state.second.pending.size();
+  }
+  return pending;
+}
+
+List<int> udp::Context::send_sockets() const {
+  List<int> sockets;
+  for (int send_socket : {unicast_send_socket, multicast_send_socket}) {
+    if (send_socket != -1) {
+      sockets.push_back(send_socket);
+    }
+  }
+  return sockets;
+}
+
+void udp::Context::unicast_send_segments(
+  const Locator_t & locator, const uint32_t * packet, size_t size, size_t segment_size)
+{
+  socket_send_segments(unicast_send_socket, resolve(locator), packet, size, segment_size);
+}
+
+void udp::Context::multicast_send_segments(
+  const Locator_t & locator, const uint32_t * packet, size_t size, size_t segment_size)
+{
+  socket_send_segments(multicast_send_socket, resolve(locator), packet, size, segment_size);
+}
+
+bool udp::Context::enable_gro(int recv_socket) {
+#ifdef __linux__
+  int enable = 1;
+  return setsockopt(recv_socket, SOL_UDP, UDP_GRO, &enable, sizeof(enable)) == 0;
+#else
+  return false;
+#endif
+}
+
+// Fills control with a UDP_SEGMENT message and returns its length.
+static size_t write_segment_control(uint8_t * control, size_t capacity, uint16_t segment_bytes) {
+  struct msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_control = control;
+  message.msg_controllen = capacity;
+  struct cmsghdr * header = CMSG_FIRSTHDR(&message);
+  header->cmsg_level = SOL_UDP;
+  header->cmsg_type = UDP_SEGMENT;
+  header->cmsg_len = CMSG_LEN(sizeof(segment_bytes));
+  memcpy(CMSG_DATA(header), &segment_bytes, sizeof(segment_bytes));
+  return CMSG_SPACE(sizeof(segment_bytes));
+}
+
+// The errors of a segmented send the kernel or the device can't do, as opposed to a full
+// socket buffer or an unreachable destination.
+static bool gso_refused(int error) {
+  return error == EIO || error == EINVAL || error == ENOPROTOOPT || error == EOPNOTSUPP;
+}
+
+// The fallback for a segmented send. Returns false if any datagram failed.
+static bool send_one_by_one(int sender_socket, udp::Destination & destination,
+  const uint8_t * data, size_t bytes, size_t segment_bytes)
+{
+  bool all_sent = true;
+  for (size_t offset = 0; offset < bytes; offset += segment_bytes) {
+    const size_t length = std::min(segment_bytes, bytes - offset);
+    if (!send_datagram(sender_socket, destination, data + offset, length)) {
+      all_sent = false;
+    }
+  }
+  return all_sent;
+}
+
+// The datagrams a send of bytes becomes on the wire.
+static size_t datagram_count(size_t bytes, size_t segment_bytes) {
+  return segment_bytes == 0 ? 1 : (bytes + segment_bytes - 1) / segment_bytes;
+}
+
+void udp::Context::socket_send_segments(
+  int sender_socket, Destination & destination, const uint32_t * packet, size_t size,
+  size_t segment_size)
+{
+  if (sender_socket == -1) {
+    return;
+  }
+  assert(segment_size > 0);
+  const uint8_t * data = reinterpret_cast<const uint8_t *>(packet);
+  const size_t bytes = size * sizeof(uint32_t);
+  const size_t segment_bytes = segment_size * sizeof(uint32_t);
+  // One segmented send is a single UDP payload as far as the socket is concerned.
+  const size_t segments_per_send =
+    std::min(max_gso_segments, CMBML__MAX_FRAGMENT_SIZE / segment_bytes);
+  const size_t bytes_per_send = segments_per_send * segment_bytes;
+  for (size_t offset = 0; offset < bytes;) {
+    if (!gso_enabled || segments_per_send < 2) {
+      const size_t length = std::min(segment_bytes, bytes - offset);
+      send_now(sender_socket, destination, data + offset, length);
+      offset += length;
+      continue;
+    }
+    const size_t length = std::min(bytes_per_send, bytes - offset);
+    send_now(sender_socket, destination, data + offset, length,
+      length > segment_bytes ? static_cast<uint16_t>(segment_bytes) : 0);
+    offset += length;
+  }
 }
 
 void udp::Context::socket_send(
-  int sender_socket, const Locator_t & locator, const uint32_t * packet, size_t size)
+  int sender_socket, Destination & destination, const uint32_t * packet, size_t size)
 {
   if (sender_socket == -1) {
     // Socket isn't open yet, so we can't send.
     return;
   }
-  const udp::LocatorUDPv4_t locator_v4(locator);
+  send_now(sender_socket, destination, packet, size * sizeof(uint32_t));
+}
+
+void udp::Context::send_now(int sender_socket, Destination & destination,
+  const void * data, size_t bytes, uint16_t segment_bytes)
+{
+  if (send_batch_depth == 0 && segment_bytes == 0) {
+    send_datagram(sender_socket, destination, data, bytes);
+    return;
+  }
+  if (send_batch_depth == 0) {
+    struct iovec vector = {const_cast<void *>(data), bytes};
+    ControlBuffer control;
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_name = &destination.address;
+    message.msg_namelen = destination.address_length;
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control.bytes;
+    message.msg_controllen =
+      write_segment_control(control.bytes, sizeof(control.bytes), segment_bytes);
+    if (sendmsg(sender_socket, &message, 0) >= 0) {
+      destination.record_sent(datagram_count(bytes, segment_bytes), bytes);
+    } else if (gso_refused(errno)) {
+      gso_enabled = false;
+      send_one_by_one(sender_socket, destination, static_cast<const uint8_t *>(data), bytes,
+        segment_bytes);
+    } else {
+      destination.send_errors += datagram_count(bytes, segment_bytes);
+    }
+    return;
+  }
+  if (queued_sends == send_queue.size()) {
+    send_queue.emplace_back();
+  }
+  QueuedSend & queued = send_queue[queued_sends++];
+  queued.socket = sender_socket;
+  queued.destination = &destination;
+  const uint8_t * begin = static_cast<const uint8_t *>(data);
+  queued.data.assign(begin, begin + bytes);
+  queued.segment_bytes = segment_bytes;
+  if (queued_sends >= send_batch_size) {
+    flush_sends();
+  }
+}
+
+// sendmmsg, or a sendmsg per message where it's missing. Returns the messages sent, or -1
+// with errno set if the first failed.
+static int send_messages(int sender_socket, udp::MessageHeader * headers, size_t count) {
+#ifdef __linux__
+  return sendmmsg(sender_socket, headers, count, 0);
+#else
+  size_t sent = 0;
+  for (; sent < count; ++sent) {
+    const ssize_t bytes = sendmsg(sender_socket, &headers[sent].msg_hdr, 0);
+    if (bytes < 0) {
+      return sent == 0 ? -1 : static_cast<int>(sent);
+    }
+    headers[sent].msg_len = bytes;
+  }
+  return static_cast<int>(sent);
+#endif
+}
+
+// recvmmsg without blocking, or a recvmsg per message where it's missing.
+static int receive_messages(int recv_socket, udp::MessageHeader * headers, size_t count) {
+#ifdef __linux__
+  return recvmmsg(recv_socket, headers, count, MSG_DONTWAIT, NULL);
+#else
+  size_t received = 0;
+  for (; received < count; ++received) {
+    const ssize_t bytes = recvmsg(recv_socket, &headers[received].msg_hdr, MSG_DONTWAIT);
+    if (bytes < 0) {
+      return received == 0 ? -1 : static_cast<int>(received);
+    }
+    headers[received].msg_len = bytes;
+  }
+  return static_cast<int>(received);
+#endif
+}
+
+size_t udp::Context::flush_sends() {
+  send_headers.resize(queued_sends);
+  send_vectors.resize(queued_sends);
+  send_controls.resize(queued_sends);
+  for (size_t i = 0; i < queued_sends; ++i) {
+    QueuedSend & queued = send_queue[i];
+    send_vectors[i].iov_base = queued.data.data();
+    send_vectors[i].iov_len = queued.data.size();
+    memset(&send_headers[i], 0, sizeof(MessageHeader));
+    send_headers[i].msg_hdr.msg_name = &queued.destination->address;
+    send_headers[i].msg_hdr.msg_namelen = queued.destination->address_length;
+    send_headers[i].msg_hdr.msg_iov = &send_vectors[i];
+    send_headers[i].msg_hdr.msg_iovlen = 1;
+    if (queued.segment_bytes != 0) {
+      send_headers[i].msg_hdr.msg_control = send_controls[i].bytes;
+      send_headers[i].msg_hdr.msg_controllen = write_segment_control(
+        send_controls[i].bytes, sizeof(send_controls[i].bytes), queued.segment_bytes);
+    }
+  }
+
+  size_t accepted = 0;
+  size_t first = 0;
+  while (first < queued_sends) {
+    // sendmmsg takes one socket, so send each run of datagrams for the same socket.
+    const int sender_socket = send_queue[first].socket;
+    size_t end = first + 1;
+    while (end < queued_sends && send_queue[end].socket == sender_socket) {
+      ++end;
+    }
+    while (first < end) {
+      int sent = send_messages(sender_socket, &send_headers[first], end - first);
+      if (sent <= 0) {
+        if (sent < 0 && errno == EINTR) {
+          continue;
+        }
+        const QueuedSend & failed = send_queue[first];
+        if (sent < 0 && failed.segment_bytes != 0 && gso_refused(errno)) {
+          gso_enabled = false;
+          if (send_one_by_one(sender_socket, *failed.destination, failed.data.data(),
+            failed.data.size(), failed.segment_bytes))
+          {
+            ++accepted;
+          }
+        } else {
+          failed.destination->send_errors +=
+            datagram_count(failed.data.size(), failed.segment_bytes);
+        }
+        // Like a failed sendto, the datagram is dropped; carry on with the next one.
+        first += 1;
+        continue;
+      }
+      for (int i = 0; i < sent; ++i) {
+        const QueuedSend & queued = send_queue[first + i];
+        queued.destination->record_sent(
+          datagram_count(queued.data.size(), queued.segment_bytes), queued.data.size());
+      }
+      accepted += sent;
+      first += sent;
+    }
+  }
+  queued_sends = 0;
+  return accepted;
+}
+
+// The size of the datagrams the kernel coalesced into a received buffer, or 0.
+static size_t gro_segment_bytes(struct msghdr & message) {
+  for (struct cmsghdr * header = CMSG_FIRSTHDR(&message); header;
+    header = CMSG_NXTHDR(&message, header))
+  {
+    if (header->cmsg_level == SOL_UDP && header->cmsg_type == UDP_GRO) {
+      int segment_bytes;
+      memcpy(&segment_bytes, CMSG_DATA(header), sizeof(segment_bytes));
+      return segment_bytes;
+    }
+  }
+  return 0;
+}
+
+size_t udp::Context::fill_receive_batch(
+  int recv_socket, ReceiveBatch & batch, size_t packet_size)
+{
+  const size_t words = (packet_size + sizeof(Packet<>::value_type) - 1) /
+    sizeof(Packet<>::value_type);
+  if (batch.buffers.size() != receive_batch_size) {
+    batch.buffers.resize(receive_batch_size);
+    batch.used.assign(receive_batch_size, 0);
+    batch.headers.resize(receive_batch_size);
+    batch.vectors.resize(receive_batch_size);
+    batch.controls.resize(receive_batch_size);
+  }
+  for (size_t i = 0; i < receive_batch_size; ++i) {
+    if (batch.buffers[i].size() < words) {
+      batch.buffers[i].resize(words);
+    }
+    batch.vectors[i].iov_base = batch.buffers[i].data();
+    batch.vectors[i].iov_len = batch.buffers[i].size() * sizeof(Packet<>::value_type);
+    memset(&batch.headers[i], 0, sizeof(MessageHeader));
+    // TODO checking src is important error checking/security
+    batch.headers[i].msg_hdr.msg_iov = &batch.vectors[i];
+    batch.headers[i].msg_hdr.msg_iovlen = 1;
+    batch.headers[i].msg_hdr.msg_control = batch.controls[i].bytes;
+    batch.headers[i].msg_hdr.msg_controllen = sizeof(batch.controls[i].bytes);
+  }
+
+  batch.ready.clear();
+  batch.count = 0;
+  batch.next = 0;
+  int received = receive_messages(recv_socket, batch.headers.data(), receive_batch_size);
+  if (received <= 0) {
+    return 0;
+  }
 
-  struct sockaddr_in dest_address;
-  dest_address.sin_port = htons(static_cast<uint32_t>(locator_v4.port));
-  dest_address.sin_addr.s_addr = static_cast<uint32_t>(locator_v4.address);
+  // Count the segments of coalesced buffers first: batch.ready points into batch.segments.
+  size_t extra_segments = 0;
+  for (int i = 0; i < received; ++i) {
+    const size_t bytes_received = batch.headers[i].msg_len;
+    const size_t segment_bytes = gro_segment_bytes(batch.headers[i].msg_hdr);
+    if (segment_bytes != 0 && segment_bytes < bytes_received) {
+      extra_segments += (bytes_received - 1) / segment_bytes;
+    }
+  }
+  if (batch.segments.size() < extra_segments) {
+    batch.segments.resize(extra_segments);
+  }
+
+  size_t next_segment = 0;
+  for (int i = 0; i < received; ++i) {
+    uint8_t * buffer = reinterpret_cast<uint8_t *>(batch.buffers[i].data());
+    const size_t bytes_received = batch.headers[i].msg_len;
+    size_t segment_bytes = gro_segment_bytes(batch.headers[i].msg_hdr);
+    if (segment_bytes == 0 || segment_bytes > bytes_received) {
+      segment_bytes = bytes_received;
+    }
+    batch.ready.push_back(&batch.buffers[i]);
+    // The first datagram stays in the buffer; the others are copied out, sized to fit.
+    for (size_t offset = segment_bytes; offset < bytes_received; offset += segment_bytes) {
+      const size_t length = std::min(segment_bytes, bytes_received - offset);
+      Packet<> & segment = batch.segments[next_segment++];
+      segment.assign(
+        (length + sizeof(Packet<>::value_type) - 1) / sizeof(Packet<>::value_type), 0);
+      memcpy(segment.data(), buffer + offset, length);
+      batch.ready.push_back(&segment);
+    }
+    // Clear what's left of the previous packet, so deserialization sees the same zero
+    // padding as with a fresh buffer.
+    const size_t dirty = std::max(batch.used[i], bytes_received);
+    if (segment_bytes < dirty) {
+      memset(buffer + segment_bytes, 0, dirty - segment_bytes);
+    }
+    batch.used[i] = segment_bytes;
+  }
+  batch.count = batch.ready.size();
+  return batch.count;
+}
+
+List<int> udp::Context::receive_sockets() const {
+  List<int> sockets;
+  for (const auto & port_sockets_pair : port_socket_map) {
+    sockets.insert(sockets.end(), port_sockets_pair.second.begin(), port_sockets_pair.second.end());
+  }
+  return sockets;
+}
 
-  sendto(sender_socket, packet, size, 0,
-      reinterpret_cast<struct sockaddr *>(&dest_address), sizeof(dest_address));
+List<int> udp::Context::receive_sockets(size_t shard) const {
+  assert(shard < receive_shards);
+  return shard_sockets[shard];
 }
 
 IPAddress udp::Context::address_as_array() const {
@@ -0,0 +1,38 @@
+#include <cmbml/psm/udp/destination_cache.hpp>
+#include <cmbml/psm/udp/constants.hpp>
+
+#include <string.h>
+
+using namespace cmbml;
+
+udp::Destination & udp::DestinationCache::resolve(const Locator_t & locator) {
+  Destination ** cached = index.find(locator);
+  if (cached) {
+    return **cached;
+  }
+  destinations.emplace_back();
+  Destination & destination = destinations.back();
+  destination.locator = locator;
+  memset(&destination.address, 0, sizeof(destination.address));
+  if (locator.kind == LOCATOR_KIND_UDPv6) {
+    struct sockaddr_in6 & address = reinterpret_cast<struct sockaddr_in6 &>(destination.address);
+    address.sin6_family = AF_INET6;
+    address.sin6_port = htons(static_cast<uint16_t>(locator.port));
+    memcpy(&address.sin6_addr, locator.address.data(), sizeof(address.sin6_addr));
+    destination.address_length = sizeof(address);
+  } else {
+    // The octets are in dot notation order, which is network byte order.
+    struct sockaddr_in & address = reinterpret_cast<struct sockaddr_in &>(destination.address);
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(locator.port));
+    memcpy(&address.sin_addr, locator.address.data(), sizeof(address.sin_addr));
+    destination.address_length = sizeof(address);
+  }
+  index.insert(locator, &destination);
+  return destination;
+}
+
+const udp::Destination * udp::DestinationCache::find(const Locator_t & locator) const {
+  Destination * const * cached = index.find(locator);
+  return cached ? *cached : nullptr;
+}
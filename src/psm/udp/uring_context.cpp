@@ -0,0 +1,518 @@
+#include <cmbml/psm/udp/uring_context.hpp>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+
+using namespace cmbml;
+
+// No liburing: the three io_uring syscalls are all we need.
+static int uring_setup(unsigned entries, struct io_uring_params * params) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return static_cast<int>(
+    syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0));
+}
+
+static int uring_register(int ring_fd, unsigned opcode, void * arg, unsigned nr_args) {
+  return static_cast<int>(syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args));
+}
+
+static const uint16_t buffer_group = 0;
+static const uint64_t user_data_value_mask = (uint64_t(1) << 56) - 1;
+
+template<typename OperationT>
+static uint64_t user_data(OperationT operation, uint64_t value) {
+  return (static_cast<uint64_t>(operation) << 56) | value;
+}
+
+udp::UringContext::UringContext(const UringOptions & options) {
+#ifdef IORING_RECV_MULTISHOT
+  if (!setup_ring(options) || !setup_buffer_ring(options) || !probe_multishot_receive()) {
+    teardown();
+  }
+#else
+  // Kernel headers older than Linux 6.0.
+  (void)options;
+#endif
+}
+
+udp::UringContext::~UringContext() {
+  teardown();
+}
+
+bool udp::UringContext::setup_ring(const UringOptions & options) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  if (options.sqpoll) {
+    params.flags = IORING_SETUP_SQPOLL;
+    params.sq_thread_idle = options.sqpoll_idle_ms;
+  }
+  ring_fd = uring_setup(options.entries, &params);
+  if (ring_fd < 0 && options.sqpoll) {
+    // SQPOLL needs privileges before Linux 5.11.
+    memset(&params, 0, sizeof(params));
+    ring_fd = uring_setup(options.entries, &params);
+  }
+  if (ring_fd < 0) {
+    ring_fd = -1;
+    return false;
+  }
+  sqpoll = (params.flags & IORING_SETUP_SQPOLL) != 0;
+
+  sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap) {
+    sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+  }
+  void * memory = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  if (memory == MAP_FAILED) {
+    return false;
+  }
+  sq_ring = memory;
+  if (single_mmap) {
+    cq_ring = sq_ring;
+  } else {
+    memory = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    if (memory == MAP_FAILED) {
+      return false;
+    }
+    cq_ring = memory;
+  }
+  sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  memory = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if (memory == MAP_FAILED) {
+    return false;
+  }
+  sqes = static_cast<struct io_uring_sqe *>(memory);
+
+  uint8_t * sq = static_cast<uint8_t *>(sq_ring);
+  sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+  sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  sq_flags = reinterpret_cast<unsigned *>(sq + params.sq_off.flags);
+  sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+  sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  sq_entries = params.sq_entries;
+  sqe_tail = *sq_tail;
+  uint8_t * cq = static_cast<uint8_t *>(cq_ring);
+  cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+  cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+  cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+  cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+  event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (event_fd < 0) {
+    return false;
+  }
+  return uring_register(ring_fd, IORING_REGISTER_EVENTFD, &event_fd, 1) == 0;
+}
+
+bool udp::UringContext::setup_buffer_ring(const UringOptions & options) {
+#ifdef IORING_RECV_MULTISHOT
+  const unsigned count = options.buffer_count;
+  if (count == 0 || (count & (count - 1)) != 0 || count > 32768) {
+    return false;
+  }
+  buffer_ring_size = count * sizeof(struct io_uring_buf);
+  void * memory = mmap(nullptr, buffer_ring_size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    return false;
+  }
+  buffer_ring = static_cast<struct io_uring_buf_ring *>(memory);
+  struct io_uring_buf_reg registration;
+  memset(&registration, 0, sizeof(registration));
+  registration.ring_addr = reinterpret_cast<uint64_t>(memory);
+  registration.ring_entries = count;
+  registration.bgid = buffer_group;
+  // Linux 5.19.
+  if (uring_register(ring_fd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0) {
+    return false;
+  }
+  buffer_mask = count - 1;
+  const size_t words = (options.buffer_bytes + sizeof(Packet<>::value_type) - 1) /
+    sizeof(Packet<>::value_type);
+  buffers.assign(count, Packet<>(words));
+  buffer_used.assign(count, 0);
+  for (unsigned i = 0; i < count; ++i) {
+    recycle_buffer(static_cast<uint16_t>(i));
+  }
+  return true;
+#else
+  (void)options;
+  return false;
+#endif
+}
+
+// Multishot receive needs Linux 6.0; older kernels reject the submission with EINVAL.
+// Arms one on a throwaway socket and cancels it.
+bool udp::UringContext::probe_multishot_receive() {
+  int probe_socket = socket(AF_INET, SOCK_DGRAM, 0);
+  if (probe_socket < 0) {
+    return false;
+  }
+  const uint64_t receive_data = user_data(Operation::receive, probe_socket);
+  const uint64_t cancel_data = user_data(Operation::cancel, 0);
+  arm_receive(probe_socket);
+  struct io_uring_sqe * sqe = get_sqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = receive_data;
+  sqe->user_data = cancel_data;
+
+  int receive_result = 0;
+  bool cancelled = false;
+  while (!cancelled) {
+    if (submit(true) < 0) {
+      break;
+    }
+    unsigned head = *cq_head;
+    const unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+      const struct io_uring_cqe & cqe = cqes[head & cq_mask];
+      if (cqe.user_data == receive_data) {
+        receive_result = cqe.res;
+      } else if (cqe.user_data == cancel_data) {
+        cancelled = true;
+      }
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+  }
+  close(probe_socket);
+  return receive_result == -ECANCELED;
+}
+
+void udp::UringContext::teardown() {
+  // Closing the ring cancels what's in flight.
+  if (ring_fd != -1) {
+    close(ring_fd);
+    ring_fd = -1;
+  }
+  if (event_fd != -1) {
+    close(event_fd);
+    event_fd = -1;
+  }
+  if (sqes) {
+    munmap(sqes, sqes_size);
+    sqes = nullptr;
+  }
+  if (cq_ring && cq_ring != sq_ring) {
+    munmap(cq_ring, cq_ring_size);
+  }
+  cq_ring = nullptr;
+  if (sq_ring) {
+    munmap(sq_ring, sq_ring_size);
+    sq_ring = nullptr;
+  }
+  if (buffer_ring) {
+    munmap(buffer_ring, buffer_ring_size);
+    buffer_ring = nullptr;
+  }
+}
+
+struct io_uring_sqe * udp::UringContext::get_sqe() {
+  while (sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) {
+    // Full: hand the entries to the kernel to make room.
+    if (submit() < 0 && errno != EAGAIN && errno != EBUSY) {
+      break;
+    }
+  }
+  const unsigned index = sqe_tail & sq_mask;
+  sq_array[index] = index;
+  ++sqe_tail;
+  struct io_uring_sqe * sqe = &sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+int udp::UringContext::submit(bool wait) {
+  unsigned to_submit = sqe_tail - *sq_tail;
+  __atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+  unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+  if (sqpoll) {
+    // The kernel thread takes the entries; it only has to be woken if it went to sleep.
+    to_submit = 0;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP) {
+      flags |= IORING_ENTER_SQ_WAKEUP;
+    }
+  }
+  if (to_submit == 0 && flags == 0) {
+    return 0;
+  }
+  int result;
+  do {
+    result = uring_enter(ring_fd, to_submit, wait ? 1 : 0, flags);
+  } while (result < 0 && errno == EINTR);
+  return result;
+}
+
+void udp::UringContext::arm_receive(int recv_socket) {
+#ifdef IORING_RECV_MULTISHOT
+  struct io_uring_sqe * sqe = get_sqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = recv_socket;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = buffer_group;
+  sqe->user_data = user_data(Operation::receive, recv_socket);
+#else
+  (void)recv_socket;
+#endif
+}
+
+void udp::UringContext::arm_interrupt() {
+  struct io_uring_sqe * sqe = get_sqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = interrupt_pipe[0];
+  sqe->poll32_events = POLLIN;
+  sqe->user_data = user_data(Operation::interrupt, 0);
+  interrupt_armed = true;
+}
+
+void udp::UringContext::arm_new_receivers() {
+  for (int recv_socket : Context::receive_sockets()) {
+    if (std::find(armed_sockets.begin(), armed_sockets.end(), recv_socket) ==
+      armed_sockets.end())
+    {
+      arm_receive(recv_socket);
+      armed_sockets.push_back(recv_socket);
+    }
+  }
+  submit();
+}
+
+void udp::UringContext::add_unicast_receiver(const Locator_t & locator) {
+  Context::add_unicast_receiver(locator);
+  if (uring_enabled()) {
+    arm_new_receivers();
+  }
+}
+
+void udp::UringContext::add_multicast_receiver(const Locator_t & locator) {
+  Context::add_multicast_receiver(locator);
+  if (uring_enabled()) {
+    arm_new_receivers();
+  }
+}
+
+void udp::UringContext::unicast_send(
+  const Locator_t & locator, const uint32_t * packet, size_t size)
+{
+  if (!uring_enabled()) {
+    Context::unicast_send(locator, packet, size);
+    return;
+  }
+  uring_send(unicast_send_socket, resolve(locator), packet, size);
+}
+
+void udp::UringContext::multicast_send(
+  const Locator_t & locator, const uint32_t * packet, size_t size)
+{
+  if (!uring_enabled()) {
+    Context::multicast_send(locator, packet, size);
+    return;
+  }
+  uring_send(multicast_send_socket, resolve(locator), packet, size);
+}
+
+void udp::UringContext::unicast_send(
+  Destination & destination, const uint32_t * packet, size_t size)
+{
+  if (!uring_enabled()) {
+    Context::unicast_send(destination, packet, size);
+    return;
+  }
+  uring_send(unicast_send_socket, destination, packet, size);
+}
+
+void udp::UringContext::multicast_send(
+  Destination & destination, const uint32_t * packet, size_t size)
+{
+  if (!uring_enabled()) {
+    Context::multicast_send(destination, packet, size);
+    return;
+  }
+  uring_send(multicast_send_socket, destination, packet, size);
+}
+
+void udp::UringContext::uring_send(
+  int sender_socket, Destination & destination, const uint32_t * packet, size_t size)
+{
+  if (sender_socket == -1) {
+    return;
+  }
+  if (free_send_slots.empty()) {
+    // Take back the slots of completed sends before adding one.
+    reap_completions();
+  }
+  size_t index;
+  if (free_send_slots.empty()) {
+    index = send_slots.size();
+    send_slots.emplace_back();
+  } else {
+    index = free_send_slots.back();
+    free_send_slots.pop_back();
+  }
+  SendSlot & slot = send_slots[index];
+  slot.destination = &destination;
+  const uint8_t * begin = reinterpret_cast<const uint8_t *>(packet);
+  slot.data.assign(begin, begin + size * sizeof(uint32_t));
+  slot.vector.iov_base = slot.data.data();
+  slot.vector.iov_len = slot.data.size();
+  memset(&slot.message, 0, sizeof(slot.message));
+  slot.message.msg_name = &destination.address;
+  slot.message.msg_namelen = destination.address_length;
+  slot.message.msg_iov = &slot.vector;
+  slot.message.msg_iovlen = 1;
+
+  struct io_uring_sqe * sqe = get_sqe();
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = sender_socket;
+  sqe->addr = reinterpret_cast<uint64_t>(&slot.message);
+  sqe->len = 1;
+  sqe->user_data = user_data(Operation::send, index);
+  if (uring_batch_depth == 0) {
+    submit();
+  }
+}
+
+size_t udp::UringContext::flush_sends() {
+  if (!uring_enabled()) {
+    return 0;
+  }
+  const size_t queued = sqe_tail - *sq_tail;
+  submit();
+  return queued;
+}
+
+bool udp::UringContext::reap_completions() {
+  unsigned head = *cq_head;
+  const unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+  if (head == tail) {
+    return false;
+  }
+  bool rearmed = false;
+  for (; head != tail; ++head) {
+    const struct io_uring_cqe cqe = cqes[head & cq_mask];
+    const uint64_t value = cqe.user_data & user_data_value_mask;
+    switch (static_cast<Operation>(cqe.user_data >> 56)) {
+      case Operation::send: {
+        const SendSlot & slot = send_slots[value];
+        if (cqe.res >= 0) {
+          slot.destination->record_sent(1, static_cast<size_t>(cqe.res));
+        } else {
+          ++slot.destination->send_errors;
+        }
+        free_send_slots.push_back(value);
+        break;
+      }
+      case Operation::receive:
+        if (cqe.flags & IORING_CQE_F_BUFFER) {
+          const uint16_t buffer_id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+          if (cqe.res >= 0) {
+            received.push_back(ReceivedPacket{buffer_id, static_cast<size_t>(cqe.res)});
+          } else {
+            recycle_buffer(buffer_id);
+          }
+        }
+        // The multishot receive ended, e.g. with ENOBUFS while every buffer was lent out.
+        if (!(cqe.flags & IORING_CQE_F_MORE) && cqe.res != -EBADF && cqe.res != -ECANCELED) {
+          arm_receive(static_cast<int>(value));
+          rearmed = true;
+        }
+        break;
+      case Operation::interrupt:
+        clear_interrupt();
+        interrupt_armed = false;
+        interrupted = true;
+        break;
+      default:
+        break;
+    }
+  }
+  __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+  if (rearmed) {
+    submit();
+  }
+  return true;
+}
+
+void udp::UringContext::wait_for_completion() {
+  if (!interrupt_armed && interrupt_pipe[0] != -1) {
+    arm_interrupt();
+  }
+  while (received.empty() && !interrupted) {
+    if (!reap_completions() && submit(true) < 0) {
+      return;
+    }
+  }
+  interrupted = false;
+}
+
+const Packet<> * udp::UringContext::next_packet() {
+  if (lent_buffer != -1) {
+    recycle_buffer(static_cast<uint16_t>(lent_buffer));
+    lent_buffer = -1;
+  }
+  if (received.empty()) {
+    reap_completions();
+  }
+  if (received.empty()) {
+    // Clear the eventfd before looking again, so a completion posted in between leaves it
+    // readable.
+    uint64_t count;
+    ssize_t bytes_read = read(event_fd, &count, sizeof(count));
+    (void)bytes_read;
+    reap_completions();
+    if (received.empty()) {
+      return nullptr;
+    }
+  }
+  const ReceivedPacket packet = received.front();
+  received.pop_front();
+  // Clear what's left of the previous packet, so deserialization sees the same zero
+  // padding as with a fresh buffer.
+  uint8_t * buffer = reinterpret_cast<uint8_t *>(buffers[packet.buffer_id].data());
+  if (packet.bytes < buffer_used[packet.buffer_id]) {
+    memset(buffer + packet.bytes, 0, buffer_used[packet.buffer_id] - packet.bytes);
+  }
+  buffer_used[packet.buffer_id] = packet.bytes;
+  lent_buffer = packet.buffer_id;
+  return &buffers[packet.buffer_id];
+}
+
+void udp::UringContext::recycle_buffer(uint16_t buffer_id) {
+#ifdef IORING_RECV_MULTISHOT
+  // Not buffer_ring->bufs: in C++ the empty struct in __DECLARE_FLEX_ARRAY moves it by a byte.
+  // The tail overlays the resv field of the first entry. Only this thread writes it.
+  struct io_uring_buf * entries = reinterpret_cast<struct io_uring_buf *>(buffer_ring);
+  uint16_t * tail = &entries[0].resv;
+  const uint16_t next = *tail;
+  struct io_uring_buf * buffer = &entries[next & buffer_mask];
+  buffer->addr = reinterpret_cast<uint64_t>(buffers[buffer_id].data());
+  buffer->len = static_cast<uint32_t>(buffers[buffer_id].size() * sizeof(Packet<>::value_type));
+  buffer->bid = buffer_id;
+  __atomic_store_n(tail, static_cast<uint16_t>(next + 1), __ATOMIC_RELEASE);
+#else
+  (void)buffer_id;
+#endif
+}
+
+List<int> udp::UringContext::receive_sockets() const {
+  if (!uring_enabled()) {
+    return Context::receive_sockets();
+  }
+  return List<int>{event_fd};
+}
@@ -4,63 +4,70 @@
 
 using namespace cmbml;
 
-const SequenceNumber_t & WriterProxy::max_available_changes() {
-  const SequenceNumber_t * max_seq = &maximum_sequence_number;
-  for (auto it = changes_from_writer.begin(); it != changes_from_writer.end(); ++it) {
-    if (it->second.status == ChangeFromWriterStatus::received ||
-        it->second.status == ChangeFromWriterStatus::lost)
-    {
-      if (it->second.sequence_number > *max_seq) {
-        max_seq = &it->second.sequence_number;
-      }
-    }
-  }
-  return *max_seq;
+SequenceNumber_t WriterProxy::max_available_changes() const {
+  return SequenceNumber_t::from_value(changes_from_writer.max_available());
 }
 
 void WriterProxy::set_irrelevant_change(const SequenceNumber_t & seq_num) {
   set_irrelevant_change(seq_num.value());
 }
 
-void WriterProxy::set_irrelevant_change(const int64_t seq_num) {
-  assert(changes_from_writer.count(seq_num));
-  ChangeFromWriter & ref = changes_from_writer.at(seq_num);
-  ref.is_relevant = false;
-  ref.status = ChangeFromWriterStatus::received;
+// Irrelevant changes count as received (8.4.10.4.3); the window carries no relevance flag.
+void WriterProxy::set_irrelevant_change(const uint64_t seq_num) {
+  changes_from_writer.set_received(seq_num);
 }
 
 void WriterProxy::update_lost_changes(const SequenceNumber_t & first_available_seq_num) {
-  std::for_each(changes_from_writer.begin(), changes_from_writer.end(),
-    [first_available_seq_num](auto & change_pair) {
-      ChangeFromWriter & change = change_pair.second;
-      if ((change.status == ChangeFromWriterStatus::unknown ||
-            change.status == ChangeFromWriterStatus::missing) &&
-          (change.sequence_number < first_available_seq_num))
-      {
-        change.status = ChangeFromWriterStatus::lost;
-      }
-    }
-  );
+  changes_from_writer.update_lost(first_available_seq_num.value());
 }
 
 void WriterProxy::update_missing_changes(const SequenceNumber_t & last_available_seq_num) {
-  std::for_each(changes_from_writer.begin(), changes_from_writer.end(),
-    [last_available_seq_num](auto & change_pair) {
-      ChangeFromWriter & change = change_pair.second;
-      if (change.status == ChangeFromWriterStatus::unknown &&
-          change.sequence_number <= last_available_seq_num)
-      {
-        change.status = ChangeFromWriterStatus::missing;
-      }
-    }
-  );
+  changes_from_writer.update_missing(last_available_seq_num.value());
 }
 
 void WriterProxy::set_received_change(const SequenceNumber_t & seq_num) {
-  assert(changes_from_writer.count(seq_num.value()));
-  changes_from_writer.at(seq_num.value()).status = ChangeFromWriterStatus::received;
+  changes_from_writer.set_received(seq_num.value());
+}
+
+List<SequenceNumber_t> WriterProxy::missing_changes() const {
+  return changes_from_writer.missing();
+}
+
+bool WriterProxy::has_missing_changes() const {
+  return changes_from_writer.has_missing();
+}
+
+bool WriterProxy::schedule_acknack(Clock::time_point now) {
+  if (acknack_armed) {
+    return false;
+  }
+  if (acknack_count > 0 && now < last_acknack_time + heartbeat_suppression_duration) {
+    return false;
+  }
+  acknack_armed = true;
+  acknack_due_time = now + heartbeat_response_delay;
+  return true;
+}
+
+bool WriterProxy::acknack_due(Clock::time_point now) const {
+  return acknack_armed && now >= acknack_due_time;
+}
+
+AckNack WriterProxy::make_acknack(const EntityId_t & reader_id, Clock::time_point now) {
+  AckNack acknack;
+  acknack.reader_id = reader_id;
+  acknack.writer_id = remote_writer_guid.entity_id;
+  // TODO see spec page 127 for capacity handling behavior in sequence set
+  acknack.reader_sn_state.base = max_available_changes() + 1;
+  acknack.reader_sn_state.set = missing_changes();
+  // Current setting final=1, which means we do not expect a response from the writer
+  acknack.final_flag = 1;
+  acknack.count = ++acknack_count;
+  acknack_armed = false;
+  last_acknack_time = now;
+  return acknack;
 }
 
-const GUID_t & WriterProxy::get_guid() {
+const GUID_t & WriterProxy::get_guid() const {
   return remote_writer_guid;
 }
@@ -0,0 +1,259 @@
+#include <algorithm>
+#include <cassert>
+#include <cmbml/utility/timer_wheel.hpp>
+
+using namespace cmbml;
+
+const uint32_t TimerHandle::invalid_index;
+const size_t TimerWheel::slot_bits;
+const size_t TimerWheel::slots_per_level;
+const size_t TimerWheel::levels;
+
+static const uint64_t slot_mask = TimerWheel::slots_per_level - 1;
+static const uint64_t no_tick = std::numeric_limits<uint64_t>::max();
+
+// Ticks spanned by one slot of the given level.
+static uint64_t level_span(size_t level) {
+  return 1ULL << (TimerWheel::slot_bits * level);
+}
+
+static uint64_t rotate_right(uint64_t bits, size_t n) {
+  return n ? (bits >> n) | (bits << (64 - n)) : bits;
+}
+
+TimerWheel::TimerWheel(std::chrono::nanoseconds res, Clock::time_point start_time) :
+  resolution(res), start(start_time)
+{
+  assert(resolution.count() > 0);
+  for (auto & level : slot_heads) {
+    level.fill(TimerHandle::invalid_index);
+  }
+}
+
+uint64_t TimerWheel::ticks_until(Clock::time_point time_point, bool round_up) const {
+  if (time_point <= start) {
+    return 0;
+  }
+  const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(time_point - start);
+  const uint64_t ticks = elapsed / resolution;
+  return round_up && elapsed % resolution != std::chrono::nanoseconds(0) ? ticks + 1 : ticks;
+}
+
+TimerHandle TimerWheel::arm(
+  std::chrono::nanoseconds delay, std::function<void()> callback,
+  std::chrono::nanoseconds period, Clock::time_point now)
+{
+  uint32_t index;
+  if (free_timers.empty()) {
+    index = static_cast<uint32_t>(timers.size());
+    timers.emplace_back();
+  } else {
+    index = free_timers.back();
+    free_timers.pop_back();
+  }
+  Timer & timer = timers[index];
+  timer.callback = std::move(callback);
+  // The slot of the current tick has already run.
+  timer.expires = std::max(ticks_until(now + delay, true), current_tick + 1);
+  timer.period = 0;
+  if (period > std::chrono::nanoseconds(0)) {
+    timer.period = std::max<uint64_t>(
+      (period + resolution - std::chrono::nanoseconds(1)) / resolution, 1);
+  }
+  timer.state = TimerState::armed;
+  ++armed_count;
+  insert(index);
+  return TimerHandle{index, timer.generation};
+}
+
+bool TimerWheel::cancel(const TimerHandle & handle) {
+  if (!is_armed(handle)) {
+    return false;
+  }
+  Timer & timer = timers[handle.index];
+  if (timer.state == TimerState::running) {
+    // run_slot releases it once the callback returns.
+    timer.state = TimerState::cancelled;
+    return true;
+  }
+  unlink(handle.index);
+  release(handle.index);
+  return true;
+}
+
+bool TimerWheel::is_armed(const TimerHandle & handle) const {
+  if (handle.index >= timers.size()) {
+    return false;
+  }
+  const Timer & timer = timers[handle.index];
+  return timer.generation == handle.generation &&
+    (timer.state == TimerState::armed || timer.state == TimerState::running);
+}
+
+void TimerWheel::insert(uint32_t index) {
+  Timer & timer = timers[index];
+  assert(timer.expires >= current_tick);
+  const uint64_t delta = timer.expires - current_tick;
+  size_t level = 0;
+  while (level < levels - 1 && delta >= level_span(level + 1)) {
+    ++level;
+  }
+  uint64_t placement = timer.expires;
+  if (delta >= level_span(levels)) {
+    // Beyond the top level: park it in the furthest top-level slot.
+    placement = current_tick + level_span(levels) - 1;
+  }
+  const size_t slot = (placement >> (slot_bits * level)) & slot_mask;
+
+  timer.level = static_cast<uint8_t>(level);
+  timer.slot = static_cast<uint8_t>(slot);
+  timer.prev = TimerHandle::invalid_index;
+  timer.next = slot_heads[level][slot];
+  if (timer.next != TimerHandle::invalid_index) {
+    timers[timer.next].prev = index;
+  }
+  slot_heads[level][slot] = index;
+  occupied[level] |= 1ULL << slot;
+}
+
+void TimerWheel::unlink(uint32_t index) {
+  Timer & timer = timers[index];
+  if (timer.prev != TimerHandle::invalid_index) {
+    timers[timer.prev].next = timer.next;
+  } else {
+    slot_heads[timer.level][timer.slot] = timer.next;
+    if (timer.next == TimerHandle::invalid_index) {
+      occupied[timer.level] &= ~(1ULL << timer.slot);
+    }
+  }
+  if (timer.next != TimerHandle::invalid_index) {
+    timers[timer.next].prev = timer.prev;
+  }
+  timer.prev = timer.next = TimerHandle::invalid_index;
+}
+
+void TimerWheel::release(uint32_t index) {
+  Timer & timer = timers[index];
+  timer.callback = nullptr;
+  timer.state = TimerState::free;
+  ++timer.generation;
+  free_timers.push_back(index);
+  --armed_count;
+}
+
+void TimerWheel::cascade(size_t level, size_t slot) {
+  uint32_t index = slot_heads[level][slot];
+  slot_heads[level][slot] = TimerHandle::invalid_index;
+  occupied[level] &= ~(1ULL << slot);
+  while (index != TimerHandle::invalid_index) {
+    const uint32_t next = timers[index].next;
+    insert(index);
+    index = next;
+  }
+}
+
+size_t TimerWheel::run_slot(size_t slot) {
+  List<uint32_t> due;
+  uint32_t index = slot_heads[0][slot];
+  slot_heads[0][slot] = TimerHandle::invalid_index;
+  occupied[0] &= ~(1ULL << slot);
+  while (index != TimerHandle::invalid_index) {
+    Timer & timer = timers[index];
+    assert(timer.expires == current_tick);
+    timer.state = TimerState::running;
+    due.push_back(index);
+    index = timer.next;
+    timer.prev = timer.next = TimerHandle::invalid_index;
+  }
+
+  size_t fired = 0;
+  for (const uint32_t due_index : due) {
+    if (timers[due_index].state != TimerState::running) {
+      // Cancelled by an earlier callback.
+      release(due_index);
+      continue;
+    }
+    // Callbacks may arm timers and grow the timer pool, so don't hold a reference across.
+    auto callback = std::move(timers[due_index].callback);
+    callback();
+    ++fired;
+    Timer & timer = timers[due_index];
+    if (timer.state == TimerState::running && timer.period) {
+      timer.callback = std::move(callback);
+      timer.expires = std::max(timer.expires + timer.period, current_tick + 1);
+      timer.state = TimerState::armed;
+      insert(due_index);
+    } else {
+      release(due_index);
+    }
+  }
+  return fired;
+}
+
+uint64_t TimerWheel::next_event_tick() const {
+  uint64_t next = no_tick;
+  for (size_t level = 0; level < levels; ++level) {
+    if (!occupied[level]) {
+      continue;
+    }
+    // Slots are visited in the order of the blocks following the current one.
+    const size_t shift = slot_bits * level;
+    const uint64_t block = current_tick >> shift;
+    const uint64_t rotated = rotate_right(occupied[level], (block + 1) & slot_mask);
+    const uint64_t blocks_ahead = 1 + __builtin_ctzll(rotated);
+    next = std::min(next, (block + blocks_ahead) << shift);
+  }
+  return next;
+}
+
+size_t TimerWheel::expire(Clock::time_point now) {
+  const uint64_t target = ticks_until(now, false);
+  size_t fired = 0;
+  while (current_tick < target) {
+    const uint64_t next = next_event_tick();
+    if (next > target) {
+      current_tick = target;
+      break;
+    }
+    current_tick = next;
+    // Higher levels first, so their timers can land in the slots cascaded below.
+    for (size_t level = levels - 1; level > 0; --level) {
+      if ((current_tick & (level_span(level) - 1)) == 0) {
+        cascade(level, (current_tick >> (slot_bits * level)) & slot_mask);
+      }
+    }
+    fired += run_slot(current_tick & slot_mask);
+  }
+  return fired;
+}
+
+TimerWheel::Clock::time_point TimerWheel::next_wakeup() const {
+  uint64_t next = no_tick;
+  for (size_t level = 0; level < levels; ++level) {
+    uint64_t remaining = occupied[level];
+    if (!remaining) {
+      continue;
+    }
+    const size_t shift = slot_bits * level;
+    const uint64_t block = current_tick >> shift;
+    const size_t first = (block + 1) & slot_mask;
+    // The earliest occupied slot of a level holds its earliest timers, except in the top
+    // level, where timers parked beyond its span break the order; scan all of its slots.
+    while (remaining) {
+      const size_t slot = (first + __builtin_ctzll(rotate_right(remaining, first))) & slot_mask;
+      remaining &= ~(1ULL << slot);
+      for (uint32_t index = slot_heads[level][slot]; index != TimerHandle::invalid_index;
+        index = timers[index].next)
+      {
+        next = std::min(next, timers[index].expires);
+      }
+      if (level < levels - 1) {
+        break;
+      }
+    }
+  }
+  if (next == no_tick) {
+    return Clock::time_point::max();
+  }
+  return start + std::chrono::duration_cast<Clock::duration>(resolution * next);
+}
@@ -0,0 +1,149 @@
+#include <cmbml/dds/wait_set.hpp>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <limits>
+#include <thread>
+
+using namespace cmbml;
+using namespace cmbml::dds;
+
+Condition::~Condition() {
+  List<WaitSet *> attached;
+  {
+    std::lock_guard<std::mutex> lock(wait_sets_mutex);
+    attached = wait_sets;
+  }
+  for (WaitSet * wait_set : attached) {
+    wait_set->detach_condition(*this);
+  }
+}
+
+void Condition::set_trigger_value(bool value) {
+  if (trigger_value.exchange(value) || !value) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(wait_sets_mutex);
+  for (WaitSet * wait_set : wait_sets) {
+    wait_set->wake();
+  }
+}
+
+void StatusCondition::set_enabled_statuses(StatusMask mask) {
+  enabled_statuses = mask;
+  update_trigger_value();
+}
+
+void StatusCondition::add_status_changes(StatusMask statuses) {
+  status_changes |= statuses;
+  update_trigger_value();
+}
+
+void StatusCondition::clear_status_changes(StatusMask statuses) {
+  status_changes &= ~statuses;
+  update_trigger_value();
+}
+
+void StatusCondition::update_trigger_value() {
+  set_trigger_value((status_changes & enabled_statuses) != 0);
+}
+
+WaitSet::WaitSet() {
+  event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  assert(event_fd >= 0);
+}
+
+WaitSet::~WaitSet() {
+  List<Condition *> attached;
+  {
+    std::lock_guard<std::mutex> lock(conditions_mutex);
+    attached = conditions;
+  }
+  for (Condition * condition : attached) {
+    detach_condition(*condition);
+  }
+  if (event_fd >= 0) {
+    close(event_fd);
+  }
+}
+
+void WaitSet::attach_condition(Condition & condition) {
+  std::lock_guard<std::mutex> lock(conditions_mutex);
+  if (std::find(conditions.begin(), conditions.end(), &condition) != conditions.end()) {
+    return;
+  }
+  conditions.push_back(&condition);
+  std::lock_guard<std::mutex> condition_lock(condition.wait_sets_mutex);
+  condition.wait_sets.push_back(this);
+  // Already triggered: a thread in wait() must see it.
+  if (condition.get_trigger_value()) {
+    wake();
+  }
+}
+
+void WaitSet::detach_condition(Condition & condition) {
+  std::lock_guard<std::mutex> lock(conditions_mutex);
+  conditions.erase(
+    std::remove(conditions.begin(), conditions.end(), &condition), conditions.end());
+  std::lock_guard<std::mutex> condition_lock(condition.wait_sets_mutex);
+  condition.wait_sets.erase(
+    std::remove(condition.wait_sets.begin(), condition.wait_sets.end(), this),
+    condition.wait_sets.end());
+}
+
+void WaitSet::wake() {
+  const uint64_t one = 1;
+  ssize_t written = write(event_fd, &one, sizeof(one));
+  (void)written;
+}
+
+void WaitSet::collect_triggered(List<Condition *> & active_conditions) {
+  active_conditions.clear();
+  std::lock_guard<std::mutex> lock(conditions_mutex);
+  for (Condition * condition : conditions) {
+    if (condition->get_trigger_value()) {
+      active_conditions.push_back(condition);
+    }
+  }
+}
+
+bool WaitSet::wait(List<Condition *> & active_conditions, std::chrono::nanoseconds timeout) {
+  using Clock = std::chrono::steady_clock;
+  const bool forever = timeout == std::chrono::nanoseconds::max();
+  const auto deadline = forever ? Clock::time_point::max() : Clock::now() + timeout;
+  while (true) {
+    // Drain before checking, so a trigger after the check leaves the eventfd readable.
+    uint64_t count;
+    ssize_t bytes_read = read(event_fd, &count, sizeof(count));
+    (void)bytes_read;
+    collect_triggered(active_conditions);
+    if (!active_conditions.empty()) {
+      return true;
+    }
+
+    int poll_timeout = -1;
+    if (!forever) {
+      const auto now = Clock::now();
+      if (now >= deadline) {
+        return false;
+      }
+      // Round up so the wait doesn't end just before the deadline.
+      const auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - now + std::chrono::milliseconds(1) - std::chrono::nanoseconds(1));
+      poll_timeout = static_cast<int>(
+        std::min<std::chrono::milliseconds::rep>(wait.count(), std::numeric_limits<int>::max()));
+    }
+    struct pollfd poll_fd = {event_fd, POLLIN, 0};
+    if (poll(&poll_fd, 1, poll_timeout) < 0 && errno != EINTR) {
+      // EFAULT and EINVAL can't happen with one pollfd on the stack. Out of kernel memory,
+      // check the conditions every millisecond instead of reporting a timeout early.
+      assert(errno == ENOMEM);
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+}
@@ -0,0 +1,156 @@
+#include <cmbml/utility/work_stealing_executor.hpp>
+
+#include <algorithm>
+
+using namespace cmbml;
+
+const size_t WorkStealingExecutor::Strand::run_budget;
+
+// Lets schedule() push to the deque of the worker it runs on.
+static thread_local const WorkStealingExecutor * current_executor = nullptr;
+static thread_local size_t current_worker = 0;
+
+void WorkStealingExecutor::Strand::post(std::function<void()> callback) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    queue.push_back(std::move(callback));
+    if (scheduled) {
+      return;
+    }
+    scheduled = true;
+  }
+  executor.schedule(this);
+}
+
+void WorkStealingExecutor::Strand::run() {
+  for (size_t i = 0; i < run_budget && !executor.stopping; ++i) {
+    std::function<void()> callback;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (queue.empty()) {
+        scheduled = false;
+        return;
+      }
+      callback = std::move(queue.front());
+      queue.pop_front();
+    }
+    callback();
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (queue.empty()) {
+      scheduled = false;
+      return;
+    }
+  }
+  // Out of budget: let the other strands have a turn.
+  executor.schedule(this, true);
+}
+
+WorkStealingExecutor::WorkStealingExecutor(size_t num_workers) {
+  for (size_t i = 0; i < std::max<size_t>(num_workers, 1); ++i) {
+    workers.emplace_back();
+  }
+}
+
+WorkStealingExecutor::~WorkStealingExecutor() {
+  shutdown();
+  for (auto & worker : workers) {
+    if (worker.thread.joinable()) {
+      worker.thread.join();
+    }
+  }
+}
+
+WorkStealingExecutor::Strand & WorkStealingExecutor::make_strand() {
+  std::lock_guard<std::mutex> lock(strands_mutex);
+  strands.emplace_back(new Strand(*this));
+  return *strands.back();
+}
+
+void WorkStealingExecutor::schedule(Strand * strand, bool yield) {
+  const size_t index = current_executor == this ?
+    current_worker : next_worker++ % workers.size();
+  // Counted before it's visible, so the count never drops below zero.
+  ++queued_strands;
+  {
+    std::lock_guard<std::mutex> lock(workers[index].mutex);
+    if (yield) {
+      workers[index].strands.push_front(strand);
+    } else {
+      workers[index].strands.push_back(strand);
+    }
+  }
+  if (idle_workers > 0) {
+    std::lock_guard<std::mutex> lock(idle_mutex);
+    idle_condition.notify_one();
+  }
+}
+
+WorkStealingExecutor::Strand * WorkStealingExecutor::pop(size_t worker_index) {
+  Worker & worker = workers[worker_index];
+  std::lock_guard<std::mutex> lock(worker.mutex);
+  if (worker.strands.empty()) {
+    return nullptr;
+  }
+  Strand * strand = worker.strands.back();
+  worker.strands.pop_back();
+  return strand;
+}
+
+WorkStealingExecutor::Strand * WorkStealingExecutor::steal(size_t thief_index) {
+  for (size_t i = 1; i < workers.size(); ++i) {
+    Worker & victim = workers[(thief_index + i) % workers.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.strands.empty()) {
+      Strand * strand = victim.strands.front();
+      victim.strands.pop_front();
+      return strand;
+    }
+  }
+  return nullptr;
+}
+
+void WorkStealingExecutor::worker_loop(size_t worker_index) {
+  current_executor = this;
+  current_worker = worker_index;
+  while (!stopping) {
+    Strand * strand = pop(worker_index);
+    if (!strand) {
+      strand = steal(worker_index);
+    }
+    if (strand) {
+      --queued_strands;
+      strand->run();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(idle_mutex);
+    ++idle_workers;
+    idle_condition.wait(lock, [this]() { return queued_strands > 0 || stopping; });
+    --idle_workers;
+  }
+  current_executor = nullptr;
+}
+
+void WorkStealingExecutor::spin() {
+  if (stopping) {
+    return;
+  }
+  for (size_t i = 0; i < workers.size(); ++i) {
+    workers[i].thread = std::thread([this, i]() { worker_loop(i); });
+  }
+  reactor.spin();
+  shutdown();
+  for (auto & worker : workers) {
+    if (worker.thread.joinable()) {
+      worker.thread.join();
+    }
+  }
+}
+
+void WorkStealingExecutor::shutdown() {
+  stopping = true;
+  reactor.shutdown();
+  std::lock_guard<std::mutex> lock(idle_mutex);
+  idle_condition.notify_all();
+}
@@ -22,6 +22,18 @@ CacheChange ReaderCacheAccessor::pop_next_unsent_change() {
   return change;
 }
 
+void ReaderCacheAccessor::skip_next_unsent_change() {
+  assert(writer_cache);
+  assert(writer_cache->contains_change((highest_seq_num_sent + 1).value()));
+  highest_seq_num_sent = highest_seq_num_sent + 1;
+}
+
+bool ReaderCacheAccessor::has_unsent_changes() const {
+  assert(writer_cache);
+  return writer_cache->size() > 0 &&
+    highest_seq_num_sent.value() < writer_cache->get_max_sequence_number().value();
+}
+
 // request_seq_numbers must be sorted in ascending order
 void ReaderCacheAccessor::set_requested_changes(const List<SequenceNumber_t> & request_seq_numbers) {
   for (const auto & seq : request_seq_numbers) {
@@ -34,6 +46,16 @@ void ReaderLocator::reset_unsent_changes() {
   highest_seq_num_sent = writer_cache->get_min_sequence_number();
 }
 
+void ReaderLocator::deliver_local(CacheChange && change) {
+  assert(!local_readers.empty());
+  // Removed readers are skipped: their locator has nobody else to send to.
+  for (size_t i = 0; i + 1 < local_readers.size(); ++i) {
+    CacheChange copy(change);
+    local_readers[i]->deliver(std::move(copy));
+  }
+  local_readers.back()->deliver(std::move(change));
+}
+
 bool ReaderLocator::locator_compare(const Locator_t & loc) {
   for (size_t i = 0; i < 16; ++i) {
     if (loc.address[i] != locator.address[i]) {
@@ -61,6 +83,14 @@ void ReaderProxy::set_acked_changes(const SequenceNumber_t & seq_num) {
   highest_acked_seq_num = seq_num;
 }
 
+void ReaderProxy::deliver_local(CacheChange && change) {
+  assert(local_reader);
+  const SequenceNumber_t seq_num = change.sequence_number;
+  // A removed reader is gone, not unreachable: the change is dropped.
+  local_reader->deliver(std::move(change));
+  set_acked_changes(seq_num);
+}
+
 void ReaderProxy::add_change_for_reader(ChangeForReader && change) {
   // Naive?
 
@@ -0,0 +1,149 @@
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+
+#include <cmbml/structure/reader.hpp>
+
+#include "helpers.hpp"
+
+using namespace cmbml;
+
+using ReliableParams = EndpointParams<ReliabilityKind_t::reliable, TopicKind_t::with_key>;
+using ReliableReader = StatelessReader<false, ReliableParams>;
+
+// Records the datagrams sent to each locator, and their sizes.
+struct RecordingContext {
+  void unicast_send(const Locator_t & locator, const uint32_t *, size_t size) {
+    unicast.push_back(locator);
+    sizes.push_back(size);
+  }
+  void multicast_send(const Locator_t & locator, const uint32_t *, size_t size) {
+    multicast.push_back(locator);
+    sizes.push_back(size);
+  }
+  List<Locator_t> unicast;
+  List<Locator_t> multicast;
+  List<size_t> sizes;
+};
+
+void match(ReliableReader & reader, const GUID_t & guid, List<Locator_t> unicast_locators,
+  List<Locator_t> multicast_locators)
+{
+  reader.add_matched_writer(WriterProxy(guid, unicast_locators, multicast_locators));
+}
+
+int main(int argc, char ** argv) {
+  using std::chrono::milliseconds;
+  const WriterProxy::Clock::time_point start = WriterProxy::Clock::now();
+
+  // The first HEARTBEAT arms the timer; the others wait for it.
+  {
+    List<Locator_t> unicast_locators;
+    List<Locator_t> multicast_locators;
+    WriterProxy proxy(make_guid(1, 1), unicast_locators, multicast_locators);
+    proxy.heartbeat_response_delay = milliseconds(5);
+    assert(proxy.schedule_acknack(start));
+    assert(proxy.acknack_scheduled() && proxy.acknack_deadline() == start + milliseconds(5));
+    assert(!proxy.schedule_acknack(start + milliseconds(1)));
+    assert(proxy.acknack_deadline() == start + milliseconds(5));
+    assert(!proxy.acknack_due(start + milliseconds(4)));
+    assert(proxy.acknack_due(start + milliseconds(5)));
+
+    const AckNack first = proxy.make_acknack(EntityId_t(), start + milliseconds(5));
+    assert(first.count == 1);
+    assert(!proxy.acknack_scheduled() && !proxy.acknack_due(start + milliseconds(5)));
+    // Without a suppression duration the next HEARTBEAT is answered again.
+    assert(proxy.schedule_acknack(start + milliseconds(5)));
+    assert(proxy.make_acknack(EntityId_t(), start + milliseconds(10)).count == 2);
+  }
+
+  // Within heartbeat_suppression_duration of the last ACKNACK, HEARTBEATs are ignored.
+  {
+    List<Locator_t> unicast_locators;
+    List<Locator_t> multicast_locators;
+    WriterProxy proxy(make_guid(1, 1), unicast_locators, multicast_locators);
+    proxy.heartbeat_response_delay = milliseconds(0);
+    proxy.heartbeat_suppression_duration = milliseconds(10);
+    // Nothing was sent yet, so nothing is suppressed.
+    assert(proxy.schedule_acknack(start));
+    proxy.make_acknack(EntityId_t(), start);
+    assert(!proxy.schedule_acknack(start + milliseconds(9)));
+    assert(!proxy.acknack_scheduled());
+    assert(proxy.schedule_acknack(start + milliseconds(10)));
+  }
+
+  // Each sent ACKNACK counts once.
+  {
+    List<Locator_t> unicast_locators = {make_locator(7410)};
+    List<Locator_t> multicast_locators;
+    WriterProxy proxy(make_guid(1, 1), unicast_locators, multicast_locators);
+    RecordingContext context;
+    proxy.schedule_acknack(start);
+    AckNack acknack = proxy.make_acknack(EntityId_t(), start);
+    assert(acknack.count == 1);
+    proxy.send(std::move(acknack), context);
+    assert(context.unicast.size() == 1);
+    proxy.schedule_acknack(start);
+    assert(proxy.make_acknack(EntityId_t(), start).count == 2);
+  }
+
+  // The due ACKNACKs of one participant's writers share a datagram, sent to that
+  // participant's unicast locator only. Writers whose timers haven't expired wait.
+  {
+    ReliableReader reader;
+    reader.guid = make_guid(9, 1);
+    const Locator_t participant = make_locator(7410);
+    const Locator_t other_participant = make_locator(7420);
+    const Locator_t group = make_locator(7400, 239);
+    const GUID_t first = make_guid(1, 1);
+    const GUID_t second = make_guid(1, 2);
+    const GUID_t other = make_guid(2, 1);
+    const GUID_t late = make_guid(3, 1);
+    match(reader, first, {participant}, {group});
+    match(reader, second, {participant}, {group});
+    match(reader, other, {other_participant}, {group});
+    match(reader, late, {make_locator(7430)}, {});
+    for (const GUID_t & guid : {first, second, other}) {
+      WriterProxy * proxy = reader.matched_writer_lookup(guid);
+      proxy->heartbeat_response_delay = milliseconds(5);
+      proxy->schedule_acknack(start);
+    }
+    WriterProxy * late_proxy = reader.matched_writer_lookup(late);
+    late_proxy->heartbeat_response_delay = milliseconds(50);
+    late_proxy->schedule_acknack(start);
+
+    RecordingContext context;
+    assert(!reader.acknacks_due(start + milliseconds(4)));
+    reader.send_due_acknacks(context, start + milliseconds(4));
+    assert(context.unicast.empty());
+
+    assert(reader.acknacks_due(start + milliseconds(5)));
+    reader.send_due_acknacks(context, start + milliseconds(5));
+    assert((context.unicast == List<Locator_t>{participant, other_participant}));
+    assert(context.multicast.empty());
+    // Two ACKNACKs in the first datagram, one in the second.
+    assert(context.sizes[0] == 2 * context.sizes[1]);
+    for (const GUID_t & guid : {first, second, other}) {
+      assert(!reader.matched_writer_lookup(guid)->acknack_scheduled());
+    }
+    assert(late_proxy->acknack_scheduled());
+    assert(!reader.acknacks_due(start + milliseconds(5)));
+  }
+
+  // A writer without unicast locators is answered on its multicast locators.
+  {
+    ReliableReader reader;
+    const Locator_t group = make_locator(7400, 239);
+    match(reader, make_guid(1, 1), {}, {group});
+    WriterProxy * proxy = reader.matched_writer_lookup(make_guid(1, 1));
+    proxy->heartbeat_response_delay = milliseconds(0);
+    proxy->schedule_acknack(start);
+    RecordingContext context;
+    reader.send_due_acknacks(context, start);
+    assert(context.unicast.empty());
+    assert((context.multicast == List<Locator_t>{group}));
+  }
+
+  printf("All tests passed.\n");
+  return 0;
+}
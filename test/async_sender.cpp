@@ -0,0 +1,126 @@
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+#include <cmbml/utility/async_sender.hpp>
+
+#include "helpers.hpp"
+
+using namespace cmbml;
+
+struct Datagram {
+  Locator_t locator;
+  bool multicast;
+  Packet<> packet;
+};
+
+static std::mutex sent_mutex;
+static List<Datagram> sent_datagrams;
+
+List<Datagram> take_sent() {
+  std::lock_guard<std::mutex> lock(sent_mutex);
+  List<Datagram> sent;
+  sent.swap(sent_datagrams);
+  return sent;
+}
+
+// Records datagrams instead of sending them.
+struct RecordingContext {
+  void unicast_send(const Locator_t & locator, const uint32_t * packet, size_t size) {
+    record(locator, false, packet, size);
+  }
+
+  void multicast_send(const Locator_t & locator, const uint32_t * packet, size_t size) {
+    record(locator, true, packet, size);
+  }
+
+  void record(const Locator_t & locator, bool multicast, const uint32_t * packet, size_t size) {
+    std::lock_guard<std::mutex> lock(sent_mutex);
+    sent_datagrams.push_back(Datagram{locator, multicast, Packet<>(packet, packet + size)});
+  }
+};
+
+template<typename PredicateT>
+void wait_for(PredicateT && predicate) {
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (!predicate()) {
+    assert(std::chrono::steady_clock::now() < deadline);
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+}
+
+int main(int argc, char ** argv) {
+  const Locator_t a = make_locator(7400);
+  const Locator_t b = make_locator(7401);
+
+  // Messages for one destination are appended into one datagram, flushed after flush_period.
+  {
+    AsyncSender<RecordingContext> sender(1024, std::chrono::milliseconds(20));
+    sender.enqueue(a, false, Packet<>{1, 2});
+    sender.enqueue(b, true, Packet<>{3});
+    sender.enqueue(a, false, Packet<>{4});
+    wait_for([&sender]() { return sender.datagrams_sent() == 2; });
+    auto sent = take_sent();
+    assert(sent.size() == 2);
+    for (const auto & datagram : sent) {
+      if (datagram.locator == a) {
+        assert(!datagram.multicast);
+        assert((datagram.packet == Packet<>{1, 2, 4}));
+      } else {
+        assert(datagram.locator == b && datagram.multicast);
+        assert((datagram.packet == Packet<>{3}));
+      }
+    }
+    assert(sender.messages_sent() == 3);
+  }
+
+  // A datagram is sent early when the next message wouldn't fit.
+  {
+    AsyncSender<RecordingContext> sender(3 * sizeof(uint32_t), std::chrono::seconds(10));
+    sender.enqueue(a, false, Packet<>{1, 2});
+    sender.enqueue(a, false, Packet<>{3, 4});
+    wait_for([&sender]() { return sender.datagrams_sent() == 1; });
+    auto sent = take_sent();
+    assert((sent[0].packet == Packet<>{1, 2}));
+  }
+  take_sent();
+
+  // The destructor sends what is still queued or batched.
+  {
+    {
+      AsyncSender<RecordingContext> sender(1024, std::chrono::seconds(10));
+      for (uint32_t i = 0; i < 100; ++i) {
+        sender.enqueue(a, false, Packet<>{i});
+      }
+    }
+    auto sent = take_sent();
+    assert(sent.size() == 1);
+    assert(sent[0].packet.size() == 100);
+    for (uint32_t i = 0; i < 100; ++i) {
+      assert(sent[0].packet[i] == i);
+    }
+  }
+
+  // Many writer threads.
+  {
+    AsyncSender<RecordingContext> sender;
+    List<std::thread> writers;
+    for (int w = 0; w < 4; ++w) {
+      writers.emplace_back([&sender, &a]() {
+        for (uint32_t i = 0; i < 1000; ++i) {
+          sender.enqueue(a, false, Packet<>{i});
+        }
+      });
+    }
+    for (auto & writer : writers) {
+      writer.join();
+    }
+    wait_for([&sender]() { return sender.messages_sent() == 4000; });
+    take_sent();
+  }
+
+  printf("All tests passed.\n");
+  return 0;
+}
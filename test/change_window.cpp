@@ -0,0 +1,96 @@
+#include <cassert>
+#include <cstdio>
+
+#include <cmbml/structure/change_window.hpp>
+
+using namespace cmbml;
+
+int main(int argc, char ** argv) {
+  // In-order reception slides the window.
+  {
+    ChangeWindow window;
+    assert(window.max_available() == 0);
+    window.set_received(1);
+    window.set_received(2);
+    assert(window.max_available() == 2);
+    assert(window.status(1) == ChangeFromWriterStatus::received);
+    assert(window.status(3) == ChangeFromWriterStatus::unknown);
+  }
+
+  // A hole stops the window; filling it releases the contiguous run.
+  {
+    ChangeWindow window;
+    window.set_received(1);
+    window.set_received(3);
+    window.set_received(4);
+    assert(window.max_available() == 1);
+    assert(!window.has_missing());
+    window.update_missing(6);
+    assert(window.has_missing());
+    List<SequenceNumber_t> missing = window.missing();
+    assert(missing.size() == 3);
+    assert(missing[0].value() == 2);
+    assert(missing[1].value() == 5);
+    assert(missing[2].value() == 6);
+    window.set_received(2);
+    assert(window.max_available() == 4);
+    assert(window.missing().size() == 2);
+  }
+
+  // Lost changes count as available.
+  {
+    ChangeWindow window;
+    window.set_received(5);
+    window.update_missing(10);
+    window.update_lost(4);
+    assert(window.max_available() == 3);
+    assert(window.status(7) == ChangeFromWriterStatus::missing);
+    window.update_lost(8);
+    assert(window.max_available() == 7);
+    {
+      List<SequenceNumber_t> missing = window.missing();
+      assert(missing.size() == 3);
+      assert(missing[0].value() == 8);
+      assert(missing[2].value() == 10);
+    }
+  }
+
+  // Entries recycled by a slide are missing if the writer already announced them.
+  {
+    ChangeWindow window;
+    window.update_missing(300);
+    for (uint64_t seq = 1; seq <= 10; ++seq) {
+      window.set_received(seq);
+    }
+    assert(window.status(260) == ChangeFromWriterStatus::missing);
+    assert(window.missing().size() == ChangeWindow::capacity);
+  }
+
+  // Missing set stays ordered across the ring wrap-around and window jumps.
+  {
+    ChangeWindow window;
+    for (uint64_t seq = 1; seq <= 250; ++seq) {
+      window.set_received(seq);
+    }
+    window.update_missing(600);
+    window.set_received(260);
+    List<SequenceNumber_t> missing = window.missing();
+    assert(missing.size() == ChangeWindow::capacity - 1);
+    for (size_t i = 1; i < missing.size(); ++i) {
+      assert(missing[i - 1].value() < missing[i].value());
+    }
+    assert(missing.front().value() == 251);
+    assert(window.status(600) == ChangeFromWriterStatus::missing);
+
+    // Far ahead of the window: older changes are given up on.
+    window.set_received(1000);
+    assert(window.max_available() == 1000 - ChangeWindow::capacity);
+    assert(window.status(1000) == ChangeFromWriterStatus::received);
+    window.update_lost(1001);
+    assert(window.max_available() == 1000);
+    assert(window.missing().empty());
+  }
+
+  printf("All tests passed.\n");
+  return 0;
+}
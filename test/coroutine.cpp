@@ -0,0 +1,115 @@
+#include <unistd.h>
+
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include <cmbml/utility/coroutine.hpp>
+
+using namespace cmbml;
+
+Task sleeper(CoroutineScheduler & scheduler, int & wakeups) {
+  const auto start = std::chrono::steady_clock::now();
+  co_await scheduler.sleep_for(std::chrono::milliseconds(2));
+  assert(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(2));
+  ++wakeups;
+  co_await scheduler.sleep_for(std::chrono::milliseconds(1));
+  ++wakeups;
+}
+
+Task pipe_reader(CoroutineScheduler & scheduler, int fd, int & bytes_seen) {
+  while (bytes_seen < 6) {
+    co_await scheduler.readable(fd);
+    char buffer[16];
+    bytes_seen += read(fd, buffer, sizeof(buffer));
+  }
+  scheduler.shutdown();
+}
+
+// "History has unsent changes": the producer adds changes and notifies, the push loop wakes
+// only once there is something to send.
+Task push_loop(AsyncEvent & changes, const int & added, int & sent, int & wakeups) {
+  while (sent < 3) {
+    co_await changes.wait_until([&added, &sent]() { return added > sent; });
+    ++wakeups;
+    sent = added;
+  }
+}
+
+Task producer(CoroutineScheduler & scheduler, AsyncEvent & changes, int & added) {
+  for (int i = 0; i < 3; ++i) {
+    // A notify without a new change doesn't wake the push loop.
+    changes.notify();
+    co_await scheduler.yield();
+    ++added;
+    changes.notify();
+    co_await scheduler.yield();
+  }
+}
+
+Task forever(AsyncEvent & never) {
+  co_await never.wait();
+}
+
+int main(int argc, char ** argv) {
+  {
+    CoroutineScheduler scheduler;
+    int pipe_fds[2];
+    assert(pipe(pipe_fds) == 0);
+
+    int wakeups = 0;
+    int bytes_seen = 0;
+    scheduler.spawn(sleeper(scheduler, wakeups));
+    scheduler.spawn(pipe_reader(scheduler, pipe_fds[0], bytes_seen));
+
+    std::thread writer([&pipe_fds]() {
+      // Well after the sleeper is done.
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      assert(write(pipe_fds[1], "abc", 3) == 3);
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      assert(write(pipe_fds[1], "def", 3) == 3);
+    });
+    scheduler.run();
+    writer.join();
+
+  assert(wakeups == 2);
+    assert(bytes_seen == 6);
+    assert(scheduler.live_count() == 0);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+  }
+
+  {
+    CoroutineScheduler scheduler;
+    AsyncEvent changes(scheduler);
+    int added = 0;
+    int sent = 0;
+    int wakeups = 0;
+    scheduler.spawn(push_loop(changes, added, sent, wakeups));
+    scheduler.spawn(producer(scheduler, changes, added));
+    scheduler.executor().add_timed_task(std::chrono::milliseconds(5), true, [&scheduler]() {
+      scheduler.shutdown();
+    });
+    scheduler.run();
+    assert(sent == 3);
+    assert(wakeups == 3);
+    assert(changes.waiter_count() == 0);
+  }
+
+  // Coroutines still suspended are freed with the scheduler.
+  {
+    CoroutineScheduler scheduler;
+    AsyncEvent never(scheduler);
+    scheduler.spawn(forever(never));
+    scheduler.executor().add_timed_task(std::chrono::milliseconds(1), true, [&scheduler]() {
+      scheduler.shutdown();
+    });
+    scheduler.run();
+    assert(scheduler.live_count() == 1);
+    assert(never.waiter_count() == 1);
+  }
+
+  printf("All tests passed.\n");
+  return 0;
+}
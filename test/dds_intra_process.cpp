@@ -0,0 +1,56 @@
+#include <cassert>
+#include <cstdio>
+
+#include <cmbml/cmbml.hpp>
+#include <cmbml/psm/loopback/context.hpp>
+
+#include "helpers.hpp"
+
+using namespace cmbml;
+
+using ReliableParams = EndpointParams<ReliabilityKind_t::reliable, TopicKind_t::with_key>;
+using LocalDataReader = dds::DataReader<StatelessReader<false, ReliableParams>, loopback::Context>;
+using LocalDataWriter = dds::DataWriter<StatefulWriter<true, ReliableParams>, loopback::Context>;
+
+int main(int argc, char ** argv) {
+  IntraProcessRegistry & registry = IntraProcessRegistry::instance();
+  const GUID_t reader_guid = make_guid(1, 1);
+  const GUID_t writer_guid = make_guid(2, 1);
+  SyncExecutor executor;
+
+  {
+    LocalDataReader reader;
+    reader.get_rtps_reader().guid = reader_guid;
+    List<Locator_t> unicast_locators;
+    List<Locator_t> multicast_locators;
+    reader.get_rtps_reader().add_matched_writer(
+      WriterProxy(writer_guid, unicast_locators, multicast_locators));
+    assert(!registry.find_reader(reader_guid));
+    // Adding its tasks makes the reader a local reader.
+    reader.add_tasks(executor);
+    assert(registry.find_reader(reader_guid));
+
+    LocalDataWriter writer;
+    writer.get_rtps_writer().guid = writer_guid;
+    writer.add_tasks(executor);
+    GUID_t matched_guid = reader_guid;
+    writer.get_rtps_writer().add_matched_reader(ReaderProxy(matched_guid, false, {}, {},
+      &writer.get_rtps_writer().writer_cache));
+    assert(writer.get_rtps_writer().lookup_matched_reader(reader_guid).local_reader);
+
+    // The sample reaches the reader through the registry, without a spin of the executor.
+    writer.set_publish_mode(dds::PublishMode::synchronous);
+    Data data;
+    data.payload = {42};
+    writer.on_write(std::move(data));
+    assert(reader.get_readcondition().get_trigger_value());
+    List<CacheChange> taken = reader.on_take();
+    assert(taken.size() == 1);
+    assert(taken[0].writer_guid == writer_guid);
+    assert((taken[0].data == List<Octet>{42}));
+  }
+  assert(!registry.find_reader(reader_guid));
+
+  printf("All tests passed.\n");
+  return 0;
+}
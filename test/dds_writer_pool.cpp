@@ -0,0 +1,90 @@
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include <cmbml/cmbml.hpp>
+#include <cmbml/psm/loopback/context.hpp>
+#include <cmbml/utility/thread_pool_executor.hpp>
+
+#include "helpers.hpp"
+
+using namespace cmbml;
+
+using ReliableParams = EndpointParams<ReliabilityKind_t::reliable, TopicKind_t::with_key>;
+using PoolDataWriter =
+  dds::DataWriter<StatefulWriter<true, ReliableParams>, udp::Context, ThreadPoolExecutor>;
+
+// An ACKNACK from reader_guid asking for change 1 again.
+AckNack make_acknack(const GUID_t & reader_guid, Count_t count) {
+  AckNack acknack;
+  acknack.reader_id = reader_guid.entity_id;
+  acknack.reader_sn_state.base = SequenceNumber_t::from_value(1);
+  acknack.reader_sn_state.set = {SequenceNumber_t::from_value(1)};
+  acknack.count = count;
+  return acknack;
+}
+
+int main(int argc, char ** argv) {
+  // A reliable writer's heartbeat and NACK response timers run on the pool while its ACKNACKs
+  // are handled on other workers. The writer's state machine takes udp::Context events, so
+  // it sends over UDP; the reader's packets come through the loopback switch, and each
+  // stands for an ACKNACK.
+  ThreadPoolExecutor executor(4);
+  GUID_t reader_guid = make_guid(1, 1);
+  const Locator_t acknack_locator = make_locator(7411);
+
+  PoolDataWriter writer;
+  writer.get_rtps_writer().guid = make_guid(2, 1);
+  writer.get_rtps_writer().heartbeat_period = {0, 100 * 1000};
+  writer.get_rtps_writer().nack_response_delay = {0, 50 * 1000};
+  writer.get_rtps_writer().add_matched_reader(ReaderProxy(reader_guid, false,
+    {make_locator(7410)}, {}, &writer.get_rtps_writer().writer_cache));
+  Data data;
+  data.payload = {42};
+  writer.on_write(std::move(data));
+  writer.add_tasks(executor);
+
+  loopback::Context acknack_context;
+  acknack_context.add_unicast_receiver(acknack_locator);
+  std::atomic<int> acknacks_handled(0);
+  executor.add_receiver(acknack_context,
+    [&writer, &acknack_context, &reader_guid, &acknacks_handled](const Packet<> & packet) {
+      MessageReceiver receiver(
+        reader_guid.prefix, loopback::Context::kind, acknack_context.address_as_array());
+      receiver.source_guid_prefix = reader_guid.prefix;
+      writer.on_acknack(make_acknack(reader_guid, packet[0]), receiver);
+      ++acknacks_handled;
+    });
+  loopback::Context reader_context;
+  Count_t acknack_count = 0;
+  executor.add_timed_task(std::chrono::microseconds(100), false,
+    [&reader_context, &acknack_locator, &acknack_count]() {
+      const uint32_t packet[1] = {static_cast<uint32_t>(++acknack_count)};
+      reader_context.unicast_send(acknack_locator, packet, 1);
+    });
+
+  // Synchronous writes send from the caller's thread meanwhile.
+  writer.set_publish_mode(dds::PublishMode::synchronous);
+  std::thread caller([&writer]() {
+    for (int i = 0; i < 100; ++i) {
+      Data data;
+      data.payload = {static_cast<Octet>(i)};
+      writer.on_write(std::move(data));
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+  });
+
+  executor.add_timed_task(std::chrono::milliseconds(100), true, [&executor]() {
+    executor.shutdown();
+  });
+  executor.spin();
+  caller.join();
+  assert(writer.get_rtps_writer().heartbeat_count > 10);
+  assert(acknacks_handled > 10);
+  assert(writer.get_rtps_writer().writer_cache.size() == 101);
+
+  printf("All tests passed.\n");
+  return 0;
+}
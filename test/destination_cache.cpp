@@ -0,0 +1,154 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+#include <cmbml/psm/udp/context.hpp>
+#include <cmbml/structure/fanout_plan.hpp>
+
+#include "helpers.hpp"
+
+using namespace cmbml;
+
+// A socket bound to an ephemeral loopback port.
+int bind_loopback(uint16_t & port) {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  assert(fd >= 0);
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = 0;
+  int result = bind(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address));
+  assert(result == 0);
+  socklen_t length = sizeof(address);
+  result = getsockname(fd, reinterpret_cast<struct sockaddr *>(&address), &length);
+  assert(result == 0);
+  port = ntohs(address.sin_port);
+  return fd;
+}
+
+// A transport without destinations, which is given the locators.
+struct LocatorContext {
+  void unicast_send(const Locator_t & locator, const uint32_t *, size_t) {
+    unicast.push_back(locator);
+  }
+  void multicast_send(const Locator_t & locator, const uint32_t *, size_t) {
+    multicast.push_back(locator);
+  }
+
+  List<Locator_t> unicast;
+  List<Locator_t> multicast;
+};
+
+int main(int argc, char ** argv) {
+  // Resolving converts the locator once; the same locator gets the same Destination.
+  {
+    udp::DestinationCache cache;
+    udp::Destination & v4 = cache.resolve(make_locator(7400));
+    assert(v4.address_length == sizeof(struct sockaddr_in));
+    const struct sockaddr_in & address = reinterpret_cast<const struct sockaddr_in &>(v4.address);
+    assert(address.sin_family == AF_INET);
+    assert(ntohs(address.sin_port) == 7400);
+    assert(ntohl(address.sin_addr.s_addr) == INADDR_LOOPBACK);
+    assert(&cache.resolve(make_locator(7400)) == &v4);
+
+    Locator_t locator_v6 = {};
+    locator_v6.kind = LOCATOR_KIND_UDPv6;
+    locator_v6.port = 7401;
+    locator_v6.address[15] = 1;
+    udp::Destination & v6 = cache.resolve(locator_v6);
+    assert(v6.address_length == sizeof(struct sockaddr_in6));
+    const struct sockaddr_in6 & address_v6 =
+      reinterpret_cast<const struct sockaddr_in6 &>(v6.address);
+    assert(address_v6.sin6_family == AF_INET6);
+    assert(ntohs(address_v6.sin6_port) == 7401);
+    assert(memcmp(&address_v6.sin6_addr, &in6addr_loopback, sizeof(in6addr_loopback)) == 0);
+
+    // Handles stay valid as the cache grows.
+    for (uint16_t port = 1; port < 100; ++port) {
+      cache.resolve(make_locator(port));
+    }
+    assert(cache.size() == 101);
+    assert(cache.find(make_locator(7400)) == &v4);
+    assert(!cache.find(make_locator(7402)));
+  }
+
+  uint16_t port;
+  const int fd = bind_loopback(port);
+  const Locator_t locator = make_locator(port);
+
+  udp::Context context;
+
+  // Sends to a handle, to the locator and in a batch all count against one destination.
+  {
+    udp::Destination & destination = context.resolve(locator);
+    const uint32_t packet[3] = {1, 2, 3};
+    context.unicast_send(destination, packet, 3);
+    context.unicast_send(locator, packet, 2);
+    {
+      udp::Context::SendBatch batch(context);
+      context.unicast_send(destination, packet, 1);
+      context.unicast_send(destination, packet, 1);
+    }
+    assert(destination.datagrams_sent == 4);
+    assert(destination.bytes_sent == 7 * sizeof(uint32_t));
+    assert(destination.send_errors == 0);
+    assert(context.destinations().size() == 1);
+
+    size_t received = 0;
+    while (context.receive_from(fd, [&received](const Packet<> & p) {
+      assert(p[0] == 1);
+      ++received;
+    }))
+    {
+    }
+    assert(received == 4);
+  }
+
+  // The sockets are IPv4, so an IPv6 destination is counted as an error.
+  {
+    Locator_t locator_v6 = {};
+    locator_v6.kind = LOCATOR_KIND_UDPv6;
+    locator_v6.port = port;
+    locator_v6.address[15] = 1;
+    const uint32_t packet[1] = {0};
+    context.unicast_send(locator_v6, packet, 1);
+    const udp::Destination * destination = context.destinations().find(locator_v6);
+    assert(destination && destination->send_errors == 1 && destination->datagrams_sent == 0);
+  }
+
+  // A FanoutPlan sends to the handles it resolved by its first send.
+  {
+    FanoutPlan plan;
+    plan.add_unicast_locator(locator);
+    Packet<> packet(2, 5);
+    plan.send(packet, context);
+    plan.send(packet, context);
+    assert(context.destinations().find(locator)->datagrams_sent == 6);
+
+    // A new locator is resolved by the next send.
+    uint16_t other_port;
+    const int other_fd = bind_loopback(other_port);
+    plan.add_unicast_locator(make_locator(other_port));
+    plan.send(packet, context);
+    assert(context.destinations().find(locator)->datagrams_sent == 7);
+    assert(context.destinations().find(make_locator(other_port))->datagrams_sent == 1);
+    close(other_fd);
+
+    // Without resolve(), the context is given the locators.
+    LocatorContext locator_context;
+    plan.add_multicast_locator(make_locator(7400));
+    plan.send(packet, locator_context);
+    assert(locator_context.unicast.size() == 2 && locator_context.unicast[0] == locator);
+    assert(locator_context.multicast.size() == 1);
+  }
+
+  close(fd);
+  printf("All tests passed.\n");
+  return 0;
+}
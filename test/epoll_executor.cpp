@@ -0,0 +1,116 @@
+#include <unistd.h>
+
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include <cmbml/utility/epoll_executor.hpp>
+#include <cmbml/utility/executor.hpp>
+
+using namespace cmbml;
+
+int main(int argc, char ** argv) {
+  // Timers, readable fds and posted work are all dispatched from the spin() thread.
+  {
+    EpollExecutor executor;
+    const auto loop_thread = std::this_thread::get_id();
+
+    int pipe_fds[2];
+    assert(pipe(pipe_fds) == 0);
+    int bytes_seen = 0;
+    executor.add_fd(pipe_fds[0], [&pipe_fds, &bytes_seen, loop_thread]() {
+      assert(std::this_thread::get_id() == loop_thread);
+      char buffer[16];
+      bytes_seen += read(pipe_fds[0], buffer, sizeof(buffer));
+    });
+
+    int timer_runs = 0;
+    executor.add_timed_task(std::chrono::milliseconds(2), false, [&timer_runs]() {
+      ++timer_runs;
+    });
+    int oneshot_runs = 0;
+    executor.add_timed_task(std::chrono::milliseconds(1), true, [&oneshot_runs]() {
+      ++oneshot_runs;
+    });
+
+    int posted_runs = 0;
+    std::thread writer([&executor, &pipe_fds, &posted_runs, loop_thread]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      ssize_t written = write(pipe_fds[1], "abc", 3);
+      assert(written == 3);
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      executor.post([&posted_runs, loop_thread]() {
+        assert(std::this_thread::get_id() == loop_thread);
+        ++posted_runs;
+      });
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      executor.shutdown();
+    });
+    executor.spin();
+    writer.join();
+
+    assert(bytes_seen == 3);
+    assert(posted_runs == 1);
+    assert(oneshot_runs == 1);
+    assert(timer_runs >= 3);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+  }
+
+  // post_to_executor runs work on the loop thread, and inline for executors without post().
+  {
+    EpollExecutor executor;
+    std::thread::id ran_on;
+    std::thread poster([&executor, &ran_on]() {
+      post_to_executor(executor, [&executor, &ran_on]() {
+        ran_on = std::this_thread::get_id();
+        executor.shutdown();
+      });
+    });
+    poster.join();
+    assert(ran_on == std::thread::id());
+    executor.spin();
+    assert(ran_on == std::this_thread::get_id());
+
+    SyncExecutor sync_executor;
+    bool ran = false;
+    post_to_executor(sync_executor, [&ran]() { ran = true; });
+    assert(ran);
+  }
+
+  // An fd is added once; adding it again is refused without a handler.
+  {
+    EpollExecutor executor;
+    int pipe_fds[2];
+    assert(pipe(pipe_fds) == 0);
+    assert(executor.add_fd(pipe_fds[0], []() {}) != EpollExecutor::invalid_fd_id);
+    assert(executor.add_fd(pipe_fds[0], []() {}) == EpollExecutor::invalid_fd_id);
+    assert(errno == EEXIST);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+  }
+
+  // A removed fd is no longer dispatched.
+  {
+    EpollExecutor executor;
+    int pipe_fds[2];
+    assert(pipe(pipe_fds) == 0);
+    int calls = 0;
+    executor.add_fd(pipe_fds[0], [&calls]() { ++calls; });
+    executor.remove_fd(pipe_fds[0]);
+    ssize_t written = write(pipe_fds[1], "x", 1);
+    assert(written == 1);
+    executor.add_timed_task(std::chrono::milliseconds(5), true, [&executor]() {
+      executor.shutdown();
+    });
+    executor.spin();
+    assert(calls == 0);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+  }
+
+  printf("All tests passed.\n");
+  return 0;
+}
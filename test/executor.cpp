@@ -0,0 +1,118 @@
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include <cmbml/cdr/common.hpp>
+#include <cmbml/psm/udp/context.hpp>
+#include <cmbml/utility/executor.hpp>
+#include <cmbml/utility/thread_pool_executor.hpp>
+
+using namespace cmbml;
+
+// Like a socket that receives a packet every 10 microseconds.
+struct BlockingContext {
+  template<typename CallbackT>
+  void receive_packet(CallbackT && callback) {
+    std::this_thread::sleep_for(std::chrono::microseconds(10));
+    callback(Packet<>(1, 0));
+  }
+};
+
+int main(int argc, char ** argv) {
+  // SyncExecutor runs tasks inline and returns from spin() on shutdown.
+  {
+    SyncExecutor executor;
+    int task_runs = 0;
+    int oneshot_runs = 0;
+    executor.add_timed_task(std::chrono::milliseconds(1), true, [&oneshot_runs]() {
+      ++oneshot_runs;
+    });
+    executor.add_task([&task_runs, &executor, &oneshot_runs]() {
+      ++task_runs;
+      if (oneshot_runs > 0) {
+        executor.shutdown();
+      }
+    });
+    executor.spin();
+    assert(oneshot_runs == 1);
+    assert(task_runs > 0);
+  }
+
+  // With only timed tasks, SyncExecutor sleeps between them instead of spinning.
+  {
+    SyncExecutor executor;
+    int timer_runs = 0;
+    executor.add_timed_task(std::chrono::milliseconds(2), false, [&timer_runs, &executor]() {
+      if (++timer_runs == 3) {
+        executor.shutdown();
+      }
+    });
+    executor.spin();
+    assert(timer_runs == 3);
+  }
+
+  // The pool keeps receiving, fires timers and shuts down cleanly from inside a task.
+  {
+    ThreadPoolExecutor executor(4);
+    BlockingContext context;
+    std::atomic<int> task_runs(0);
+    std::atomic<int> timer_runs(0);
+    std::atomic<int> oneshot_runs(0);
+    std::atomic<int> concurrent(0);
+    std::atomic<bool> overlapped(false);
+
+    executor.add_receiver(context, [&task_runs, &concurrent, &overlapped](const Packet<> &) {
+      if (++concurrent > 1) {
+        overlapped = true;
+      }
+      ++task_runs;
+      --concurrent;
+    });
+    executor.add_timed_task(std::chrono::milliseconds(1), true, [&oneshot_runs]() {
+      ++oneshot_runs;
+    });
+    executor.add_timed_task(std::chrono::milliseconds(2), false,
+      [&timer_runs, &task_runs, &executor]() {
+        if (++timer_runs >= 5 && task_runs > 100) {
+          executor.shutdown();
+        }
+      });
+    executor.spin();
+    assert(!overlapped);
+    assert(oneshot_runs == 1);
+    assert(timer_runs >= 5);
+    assert(task_runs > 100);
+  }
+
+  // shutdown() from another thread stops an idle pool.
+  {
+    ThreadPoolExecutor executor(2);
+    std::thread stopper([&executor]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      executor.shutdown();
+    });
+    executor.spin();
+    stopper.join();
+  }
+
+  // shutdown() interrupts a receiver blocked waiting for packets that never come.
+  {
+    ThreadPoolExecutor executor(2);
+    udp::Context context;
+    context.add_unicast_receiver(Locator_t());
+    executor.add_receiver(context, [](const Packet<> &) {});
+    std::thread stopper([&executor]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      executor.shutdown();
+    });
+    const auto start = std::chrono::steady_clock::now();
+    executor.spin();
+    stopper.join();
+    assert(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+  }
+
+  printf("All tests passed.\n");
+  return 0;
+}
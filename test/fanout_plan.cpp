@@ -0,0 +1,223 @@
+#include <cassert>
+#include <cstdio>
+
+#include <cmbml/behavior/writer_state_machine_actions.hpp>
+#include <cmbml/behavior/writer_state_machine_events.hpp>
+#include <cmbml/structure/writer.hpp>
+
+#include "helpers.hpp"
+
+using namespace cmbml;
+
+using ReliableParams = EndpointParams<ReliabilityKind_t::reliable, TopicKind_t::with_key>;
+using Stateful = StatefulWriter<true, ReliableParams>;
+using Stateless = StatelessWriter<true, ReliableParams>;
+
+// Counts the datagrams sent to each locator.
+struct RecordingContext {
+  void unicast_send(const Locator_t & locator, const uint32_t *, size_t) {
+    unicast.push_back(locator);
+  }
+  void multicast_send(const Locator_t & locator, const uint32_t *, size_t) {
+    multicast.push_back(locator);
+  }
+  List<Locator_t> unicast;
+  List<Locator_t> multicast;
+};
+
+// Resolves locators to Destinations, and records the sends to them.
+struct ResolvingContext : RecordingContext {
+  udp::Destination & resolve(const Locator_t & locator) {
+    ++resolved;
+    return cache.resolve(locator);
+  }
+  using RecordingContext::unicast_send;
+  using RecordingContext::multicast_send;
+  void unicast_send(udp::Destination & destination, const uint32_t *, size_t) {
+    unicast.push_back(destination.locator);
+  }
+  void multicast_send(udp::Destination & destination, const uint32_t *, size_t) {
+    multicast.push_back(destination.locator);
+  }
+  udp::DestinationCache cache;
+  size_t resolved = 0;
+};
+
+void match(Stateful & writer, GUID_t guid, List<Locator_t> && unicast,
+  List<Locator_t> && multicast)
+{
+  writer.add_matched_reader(ReaderProxy(guid, false, std::move(unicast), std::move(multicast),
+    &writer.writer_cache));
+}
+
+int main(int argc, char ** argv) {
+  const Locator_t participant = make_locator(7410);
+  const Locator_t other_participant = make_locator(7420);
+  const Locator_t group = make_locator(7400, 239);
+
+  // Readers sharing a participant's unicast locator or a multicast group get one datagram
+  // per destination.
+  {
+    Stateful writer;
+    match(writer, make_guid(1, 1), {participant}, {group});
+    match(writer, make_guid(1, 2), {participant}, {group});
+    match(writer, make_guid(2, 1), {other_participant}, {group});
+    RecordingContext context;
+    writer.send(Heartbeat(), context);
+    assert((context.unicast == List<Locator_t>{participant, other_participant}));
+    assert((context.multicast == List<Locator_t>{group}));
+
+    // Unmatching a reader whose destinations others share changes nothing.
+    writer.remove_matched_reader(&writer.lookup_matched_reader(make_guid(1, 2)));
+    context = RecordingContext();
+    writer.send(Heartbeat(), context);
+    assert(context.unicast.size() == 2 && context.multicast.size() == 1);
+
+    // The plan follows the last reader of a destination, and a new one.
+    writer.remove_matched_reader(&writer.lookup_matched_reader(make_guid(2, 1)));
+    const Locator_t third_participant = make_locator(7430);
+    match(writer, make_guid(3, 1), {third_participant}, {});
+    context = RecordingContext();
+    writer.send(Heartbeat(), context);
+    assert((context.unicast == List<Locator_t>{participant, third_participant}));
+    assert((context.multicast == List<Locator_t>{group}));
+
+    writer.remove_matched_reader(&writer.lookup_matched_reader(make_guid(1, 1)));
+    writer.remove_matched_reader(&writer.lookup_matched_reader(make_guid(3, 1)));
+    context = RecordingContext();
+    writer.send(Heartbeat(), context);
+    assert(context.unicast.empty() && context.multicast.empty());
+  }
+
+  // New changes are sent once to each destination of the readers waiting for them, also
+  // when the readers are at different changes.
+  {
+    Stateful writer;
+    match(writer, make_guid(1, 1), {participant}, {group});
+    match(writer, make_guid(1, 2), {participant}, {group});
+    List<Locator_t> sent;
+    auto record = [&sent](const Locator_t & locator, bool, const Packet<> &) {
+      sent.push_back(locator);
+    };
+    auto write = [&writer]() {
+      Data data;
+      data.payload = {1};
+      writer.add_change(ChangeKind_t::alive, std::move(data), InstanceHandle_t());
+    };
+    write();
+    write();
+    writer.send_unsent_changes(true, record);
+    assert(sent.size() == 4);
+    assert((sent == List<Locator_t>{participant, group, participant, group}));
+
+    sent.clear();
+    match(writer, make_guid(2, 1), {other_participant}, {group});
+    write();
+    writer.send_unsent_changes(true, record);
+    // Changes 1 and 2 to the new reader only, then 3 to every destination once.
+    assert(sent.size() == 7);
+    assert((sent == List<Locator_t>{other_participant, group, other_participant, group,
+      participant, group, other_participant}));
+    assert(!writer.lookup_matched_reader(make_guid(2, 1)).has_unsent_changes());
+
+    // A callback that takes a SharedPacket gets the change's one serialized copy for every
+    // destination.
+    List<const Packet<> *> shared;
+    write();
+    writer.send_unsent_changes(true,
+      [&shared](const Locator_t &, bool, const SharedPacket & packet) {
+        shared.push_back(packet.get());
+      });
+    assert(shared.size() == 3);
+    assert(shared[0] == shared[1] && shared[1] == shared[2]);
+  }
+
+  // A repair goes to the requesting readers through the Destinations their proxies
+  // resolved, and once to each of their multicast groups.
+  {
+    Stateful writer;
+    const Locator_t other_group = make_locator(7401, 239);
+    match(writer, make_guid(1, 1), {participant}, {group});
+    match(writer, make_guid(1, 2), {participant}, {group});
+    match(writer, make_guid(2, 1), {other_participant}, {group, other_group});
+    match(writer, make_guid(3, 1), {make_locator(7430)}, {});
+    RepairRequest<GUID_t> repair;
+    repair.requesters = {make_guid(1, 1), make_guid(1, 2), make_guid(2, 1), make_guid(3, 1),
+      make_guid(4, 1)};
+    repair.use_multicast = true;
+    ResolvingContext context;
+    writer.send_repair(Gap(), repair, context);
+    assert((context.multicast == List<Locator_t>{group, other_group}));
+    // Readers without a multicast locator get the repair over unicast.
+    assert((context.unicast == List<Locator_t>{make_locator(7430)}));
+
+    repair.use_multicast = false;
+    context.unicast.clear();
+    context.multicast.clear();
+    const size_t resolved = context.resolved;
+    writer.send_repair(Gap(), repair, context);
+    writer.send_repair(Gap(), repair, context);
+    assert(context.multicast.empty());
+    assert(context.unicast.size() == 8);
+    assert((List<Locator_t>(context.unicast.begin(), context.unicast.begin() + 4) ==
+      List<Locator_t>{participant, participant, other_participant, make_locator(7430)}));
+    // Only the proxies that hadn't sent over unicast yet resolved their locators.
+    assert(context.resolved == resolved + 3);
+  }
+
+  // A StatelessWriter sends to each reader locator once, as it is added and removed.
+  {
+    Stateless writer;
+    writer.add_reader_locator(ReaderLocator(Locator_t(participant), false, &writer.writer_cache));
+    writer.add_reader_locator(
+      ReaderLocator(Locator_t(other_participant), false, &writer.writer_cache));
+    RecordingContext context;
+    writer.send(Heartbeat(), context);
+    assert((context.unicast == List<Locator_t>{participant, other_participant}));
+
+    writer.remove_reader_locator(&writer.lookup_reader_locator(participant));
+    context = RecordingContext();
+    writer.send(Heartbeat(), context);
+    assert((context.unicast == List<Locator_t>{other_participant}));
+    assert(context.multicast.empty());
+  }
+
+  // A StatelessWriter serializes each change once for all the locators waiting for it.
+  {
+    Stateless writer;
+    writer.add_reader_locator(ReaderLocator(Locator_t(participant), false, &writer.writer_cache));
+    auto write = [&writer]() {
+      Data data;
+      data.payload = {1};
+      writer.add_change(ChangeKind_t::alive, std::move(data), InstanceHandle_t());
+    };
+    write();
+    writer.add_reader_locator(
+      ReaderLocator(Locator_t(other_participant), false, &writer.writer_cache));
+    write();
+    List<Locator_t> sent;
+    List<const Packet<> *> shared;
+    writer.send_unsent_changes(true,
+      [&sent, &shared](const Locator_t & locator, bool, const SharedPacket & packet) {
+        sent.push_back(locator);
+        shared.push_back(packet.get());
+      });
+    assert((sent == List<Locator_t>{participant, other_participant, participant,
+      other_participant}));
+    assert(shared[0] == shared[1] && shared[2] == shared[3]);
+    assert(!writer.lookup_reader_locator(participant).has_unsent_changes());
+
+    // The state machine's can_send sends a locator's next change to the others waiting too.
+    write();
+    RecordingContext context;
+    ReaderLocator & locator = writer.lookup_reader_locator(other_participant);
+    can_send<Stateless, RecordingContext> event{writer, locator, context, true};
+    stateless_writer::on_can_send(event);
+    assert((context.unicast == List<Locator_t>{participant, other_participant}));
+    assert(!writer.lookup_reader_locator(participant).has_unsent_changes());
+    assert(!locator.has_unsent_changes());
+  }
+
+  printf("All tests passed.\n");
+  return 0;
+}
@@ -0,0 +1,153 @@
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include <cmbml/structure/flow_controller.hpp>
+
+using namespace cmbml;
+
+// 100 bytes as a packet of 25 words.
+Packet<> make_packet(uint32_t tag, size_t bytes = 100) {
+  return Packet<>(bytes / sizeof(uint32_t), tag);
+}
+
+int main(int argc, char ** argv) {
+  using std::chrono::milliseconds;
+  const FlowClock::time_point t0 = FlowClock::now();
+  const Locator_t locator = {};
+
+  // Token bucket: a burst, then the rate.
+  {
+    TokenBucket bucket(1000, 200, t0);
+    assert(bucket.can_consume(200, t0));
+    bucket.consume(200);
+    assert(!bucket.can_consume(100, t0));
+    assert(bucket.available_at(100, t0) == t0 + milliseconds(100));
+    assert(bucket.can_consume(100, t0 + milliseconds(100)));
+    // Larger than the burst: allowed once the bucket is full.
+    assert(!bucket.can_consume(500, t0 + milliseconds(150)));
+    assert(bucket.can_consume(500, t0 + milliseconds(200)));
+    bucket.consume(500);
+    assert(!bucket.can_consume(1, t0 + milliseconds(200)));
+    assert(TokenBucket().can_consume(1 << 30, t0));
+  }
+
+  // A writer's byte rate.
+  {
+    FlowLimits limits;
+    limits.bytes_per_second = 1000;
+    limits.burst_bytes = 200;
+    FlowController controller(limits, t0);
+    List<uint32_t> sent;
+    controller.set_transport([&sent](const Locator_t &, bool, const Packet<> & packet) {
+      sent.push_back(packet[0]);
+    });
+    for (uint32_t i = 0; i < 5; ++i) {
+      controller.enqueue(locator, false, make_packet(i));
+    }
+    assert(controller.flush(t0) == 2);
+    assert(controller.queued() == 3);
+    assert(controller.next_flush_time(t0) == t0 + milliseconds(100));
+    assert(controller.flush(t0 + milliseconds(50)) == 0);
+    assert(controller.flush(t0 + milliseconds(100)) == 1);
+    assert(controller.flush(t0 + milliseconds(300)) == 2);
+    assert((sent == List<uint32_t>{0, 1, 2, 3, 4}));
+    assert(controller.next_flush_time(t0) == FlowClock::time_point::max());
+  }
+
+  // Datagrams per period.
+  {
+    FlowLimits limits;
+    limits.max_datagrams_per_period = 2;
+    limits.period = milliseconds(10);
+    FlowController controller(limits, t0);
+    size_t sent = 0;
+    controller.set_transport([&sent](const Locator_t &, bool, const Packet<> &) { ++sent; });
+    for (uint32_t i = 0; i < 5; ++i) {
+      controller.enqueue(locator, false, make_packet(i));
+    }
+    assert(controller.flush(t0) == 2);
+    assert(controller.next_flush_time(t0) == t0 + milliseconds(10));
+    assert(controller.flush(t0 + milliseconds(5)) == 0);
+    assert(controller.flush(t0 + milliseconds(10)) == 2);
+    assert(controller.flush(t0 + milliseconds(20)) == 1);
+    assert(sent == 5);
+  }
+
+  // A shared participant budget is served round-robin across writers.
+  {
+    FlowLimits shared_limits;
+    shared_limits.bytes_per_second = 1000;
+    shared_limits.burst_bytes = 400;
+    ParticipantFlowController participant(shared_limits, t0);
+    FlowController a(FlowLimits(), t0);
+    FlowController b(FlowLimits(), t0);
+    participant.attach(a);
+    participant.attach(b);
+    List<uint32_t> sent;
+    auto record = [&sent](const Locator_t &, bool, const Packet<> & packet) {
+      sent.push_back(packet[0]);
+    };
+    a.set_transport(record);
+    b.set_transport(record);
+    // A bursts first, but B still gets every other datagram.
+    for (uint32_t i = 0; i < 4; ++i) {
+      a.enqueue(locator, false, make_packet(10 + i));
+    }
+    for (uint32_t i = 0; i < 2; ++i) {
+      b.enqueue(locator, false, make_packet(20 + i));
+    }
+    assert(a.flush(t0) == 4);
+    assert((sent == List<uint32_t>{10, 20, 11, 21}));
+    assert(b.next_flush_time(t0) == t0 + milliseconds(100));
+    assert(b.flush(t0 + milliseconds(200)) == 2);
+    assert((sent == List<uint32_t>{10, 20, 11, 21, 12, 13}));
+
+    // A writer's own limit still applies within the participant's budget.
+    {
+      FlowLimits slow_limits;
+      slow_limits.max_datagrams_per_period = 1;
+      slow_limits.period = milliseconds(1000);
+      FlowController slow(slow_limits, t0);
+      slow.set_transport(record);
+      participant.attach(slow);
+      sent.clear();
+      slow.enqueue(locator, false, make_packet(30));
+      slow.enqueue(locator, false, make_packet(31));
+      a.enqueue(locator, false, make_packet(14));
+      assert(participant.flush(t0 + milliseconds(1000)) == 2);
+      assert(slow.queued() == 1);
+    }
+    // Detached when destroyed.
+    a.enqueue(locator, false, make_packet(15));
+    assert(participant.flush(t0 + milliseconds(2000)) == 1);
+  }
+
+  // Writers of a participant may enqueue and flush on their own threads.
+  {
+    ParticipantFlowController participant;
+    std::atomic<int> sent(0);
+    auto write = [&participant, &sent, &locator]() {
+      FlowController writer;
+      writer.set_transport([&sent](const Locator_t &, bool, const Packet<> &) { ++sent; });
+      participant.attach(writer);
+      for (uint32_t i = 0; i < 1000; ++i) {
+        writer.enqueue(locator, false, make_packet(i));
+        writer.flush();
+      }
+      while (writer.queued() != 0) {
+        writer.flush();
+      }
+    };
+    std::thread first(write);
+    std::thread second(write);
+    first.join();
+    second.join();
+    assert(sent == 2000);
+  }
+
+  printf("All tests passed.\n");
+  return 0;
+}
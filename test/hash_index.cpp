@@ -0,0 +1,71 @@
+#include <cassert>
+#include <cstdio>
+
+#include <cmbml/utility/hash_index.hpp>
+
+#include "helpers.hpp"
+
+using namespace cmbml;
+
+GUID_t guid(uint32_t i) {
+  return make_guid(static_cast<Octet>(0xf0 | i >> 8), static_cast<Octet>(i));
+}
+
+int main(int argc, char ** argv) {
+  const uint32_t n = 1000;
+
+  {
+    GuidIndex<size_t> index;
+    assert(index.find(guid(0)) == nullptr);
+    for (uint32_t i = 0; i < n; ++i) {
+      assert(index.insert(guid(i), i));
+    }
+    assert(index.size() == n);
+    assert(!index.insert(guid(3), 42));
+    assert(*index.find(guid(3)) == 42);
+    index.insert(guid(3), 3);
+
+    // Erase every other entry; the rest must still be reachable after the backward shifts.
+    for (uint32_t i = 0; i < n; i += 2) {
+      assert(index.erase(guid(i)));
+    }
+    assert(!index.erase(guid(0)));
+    assert(index.size() == n / 2);
+    for (uint32_t i = 0; i < n; ++i) {
+      const size_t * value = index.find(guid(i));
+      if (i % 2) {
+        assert(value && *value == i);
+      } else {
+        assert(!value);
+      }
+    }
+    index.clear();
+    assert(index.size() == 0);
+    assert(!index.find(guid(1)));
+  }
+
+  {
+    LocatorIndex<size_t> index;
+    for (uint32_t i = 0; i < n; ++i) {
+      index.insert(make_locator(7400 + i), i);
+    }
+    for (uint32_t i = 0; i < n; ++i) {
+      assert(*index.find(make_locator(7400 + i)) == i);
+    }
+    Locator_t other_kind = make_locator(7401);
+    other_kind.kind = 2;
+    assert(!index.find(other_kind));
+  }
+
+  // GUIDCompare must be a strict weak ordering.
+  {
+    GUIDCompare less;
+    GUID_t a = guid(1);
+    GUID_t b = guid(2);
+    assert(less(a, b) != less(b, a));
+    assert(!less(a, a));
+  }
+
+  printf("All tests passed.\n");
+  return 0;
+}
@@ -0,0 +1,37 @@
+#ifndef CMBML__TEST__HELPERS_HPP_
+#define CMBML__TEST__HELPERS_HPP_
+
+#include <cmbml/psm/udp/constants.hpp>
+#include <cmbml/structure/history.hpp>
+#include <cmbml/types.hpp>
+
+namespace cmbml {
+
+// An IPv4 locator for first_octet.0.0.1, in the octets udp::DestinationCache reads.
+inline Locator_t make_locator(uint32_t port, Octet first_octet = 127) {
+  Locator_t locator = {};
+  locator.kind = LOCATOR_KIND_UDPv4;
+  locator.port = port;
+  locator.address[0] = first_octet;
+  locator.address[3] = 1;
+  return locator;
+}
+
+inline GUID_t make_guid(Octet participant, Octet entity) {
+  GUID_t guid = {};
+  guid.prefix[0] = participant;
+  guid.entity_id[0] = entity;
+  return guid;
+}
+
+// A change whose payload is the low octet of its sequence number.
+inline CacheChange make_change(uint64_t seq) {
+  CacheChange change;
+  change.sequence_number = SequenceNumber_t::from_value(seq);
+  change.data = {static_cast<Octet>(seq)};
+  return change;
+}
+
+}  // namespace cmbml
+
+#endif  // CMBML__TEST__HELPERS_HPP_
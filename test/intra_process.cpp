@@ -0,0 +1,196 @@
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include <cmbml/structure/intra_process.hpp>
+#include <cmbml/structure/reader.hpp>
+#include <cmbml/structure/writer.hpp>
+
+#include "helpers.hpp"
+
+using namespace cmbml;
+
+using ReliableParams = EndpointParams<ReliabilityKind_t::reliable, TopicKind_t::with_key>;
+using BestEffortParams = EndpointParams<ReliabilityKind_t::best_effort, TopicKind_t::with_key>;
+using ReliableWriter = StatefulWriter<true, ReliableParams>;
+using ReliableReader = StatelessReader<false, ReliableParams>;
+using BestEffortReader = StatelessReader<false, BestEffortParams>;
+using LocatorWriter = StatelessWriter<true, BestEffortParams>;
+using LocatorReader = StatefulReader<false, BestEffortParams>;
+
+void write(ReliableWriter & writer, Octet value) {
+  Data data;
+  data.payload = {value};
+  writer.add_change(ChangeKind_t::alive, std::move(data), InstanceHandle_t());
+}
+
+template<typename WriterT>
+size_t network_sends(WriterT & writer) {
+  size_t sent = 0;
+  writer.send_unsent_changes(true,
+    [&sent](const Locator_t &, bool, const Packet<> &) { ++sent; });
+  return sent;
+}
+
+template<typename ReaderT>
+void match(ReaderT & reader, const GUID_t & writer_guid) {
+  List<Locator_t> unicast_locators;
+  List<Locator_t> multicast_locators;
+  reader.add_matched_writer(WriterProxy(writer_guid, unicast_locators, multicast_locators));
+}
+
+template<typename ReaderT>
+std::shared_ptr<LocalReader> register_reader(ReaderT & reader) {
+  return IntraProcessRegistry::instance().add_reader(reader.guid, reader.unicast_locator_list,
+    [&reader](CacheChange && change) { reader.deliver_local(std::move(change)); });
+}
+
+int main(int argc, char ** argv) {
+  IntraProcessRegistry & registry = IntraProcessRegistry::instance();
+
+  // Readers are found by GUID and by their unicast locators, until removed.
+  {
+    ReliableReader reader;
+    reader.guid = make_guid(1, 1);
+    reader.unicast_locator_list = {make_locator(7411)};
+    register_reader(reader);
+    assert(registry.find_reader(reader.guid));
+    assert(!registry.find_reader(make_guid(1, 2)));
+    assert(registry.find_readers(make_locator(7411)).size() == 1);
+    assert(registry.find_readers(make_locator(7412)).empty());
+    registry.remove_reader(reader.guid);
+    assert(!registry.find_reader(reader.guid));
+    assert(registry.find_readers(make_locator(7411)).empty());
+  }
+
+  // A delivery waits while the reader holds its delivery lock, which the reader's own thread
+  // may take again.
+  {
+    std::atomic<int> delivered(0);
+    auto local = registry.add_reader(make_guid(1, 3), {},
+      [&delivered](CacheChange &&) { ++delivered; });
+    std::thread writer_thread;
+    {
+      auto lock = local->lock_delivery();
+      auto nested = local->lock_delivery();
+      writer_thread = std::thread([&local]() { local->deliver(CacheChange()); });
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      assert(delivered == 0);
+    }
+    writer_thread.join();
+    assert(delivered == 1);
+    registry.remove_reader(local->guid);
+  }
+
+  // A matched reader of this process gets the writer's changes without a send, in order, and
+  // they count as acknowledged. Remote readers are still sent to.
+  {
+    ReliableWriter writer;
+    writer.guid = make_guid(2, 1);
+    ReliableReader reader;
+    reader.guid = make_guid(2, 2);
+    match(reader, writer.guid);
+    register_reader(reader);
+
+    GUID_t local_guid = reader.guid;
+    GUID_t remote_guid = make_guid(3, 2);
+    writer.add_matched_reader(ReaderProxy(local_guid, false, {make_locator(7421)}, {},
+      &writer.writer_cache));
+    writer.add_matched_reader(ReaderProxy(remote_guid, false, {make_locator(7431)}, {},
+      &writer.writer_cache));
+    assert(writer.lookup_matched_reader(local_guid).local_reader);
+    assert(!writer.lookup_matched_reader(remote_guid).local_reader);
+    // HEARTBEATs go to the remote reader only.
+    assert(writer.get_fanout_plan().unicast_locators == List<Locator_t>{make_locator(7431)});
+
+    List<uint64_t> seen;
+    reader.on_data_available = [&seen, &writer](const CacheChange & change) {
+      assert(change.writer_guid == writer.guid);
+      assert(change.data.size() == 1 && change.data[0] == change.sequence_number.value());
+      seen.push_back(change.sequence_number.value());
+    };
+    write(writer, 1);
+    write(writer, 2);
+    assert(network_sends(writer) == 2);
+    assert((seen == List<uint64_t>{1, 2}));
+    assert(reader.reader_cache.size() == 2);
+    assert(!reader.matched_writer_lookup(writer.guid)->has_missing_changes());
+
+    // Once the reader is removed, its changes are dropped rather than sent.
+    registry.remove_reader(reader.guid);
+    write(writer, 3);
+    assert(network_sends(writer) == 1);
+    assert(seen.size() == 2);
+  }
+
+  // A reader added after matching is sent to over the network.
+  {
+    ReliableWriter writer;
+    writer.guid = make_guid(4, 1);
+    GUID_t reader_guid = make_guid(4, 2);
+    writer.add_matched_reader(ReaderProxy(reader_guid, false, {make_locator(7441)}, {},
+      &writer.writer_cache));
+    ReliableReader reader;
+    reader.guid = reader_guid;
+    register_reader(reader);
+    write(writer, 1);
+    assert(network_sends(writer) == 1);
+    assert(reader.reader_cache.size() == 0);
+    registry.remove_reader(reader_guid);
+  }
+
+  // Best-effort readers keep their own rule: nothing older than what was delivered.
+  {
+    BestEffortReader reader;
+    reader.guid = make_guid(5, 2);
+    const GUID_t writer_guid = make_guid(5, 1);
+    match(reader, writer_guid);
+    auto change = [&writer_guid](uint64_t seq) {
+      CacheChange c;
+      c.writer_guid = writer_guid;
+      c.sequence_number = SequenceNumber_t::from_value(seq);
+      return c;
+    };
+    reader.deliver_local(change(1));
+    reader.deliver_local(change(3));
+    reader.deliver_local(change(2));
+    assert(reader.reader_cache.size() == 2);
+    assert(!reader.reader_cache.contains_change(SequenceNumber_t::from_value(2)));
+    // Changes of writers the reader hasn't matched are ignored.
+    CacheChange unmatched = change(4);
+    unmatched.writer_guid = make_guid(6, 1);
+    reader.deliver_local(std::move(unmatched));
+    assert(reader.reader_cache.size() == 2);
+  }
+
+  // A StatelessWriter hands each change to every reader of this process on a locator.
+  {
+    LocatorWriter writer;
+    writer.guid = make_guid(7, 1);
+    LocatorReader first;
+    first.guid = make_guid(7, 2);
+    first.unicast_locator_list = {make_locator(7471)};
+    LocatorReader second;
+    second.guid = make_guid(7, 3);
+    second.unicast_locator_list = {make_locator(7471)};
+    register_reader(first);
+    register_reader(second);
+    writer.add_reader_locator(ReaderLocator(make_locator(7471), false, &writer.writer_cache));
+    writer.add_reader_locator(ReaderLocator(make_locator(7481), false, &writer.writer_cache));
+    assert(writer.get_fanout_plan().unicast_locators == List<Locator_t>{make_locator(7481)});
+
+    Data data;
+    data.payload = {9};
+    writer.add_change(ChangeKind_t::alive, std::move(data), InstanceHandle_t());
+    assert(network_sends(writer) == 1);
+    assert(first.reader_cache.size() == 1 && second.reader_cache.size() == 1);
+    assert(first.reader_cache.copy_change(1).data == SerializedData{9});
+    registry.remove_reader(first.guid);
+    registry.remove_reader(second.guid);
+  }
+
+  printf("All tests passed.\n");
+  return 0;
+}
@@ -0,0 +1,206 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+
+#include <cmbml/psm/loopback/context.hpp>
+#include <cmbml/structure/reader.hpp>
+#include <cmbml/utility/epoll_executor.hpp>
+
+#include "helpers.hpp"
+
+using namespace cmbml;
+
+// The first word of each packet waiting on context.
+List<uint32_t> drain(loopback::Context & context) {
+  List<uint32_t> received;
+  for (int doorbell : context.receive_sockets()) {
+    while (context.receive_from(doorbell, [&received](const Packet<> & packet) {
+      received.push_back(packet[0]);
+    }, 64))
+    {
+    }
+  }
+  return received;
+}
+
+void send_sequence(loopback::Context & sender, const Locator_t & locator, uint32_t count) {
+  for (uint32_t i = 1; i <= count; ++i) {
+    const uint32_t packet[1] = {i};
+    sender.unicast_send(locator, packet, 1);
+  }
+}
+
+int main(int argc, char ** argv) {
+  using std::chrono::milliseconds;
+
+  // Unicast goes to the Context receiving on the port, multicast to each member of the group.
+  {
+    loopback::Switch network(true);
+    loopback::Context sender(network);
+    loopback::Context first(network);
+    loopback::Context second(network);
+    first.add_unicast_receiver(make_locator(7400));
+    second.add_unicast_receiver(make_locator(0));
+    assert(second.receive_locators()[0].port != 0);
+    first.add_multicast_receiver(make_locator(7401, 239));
+    second.add_multicast_receiver(make_locator(7401, 239));
+
+    const uint32_t packet[2] = {1, 0xffffffff};
+    // Any address of the host reaches the port.
+    sender.unicast_send(make_locator(7400, 10), packet, 2);
+    const uint32_t multicast_packet[1] = {2};
+    sender.multicast_send(make_locator(7401, 239), multicast_packet, 1);
+    sender.unicast_send(make_locator(7402), packet, 1);
+    assert((drain(first) == List<uint32_t>{1, 2}));
+    assert((drain(second) == List<uint32_t>{2}));
+    assert(network.stats().delivered == 3 && network.stats().unroutable == 1);
+
+    // A shorter packet reads as zeros past its end.
+    sender.unicast_send(make_locator(7400), packet, 2);
+    sender.unicast_send(make_locator(7400), packet, 1);
+    List<uint32_t> second_words;
+    while (first.receive_from(first.receive_sockets()[0], [&second_words](const Packet<> & p) {
+      second_words.push_back(p[1]);
+    }, 64))
+    {
+    }
+    assert((second_words == List<uint32_t>{0xffffffff, 0}));
+  }
+
+  // With a manual clock, packets arrive once time passes their latency.
+  {
+    loopback::Switch network(true);
+    loopback::LinkOptions slow;
+    slow.latency = milliseconds(5);
+    network.set_default_link_options(slow);
+    loopback::Context sender(network);
+    loopback::Context receiver(network);
+    receiver.add_unicast_receiver(make_locator(7410));
+    send_sequence(sender, make_locator(7410), 3);
+    assert(drain(receiver).empty() && network.in_flight() == 3);
+    network.advance(milliseconds(4));
+    assert(drain(receiver).empty());
+    network.advance(milliseconds(1));
+    assert((drain(receiver) == List<uint32_t>{1, 2, 3}));
+    assert(network.in_flight() == 0);
+  }
+
+  // Impairments are drawn from the seed, so the same seed gives the same run.
+  {
+    auto run = [](uint64_t seed) {
+      loopback::Switch network(true, seed);
+      loopback::LinkOptions impaired;
+      impaired.loss = 0.2;
+      impaired.duplication = 0.1;
+      impaired.reordering = 0.2;
+      network.set_link_options(make_locator(7420), false, impaired);
+      loopback::Context sender(network);
+      loopback::Context receiver(network);
+      receiver.add_unicast_receiver(make_locator(7420));
+      send_sequence(sender, make_locator(7420), 200);
+      network.advance(milliseconds(1));
+      List<uint32_t> received = drain(receiver);
+      const loopback::SwitchStats stats = network.stats();
+      assert(stats.lost > 0 && stats.duplicated > 0 && stats.reordered > 0);
+      assert(received.size() == 200 - stats.lost + stats.duplicated);
+      assert(!std::is_sorted(received.begin(), received.end()));
+      return received;
+    };
+    assert(run(7) == run(7));
+    assert(run(7) != run(8));
+  }
+
+  // A reliable WriterProxy puts a lossy, reordering link back in order: what a reader
+  // delivers is in order and without duplicates, up to the first lost change.
+  {
+    loopback::Switch network(true, 3);
+    loopback::LinkOptions impaired;
+    impaired.loss = 0.1;
+    impaired.duplication = 0.1;
+    impaired.reordering = 0.3;
+    network.set_default_link_options(impaired);
+    loopback::Context sender(network);
+    loopback::Context receiver(network);
+    receiver.add_unicast_receiver(make_locator(7430));
+    send_sequence(sender, make_locator(7430), 100);
+    network.advance(milliseconds(1));
+
+    List<Locator_t> unicast_locators;
+    List<Locator_t> multicast_locators;
+    WriterProxy proxy(GUID_t(), unicast_locators, multicast_locators);
+    proxy.reorder_max_hold = std::chrono::hours(1);
+    List<uint64_t> delivered;
+    auto deliver = [&delivered](CacheChange && change) {
+      delivered.push_back(change.sequence_number.value());
+    };
+    const List<uint32_t> received = drain(receiver);
+    for (uint32_t seq : received) {
+      CacheChange change;
+      change.sequence_number = SequenceNumber_t::from_value(seq);
+      proxy.deliver_change(std::move(change), deliver);
+    }
+    assert(!delivered.empty() && delivered.size() < 100);
+    for (size_t i = 0; i < delivered.size(); ++i) {
+      assert(delivered[i] == i + 1);
+    }
+    // Delivery stops at the first change the link lost.
+    const uint32_t first_lost = delivered.size() + 1;
+    assert(std::find(received.begin(), received.end(), first_lost) == received.end());
+  }
+
+  // A destroyed Context's packets in flight are dropped.
+  {
+    loopback::Switch network(true);
+    loopback::LinkOptions slow;
+    slow.latency = milliseconds(1);
+    network.set_default_link_options(slow);
+    loopback::Context sender(network);
+    {
+      loopback::Context receiver(network);
+      receiver.add_unicast_receiver(make_locator(7440));
+      send_sequence(sender, make_locator(7440), 1);
+    }
+    network.advance(milliseconds(1));
+    assert(network.stats().unroutable == 1 && network.stats().delivered == 0);
+    // The port is free again.
+    loopback::Context receiver(network);
+    receiver.add_unicast_receiver(make_locator(7440));
+  }
+
+  // On the real clock, the switch delivers delayed packets itself, and event loops wait on
+  // the doorbells.
+  {
+    loopback::Switch network;
+    loopback::LinkOptions slow;
+    slow.latency = milliseconds(2);
+    network.set_default_link_options(slow);
+    loopback::Context sender(network);
+    loopback::Context receiver(network);
+    receiver.add_unicast_receiver(make_locator(7450));
+
+    const auto start = loopback::Switch::Clock::now();
+    send_sequence(sender, make_locator(7450), 1);
+    uint32_t received = 0;
+    receiver.receive_packet([&received](const Packet<> & packet) { received = packet[0]; }, 64);
+    assert(received == 1);
+    assert(loopback::Switch::Clock::now() - start >= milliseconds(2));
+
+    EpollExecutor executor;
+    List<uint32_t> dispatched;
+    executor.add_receiver(receiver, [&dispatched](const Packet<> & packet) {
+      dispatched.push_back(packet[0]);
+    });
+    send_sequence(sender, make_locator(7450), 3);
+    for (int i = 0; i < 1000 && dispatched.size() < 3; ++i) {
+      executor.spin_once(false);
+      usleep(1000);
+    }
+    assert((dispatched == List<uint32_t>{1, 2, 3}));
+  }
+
+  printf("All tests passed.\n");
+  return 0;
+}
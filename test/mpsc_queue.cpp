@@ -0,0 +1,72 @@
+#include <cassert>
+#include <cstdio>
+#include <thread>
+#include <utility>
+
+#include <cmbml/types.hpp>
+#include <cmbml/utility/mpsc_queue.hpp>
+
+using namespace cmbml;
+
+int main(int argc, char ** argv) {
+  {
+    MpscQueue<int> queue;
+    int value = 0;
+    assert(queue.empty());
+    assert(!queue.pop(value));
+    queue.push(1);
+    queue.push(2);
+    assert(!queue.empty());
+    assert(queue.pop(value) && value == 1);
+    queue.push(3);
+    assert(queue.pop(value) && value == 2);
+    assert(queue.pop(value) && value == 3);
+    assert(!queue.pop(value));
+    assert(queue.empty());
+    // The queue is reusable after running dry.
+    queue.push(4);
+    assert(queue.pop(value) && value == 4);
+  }
+
+  // Each producer's values come out in the order it pushed them, and none is lost.
+  {
+    const int num_producers = 4;
+    const int per_producer = 20000;
+    MpscQueue<std::pair<int, int>> queue;
+    List<std::thread> producers;
+    for (int p = 0; p < num_producers; ++p) {
+      producers.emplace_back([&queue, p]() {
+        for (int i = 0; i < per_producer; ++i) {
+          queue.push(std::make_pair(p, i));
+        }
+      });
+    }
+    List<int> next(num_producers, 0);
+    int received = 0;
+    while (received < num_producers * per_producer) {
+      std::pair<int, int> value;
+      if (!queue.pop(value)) {
+        std::this_thread::yield();
+        continue;
+      }
+      assert(value.second == next[value.first]);
+      ++next[value.first];
+      ++received;
+    }
+    for (auto & producer : producers) {
+      producer.join();
+    }
+    std::pair<int, int> value;
+    assert(!queue.pop(value));
+  }
+
+  // Entries left in the queue are freed with it.
+  {
+    MpscQueue<List<int>> queue;
+    queue.push(List<int>(100, 1));
+    queue.push(List<int>(100, 2));
+  }
+
+  printf("All tests passed.\n");
+  return 0;
+}
@@ -0,0 +1,88 @@
+#include <cassert>
+#include <cstdio>
+
+#include <cmbml/structure/nack_aggregator.hpp>
+
+using namespace cmbml;
+
+int main(int argc, char ** argv) {
+  using Clock = NackAggregator<GUID_t>::Clock;
+  const Duration_t response_delay = {0, 1000};
+  const Duration_t suppression = {1, 0};
+  GUID_t reader_a = {{0}, {0, 0, 0, 1}};
+  GUID_t reader_b = {{0}, {0, 0, 0, 2}};
+  GUID_t reader_c = {{0}, {0, 0, 0, 3}};
+  SequenceNumber_t seq_1 = {0, 1};
+  SequenceNumber_t seq_2 = {0, 2};
+  SequenceNumber_t seq_3 = {0, 3};
+
+  // Requests within the window are unioned; each change is repaired once.
+  {
+    NackAggregator<GUID_t> aggregator;
+    Clock::time_point now = Clock::now();
+    assert(aggregator.add_request(reader_a, {seq_1, seq_2}, response_delay, now));
+    assert(!aggregator.add_request(reader_b, {seq_2, seq_3}, response_delay, now));
+    assert(!aggregator.add_request(reader_c, {seq_2}, response_delay, now));
+    assert(!aggregator.add_request(reader_c, {seq_2}, response_delay, now));
+    assert(!aggregator.response_due(now));
+    assert(aggregator.response_due(now + response_delay.to_ns()));
+
+    auto repairs = aggregator.collect_repairs(suppression, 1, now + response_delay.to_ns());
+    assert(repairs.size() == 3);
+    assert(repairs[0].sequence_number.value() == 1);
+    assert(repairs[0].requesters.size() == 1);
+    assert(!repairs[0].use_multicast);
+    assert(repairs[1].sequence_number.value() == 2);
+    assert(repairs[1].requesters.size() == 3);
+    assert(repairs[1].use_multicast);
+    assert(repairs[2].sequence_number.value() == 3);
+    assert(!aggregator.has_pending());
+
+    // Repeated requests within the suppression window are dropped...
+    now += response_delay.to_ns();
+    assert(aggregator.add_request(reader_a, {seq_2}, response_delay, now));
+    repairs = aggregator.collect_repairs(suppression, 1, now + response_delay.to_ns());
+    assert(repairs.empty());
+
+    // ...and honored again once it has passed.
+    now += suppression.to_ns();
+    aggregator.add_request(reader_a, {seq_2}, response_delay, now);
+    repairs = aggregator.collect_repairs(suppression, 1, now + response_delay.to_ns());
+    assert(repairs.size() == 1);
+    assert(repairs[0].sequence_number.value() == 2);
+  }
+
+  // A unicast repair suppresses only its own readers: another reader asking for the same
+  // change within the suppression window is still repaired, a multicast repair covers all.
+  {
+    NackAggregator<GUID_t> aggregator;
+    Clock::time_point now = Clock::now();
+    aggregator.add_request(reader_a, {seq_1}, response_delay, now);
+    auto repairs = aggregator.collect_repairs(suppression, 1, now);
+    assert(repairs.size() == 1 && !repairs[0].use_multicast);
+
+    aggregator.add_request(reader_a, {seq_1}, response_delay, now);
+    aggregator.add_request(reader_b, {seq_1}, response_delay, now);
+    repairs = aggregator.collect_repairs(suppression, 1, now);
+    assert(repairs.size() == 1);
+    assert((repairs[0].requesters == List<GUID_t>{reader_b}));
+    assert(!repairs[0].use_multicast);
+
+    aggregator.add_request(reader_b, {seq_2}, response_delay, now);
+    aggregator.add_request(reader_c, {seq_2}, response_delay, now);
+    repairs = aggregator.collect_repairs(suppression, 1, now);
+    assert(repairs.size() == 1 && repairs[0].use_multicast);
+    aggregator.add_request(reader_a, {seq_2}, response_delay, now);
+    assert(aggregator.collect_repairs(suppression, 1, now).empty());
+  }
+
+  // An empty request does not open a window.
+  {
+    NackAggregator<GUID_t> aggregator;
+    assert(!aggregator.add_request(reader_a, {}, response_delay));
+    assert(!aggregator.has_pending());
+  }
+
+  printf("All tests passed.\n");
+  return 0;
+}
@@ -0,0 +1,130 @@
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include <cmbml/utility/executor.hpp>
+#include <cmbml/utility/pinned_executor.hpp>
+
+using namespace cmbml;
+
+// Stands in for udp::Context, reading one byte per packet from a non-blocking pipe.
+struct PipeContext {
+  int fds[2];
+
+  PipeContext() {
+    int result = pipe2(fds, O_NONBLOCK);
+    assert(result == 0);
+    (void)result;
+  }
+
+  ~PipeContext() {
+    close(fds[0]);
+    close(fds[1]);
+  }
+
+  List<int> receive_sockets() const {
+    return {fds[0]};
+  }
+
+  template<typename CallbackT>
+  bool receive_from(int fd, CallbackT && callback) {
+    char byte;
+    if (read(fd, &byte, 1) != 1) {
+      return false;
+    }
+    callback(Packet<>(1, byte));
+    return true;
+  }
+};
+
+int main(int argc, char ** argv) {
+  PinnedExecutor<PipeContext> executor({0, 0});
+  assert(executor.size() == 2);
+
+  // Endpoints go to the least loaded worker and keep it.
+  auto & first = executor.assign();
+  auto & second = executor.assign();
+  auto & third = executor.assign();
+  assert(&first != &second);
+  assert(&third == &first);
+  assert(first.endpoint_count() == 2 && second.endpoint_count() == 1);
+
+  // Each worker has its own Context, which its endpoints use instead of making their own.
+  std::unique_ptr<PipeContext> own_context;
+  assert(&endpoint_context(first, own_context) == &first.context());
+  assert(!own_context);
+  assert(&first.context() != &second.context());
+
+  std::atomic<std::thread::id> first_thread;
+  std::atomic<std::thread::id> second_thread;
+  std::atomic<bool> wrong_thread(false);
+  std::atomic<bool> wrong_cpu(false);
+  std::atomic<int> first_runs(0);
+  std::atomic<int> second_runs(0);
+  std::atomic<int> bytes_received(0);
+  std::atomic<int> third_bytes_received(0);
+
+  auto check = [&wrong_thread, &wrong_cpu](
+    PinnedExecutor<PipeContext>::Worker & worker, std::atomic<std::thread::id> & thread_id)
+  {
+    std::thread::id expected;
+    if (!thread_id.compare_exchange_strong(expected, std::this_thread::get_id()) &&
+      expected != std::this_thread::get_id())
+    {
+      wrong_thread = true;
+    }
+    if (worker.is_pinned() && sched_getcpu() != worker.get_cpu()) {
+      wrong_cpu = true;
+    }
+  };
+
+  first.add_receiver(first.context(), [&](const Packet<> &) {
+    check(first, first_thread);
+    ++bytes_received;
+  });
+  // Endpoints of one worker share its sockets, and each gets every packet.
+  third.add_receiver(third.context(), [&](const Packet<> & packet) {
+    check(first, first_thread);
+    assert(packet[0] == 'x' + third_bytes_received);
+    ++third_bytes_received;
+  });
+  first.add_timed_task(std::chrono::milliseconds(1), false, [&]() {
+    check(first, first_thread);
+    if (++first_runs == 3) {
+      ssize_t written = write(first.context().fds[1], "xy", 2);
+      assert(written == 2);
+    }
+  });
+  second.add_timed_task(std::chrono::milliseconds(1), false, [&]() {
+    check(second, second_thread);
+    ++second_runs;
+  });
+  // Tasks can also be added from another thread once the workers are running.
+  std::thread stopper([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    second.add_timed_task(std::chrono::milliseconds(1), true, [&]() {
+      check(second, second_thread);
+      ++second_runs;
+    });
+    while (bytes_received < 2 || third_bytes_received < 2 || second_runs < 5) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    executor.shutdown();
+  });
+  executor.spin();
+  stopper.join();
+
+  assert(!wrong_thread);
+  assert(!wrong_cpu);
+  assert(first_thread.load() != second_thread.load());
+  assert(bytes_received == 2 && third_bytes_received == 2);
+
+  printf("All tests passed.\n");
+  return 0;
+}
@@ -0,0 +1,115 @@
+#include <cassert>
+#include <cstdio>
+
+#include <cmbml/behavior/reader_state_machine_actions.hpp>
+#include <cmbml/structure/reader.hpp>
+
+#include "helpers.hpp"
+
+using namespace cmbml;
+
+using ReliableReader =
+  StatelessReader<false, EndpointParams<ReliabilityKind_t::reliable, TopicKind_t::with_key>>;
+
+// What on_gap reads from a gap_received event.
+struct GapEvent {
+  ReliableReader & reader;
+  WriterProxy * writer;
+  Gap gap;
+};
+
+Gap make_gap(uint64_t start, uint64_t end, List<uint64_t> set = {}) {
+  Gap gap;
+  gap.gap_start = SequenceNumber_t::from_value(start);
+  gap.gap_list.base = SequenceNumber_t::from_value(end);
+  for (uint64_t seq : set) {
+    gap.gap_list.set.push_back(SequenceNumber_t::from_value(seq));
+  }
+  return gap;
+}
+
+int main(int argc, char ** argv) {
+  // Without a listener, changes go to the history.
+  {
+    ReliableReader reader;
+    reader.deliver(make_change(1));
+    assert(reader.reader_cache.size() == 1);
+  }
+
+  // The listener sees each change before it is kept.
+  {
+    ReliableReader reader;
+    List<uint64_t> seen;
+    reader.on_data_available = [&reader, &seen](const CacheChange & change) {
+      assert(!reader.reader_cache.contains_change(change.sequence_number));
+      assert(change.data.size() == 1 && change.data[0] == change.sequence_number.value());
+      seen.push_back(change.sequence_number.value());
+    };
+    reader.deliver(make_change(1));
+    reader.deliver(make_change(2));
+    assert((seen == List<uint64_t>{1, 2}));
+    assert(reader.reader_cache.size() == 2);
+  }
+
+  // Listener only: nothing is stored. Reliable delivery still hands changes over in order.
+  {
+    ReliableReader reader;
+    List<uint64_t> seen;
+    reader.on_data_available = [&seen](const CacheChange & change) {
+      seen.push_back(change.sequence_number.value());
+    };
+    reader.keep_in_history = false;
+    List<Locator_t> unicast_locators;
+    List<Locator_t> multicast_locators;
+    WriterProxy proxy(GUID_t(), unicast_locators, multicast_locators);
+    auto deliver = [&reader](CacheChange && change) { reader.deliver(std::move(change)); };
+    proxy.deliver_change(make_change(1), deliver);
+    proxy.deliver_change(make_change(3), deliver);
+    assert((seen == List<uint64_t>{1}));
+    proxy.deliver_change(make_change(2), deliver);
+    assert((seen == List<uint64_t>{1, 2, 3}));
+    assert(reader.reader_cache.size() == 0);
+  }
+
+  // A GAP makes every change from gap_start up to gap_list.base irrelevant, releasing the
+  // changes held behind them.
+  {
+    ReliableReader reader;
+    List<uint64_t> seen;
+    reader.on_data_available = [&seen](const CacheChange & change) {
+      seen.push_back(change.sequence_number.value());
+    };
+    List<Locator_t> unicast_locators;
+    List<Locator_t> multicast_locators;
+    WriterProxy proxy(GUID_t(), unicast_locators, multicast_locators);
+    proxy.reorder_max_hold = std::chrono::hours(1);
+    auto deliver = [&reader](CacheChange && change) { reader.deliver(std::move(change)); };
+    proxy.deliver_change(make_change(1), deliver);
+    proxy.deliver_change(make_change(5), deliver);
+    proxy.deliver_change(make_change(9), deliver);
+    GapEvent gap{reader, &proxy, make_gap(2, 5, {6, 7, 8})};
+    on_gap(gap);
+    assert((seen == List<uint64_t>{1, 5, 9}));
+    assert(proxy.max_available_changes().value() == 9);
+    assert(!proxy.has_missing_changes());
+
+    // A range behind a hole waits for it.
+    proxy.deliver_change(make_change(11), deliver);
+    GapEvent ahead{reader, &proxy, make_gap(12, 15)};
+    on_gap(ahead);
+    assert(proxy.max_available_changes().value() == 9);
+    GapEvent first{reader, &proxy, make_gap(10, 11)};
+    on_gap(first);
+    assert(proxy.max_available_changes().value() == 14);
+    // Past the window, the holes before the range are given up on, as for DATA that far
+    // ahead, and the rest is closed at once.
+    GapEvent long_range{reader, &proxy, make_gap(20, 1000000000)};
+    on_gap(long_range);
+    assert(proxy.max_available_changes().value() == 1000000000 - 1);
+    proxy.deliver_change(make_change(1000000000), deliver);
+    assert((seen == List<uint64_t>{1, 5, 9, 11, 1000000000}));
+  }
+
+  printf("All tests passed.\n");
+  return 0;
+}
@@ -0,0 +1,186 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include <cmbml/psm/udp/context.hpp>
+#include <cmbml/utility/pinned_executor.hpp>
+
+using namespace cmbml;
+
+// An RTPS header followed by the sequence number of the datagram for its participant.
+Packet<> make_datagram(uint32_t participant, uint32_t sequence) {
+  // "RTPS", version, vendor, then the GUID prefix.
+  Packet<> packet = {htonl(0x52545053), htonl(0x02020000),
+    htonl(participant * 2654435761u), htonl(participant), htonl(0x01000000 | participant),
+    participant, sequence};
+  return packet;
+}
+
+// The shard the steering program picks for a participant.
+size_t shard_of(uint32_t participant, size_t shards) {
+  const Packet<> packet = make_datagram(participant, 0);
+  return (ntohl(packet[2]) ^ ntohl(packet[3]) ^ ntohl(packet[4])) % shards;
+}
+
+struct sockaddr_in bound_address(int recv_socket) {
+  struct sockaddr_in address;
+  socklen_t length = sizeof(address);
+  int result = getsockname(recv_socket, reinterpret_cast<struct sockaddr *>(&address), &length);
+  assert(result == 0);
+  return address;
+}
+
+void send_datagrams(const struct sockaddr_in & destination, uint32_t participants,
+  uint32_t per_participant)
+{
+  int send_socket = socket(AF_INET, SOCK_DGRAM, 0);
+  assert(send_socket >= 0);
+  for (uint32_t sequence = 0; sequence < per_participant; ++sequence) {
+    for (uint32_t participant = 0; participant < participants; ++participant) {
+      const Packet<> packet = make_datagram(participant, sequence);
+      sendto(send_socket, packet.data(), packet.size() * sizeof(uint32_t), 0,
+        reinterpret_cast<const struct sockaddr *>(&destination), sizeof(destination));
+    }
+  }
+  close(send_socket);
+}
+
+int main(int argc, char ** argv) {
+  const uint32_t participants = 16;
+  const uint32_t per_participant = 4;
+
+  // Steered by GUID prefix: each participant's datagrams reach one socket, in order.
+  {
+    const size_t shards = 4;
+    udp::Context context;
+    context.set_receive_shards(shards, true);
+    context.add_unicast_receiver(Locator_t{});
+    assert(context.receive_sockets().size() == shards);
+    const struct sockaddr_in destination = bound_address(context.receive_sockets(0)[0]);
+    for (size_t shard = 1; shard < shards; ++shard) {
+      assert(bound_address(context.receive_sockets(shard)[0]).sin_port == destination.sin_port);
+    }
+
+    send_datagrams(destination, participants, per_participant);
+    // Too short for an RTPS header.
+    int send_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    const uint32_t runt = 0xdead;
+    sendto(send_socket, &runt, sizeof(runt), 0,
+      reinterpret_cast<const struct sockaddr *>(&destination), sizeof(destination));
+    close(send_socket);
+
+    std::map<uint32_t, uint32_t> next_sequence;
+    size_t received = 0;
+    for (size_t shard = 0; shard < shards; ++shard) {
+      const int recv_socket = context.receive_sockets(shard)[0];
+      while (context.receive_from(recv_socket, [&](const Packet<> & packet) {
+        if (packet[0] == runt) {
+          assert(shard == 0);
+          return;
+        }
+        const uint32_t participant = packet[5];
+        assert(shard_of(participant, shards) == shard);
+        assert(packet[6] == next_sequence[participant]++);
+        ++received;
+      }))
+      {
+      }
+    }
+    assert(received == participants * per_participant);
+  }
+
+  // Each shard is read on its own worker.
+  {
+    const size_t shards = 2;
+    udp::Context context;
+    context.set_receive_shards(shards, true);
+    context.add_unicast_receiver(Locator_t{});
+    const struct sockaddr_in destination = bound_address(context.receive_sockets(0)[0]);
+
+    PinnedExecutor<> executor({0, 0});
+    std::mutex mutex;
+    std::map<uint32_t, std::thread::id> participant_thread;
+    std::map<uint32_t, uint32_t> next_sequence;
+    size_t received = 0;
+    executor.add_sharded_receiver(context, [&](const Packet<> & packet) {
+      std::lock_guard<std::mutex> lock(mutex);
+      const uint32_t participant = packet[5];
+      auto thread = participant_thread.emplace(participant, std::this_thread::get_id()).first;
+      assert(thread->second == std::this_thread::get_id());
+      assert(packet[6] == next_sequence[participant]++);
+      ++received;
+    });
+    std::thread spin_thread([&executor]() { executor.spin(); });
+
+    send_datagrams(destination, participants, per_participant);
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (true) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (received == participants * per_participant) {
+          break;
+        }
+      }
+      assert(std::chrono::steady_clock::now() < deadline);
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    executor.shutdown();
+    spin_thread.join();
+    // Both workers took part.
+    std::map<std::thread::id, size_t> per_thread;
+    for (const auto & entry : participant_thread) {
+      ++per_thread[entry.second];
+    }
+    assert(per_thread.size() == shards);
+  }
+
+  // Every multicast socket gets a copy, so each shard filters out the others' participants.
+  {
+    const size_t shards = 2;
+    udp::Context context;
+    context.set_receive_shards(shards);
+    Locator_t group = {};
+    group.address = {{239, 255, 0, 1}};
+    context.add_multicast_receiver(group);
+    // No multicast without a route for it.
+    if (!context.receive_sockets().empty()) {
+      group.port = ntohs(bound_address(context.receive_sockets(0)[0]).sin_port);
+      for (uint32_t participant = 0; participant < participants; ++participant) {
+        const Packet<> packet = make_datagram(participant, 0);
+        context.multicast_send(group, packet.data(), packet.size());
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      size_t received = 0;
+      for (size_t shard = 0; shard < shards; ++shard) {
+        const int recv_socket = context.receive_sockets(shard)[0];
+        while (context.receive_from(recv_socket, [&](const Packet<> & packet) {
+          assert(shard_of(packet[5], shards) == shard);
+          ++received;
+        }))
+        {
+        }
+      }
+      assert(received == participants);
+    }
+  }
+
+  // Without shards there is one socket per port, as before.
+  {
+    udp::Context context;
+    context.add_unicast_receiver(Locator_t{});
+    assert(context.receive_sockets().size() == 1);
+    assert(context.receive_sockets(0).size() == 1);
+  }
+
+  printf("All tests passed.\n");
+  return 0;
+}
@@ -0,0 +1,78 @@
+#include <cassert>
+#include <cstdio>
+
+#include <cmbml/structure/reorder_buffer.hpp>
+
+#include "helpers.hpp"
+
+using namespace cmbml;
+
+int main(int argc, char ** argv) {
+  using Clock = ReorderBuffer::Clock;
+  List<uint64_t> delivered;
+  auto deliver = [&delivered](CacheChange && change) {
+    delivered.push_back(change.sequence_number.value());
+  };
+  const Clock::time_point now = Clock::now();
+
+  // Early changes are held until the hole is filled by DATA.
+  {
+    ReorderBuffer buffer;
+    assert(buffer.add_change(make_change(1), now, deliver));
+    assert(buffer.add_change(make_change(3), now, deliver));
+    assert(buffer.add_change(make_change(4), now, deliver));
+    assert(!buffer.add_change(make_change(3), now, deliver));
+    assert(delivered.size() == 1);
+    assert(buffer.size() == 2);
+    assert(buffer.add_change(make_change(2), now, deliver));
+    assert((delivered == List<uint64_t>{1, 2, 3, 4}));
+    assert(buffer.size() == 0);
+    assert(!buffer.add_change(make_change(2), now, deliver));
+  }
+
+  // ...or by a GAP, or by the writer reporting the change lost.
+  {
+    delivered.clear();
+    ReorderBuffer buffer;
+    buffer.add_change(make_change(2), now, deliver);
+    buffer.add_change(make_change(5), now, deliver);
+    buffer.skip_change(3, deliver);
+    assert(delivered.empty());
+    buffer.skip_change(1, deliver);
+    assert((delivered == List<uint64_t>{2}));
+    buffer.skip_below(5, deliver);
+    assert((delivered == List<uint64_t>{2, 5}));
+    assert(buffer.next_expected() == 6);
+    buffer.skip_below(1000, deliver);
+    assert(buffer.next_expected() == 1000);
+  }
+
+  // A hole is given up on once the change behind it was held for max_hold.
+  {
+    delivered.clear();
+    ReorderBuffer buffer;
+    const auto max_hold = std::chrono::milliseconds(10);
+    buffer.add_change(make_change(3), now, deliver);
+    buffer.add_change(make_change(6), now + max_hold, deliver);
+    buffer.release_expired(now + max_hold / 2, max_hold, deliver);
+    assert(delivered.empty());
+    buffer.release_expired(now + max_hold, max_hold, deliver);
+    assert((delivered == List<uint64_t>{3}));
+    buffer.release_expired(now + 2 * max_hold, max_hold, deliver);
+    assert((delivered == List<uint64_t>{3, 6}));
+  }
+
+  // A change beyond the window pushes the oldest holes out.
+  {
+    delivered.clear();
+    ReorderBuffer buffer;
+    buffer.add_change(make_change(2), now, deliver);
+    buffer.add_change(make_change(ReorderBuffer::capacity + 3), now, deliver);
+    assert((delivered == List<uint64_t>{2}));
+    assert(buffer.next_expected() == 4);
+    assert(buffer.size() == 1);
+  }
+
+  printf("All tests passed.\n");
+  return 0;
+}
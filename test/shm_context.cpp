@@ -0,0 +1,287 @@
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdio>
+#include <memory>
+
+#include <cmbml/psm/shm/context.hpp>
+#include <cmbml/utility/epoll_executor.hpp>
+
+using namespace cmbml;
+
+// Ports derived from the pid, so concurrent runs don't share rings.
+uint16_t test_port(uint16_t offset) {
+  return 20000 + (getpid() % 4000) * 8 + offset;
+}
+
+bool readable(int fd) {
+  struct pollfd poll_fd = {fd, POLLIN, 0};
+  return poll(&poll_fd, 1, 0) == 1;
+}
+
+int main(int argc, char ** argv) {
+  shm::ShmOptions small_ring;
+  small_ring.ring_capacity = 4;
+  shm::Context receiver(small_ring);
+  shm::Context sender;
+
+  // Locators: only the shm locators of this host are used, in place of the UDP ones.
+  {
+    const Locator_t local = sender.shm_locator(test_port(0));
+    assert(local.kind == LOCATOR_KIND_SHM && sender.is_local(local));
+    Locator_t remote = local;
+    remote.address[0] ^= 0xff;
+    assert(!sender.is_local(remote));
+    Locator_t udp_locator = {};
+    udp_locator.kind = LOCATOR_KIND_UDPv4;
+    udp_locator.port = 7400;
+    List<Locator_t> reachable = sender.reachable_locators({udp_locator, local});
+    assert(reachable.size() == 1 && reachable[0] == local);
+    reachable = sender.reachable_locators({udp_locator, remote});
+    assert(reachable.size() == 1 && reachable[0] == udp_locator);
+  }
+
+  const Locator_t destination = receiver.shm_locator(test_port(0));
+  receiver.add_unicast_receiver(destination);
+  assert(receiver.receive_sockets().size() == 1);
+  const int doorbell = receiver.receive_sockets()[0];
+
+  // Packets arrive in order; a shorter packet reads as zeros past its end.
+  {
+    for (uint32_t i = 0; i < 3; ++i) {
+      const uint32_t packet[2] = {i, 0xffffffff};
+      sender.unicast_send(destination, packet, i == 2 ? 1 : 2);
+    }
+    uint32_t received = 0;
+    while (received < 3) {
+      receiver.receive_packet([&received](const Packet<> & packet) {
+        assert(packet[0] == received);
+        assert(packet[1] == (received == 2 ? 0 : 0xffffffff));
+        ++received;
+      });
+    }
+    // Every block was released by the receiver.
+    assert(sender.blocks_in_use() == 0);
+    const udp::Destination * stats = sender.destinations().find(destination);
+    assert(stats && stats->datagrams_sent == 3 && stats->bytes_sent == 5 * sizeof(uint32_t));
+  }
+
+  // The doorbell rings only once the receiver has found the ring empty.
+  {
+    assert(!receiver.receive_from(doorbell, [](const Packet<> &) { assert(false); }));
+    assert(!readable(doorbell));
+    const uint32_t packet[1] = {42};
+    sender.unicast_send(destination, packet, 1);
+    assert(readable(doorbell));
+    sender.unicast_send(destination, packet, 1);
+    size_t received = 0;
+    while (receiver.receive_from(doorbell, [&received](const Packet<> & p) {
+      assert(p[0] == 42);
+      ++received;
+    }))
+    {
+    }
+    assert(received == 2);
+    // The drained doorbell isn't readable again until the next send.
+    assert(!readable(doorbell));
+    sender.unicast_send(destination, packet, 1);
+    sender.unicast_send(destination, packet, 1);
+    uint8_t rings[8];
+    assert(read(doorbell, rings, sizeof(rings)) == 1);
+    while (receiver.receive_from(doorbell, [](const Packet<> &) {})) {
+    }
+  }
+
+  // A full ring drops the send, as a full socket buffer would.
+  {
+    const uint32_t packet[1] = {7};
+    udp::Destination & stats = sender.resolve(destination);
+    const uint64_t sent = stats.datagrams_sent;
+    for (int i = 0; i < 5; ++i) {
+      sender.unicast_send(stats, packet, 1);
+    }
+    assert(stats.datagrams_sent == sent + 4 && stats.send_errors == 1);
+    size_t received = 0;
+    while (receiver.receive_from(doorbell, [&received](const Packet<> &) { ++received; })) {
+    }
+    assert(received == 4);
+    assert(sender.blocks_in_use() == 0);
+  }
+
+  // No receiver on the port, or a locator of another host: dropped.
+  {
+    const uint32_t packet[1] = {0};
+    const Locator_t closed = sender.shm_locator(test_port(7));
+    sender.unicast_send(closed, packet, 1);
+    assert(sender.destinations().find(closed)->send_errors == 1);
+    Locator_t remote = destination;
+    remote.address[0] ^= 0xff;
+    sender.unicast_send(remote, packet, 1);
+    assert(sender.destinations().find(remote)->send_errors == 1);
+  }
+
+  // A SharedPacket is written once for all of its receivers.
+  {
+    shm::Context second_receiver;
+    const Locator_t second = second_receiver.shm_locator(test_port(1));
+    second_receiver.add_unicast_receiver(second);
+    auto packet = std::make_shared<const Packet<>>(Packet<>{1, 2, 3});
+    sender.unicast_send(destination, packet);
+    sender.multicast_send(second, packet);
+    assert(sender.blocks_in_use() == 1);
+    size_t received = 0;
+    auto check = [&received](const Packet<> & p) {
+      assert(p[0] == 1 && p[2] == 3);
+      ++received;
+    };
+    receiver.receive_packet(check);
+    second_receiver.receive_packet(check);
+    assert(received == 2);
+    // The sender keeps the block until it sends another packet.
+    assert(sender.blocks_in_use() == 1);
+    sender.unicast_send(destination, std::make_shared<const Packet<>>(Packet<>{4}));
+    receiver.receive_packet([](const Packet<> & p) { assert(p[0] == 4); });
+    assert(sender.blocks_in_use() == 1);
+  }
+
+  // A receiver that goes away releases the blocks still waiting in its ring.
+  {
+    const size_t in_use = sender.blocks_in_use();
+    {
+      shm::Context closing;
+      const Locator_t closing_locator = closing.shm_locator(test_port(3));
+      closing.add_unicast_receiver(closing_locator);
+      const uint32_t packet[1] = {3};
+      sender.unicast_send(closing_locator, packet, 1);
+      sender.unicast_send(closing_locator, packet, 1);
+      assert(sender.blocks_in_use() == in_use + 2);
+    }
+    assert(sender.blocks_in_use() == in_use);
+  }
+
+  // Blocks pushed to a receiver that died are taken back once the sender's pool runs out.
+  {
+    const Locator_t dead = receiver.shm_locator(test_port(4));
+    int ready[2];
+    int done[2];
+    assert(pipe(ready) == 0 && pipe(done) == 0);
+    const pid_t child = fork();
+    assert(child >= 0);
+    if (child == 0) {
+      shm::Context * leaked = new shm::Context();
+      leaked->add_unicast_receiver(dead);
+      const uint8_t byte = 1;
+      uint8_t go;
+      if (write(ready[1], &byte, 1) != 1 || read(done[0], &go, 1) != 1) {
+        _exit(1);
+      }
+      _exit(0);
+    }
+    uint8_t byte = 0;
+    assert(read(ready[0], &byte, 1) == 1);
+
+    shm::ShmOptions small_pool;
+    small_pool.pool_blocks = 4;
+    shm::Context pool_sender(small_pool);
+    const uint32_t packet[1] = {4};
+    for (int i = 0; i < 4; ++i) {
+      pool_sender.unicast_send(dead, packet, 1);
+    }
+    assert(pool_sender.blocks_in_use() == 4);
+    assert(write(done[1], &byte, 1) == 1);
+    int status;
+    waitpid(child, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    for (int fd : {ready[0], ready[1], done[0], done[1]}) {
+      close(fd);
+    }
+
+    pool_sender.unicast_send(destination, packet, 1);
+    receiver.receive_packet([](const Packet<> & p) { assert(p[0] == 4); });
+    assert(pool_sender.blocks_in_use() == 0);
+    // Take over the ring the child left, so it's removed.
+    shm::Context next_receiver;
+    next_receiver.add_unicast_receiver(dead);
+  }
+
+  // Event loops wait on the doorbell.
+  {
+    EpollExecutor executor;
+    uint32_t received = 0;
+    executor.add_receiver(receiver, [&received](const Packet<> & packet) {
+      assert(packet[0] == 10 + received);
+      ++received;
+    });
+    for (uint32_t i = 0; i < 2; ++i) {
+      const uint32_t packet[1] = {10 + i};
+      sender.unicast_send(destination, packet, 1);
+    }
+    for (int i = 0; i < 1000 && received < 2; ++i) {
+      executor.spin_once(false);
+      usleep(1000);
+    }
+    assert(received == 2);
+  }
+
+  // From another process.
+  {
+    const pid_t child = fork();
+    assert(child >= 0);
+    if (child == 0) {
+      {
+        shm::Context child_sender;
+        for (uint32_t i = 0; i < 100; ++i) {
+          const uint32_t packet[1] = {i};
+          // The ring holds 4; wait for the receiver to make room.
+          while (true) {
+            udp::Destination & stats = child_sender.resolve(destination);
+            const uint64_t sent = stats.datagrams_sent;
+            child_sender.unicast_send(stats, packet, 1);
+            if (stats.datagrams_sent != sent) {
+              break;
+            }
+            usleep(100);
+          }
+        }
+      }
+      _exit(0);
+    }
+    uint32_t received = 0;
+    while (received < 100) {
+      receiver.receive_packet([&received](const Packet<> & packet) {
+        assert(packet[0] == received);
+        ++received;
+      });
+    }
+    int status;
+    waitpid(child, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+
+  // A ring left by a process that died is taken over.
+  {
+    const Locator_t abandoned = receiver.shm_locator(test_port(2));
+    const pid_t child = fork();
+    assert(child >= 0);
+    if (child == 0) {
+      shm::Context * leaked = new shm::Context();
+      leaked->add_unicast_receiver(abandoned);
+      _exit(leaked->receive_sockets().size() == 1 ? 0 : 1);
+    }
+    int status;
+    waitpid(child, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    shm::Context next_receiver;
+    next_receiver.add_unicast_receiver(abandoned);
+    assert(next_receiver.receive_sockets().size() == 1);
+    const uint32_t packet[1] = {5};
+    sender.unicast_send(abandoned, packet, 1);
+    next_receiver.receive_packet([](const Packet<> & p) { assert(p[0] == 5); });
+  }
+
+  printf("All tests passed.\n");
+  return 0;
+}
@@ -0,0 +1,99 @@
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+
+#include <cmbml/utility/timer_wheel.hpp>
+
+using namespace cmbml;
+using std::chrono::milliseconds;
+
+int main(int argc, char ** argv) {
+  const auto start = TimerWheel::Clock::now();
+
+  // One-shot timers fire once, in order, and their handles go stale.
+  {
+    TimerWheel wheel(milliseconds(1), start);
+    List<int> fired;
+    TimerHandle late = wheel.arm(milliseconds(10), [&fired]() { fired.push_back(10); },
+      milliseconds(0), start);
+    wheel.arm(milliseconds(3), [&fired]() { fired.push_back(3); }, milliseconds(0), start);
+    assert(wheel.size() == 2);
+    assert(wheel.next_wakeup() == start + milliseconds(3));
+
+    assert(wheel.expire(start + milliseconds(2)) == 0);
+    assert(wheel.expire(start + milliseconds(3)) == 1);
+    assert(wheel.next_wakeup() == start + milliseconds(10));
+    assert(wheel.expire(start + milliseconds(50)) == 1);
+    assert(fired.size() == 2 && fired[0] == 3 && fired[1] == 10);
+    assert(!wheel.is_armed(late));
+    assert(!wheel.cancel(late));
+    assert(wheel.empty());
+    assert(wheel.next_wakeup() == TimerWheel::Clock::time_point::max());
+  }
+
+  // Cancelled timers never fire.
+  {
+    TimerWheel wheel(milliseconds(1), start);
+    int fired = 0;
+    TimerHandle handle = wheel.arm(milliseconds(5), [&fired]() { ++fired; },
+      milliseconds(0), start);
+    assert(wheel.cancel(handle));
+    assert(wheel.expire(start + milliseconds(10)) == 0);
+    assert(fired == 0);
+  }
+
+  // Periodic timers rearm until cancelled, including from their own callback.
+  {
+    TimerWheel wheel(milliseconds(1), start);
+    int fired = 0;
+    TimerHandle handle;
+    handle = wheel.arm(milliseconds(2), [&fired, &wheel, &handle]() {
+      if (++fired == 4) {
+        wheel.cancel(handle);
+      }
+    }, milliseconds(2), start);
+    for (int ms = 1; ms <= 20; ++ms) {
+      wheel.expire(start + milliseconds(ms));
+    }
+    assert(fired == 4);
+    assert(wheel.empty());
+  }
+
+  // Timers in the upper levels cascade down and fire on their tick, including timers
+  // beyond the span of the top level.
+  {
+    TimerWheel wheel(milliseconds(1), start);
+    const List<uint64_t> delays = {63, 64, 65, 4095, 4096, 4097, 300000, 20000000};
+    List<uint64_t> fired;
+    for (const auto delay : delays) {
+      wheel.arm(milliseconds(delay), [&fired, delay]() { fired.push_back(delay); },
+        milliseconds(0), start);
+    }
+    for (const auto delay : delays) {
+      assert(wheel.next_wakeup() == start + milliseconds(delay));
+      assert(wheel.expire(start + milliseconds(delay - 1)) == 0);
+      assert(wheel.expire(start + milliseconds(delay)) == 1);
+      assert(fired.back() == delay);
+    }
+    assert(wheel.empty());
+  }
+
+  // A callback may arm new timers.
+  {
+    TimerWheel wheel(milliseconds(1), start);
+    int fired = 0;
+    for (int i = 0; i < 100; ++i) {
+      wheel.arm(milliseconds(1), [&wheel, &fired, start]() {
+        ++fired;
+        wheel.arm(milliseconds(1), [&fired]() { ++fired; }, milliseconds(0),
+          start + milliseconds(1));
+      }, milliseconds(0), start);
+    }
+    assert(wheel.expire(start + milliseconds(1)) == 100);
+    assert(wheel.expire(start + milliseconds(2)) == 100);
+    assert(fired == 200);
+  }
+
+  printf("All tests passed.\n");
+  return 0;
+}
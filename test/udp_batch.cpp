@@ -0,0 +1,185 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+#include <cmbml/psm/udp/context.hpp>
+#include <cmbml/utility/epoll_executor.hpp>
+
+#include "helpers.hpp"
+
+using namespace cmbml;
+
+// A socket bound to an ephemeral loopback port.
+int bind_loopback(uint16_t & port) {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  assert(fd >= 0);
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = 0;
+  int result = bind(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address));
+  assert(result == 0);
+  socklen_t length = sizeof(address);
+  result = getsockname(fd, reinterpret_cast<struct sockaddr *>(&address), &length);
+  assert(result == 0);
+  port = ntohs(address.sin_port);
+  return fd;
+}
+
+int main(int argc, char ** argv) {
+  uint16_t port;
+  const int fd = bind_loopback(port);
+  const Locator_t destination = make_locator(port);
+
+  udp::Context context;
+  context.receive_batch_size = 4;
+
+  // Nothing is sent until the outermost SendBatch ends.
+  {
+    udp::Context::SendBatch batch(context);
+    {
+      udp::Context::SendBatch nested(context);
+      for (uint32_t i = 0; i < 3; ++i) {
+        const uint32_t packet[2] = {i, i + 100};
+        context.unicast_send(destination, packet, 2);
+      }
+    }
+    const uint32_t packet[1] = {3};
+    context.unicast_send(destination, packet, 1);
+    assert(!context.receive_from(fd, [](const Packet<> &) { assert(false); }));
+  }
+
+  // All four come back from one recvmmsg, in order, with the bytes that were sent.
+  size_t batches = 0;
+  bool received = context.receive_batch_from(fd,
+    [&batches](const udp::Context::PacketBatch & packets) {
+      ++batches;
+      assert(packets.size() == 4);
+      for (uint32_t i = 0; i < 3; ++i) {
+        assert(packets[i][0] == i);
+        assert(packets[i][1] == i + 100);
+      }
+      assert(packets[3][0] == 3);
+      // The rest of a reused buffer is cleared.
+      assert(packets[3][1] == 0);
+    });
+  assert(received && batches == 1);
+  assert(!context.receive_batch_from(fd, [](const udp::Context::PacketBatch &) {}));
+
+  // A full queue is flushed early; receive_from hands the packets out one at a time.
+  context.send_batch_size = 2;
+  {
+    udp::Context::SendBatch batch(context);
+    for (uint32_t i = 0; i < 6; ++i) {
+      context.unicast_send(destination, &i, 1);
+    }
+    uint32_t first = 0;
+    assert(context.receive_from(fd, [&first](const Packet<> & packet) { first = packet[0]; }));
+    assert(first == 0);
+  }
+  for (uint32_t i = 1; i < 6; ++i) {
+    uint32_t value = 0;
+    assert(context.receive_from(fd, [&value](const Packet<> & packet) { value = packet[0]; }));
+    assert(value == i);
+  }
+  assert(!context.receive_from(fd, [](const Packet<> &) {}));
+
+  // Without a SendBatch, each send goes out at once.
+  const uint32_t packet[1] = {42};
+  context.unicast_send(destination, packet, 1);
+  uint32_t value = 0;
+  assert(context.receive_from(fd, [&value](const Packet<> & packet) { value = packet[0]; }));
+  assert(value == 42);
+
+  // Segmented sends arrive as one datagram per segment, with or without offload.
+  context.enable_gro(fd);
+  const bool gso_detected = context.gso_enabled;
+  for (int pass = 0; pass < 3; ++pass) {
+    context.gso_enabled = gso_detected && pass != 1;
+    // 20 segments of 4000 bytes take two GSO sends; the last segment is shorter.
+    const size_t segment_size = 1000;
+    List<uint32_t> train;
+    for (uint32_t k = 0; k < 20; ++k) {
+      for (uint32_t j = 0; j < (k == 19 ? 10 : segment_size); ++j) {
+        train.push_back(k * segment_size + j);
+      }
+    }
+    if (pass == 2) {
+      udp::Context::SendBatch batch(context);
+      context.unicast_send_segments(destination, train.data(), train.size(), segment_size);
+    } else {
+      context.unicast_send_segments(destination, train.data(), train.size(), segment_size);
+    }
+    uint32_t segments = 0;
+    while (context.receive_from(fd, [&segments, segment_size](const Packet<> & packet) {
+      const size_t length = segments == 19 ? 10 : segment_size;
+      assert(packet.size() >= length);
+      for (uint32_t j = 0; j < length; ++j) {
+        assert(packet[j] == segments * segment_size + j);
+      }
+      for (size_t j = length; j < packet.size(); ++j) {
+        assert(packet[j] == 0);
+      }
+      ++segments;
+    }))
+    {
+    }
+    assert(segments == 20);
+  }
+
+  // A zero-copy send holds the packet until the executor reaps its completion.
+  if (context.enable_zerocopy(1024)) {
+    EpollExecutor executor;
+    executor.add_zerocopy_reaper(context);
+    auto large = std::make_shared<const Packet<>>(2048, 7);
+    context.unicast_send(destination, large);
+    assert(context.zerocopy_pending() == 1);
+    assert(large.use_count() == 2);
+    // Below the threshold, the packet is copied.
+    context.unicast_send(destination, std::make_shared<const Packet<>>(16, 7));
+    assert(context.zerocopy_pending() == 1);
+    for (int i = 0; i < 100 && context.zerocopy_pending() != 0; ++i) {
+      executor.spin_once(false);
+      usleep(1000);
+    }
+    assert(context.zerocopy_pending() == 0);
+    assert(large.use_count() == 1);
+    size_t received = 0;
+    while (context.receive_from(fd, [&received](const Packet<> & packet) {
+      assert(packet[0] == 7);
+      ++received;
+    }))
+    {
+    }
+    assert(received == 2);
+
+    // Inside a SendBatch, the datagrams queued before a zero-copy send go out first.
+    List<uint32_t> first_words;
+    {
+      udp::Context::SendBatch batch(context);
+      context.unicast_send(destination, std::make_shared<const Packet<>>(16, 3));
+      context.unicast_send(destination, large);
+      assert(context.zerocopy_pending() == 1);
+    }
+    for (int i = 0; i < 100 && context.zerocopy_pending() != 0; ++i) {
+      executor.spin_once(false);
+      usleep(1000);
+    }
+    while (context.receive_from(fd, [&first_words](const Packet<> & packet) {
+      first_words.push_back(packet[0]);
+    }))
+    {
+    }
+    assert((first_words == List<uint32_t>{3, 7}));
+  }
+
+  close(fd);
+  printf("All tests passed.\n");
+  return 0;
+}
@@ -0,0 +1,130 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+#include <cmbml/psm/udp/uring_context.hpp>
+#include <cmbml/utility/epoll_executor.hpp>
+
+using namespace cmbml;
+
+// The locator a receiver of the context was bound to.
+Locator_t bound_locator(int recv_socket) {
+  struct sockaddr_in address;
+  socklen_t length = sizeof(address);
+  int result = getsockname(recv_socket, reinterpret_cast<struct sockaddr *>(&address), &length);
+  assert(result == 0);
+  Locator_t locator = {};
+  locator.kind = LOCATOR_KIND_UDPv4;
+  locator.port = ntohs(address.sin_port);
+  const uint32_t host = ntohl(address.sin_addr.s_addr);
+  for (int i = 0; i < 4; ++i) {
+    locator.address[i] = (host >> (24 - 8 * i)) & 0xff;
+  }
+  return locator;
+}
+
+// A receiver on an ephemeral port; returns its locator.
+template<typename ContextT>
+Locator_t add_receiver(ContextT & context) {
+  Locator_t any = {};
+  context.add_unicast_receiver(any);
+  return bound_locator(context.Context::receive_sockets().back());
+}
+
+template<typename ContextT>
+void send_and_receive(ContextT & context) {
+  const Locator_t destination = add_receiver(context);
+
+  {
+    typename ContextT::SendBatch batch(context);
+    for (uint32_t i = 0; i < 3; ++i) {
+      const uint32_t packet[2] = {i, 0xffffffff};
+      context.unicast_send(destination, packet, i == 2 ? 1 : 2);
+    }
+  }
+  uint32_t received = 0;
+  while (received < 3) {
+    context.receive_packet([&received](const Packet<> & packet) {
+      assert(packet[0] == received);
+      // The third packet is shorter; the rest of the reused buffer reads as zeros.
+      assert(packet[1] == (received == 2 ? 0 : 0xffffffff));
+      ++received;
+    });
+  }
+
+  // Event loops wait on receive_sockets() and read with receive_from.
+  EpollExecutor executor;
+  received = 0;
+  executor.add_receiver(context, [&received](const Packet<> & packet) {
+    assert(packet[0] == 10 + received);
+    ++received;
+  });
+  for (uint32_t i = 0; i < 2; ++i) {
+    const uint32_t packet[1] = {10 + i};
+    context.unicast_send(destination, packet, 1);
+  }
+  for (int i = 0; i < 1000 && received < 2; ++i) {
+    executor.spin_once(false);
+    usleep(1000);
+  }
+  assert(received == 2);
+
+  // interrupt_receive ends a receive_packet that has nothing to read, once.
+  context.interrupt_receive();
+  received = 0;
+  context.receive_packet([&received](const Packet<> &) { ++received; });
+  assert(received == 0);
+  const uint32_t packet[1] = {20};
+  context.unicast_send(destination, packet, 1);
+  while (received == 0) {
+    context.receive_packet([&received](const Packet<> & packet) {
+      assert(packet[0] == 20);
+      ++received;
+    });
+  }
+}
+
+int main(int argc, char ** argv) {
+  {
+    udp::UringContext context;
+    if (!context.uring_enabled()) {
+      printf("io_uring unavailable, testing the fallback only.\n");
+    }
+    send_and_receive(context);
+  }
+
+  // Few buffers: the multishot receive runs out and has to be rearmed.
+  {
+    udp::UringOptions options;
+    options.buffer_count = 2;
+    options.buffer_bytes = 64;
+    udp::UringContext context(options);
+    send_and_receive(context);
+  }
+
+  // Submissions are picked up by a kernel thread.
+  {
+    udp::UringOptions options;
+    options.sqpoll = true;
+    options.sqpoll_idle_ms = 1;
+    udp::UringContext context(options);
+    send_and_receive(context);
+  }
+
+  // Without a power-of-two buffer count the ring isn't set up; everything goes to Context.
+  {
+    udp::UringOptions options;
+    options.buffer_count = 3;
+    udp::UringContext context(options);
+    assert(!context.uring_enabled());
+    send_and_receive(context);
+  }
+
+  printf("All tests passed.\n");
+  return 0;
+}
@@ -0,0 +1,149 @@
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include <cmbml/behavior/reader_state_machine_actions.hpp>
+#include <cmbml/dds/wait_set.hpp>
+#include <cmbml/structure/reader.hpp>
+
+using namespace cmbml;
+using namespace cmbml::dds;
+
+using ReliableReader =
+  StatelessReader<false, EndpointParams<ReliabilityKind_t::reliable, TopicKind_t::with_key>>;
+
+// What on_gap reads from a gap_received event.
+struct GapEvent {
+  ReliableReader & reader;
+  WriterProxy * writer;
+  Gap gap;
+};
+
+int main(int argc, char ** argv) {
+  // Nothing triggered: wait times out.
+  {
+    WaitSet wait_set;
+    GuardCondition guard;
+    wait_set.attach_condition(guard);
+    List<Condition *> active;
+    const auto start = std::chrono::steady_clock::now();
+    assert(!wait_set.wait(active, std::chrono::milliseconds(5)));
+    assert(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(5));
+    assert(active.empty());
+  }
+
+  // A condition triggered from another thread wakes the waiter.
+  {
+    WaitSet wait_set;
+    ReadCondition read_condition;
+    GuardCondition guard;
+    wait_set.attach_condition(read_condition);
+    wait_set.attach_condition(guard);
+    std::thread executor_thread([&read_condition]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      read_condition.set_has_data(true);
+    });
+    List<Condition *> active;
+    assert(wait_set.wait(active));
+    assert(active.size() == 1 && active[0] == &read_condition);
+    executor_thread.join();
+
+    // Still triggered until the data is taken.
+    assert(wait_set.wait(active, std::chrono::milliseconds(0)));
+    read_condition.set_has_data(false);
+    assert(!wait_set.wait(active, std::chrono::milliseconds(1)));
+  }
+
+  // Attaching a condition that is already triggered.
+  {
+    GuardCondition guard;
+    guard.set_trigger_value(true);
+    WaitSet wait_set;
+    wait_set.attach_condition(guard);
+    List<Condition *> active;
+    assert(wait_set.wait(active, std::chrono::milliseconds(0)));
+    wait_set.detach_condition(guard);
+    assert(!wait_set.wait(active, std::chrono::milliseconds(0)));
+  }
+
+  // A StatusCondition triggers only for its enabled statuses.
+  {
+    WaitSet wait_set;
+    StatusCondition status_condition;
+    status_condition.set_enabled_statuses(data_available_status);
+    wait_set.attach_condition(status_condition);
+    List<Condition *> active;
+    status_condition.add_status_changes(subscription_matched_status);
+    assert(!status_condition.get_trigger_value());
+    assert(!wait_set.wait(active, std::chrono::milliseconds(0)));
+    status_condition.add_status_changes(data_available_status);
+    assert(wait_set.wait(active, std::chrono::milliseconds(0)));
+    status_condition.clear_status_changes(data_available_status);
+    assert(!status_condition.get_trigger_value());
+    assert(status_condition.get_status_changes() == subscription_matched_status);
+    status_condition.set_enabled_statuses(all_statuses);
+    assert(status_condition.get_trigger_value());
+  }
+
+  // A GAP that fills a hole releases the changes held behind it, which wakes the application
+  // like a DATA would.
+  {
+    WaitSet wait_set;
+    ReadCondition read_condition;
+    StatusCondition status_condition;
+    wait_set.attach_condition(read_condition);
+    ReliableReader reader;
+    List<Locator_t> unicast_locators;
+    List<Locator_t> multicast_locators;
+    WriterProxy proxy(GUID_t(), unicast_locators, multicast_locators);
+    proxy.reorder_max_hold = std::chrono::hours(1);
+    CacheChange change;
+    change.sequence_number = SequenceNumber_t::from_value(2);
+    proxy.deliver_change(std::move(change),
+      [&reader](CacheChange && c) { reader.deliver(std::move(c)); });
+    assert(reader.reader_cache.size() == 0);
+
+    Gap gap;
+    gap.gap_start = SequenceNumber_t::from_value(1);
+    gap.gap_list.base = SequenceNumber_t::from_value(2);
+    GapEvent event{reader, &proxy, gap};
+    const size_t cached = reader.reader_cache.size();
+    on_gap(event);
+    notify_if_cached(reader.reader_cache, cached, read_condition, status_condition);
+    List<Condition *> active;
+    assert(wait_set.wait(active, std::chrono::milliseconds(0)));
+    assert(active.size() == 1 && active[0] == &read_condition);
+    assert(status_condition.get_status_changes() == data_available_status);
+
+    // An event that stores nothing leaves the conditions alone.
+    read_condition.set_has_data(false);
+    status_condition.clear_status_changes(data_available_status);
+    const size_t cached_again = reader.reader_cache.size();
+    on_gap(event);
+    notify_if_cached(reader.reader_cache, cached_again, read_condition, status_condition);
+    assert(!read_condition.get_trigger_value() && !status_condition.get_trigger_value());
+  }
+
+  // Either side may be destroyed first.
+  {
+    WaitSet wait_set;
+    {
+      GuardCondition guard;
+      wait_set.attach_condition(guard);
+    }
+    List<Condition *> active;
+    assert(!wait_set.wait(active, std::chrono::milliseconds(0)));
+  }
+  {
+    GuardCondition guard;
+    {
+      WaitSet wait_set;
+      wait_set.attach_condition(guard);
+    }
+    guard.set_trigger_value(true);
+  }
+
+  printf("All tests passed.\n");
+  return 0;
+}
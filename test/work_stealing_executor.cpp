@@ -0,0 +1,143 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include <cmbml/utility/work_stealing_executor.hpp>
+
+using namespace cmbml;
+
+// Stands in for udp::Context, reading one byte per "packet" from a non-blocking pipe.
+struct PipeContext {
+  int fds[2];
+
+  PipeContext() {
+    int result = pipe2(fds, O_NONBLOCK);
+    assert(result == 0);
+    (void)result;
+  }
+
+  ~PipeContext() {
+    close(fds[0]);
+    close(fds[1]);
+  }
+
+  List<int> receive_sockets() const {
+    return {fds[0]};
+  }
+
+  template<typename CallbackT>
+  bool receive_from(int fd, CallbackT && callback) {
+    char byte;
+    if (read(fd, &byte, 1) != 1) {
+      return false;
+    }
+    callback(byte);
+    return true;
+  }
+};
+
+int main(int argc, char ** argv) {
+  // Work posted to one strand never overlaps, runs in order, and idle workers steal strands
+  // queued on a busy one.
+  {
+    const size_t num_strands = 64;
+    const size_t posts_per_strand = 500;
+    WorkStealingExecutor executor(4);
+
+    struct EndpointState {
+      std::atomic<bool> running{false};
+      size_t next = 0;
+      bool overlapped = false;
+      bool out_of_order = false;
+    };
+    List<EndpointState> endpoints(num_strands);
+    List<WorkStealingExecutor::Strand *> strands;
+    for (size_t i = 0; i < num_strands; ++i) {
+      strands.push_back(&executor.make_strand());
+    }
+
+    std::mutex threads_mutex;
+    std::set<std::thread::id> threads;
+    std::atomic<size_t> remaining(num_strands * posts_per_strand);
+
+    // Everything is posted from inside one strand, so it all lands on one worker's deque.
+    strands[0]->post([&]() {
+      for (size_t n = 0; n < posts_per_strand; ++n) {
+        for (size_t i = 0; i < num_strands; ++i) {
+          strands[i]->post([&, i, n]() {
+            EndpointState & state = endpoints[i];
+            if (state.running.exchange(true)) {
+              state.overlapped = true;
+            }
+            if (state.next != n) {
+              state.out_of_order = true;
+            }
+            ++state.next;
+            {
+              std::lock_guard<std::mutex> lock(threads_mutex);
+              threads.insert(std::this_thread::get_id());
+            }
+            // A little work so the other workers have time to steal.
+            volatile size_t spin = 0;
+            for (size_t k = 0; k < 200; ++k) {
+              spin = spin + k;
+            }
+            state.running = false;
+            if (--remaining == 0) {
+              executor.shutdown();
+            }
+          });
+        }
+      }
+    });
+    executor.spin();
+
+    assert(remaining == 0);
+    for (const auto & state : endpoints) {
+      assert(!state.overlapped);
+      assert(!state.out_of_order);
+      assert(state.next == posts_per_strand);
+    }
+    assert(threads.size() > 1);
+  }
+
+  // Timers and receivers post to their strand.
+  {
+    WorkStealingExecutor executor(2);
+    WorkStealingExecutor::Strand & strand = executor.make_strand();
+    PipeContext context;
+
+    std::atomic<int> timer_runs(0);
+    std::atomic<int> bytes_received(0);
+    strand.add_receiver(context, [&bytes_received](char) { ++bytes_received; });
+    strand.add_timed_task(std::chrono::milliseconds(2), false, [&]() {
+      if (++timer_runs == 3) {
+        ssize_t written = write(context.fds[1], "abcd", 4);
+        assert(written == 4);
+      }
+    });
+    std::atomic<int> oneshot_runs(0);
+    strand.add_timed_task(std::chrono::milliseconds(1), true, [&oneshot_runs]() {
+      ++oneshot_runs;
+    });
+    strand.add_timed_task(std::chrono::milliseconds(1), false, [&]() {
+      if (bytes_received == 4) {
+        executor.shutdown();
+      }
+    });
+    executor.spin();
+    assert(timer_runs >= 3);
+    assert(bytes_received == 4);
+    assert(oneshot_runs == 1);
+  }
+
+  printf("All tests passed.\n");
+  return 0;
+}